@@ -0,0 +1,58 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "CPUStructures.h"
+
+namespace Benchmark
+{
+	void Create_Grid_Mesh(Model &model, uint32_t triangleCount);
+	void Create_Checker_Texture(TextureInfo &texture, int size);
+
+	void Run_BVH_Build(const ConfigInfo &config);
+	void Run_BVH8(const ConfigInfo &config);
+	void Run_Packets(const ConfigInfo &config);
+	bool Run_Crack_Test(const ConfigInfo &config);
+	void Run_Triangle_Kernels(const ConfigInfo &config);
+	void Run_Render_Scaling(const ConfigInfo &config);
+	void Run_Instances(const ConfigInfo &config);
+	void Run_Refit(const ConfigInfo &config);
+	void Run_BVH_Cache(const ConfigInfo &config);
+	void Run_Linear_BVH(const ConfigInfo &config);
+	void Run_Spatial_Splits(const ConfigInfo &config);
+	void Run_Texture_Sampling(const ConfigInfo &config);
+	bool Run_Sampler_Test(const ConfigInfo &config);
+	void Run_Accumulation(const ConfigInfo &config);
+	void Run_Ray_Sorting(const ConfigInfo &config);
+	void Run_Wavefront(const ConfigInfo &config);
+	void Run_Path_Tracing(const ConfigInfo &config);
+	bool Write_BVH_Stats(const ConfigInfo &config);
+
+	bool Run(const ConfigInfo &config);
+	bool Run_Test(const ConfigInfo &config);
+}
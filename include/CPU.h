@@ -0,0 +1,87 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "CPUStructures.h"
+
+namespace BVH
+{
+	void Build(BVHTree &bvh, const Model &model, unsigned threadCount);
+	void Build(CPUBottomLevelAS &blas, const Model &model, unsigned threadCount);
+	void Build(CPUTopLevelAS &tlas, unsigned threadCount);
+	void Build_Linear(BVHTree &bvh, const Model &model, uint32_t mortonBits, unsigned threadCount);
+	void Radix_Sort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values, uint32_t keyBits, unsigned threadCount);
+	void Build_Spatial(BVHTree &bvh, const Model &model, float overlapBudget, float duplicateBudget, unsigned threadCount);
+	void Refit(BVHTree &bvh, const Model &model, unsigned threadCount);
+	bool Update(BVHTree &bvh, const Model &model, BVHUpdateState &state, unsigned threadCount);
+	float Get_SAH_Cost(const BVHTree &bvh);
+	bool Intersect(const BVHTree &bvh, const Model &model, const CPURay &ray, CPUHit &hit);
+	bool Occluded(const BVHTree &bvh, const Model &model, const CPURay &ray);
+	void Intersect_Subtree(const BVHTree &bvh, const Model &model, const CPURay &ray, CPUHit &hit, uint32_t nodeIndex);
+	void Intersect_Packet(const BVHTree &bvh, const Model &model, const CPURay* rays, CPUHit* hits, uint32_t rayCount, uint32_t packetWidth);
+	void Sort_Rays(const CPURay* rays, uint32_t rayCount, const BVHNode &bounds, std::vector<uint32_t> &order, unsigned threadCount);
+	void Intersect_Rays(const BVHTree &bvh, const BVH8Tree &bvh8, const Model &model, const CPURay* rays, CPUHit* hits, uint32_t rayCount, bool sort, unsigned threadCount);
+	bool Intersect_Counted(const BVHTree &bvh, const Model &model, const CPURay &ray, CPUHit &hit, BVHTraversalStats &stats);
+	void Get_Stats(const BVHTree &bvh, const Model &model, BVHStats &stats, unsigned threadCount);
+
+	WatertightRay Get_Watertight_Ray(const CPURay &ray);
+	bool Intersect_Triangle(const Model &model, uint32_t triangleIndex, const WatertightRay &ray, CPUHit &hit);
+	bool Intersect_Triangles4(const Model &model, const uint32_t* triangleIndices, uint32_t count, const WatertightRay &ray, CPUHit &hit);
+	bool Intersect_Triangles8(const Model &model, const uint32_t* triangleIndices, uint32_t count, const WatertightRay &ray, CPUHit &hit);
+
+	void Collapse(BVH8Tree &bvh8, const BVHTree &bvh);
+	bool Intersect(const BVH8Tree &bvh, const Model &model, const CPURay &ray, CPUHit &hit);
+	bool Occluded(const BVH8Tree &bvh, const Model &model, const CPURay &ray);
+
+	uint64_t Get_Content_Hash(const Model &model, unsigned threadCount);
+	bool Save_Cache(const std::string &path, const Model &model, const BVHTree &bvh, const BVH8Tree &bvh8, unsigned threadCount);
+	bool Load_Cache(const std::string &path, const Model &model, BVHTree &bvh, BVH8Tree &bvh8, unsigned threadCount);
+
+	bool Intersect(const CPUTopLevelAS &tlas, const CPURay &ray, uint32_t instanceInclusionMask, CPUHit &hit);
+}
+
+namespace CPU
+{
+	bool Create_Scene(CPUScene &scene, const Model &model, const TextureInfo &texture, const std::string &cachePath, unsigned threadCount);
+	void Render(const CPUScene &scene, const ViewCB &view, CPUImage &image, unsigned threadCount);
+	uint64_t Get_View_Hash(const ViewCB &view);
+	bool Accumulate(const CPUScene &scene, const ViewCB &view, CPUAccumulator &accumulator, CPUImage &image, unsigned threadCount);
+	DirectX::XMFLOAT4 Load_Texel(const TextureInfo &texture, int x, int y);
+	CPURay Get_Primary_Ray(const ViewCB &view, const DirectX::XMMATRIX &invView, int x, int y, float subpixelX, float subpixelY);
+	DirectX::XMFLOAT2 Get_Subpixel(int x, int y, uint32_t sampleIndex);
+	uint8_t To_UNORM8(float value);
+	void Render_Wavefront(const CPUScene &scene, const ViewCB &view, CPUWavefront &wavefront, CPUImage &image, unsigned threadCount);
+}
+
+namespace Texture
+{
+	void Create(CPUTexture &texture, const TextureInfo &source, unsigned threadCount);
+	DirectX::XMFLOAT4 Sample(const CPUTexture &texture, const CPUSampler &sampler, const DirectX::XMFLOAT2 &uv, float lod);
+	void Sample4(const CPUTexture &texture, const CPUSampler &sampler, const float* u, const float* v, const float* lod, DirectX::XMFLOAT4* colors);
+	void Sample8(const CPUTexture &texture, const CPUSampler &sampler, const float* u, const float* v, const float* lod, DirectX::XMFLOAT4* colors);
+}
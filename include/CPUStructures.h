@@ -0,0 +1,561 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <DirectXMath.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//--------------------------------------------------------------------------------------
+// Helpers
+//--------------------------------------------------------------------------------------
+
+static bool CompareVector3WithEpsilon(const DirectX::XMFLOAT3& lhs, const DirectX::XMFLOAT3& rhs)
+{
+	const DirectX::XMFLOAT3 vector3Epsilon = DirectX::XMFLOAT3(0.00001f, 0.00001f, 0.00001f);
+	return DirectX::XMVector3NearEqual(DirectX::XMLoadFloat3(&lhs), DirectX::XMLoadFloat3(&rhs), DirectX::XMLoadFloat3(&vector3Epsilon));
+}
+
+static bool CompareVector2WithEpsilon(const DirectX::XMFLOAT2& lhs, const DirectX::XMFLOAT2& rhs)
+{
+	const DirectX::XMFLOAT2 vector2Epsilon = DirectX::XMFLOAT2(0.00001f, 0.00001f);
+	return DirectX::XMVector3NearEqual(DirectX::XMLoadFloat2(&lhs), DirectX::XMLoadFloat2(&rhs), DirectX::XMLoadFloat2(&vector2Epsilon));
+}
+
+//--------------------------------------------------------------------------------------
+// Global Structures
+//--------------------------------------------------------------------------------------
+
+struct ConfigInfo 
+{
+	int				width = 640;
+	int				height = 360;
+	bool			vsync = false;
+	bool			combinedLibrary = false;
+	uint32_t		hitFeatures = 0;
+	std::string		model = "";
+	std::string		shaderStats = "";
+	std::string		cpuOutput = "";
+	uint32_t		cpuSamples = 1;
+	uint32_t		cpuBounces = 0;
+	unsigned		threads = 0;
+	uint32_t		packetWidth = 8;
+	bool			bvhCache = false;
+	std::string		benchmark = "";
+	std::string		bvhStats = "";
+	std::string		regression = "";
+	bool			updateGolden = false;
+	std::string		test = "";
+	uint32_t		benchmarkTriangles = 50000000;
+};
+
+struct Vertex
+{
+	DirectX::XMFLOAT3 position;
+	DirectX::XMFLOAT2 uv;
+
+	bool operator==(const Vertex &v) const 
+	{
+		if (CompareVector3WithEpsilon(position, v.position)) 
+		{
+			if (CompareVector2WithEpsilon(uv, v.uv)) return true;
+			return true;
+		}
+		return false;
+	}
+
+	Vertex& operator=(const Vertex& v) 
+	{
+		position = v.position;
+		uv = v.uv;
+		return *this;
+	}
+};
+
+struct Material 
+{
+	std::string name = "defaultMaterial";
+	std::string texturePath = "";
+	float  textureResolution = 512;
+};
+
+struct Model
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+};
+
+struct TextureInfo
+{
+	std::vector<uint8_t> pixels;
+	int width = 0;
+	int height = 0;
+	int stride = 0;
+	int offset = 0;
+};
+
+struct MappedFile
+{
+	uint8_t* data = nullptr;			// copy on write view of the whole file, writes stay private to the process
+	size_t size = 0;
+	void* file = nullptr;				// the open file and its mapping, released by Platform::UnmapFile
+	void* mapping = nullptr;
+};
+
+struct MaterialCB 
+{
+	DirectX::XMFLOAT4 resolution;
+};
+
+struct ViewCB
+{
+	DirectX::XMMATRIX view = DirectX::XMMatrixIdentity();
+	DirectX::XMFLOAT4 viewOriginAndTanHalfFovY = DirectX::XMFLOAT4(0, 0.f, 0.f, 0.f);
+	DirectX::XMFLOAT2 resolution = DirectX::XMFLOAT2(1280, 720);
+};
+
+//--------------------------------------------------------------------------------------
+//  Shader Dependencies
+//--------------------------------------------------------------------------------------
+
+struct ShaderSourceFile
+{
+	std::string			contents;
+	uint64_t			hash = 0;
+};
+
+struct ShaderSourceCache
+{
+	std::mutex												lock;
+	std::unordered_map<std::wstring, ShaderSourceFile>		files;		// keyed by full path
+};
+
+struct ShaderDependency
+{
+	std::wstring		path;					// full path of a file read while compiling the shader
+	uint64_t			hash = 0;				// hash of the contents that were compiled
+};
+
+struct ShaderDependencyGraph
+{
+	std::mutex																lock;
+	std::unordered_map<std::wstring, std::vector<ShaderDependency>>		includes;	// installed shader -> the files its blob was compiled from
+};
+
+struct ShaderDirectoryWatcher
+{
+	std::wstring														directory;
+	std::unordered_map<std::wstring, std::filesystem::file_time_type>	files;				// full path -> last write time when last polled
+	std::chrono::steady_clock::time_point								lastPoll;
+	double																pollIntervalMs = 250;
+};
+
+//--------------------------------------------------------------------------------------
+//  CPU Ray Tracing
+//--------------------------------------------------------------------------------------
+
+struct CPURay
+{
+	DirectX::XMFLOAT3	origin;
+	float				tMin = 0.f;
+	DirectX::XMFLOAT3	direction;
+	float				tMax = 0.f;
+};
+
+struct CPUHit
+{
+	float				t = 0.f;
+	DirectX::XMFLOAT2	uv;							// barycentrics of the second and third vertex, like Attributes.uv
+	uint32_t			triangleIndex = UINT32_MAX;	// PrimitiveIndex(), UINT32_MAX on a miss
+	uint32_t			instanceIndex = 0;			// InstanceIndex(), for hits in a two-level structure
+};
+
+struct WatertightRay
+{
+	DirectX::XMFLOAT3	origin;
+	float				tMin = 0.f;
+	int					kx = 0, ky = 1, kz = 2;		// the axes, permuted so the direction's largest component is along kz
+	DirectX::XMFLOAT3	shear;						// shears the direction onto the kz axis, with unit length
+};
+
+// An array of elements that a std::vector owns, or that are used in place in a mapped file, such as a BVH cache.
+// The elements of a view can be written (the mapping is copy on write), and resizing a view copies it into a vector first.
+template<typename T>
+struct CPUArray
+{
+	std::vector<T>				owned;
+	std::shared_ptr<void>		mapping;			// keeps the file of a view mapped, null when the vector owns the elements
+	T*							items = nullptr;
+	size_t						count = 0;
+
+	CPUArray() = default;
+	CPUArray(std::vector<T> elements) : owned(std::move(elements)) { Sync(); }
+	CPUArray(const CPUArray &other) : owned(other.begin(), other.end()) { Sync(); }
+	CPUArray(CPUArray &&other) noexcept { swap(other); }
+	CPUArray& operator=(CPUArray other) { swap(other); return *this; }
+
+	void swap(CPUArray &other) noexcept
+	{
+		owned.swap(other.owned);
+		mapping.swap(other.mapping);
+		std::swap(items, other.items);
+		std::swap(count, other.count);
+	}
+
+	// Use count elements of a mapped file in place, keeping the file mapped until the array no longer needs it
+	void View(T* first, size_t size, const std::shared_ptr<void> &file)
+	{
+		owned = std::vector<T>();
+		mapping = file;
+		items = first;
+		count = size;
+	}
+
+	bool Is_View() const { return mapping != nullptr; }
+
+	// Copy a view into the vector, so it can be resized
+	void Own()
+	{
+		if (!mapping) return;
+		owned.assign(items, items + count);
+		mapping.reset();
+		Sync();
+	}
+
+	void Sync()
+	{
+		items = owned.data();
+		count = owned.size();
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T* data() { return items; }
+	const T* data() const { return items; }
+	T* begin() { return items; }
+	T* end() { return items + count; }
+	const T* begin() const { return items; }
+	const T* end() const { return items + count; }
+	T& operator[](size_t i) { return items[i]; }
+	const T& operator[](size_t i) const { return items[i]; }
+	T& back() { return items[count - 1]; }
+	const T& back() const { return items[count - 1]; }
+	bool operator==(const CPUArray &other) const { return std::equal(begin(), end(), other.begin(), other.end()); }
+
+	void push_back(T item) { Own(); owned.push_back(std::move(item)); Sync(); }
+	template<typename... Args> void emplace_back(Args&&... args) { Own(); owned.emplace_back(std::forward<Args>(args)...); Sync(); }
+	void resize(size_t size) { Own(); owned.resize(size); Sync(); }
+	void resize(size_t size, T item) { Own(); owned.resize(size, item); Sync(); }
+	void reserve(size_t size) { Own(); owned.reserve(size); Sync(); }
+	void clear() { owned.clear(); mapping.reset(); Sync(); }
+	void shrink_to_fit() { Own(); owned.shrink_to_fit(); Sync(); }
+	template<typename Iterator> void assign(Iterator first, Iterator last) { Own(); owned.assign(first, last); Sync(); }
+};
+
+struct BVHNode
+{
+	DirectX::XMFLOAT3	boundsMin;
+	uint32_t			leftFirst = 0;				// first triangle of a leaf, or the left child (the right child follows it)
+	DirectX::XMFLOAT3	boundsMax;
+	uint32_t			count = 0;					// triangles in a leaf, 0 for interior nodes
+};
+
+struct BVHTree
+{
+	CPUArray<BVHNode>		nodes;					// nodes[0] is the root
+	CPUArray<uint32_t>		triangles;				// triangle indices, in leaf order (instance indices in a top-level BVH)
+};
+
+// A traversal stack that lives on the call stack up to N entries, and spills to the heap for deeper trees
+template<typename T, uint32_t N>
+struct CPUTraversalStack
+{
+	T					entries[N];
+	std::vector<T>		overflow;					// entries past the first N
+	uint32_t			size = 0;
+
+	void Push(const T &entry)
+	{
+		if (size < N) entries[size] = entry;
+		else overflow.push_back(entry);
+		size++;
+	}
+
+	T& Top() { return (size > N) ? overflow.back() : entries[size - 1]; }
+
+	T Pop()
+	{
+		size--;
+		if (size < N) return entries[size];
+		T entry = overflow.back();
+		overflow.pop_back();
+		return entry;
+	}
+};
+
+// Mirrors D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE and _PREFER_FAST_BUILD
+enum BVHBuildFlags
+{
+	BVH_BUILD_FLAG_PREFER_FAST_TRACE = 0,			// binned SAH builder
+	BVH_BUILD_FLAG_PREFER_FAST_BUILD = 1,			// linear builder over Morton codes
+	BVH_BUILD_FLAG_ALLOW_SPATIAL_SPLITS = 2,		// binned SAH builder with spatial splits, for meshes with large or long thin triangles
+};
+
+struct BVHUpdateState
+{
+	BVHBuildFlags		buildFlags = BVH_BUILD_FLAG_PREFER_FAST_TRACE;	// for rebuilds
+	float				rebuildRatio = 1.3f;		// rebuild once refitting has raised the SAH cost by this factor over the last build
+	float				builtCost = 0.f;			// SAH cost right after the last build, 0 before the first
+	float				cost = 0.f;					// SAH cost after the last update
+	uint32_t			refits = 0;
+	uint32_t			rebuilds = 0;
+};
+
+struct BVHTraversalStats
+{
+	uint64_t			rays = 0;
+	uint64_t			hits = 0;
+	uint64_t			nodeVisits = 0;				// interior nodes and leaves, including the root
+	uint64_t			boxTests = 0;
+	uint64_t			triangleTests = 0;
+};
+
+struct BVHStats
+{
+	size_t					nodeCount = 0;
+	size_t					leafCount = 0;
+	size_t					references = 0;		// triangle references in leaves, more than the triangles if spatial splits duplicated some
+	uint32_t				maxDepth = 0;			// of the deepest leaf, the root is at depth 0
+	float					sahCost = 0.f;
+	float					epo = 0.f;				// end point overlap (Aila et al. 2013), 0 for a tree whose nodes overlap no other geometry
+	size_t					memoryBytes = 0;		// nodes and triangle indices
+	std::vector<uint32_t>	leafSizes;				// leafSizes[n] is the number of leaves with n triangles
+	std::vector<uint32_t>	leafDepths;				// leafDepths[d] is the number of leaves at depth d
+};
+
+struct BVH8Node
+{
+	DirectX::XMFLOAT3	origin;						// minimum corner of the node's bounds
+	int8_t				exponent[3];				// the child bounds are quantized in steps of 2^exponent on each axis
+	uint8_t				childCount = 0;
+	uint8_t				boundsMin[3][8];			// child bounds in steps from the origin, per axis, rounded outward
+	uint8_t				boundsMax[3][8];
+	uint32_t			children[8];				// child node, or the first triangle of a leaf child
+	uint8_t				counts[8];					// triangles in a leaf child, 0 for interior children
+};
+
+struct BVH8Tree
+{
+	CPUArray<BVH8Node>		nodes;					// nodes[0] is the root
+	CPUArray<uint32_t>		triangles;				// triangle indices, in leaf order
+};
+
+struct CPUBottomLevelAS
+{
+	const Model*		model = nullptr;
+	BVHBuildFlags		buildFlags = BVH_BUILD_FLAG_PREFER_FAST_TRACE;
+	BVHTree				bvh;
+	BVH8Tree			bvh8;						// used instead of the binary BVH when AVX2 is available
+};
+
+// Mirrors D3D12_RAYTRACING_INSTANCE_DESC
+struct CPUInstance
+{
+	DirectX::XMFLOAT3X4	transform;					// object to world, laid out like D3D12_RAYTRACING_INSTANCE_DESC::Transform
+	DirectX::XMFLOAT3X4	worldToObject;				// the inverse transform, set when the top-level BVH is built
+	uint32_t			instanceID = 0;				// InstanceID()
+	uint32_t			instanceMask = 0xFF;		// the instance is skipped by rays whose InstanceInclusionMask shares no bits with it
+	uint32_t			hitGroupIndex = 0;			// InstanceContributionToHitGroupIndex
+	uint32_t			bottomLevel = 0;			// index into CPUTopLevelAS::bottomLevels
+};
+
+struct CPUTopLevelAS
+{
+	std::vector<CPUBottomLevelAS>	bottomLevels;	// shared by all the instances that reference them
+	std::vector<CPUInstance>		instances;
+	BVHTree							bvh;			// over the world space bounds of the instances
+};
+
+// Mirrors D3D12_FILTER_MIN_MAG_MIP_POINT, D3D12_FILTER_MIN_MAG_LINEAR_MIP_POINT and D3D12_FILTER_MIN_MAG_MIP_LINEAR
+enum CPUTextureFilter
+{
+	CPU_TEXTURE_FILTER_POINT = 0,					// nearest texel of the nearest mip level
+	CPU_TEXTURE_FILTER_BILINEAR = 1,				// bilinear in the nearest mip level
+	CPU_TEXTURE_FILTER_TRILINEAR = 2,				// bilinear in the two nearest mip levels, blended by the fractional level
+};
+
+// Mirrors D3D12_TEXTURE_ADDRESS_MODE_WRAP and D3D12_TEXTURE_ADDRESS_MODE_CLAMP
+enum CPUTextureAddressMode
+{
+	CPU_TEXTURE_ADDRESS_WRAP = 0,
+	CPU_TEXTURE_ADDRESS_CLAMP = 1,
+};
+
+struct CPUSampler
+{
+	CPUTextureFilter		filter = CPU_TEXTURE_FILTER_BILINEAR;
+	CPUTextureAddressMode	addressU = CPU_TEXTURE_ADDRESS_WRAP;
+	CPUTextureAddressMode	addressV = CPU_TEXTURE_ADDRESS_WRAP;
+};
+
+struct CPUTextureLevel
+{
+	int						width = 0;
+	int						height = 0;
+	uint32_t				offset = 0;				// first texel of the level in CPUTexture::texels
+};
+
+struct CPUTexture
+{
+	std::vector<uint32_t>			texels;			// R8G8B8A8 texels of every mip level, level 0 first
+	std::vector<CPUTextureLevel>	levels;			// the full resolution texture, then each level half the size of the last, down to 1x1
+};
+
+struct CPUScene
+{
+	const Model*		model = nullptr;
+	const TextureInfo*	texture = nullptr;
+	MaterialCB			material;
+	BVHTree				bvh;
+	BVH8Tree			bvh8;						// used instead of the binary BVH for single rays when AVX2 is available
+	uint32_t			packetWidth = 8;			// primary rays per packet (4, 8 or 16), or 1 to trace single rays
+	bool				workStealing = true;		// false splits the image into equal bands of rows per thread instead
+};
+
+struct CPUImage
+{
+	int						width = 0;
+	int						height = 0;
+	std::vector<uint8_t>		pixels;					// RGBA8, like the DXR output texture
+};
+
+struct CPUAccumulatorPixel
+{
+	DirectX::XMFLOAT3		mean = DirectX::XMFLOAT3(0.f, 0.f, 0.f);	// of the color samples
+	float					m2 = 0.f;				// sum of squared differences from the mean luminance (Welford)
+	uint32_t				count = 0;				// samples taken
+};
+
+struct CPUAccumulator
+{
+	bool					adaptive = true;		// false takes one sample per pixel per pass until maxSamples
+	uint32_t				minSamples = 8;			// per pixel before its variance is trusted, at least 2
+	uint32_t				maxSamples = 1024;		// per pixel
+	uint32_t				maxPassSamples = 8;		// per pixel per pass, up to 255
+	float					errorThreshold = 0.01f;	// standard error of the mean luminance at which a pixel has converged
+	uint64_t				viewHash = 0;			// of the ViewCB the samples belong to
+	uint32_t				passes = 0;				// since the camera last changed
+	uint64_t				samples = 0;			// since the camera last changed
+	uint32_t				activePixels = 0;		// that took samples in the last pass
+	std::vector<CPUAccumulatorPixel>	pixels;
+};
+
+enum CPUWavefrontStage
+{
+	CPU_WAVEFRONT_STAGE_GENERATE = 0,				// camera rays for the next pixels
+	CPU_WAVEFRONT_STAGE_EXTEND = 1,					// trace the queue to its closest hits
+	CPU_WAVEFRONT_STAGE_SHADE_HIT = 2,				// albedo and the next bounce of paths that hit
+	CPU_WAVEFRONT_STAGE_SHADE_MISS = 3,				// background or sky of paths that missed
+	CPU_WAVEFRONT_STAGE_SHADOW = 4,					// shadow rays toward the lights, with any hit traversal
+	CPU_WAVEFRONT_STAGE_COMPACT = 5,				// hit and miss queues, and the surviving paths packed into the next queue
+	CPU_WAVEFRONT_STAGE_COUNT = 6,
+};
+
+enum CPULightType
+{
+	CPU_LIGHT_DIRECTIONAL = 0,						// a sun, infinitely far away
+	CPU_LIGHT_POINT = 1,							// a sphere, whose light falls off with the squared distance
+};
+
+struct CPULight
+{
+	CPULightType			type = CPU_LIGHT_DIRECTIONAL;
+	DirectX::XMFLOAT3		position = DirectX::XMFLOAT3(0.f, 0.f, 0.f);	// of point lights
+	DirectX::XMFLOAT3		direction = DirectX::XMFLOAT3(0.f, -1.f, 0.f);	// the light travels in, for directional lights
+	DirectX::XMFLOAT3		color = DirectX::XMFLOAT3(1.f, 1.f, 1.f);		// irradiance facing a directional light, intensity of a point light
+	float					radius = 0.f;			// angular radius of directional lights in radians, radius of point lights, for soft shadows
+};
+
+// The state of the paths in flight, one element per path in each array
+struct CPUWavefrontQueue
+{
+	uint32_t				count = 0;
+	std::vector<float>		originX, originY, originZ;
+	std::vector<float>		directionX, directionY, directionZ;
+	std::vector<float>		throughputR, throughputG, throughputB;
+	std::vector<uint32_t>	pixel;					// index of the pixel the path adds to
+	std::vector<float>		hitT, hitU, hitV;		// closest hit, set by the extend stage
+	std::vector<uint32_t>	hitTriangle;			// UINT32_MAX for a miss
+	std::vector<uint8_t>	flags;					// 1 if the path hit, then 1 if it continues
+};
+
+// Shadow rays toward a light, one element per hit in each array
+struct CPUShadowQueue
+{
+	uint32_t				count = 0;
+	std::vector<float>		originX, originY, originZ;
+	std::vector<float>		directionX, directionY, directionZ;
+	std::vector<float>		tMax;					// the distance to the light, 0 for hits with nothing to trace
+	std::vector<float>		radianceR, radianceG, radianceB;	// added to the pixel if the light is not occluded
+	std::vector<uint32_t>	pixel;
+};
+
+struct CPUWavefront
+{
+	uint32_t				samplesPerPixel = 1;	// jittered across the pixel when more than one
+	uint32_t				maxBounces = 2;			// diffuse bounces after the camera ray, 0 without lights renders like CPU::Render
+	uint32_t				maxPaths = 1 << 20;		// in flight at once, which sizes the queues
+	DirectX::XMFLOAT3		skyColor = DirectX::XMFLOAT3(1.f, 1.f, 1.f);	// radiance that lights bounces that escape
+	bool					skyAtLastBounce = true;	// paths cut off at the last bounce are lit by the sky, false leaves them dark
+	std::vector<CPULight>	lights;					// each hit samples one at random with a shadow ray
+	uint32_t				rouletteDepth = 3;		// bounces before Russian roulette may end paths, UINT32_MAX for none
+	std::vector<float>		bounceBudgets;			// most rays traced for each bounce, as a fraction of a wave's camera rays, on average
+	CPUWavefrontQueue		queues[2];				// the current queue, and the next one it is compacted into
+	CPUShadowQueue			shadows;
+	std::vector<uint32_t>	hitIndices;				// of the current queue
+	std::vector<uint32_t>	missIndices;
+	std::vector<DirectX::XMFLOAT3>	radiance;		// sum per pixel of the samples
+	double					stageMs[CPU_WAVEFRONT_STAGE_COUNT] = {};		// of the last render, summed over waves and bounces
+	uint64_t				stageItems[CPU_WAVEFRONT_STAGE_COUNT] = {};	// queue entries each stage processed
+	std::vector<uint64_t>	bounceRays;				// rays traced for the camera, then each bounce
+	std::vector<uint64_t>	bounceShadowRays;		// shadow rays traced from the hits of the camera rays, then of each bounce
+	std::vector<double>		bounceMs;				// time of all the stages for the camera rays, then each bounce
+	uint64_t				rays = 0;				// traced in the last render, with the shadow rays
+	uint64_t				samples = 0;			// camera paths in the last render
+	double					renderMs = 0.0;
+	double					samplesPerSecond = 0.0;
+	uint32_t				waves = 0;
+};
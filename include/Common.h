@@ -40,7 +40,13 @@
 #include <dxc/dxcapi.h>
 #include <dxc/dxcapi.use.h>
 
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 //--------------------------------------------------------------------------------------
@@ -69,7 +69,19 @@ namespace D3DShaders
 	void Init_Shader_Compiler(D3D12ShaderCompilerInfo &shaderCompiler);
 	void Compile_Shader(D3D12ShaderCompilerInfo &compilerInfo, RtProgram &program);
 	void Compile_Shader(D3D12ShaderCompilerInfo &compilerInfo, D3D12ShaderInfo &info, IDxcBlob** blob);
+	void Compile_Shaders(D3D12ShaderCompilerInfo &compilerInfo, std::vector<D3D12ShaderInfo> &infos, std::vector<IDxcBlob*> &blobs, std::vector<std::vector<ShaderDependency>> &dependencies);
+	void Compile_Shaders(D3D12ShaderCompilerInfo &compilerInfo, std::vector<D3D12ShaderInfo> &infos, std::vector<IDxcBlob*> &blobs, std::vector<std::vector<ShaderDependency>> &dependencies, std::vector<std::string> &errors);
+	void Compile_Shaders(D3D12ShaderCompilerInfo &compilerInfo, std::vector<RtProgram*> &programs);
+	std::wstring Get_Shader_Key(const D3D12ShaderInfo &info);
+	bool Is_Shader_Stale(D3D12ShaderCompilerInfo &compilerInfo, const D3D12ShaderInfo &info);
+	void Watch_Shader_Directory(D3D12ShaderCompilerInfo &compilerInfo, LPCWSTR directory);
+	bool Shader_Files_Changed(D3D12ShaderCompilerInfo &compilerInfo);
+	void Init_Permutations(D3D12ShaderCompilerInfo &compilerInfo, D3D12ShaderPermutations &permutations, const D3D12ShaderInfo &info, const std::vector<std::wstring> &features);
+	bool Get_Permutation(D3D12ShaderPermutations &permutations, uint32_t key, RtProgram &program);
+	void Evict_Stale_Permutations(D3D12ShaderPermutations &permutations);
+	void Write_Compile_Stats(D3D12ShaderCompilerInfo &compilerInfo, const std::string &filename);
 	void Destroy(D3D12ShaderCompilerInfo &shaderCompiler);
+	void Destroy(D3D12ShaderPermutations &permutations);
 }
 
 namespace D3D12
@@ -97,11 +109,16 @@ namespace DXR
 {	
 	void Create_Bottom_Level_AS(D3D12Global &d3d, DXRGlobal &dxr, D3D12Resources &resources, Model &model);
 	void Create_Top_Level_AS(D3D12Global &d3d, DXRGlobal &dxr, D3D12Resources &resources);
-	void Create_RayGen_Program(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler);
-	void Create_Miss_Program(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler);
-	void Create_Closest_Hit_Program(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler);
+	void Create_RayGen_Program(D3D12Global &d3d, DXRGlobal &dxr);
+	void Create_Miss_Program(D3D12Global &d3d, DXRGlobal &dxr);
+	void Create_Closest_Hit_Program(D3D12Global &d3d, DXRGlobal &dxr);
+	void Create_Library_Program(D3D12Global &d3d, DXRGlobal &dxr);
+	void Compile_Programs(DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler);
+	void Reload_Programs(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler);
 	void Create_Pipeline_State_Object(D3D12Global &d3d, DXRGlobal &dxr);
+	void Rebuild_Pipeline_State_Object(D3D12Global &d3d, DXRGlobal &dxr);
 	void Create_Shader_Table(D3D12Global &d3d, DXRGlobal &dxr, D3D12Resources &resources);
+	void Update_Shader_Table(DXRGlobal &dxr);
 	void Create_Descriptor_Heaps(D3D12Global &d3d, DXRGlobal &dxr, D3D12Resources &resources, const Model &model);
 	void Create_DXR_Output(D3D12Global &d3d, D3D12Resources &resources);
 
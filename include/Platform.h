@@ -0,0 +1,59 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "CPUStructures.h"
+
+//--------------------------------------------------------------------------------------
+// Portability shim for the CPU ray tracer, which builds on Windows with MSVC and elsewhere with GCC or Clang
+//--------------------------------------------------------------------------------------
+
+// Marks a function that uses AVX2 and FMA intrinsics. MSVC compiles any intrinsic anywhere, GCC and Clang only in functions
+// that target the instruction set. Callers check Utils::HasAVX2 first.
+// Templates shared by SSE and AVX2 code are forced into their callers, so they compile for the caller's instruction set.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define PLATFORM_TARGET_AVX2
+#define PLATFORM_INLINE_INTO_CALLER inline
+#else
+#define PLATFORM_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define PLATFORM_INLINE_INTO_CALLER inline __attribute__((always_inline))
+#endif
+
+namespace Platform
+{
+	void CPUID(int info[4], int leaf, int subleaf);
+	uint64_t XGETBV(uint32_t index);
+	int LeadingZeros64(uint64_t value);
+
+	bool MapFile(const std::string &path, MappedFile &file);
+	void UnmapFile(MappedFile &file);
+
+	void DebugOutput(const char* message);
+	void ShowError(const wchar_t* message);
+	void Quit(int exitCode);
+}
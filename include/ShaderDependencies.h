@@ -0,0 +1,43 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "CPUStructures.h"
+
+namespace ShaderDependencies
+{
+	std::wstring Get_Path(const std::wstring &filename);
+	const ShaderSourceFile* Load_Source(ShaderSourceCache &cache, const std::wstring &path);
+	void Add(std::vector<ShaderDependency> &dependencies, const std::wstring &path, uint64_t hash);
+	std::wstring Get_Key(const std::wstring &path, const std::wstring &entryPoint, const std::vector<std::wstring> &defines);
+	void Record(ShaderDependencyGraph &graph, const std::wstring &shader, const std::vector<ShaderDependency> &dependencies);
+	bool Is_Stale(const std::vector<ShaderDependency> &dependencies);
+	bool Is_Stale(ShaderDependencyGraph &graph, const std::wstring &shader);
+	void Watch_Directory(ShaderDirectoryWatcher &watcher, const std::wstring &directory);
+	bool Files_Changed(ShaderDirectoryWatcher &watcher);
+}
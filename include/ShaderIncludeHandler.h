@@ -0,0 +1,90 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "ShaderDependencies.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+#include <dxc/dxcapi.h>
+
+#include <atomic>
+
+/**
+* Include handler that serves files from a source cache shared by a batch of compiles, 
+* and records every file the shader being compiled depends on, with the hash of the contents it was given.
+* Lives on the stack for the duration of a single compile.
+* Only needs DXC's headers, so it builds against DXC on any OS.
+*/
+class ShaderIncludeHandler : public IDxcIncludeHandler
+{
+public:
+	ShaderIncludeHandler(IDxcLibrary* library, ShaderSourceCache &cache, std::vector<ShaderDependency> &dependencies) :
+		library(library),
+		cache(cache),
+		dependencies(dependencies) {}
+
+	HRESULT STDMETHODCALLTYPE LoadSource(LPCWSTR pFilename, IDxcBlob** ppIncludeSource) override
+	{
+		*ppIncludeSource = nullptr;
+
+		std::wstring path = ShaderDependencies::Get_Path(pFilename);
+		const ShaderSourceFile* file = ShaderDependencies::Load_Source(cache, path);
+		if (!file) return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+
+		ShaderDependencies::Add(dependencies, path, file->hash);
+
+		// The cache outlives the compile, so the blob can reference its memory directly
+		IDxcBlobEncoding* blob = nullptr;
+		HRESULT hr = library->CreateBlobWithEncodingFromPinned((LPBYTE)file->contents.data(), static_cast<UINT32>(file->contents.size()), CP_UTF8, &blob);
+		*ppIncludeSource = blob;
+		return hr;
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
+	{
+		if (riid == __uuidof(IDxcIncludeHandler) || riid == __uuidof(IUnknown))
+		{
+			*ppvObject = static_cast<IDxcIncludeHandler*>(this);
+			AddRef();
+			return S_OK;
+		}
+		*ppvObject = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef() override { return ++refCount; }
+	ULONG STDMETHODCALLTYPE Release() override { return --refCount; }
+
+private:
+	IDxcLibrary*						library;
+	ShaderSourceCache&					cache;
+	std::vector<ShaderDependency>&		dependencies;
+	std::atomic<ULONG>					refCount{ 1 };
+};
@@ -28,92 +28,7 @@
 #pragma once
 
 #include "Common.h"
-
-//--------------------------------------------------------------------------------------
-// Helpers
-//--------------------------------------------------------------------------------------
-
-static bool CompareVector3WithEpsilon(const DirectX::XMFLOAT3& lhs, const DirectX::XMFLOAT3& rhs)
-{
-	const DirectX::XMFLOAT3 vector3Epsilon = DirectX::XMFLOAT3(0.00001f, 0.00001f, 0.00001f);
-	return DirectX::XMVector3NearEqual(DirectX::XMLoadFloat3(&lhs), DirectX::XMLoadFloat3(&rhs), DirectX::XMLoadFloat3(&vector3Epsilon)) == TRUE;
-}
-
-static bool CompareVector2WithEpsilon(const DirectX::XMFLOAT2& lhs, const DirectX::XMFLOAT2& rhs)
-{
-	const DirectX::XMFLOAT2 vector2Epsilon = DirectX::XMFLOAT2(0.00001f, 0.00001f);
-	return DirectX::XMVector3NearEqual(DirectX::XMLoadFloat2(&lhs), DirectX::XMLoadFloat2(&rhs), DirectX::XMLoadFloat2(&vector2Epsilon)) == TRUE;
-}
-
-//--------------------------------------------------------------------------------------
-// Global Structures
-//--------------------------------------------------------------------------------------
-
-struct ConfigInfo 
-{
-	int				width = 640;
-	int				height = 360;
-	bool			vsync = false;
-	std::string		model = "";
-	HINSTANCE		instance = NULL;
-};
-
-struct Vertex
-{
-	DirectX::XMFLOAT3 position;
-	DirectX::XMFLOAT2 uv;
-
-	bool operator==(const Vertex &v) const 
-	{
-		if (CompareVector3WithEpsilon(position, v.position)) 
-		{
-			if (CompareVector2WithEpsilon(uv, v.uv)) return true;
-			return true;
-		}
-		return false;
-	}
-
-	Vertex& operator=(const Vertex& v) 
-	{
-		position = v.position;
-		uv = v.uv;
-		return *this;
-	}
-};
-
-struct Material 
-{
-	std::string name = "defaultMaterial";
-	std::string texturePath = "";
-	float  textureResolution = 512;
-};
-
-struct Model
-{
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-};
-
-struct TextureInfo
-{
-	std::vector<UINT8> pixels;
-	int width = 0;
-	int height = 0;
-	int stride = 0;
-	int offset = 0;
-};
-
-struct MaterialCB 
-{
-	DirectX::XMFLOAT4 resolution;
-};
-
-struct ViewCB
-{
-	DirectX::XMMATRIX view = DirectX::XMMatrixIdentity();
-	DirectX::XMFLOAT4 viewOriginAndTanHalfFovY = DirectX::XMFLOAT4(0, 0.f, 0.f, 0.f);
-	DirectX::XMFLOAT2 resolution = DirectX::XMFLOAT2(1280, 720);
-};
+#include "CPUStructures.h"
 
 //--------------------------------------------------------------------------------------
 // D3D12
@@ -149,11 +64,48 @@ struct D3D12BufferCreateInfo
 		state(InState) {}
 };
 
+struct D3D12ShaderBindingStats
+{
+	std::string		name;
+	UINT			type = 0;				// D3D_SHADER_INPUT_TYPE
+	UINT			bindPoint = 0;
+	UINT			bindCount = 0;
+	UINT			space = 0;
+};
+
+struct D3D12ShaderCompileStats
+{
+	std::wstring							filename;
+	std::wstring							entryPoint;
+	std::wstring							targetProfile;
+	std::vector<std::wstring>				defines;
+	double									preprocessMs = 0;
+	double									compileMs = 0;			// includes the compiler's own preprocessing
+	size_t									dxilSize = 0;
+	UINT									instructionCount = 0;
+	std::vector<D3D12ShaderBindingStats>	bindings;
+};
+
+struct D3D12LibraryLayoutStats
+{
+	std::string		layout;					// separate or combined
+	size_t			libraryCount = 0;
+	size_t			dxilSize = 0;
+	double			compileMs = 0;			// fastest of several compiles of all the layout's libraries
+};
+
 struct D3D12ShaderCompilerInfo 
 {
-	dxc::DxcDllSupport		DxcDllHelper;
-	IDxcCompiler*			compiler = nullptr;
-	IDxcLibrary*			library = nullptr;
+	dxc::DxcDllSupport						DxcDllHelper;
+	IDxcCompiler*							compiler = nullptr;
+	IDxcLibrary*							library = nullptr;
+	ShaderDependencyGraph					dependencies;		// of the blobs installed in programs
+	ShaderDirectoryWatcher					watcher;
+
+	bool									collectStats = false;
+	std::mutex								statsLock;
+	std::vector<D3D12ShaderCompileStats>	stats;
+	std::vector<D3D12LibraryLayoutStats>	libraryLayouts;
 };
 
 struct D3D12ShaderInfo 
@@ -175,6 +127,25 @@ struct D3D12ShaderInfo
 	}
 };
 
+struct D3D12ShaderPermutations
+{
+	D3D12ShaderCompilerInfo*								compilerInfo = nullptr;
+	D3D12ShaderInfo											info;				// the shader, without feature defines
+	std::vector<std::wstring>								features;			// the define enabled by each feature bit
+
+	std::mutex												lock;
+	std::condition_variable									wake;
+	std::thread												worker;
+	bool													shutdown = false;
+
+	std::vector<uint32_t>									pending;			// requested, not yet compiled
+	std::unordered_set<uint32_t>							requested;
+	std::unordered_map<uint32_t, IDxcBlob*>					blobs;				// compiled (null if compilation failed)
+	std::unordered_map<uint32_t, std::vector<DxcDefine>>	defines;
+	std::unordered_map<uint32_t, std::vector<ShaderDependency>>	dependencies;	// of each compiled permutation, failed or not
+	uint32_t												compileCount = 0;
+};
+
 struct D3D12Resources 
 {
 	ID3D12Resource*									DXROutput;
@@ -249,6 +220,7 @@ struct RtProgram
 	D3D12_EXPORT_DESC		exportDesc;
 	D3D12_STATE_SUBOBJECT	subobject;
 	std::wstring			exportName;
+	std::vector<DxcDefine>	defines;				// info.defines points here, so the program owns the defines of its blob
 
 	RtProgram()
 	{
@@ -276,6 +248,13 @@ struct RtProgram
 		subobject.pDesc = &dxilLibDesc;
 	}
 
+	void SetDefines(const std::vector<DxcDefine> &programDefines)
+	{
+		defines = programDefines;
+		info.defines = defines.data();
+		info.defineCount = static_cast<UINT32>(defines.size());
+	}
+
 };
 
 struct HitProgram
@@ -317,6 +296,8 @@ struct DXRGlobal
 	RtProgram										rgs;
 	RtProgram										miss;
 	HitProgram										hit;
+	RtProgram										lib;				// all entry points, when combinedLibrary is set
+	bool											combinedLibrary = false;
 
 	ID3D12StateObject*								rtpso = nullptr;
 	ID3D12StateObjectProperties*					rtpsoInfo = nullptr;
@@ -27,17 +27,30 @@
 
 #pragma once
 
-#include "Structures.h"
+#include "CPUStructures.h"
+
+#include <functional>
 
 namespace Utils
 {
-	HRESULT ParseCommandLine(LPWSTR lpCmdLine, ConfigInfo &config);
+	bool ParseCommandLine(int argc, char** argv, ConfigInfo &config);
 
 	std::vector<char> ReadFile(const std::string &filename);
+	bool ReadFile(const std::wstring &filename, std::string &contents);
+
+	uint64_t Hash(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+	unsigned GetThreadCount(unsigned requested);
+	bool HasAVX2();
+	void ParallelFor(size_t count, unsigned threadCount, const std::function<void(size_t begin, size_t end)> &body);
+	void ParallelForWorkStealing(size_t count, unsigned threadCount, const std::function<void(size_t index)> &body);
 
 	void LoadModel(std::string filepath, Model &model, Material &material);
 
-	void Validate(HRESULT hr, LPWSTR message);
+	void Validate(long hr, const wchar_t* message);		// hr is an HRESULT
 
 	TextureInfo LoadTexture(std::string filepath);
+	bool WriteImage(std::string filepath, int width, int height, const uint8_t* pixels);
+
+	void UpdateView(ViewCB &view, DirectX::XMFLOAT3 &eyeAngle, int width, int height);
 }
\ No newline at end of file
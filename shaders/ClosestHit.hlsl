@@ -27,6 +27,12 @@
 
 #include "Common.hlsl"
 
+// ---[ Permutation Features ]---
+// Compiled on demand by the shader permutation system (see D3DShaders::Get_Permutation)
+//   TEXTURE_BILINEAR		bilinearly filter the albedo texture instead of point sampling it
+//   DEBUG_BARYCENTRICS		output the triangle barycentrics
+//   DEBUG_UV				output the interpolated texture coordinates
+
 // ---[ Closest Hit Shader ]---
 
 [shader("closesthit")]
@@ -36,8 +42,28 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 	float3 barycentrics = float3((1.0f - attrib.uv.x - attrib.uv.y), attrib.uv.x, attrib.uv.y);
 	VertexAttributes vertex = GetVertexAttributes(triangleIndex, barycentrics);
 
+#if TEXTURE_BILINEAR
+	float2 texel = vertex.uv * textureResolution.x - 0.5f;
+	float2 weight = frac(texel);
+	int2 maxCoord = int2(textureResolution.x - 1, textureResolution.x - 1);
+	int2 coord0 = clamp(int2(floor(texel)), 0, maxCoord);
+	int2 coord1 = clamp(int2(floor(texel)) + 1, 0, maxCoord);
+
+	float3 c00 = albedo.Load(int3(coord0.x, coord0.y, 0)).rgb;
+	float3 c10 = albedo.Load(int3(coord1.x, coord0.y, 0)).rgb;
+	float3 c01 = albedo.Load(int3(coord0.x, coord1.y, 0)).rgb;
+	float3 c11 = albedo.Load(int3(coord1.x, coord1.y, 0)).rgb;
+	float3 color = lerp(lerp(c00, c10, weight.x), lerp(c01, c11, weight.x), weight.y);
+#else
 	int2 coord = floor(vertex.uv * textureResolution.x);
 	float3 color = albedo.Load(int3(coord, 0)).rgb;
+#endif
+
+#if DEBUG_BARYCENTRICS
+	color = barycentrics;
+#elif DEBUG_UV
+	color = float3(frac(vertex.uv), 0.f);
+#endif
 
 	payload.ShadedColorAndHitT = float4(color, RayTCurrent());
 }
\ No newline at end of file
@@ -25,6 +25,9 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef COMMON_HLSL
+#define COMMON_HLSL
+
 // ---[ Structures ]---
 
 struct HitInfo
@@ -91,4 +94,6 @@ VertexAttributes GetVertexAttributes(uint triangleIndex, float3 barycentrics)
 	}
 
 	return v;
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,969 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CPU.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Bounding Volume Hierarchy Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+static const uint32_t BinCount = 16;
+static const uint32_t MaxLeafSize = 8;					// larger nodes are always split
+static const uint32_t TaskThreshold = 1024;				// subtrees at least this large are handed to other threads
+static const uint32_t HorizontalThreshold = 65536;		// nodes at least this large are binned by all threads
+static const uint32_t MaxStackDepth = 128;				// traversal stack entries before spilling to the heap
+
+static const float TraversalCost = 1.f;
+static const float IntersectionCost = 1.f;
+
+static const float SpatialOverlapBudget = 1e-5f;		// spatial splits are tried where object split children overlap by this fraction of the root's area
+static const float SpatialDuplicateBudget = 0.3f;		// spatial splits may add up to 30% more triangle references
+
+inline float Min(float a, float b) { return (a < b) ? a : b; }
+inline float Max(float a, float b) { return (a > b) ? a : b; }
+
+struct AABB
+{
+	XMFLOAT3 min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	void Grow(const XMFLOAT3 &p)
+	{
+		min = XMFLOAT3(Min(min.x, p.x), Min(min.y, p.y), Min(min.z, p.z));
+		max = XMFLOAT3(Max(max.x, p.x), Max(max.y, p.y), Max(max.z, p.z));
+	}
+
+	void Grow(const AABB &b)
+	{
+		min = XMFLOAT3(Min(min.x, b.min.x), Min(min.y, b.min.y), Min(min.z, b.min.z));
+		max = XMFLOAT3(Max(max.x, b.max.x), Max(max.y, b.max.y), Max(max.z, b.max.z));
+	}
+
+	XMFLOAT3 Centroid() const
+	{
+		return XMFLOAT3((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f);
+	}
+
+	float Area() const
+	{
+		if (min.x > max.x) return 0.f;
+		float x = max.x - min.x, y = max.y - min.y, z = max.z - min.z;
+		return 2.f * (x * y + y * z + z * x);
+	}
+};
+
+struct Bin
+{
+	XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+	XMVECTOR centroidMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR centroidMax = XMVectorReplicate(-FLT_MAX);
+	uint32_t count = 0;
+
+	void Grow(const Bin &b)
+	{
+		boundsMin = XMVectorMin(boundsMin, b.boundsMin);
+		boundsMax = XMVectorMax(boundsMax, b.boundsMax);
+		centroidMin = XMVectorMin(centroidMin, b.centroidMin);
+		centroidMax = XMVectorMax(centroidMax, b.centroidMax);
+		count += b.count;
+	}
+
+	AABB Bounds() const
+	{
+		AABB result;
+		XMStoreFloat3(&result.min, boundsMin);
+		XMStoreFloat3(&result.max, boundsMax);
+		return result;
+	}
+
+	AABB Centroid_Bounds() const
+	{
+		AABB result;
+		XMStoreFloat3(&result.min, centroidMin);
+		XMStoreFloat3(&result.max, centroidMax);
+		return result;
+	}
+};
+
+struct PrimitiveReference
+{
+	AABB bounds;
+	uint32_t primitive;			// triangle, or instance in a top-level BVH
+};
+
+struct BuildTask
+{
+	uint32_t nodeIndex;
+	AABB centroidBounds;
+};
+
+struct BuildContext
+{
+	BVHTree*					bvh = nullptr;
+	vector<PrimitiveReference>	references;					// primitive bounds, partitioned in place into leaf order
+	atomic<uint32_t>			nodeCount;
+	unsigned					threadCount = 1;
+	uint32_t					horizontalThreshold = HorizontalThreshold;
+
+	mutex						lock;
+	condition_variable			wake;
+	vector<BuildTask>			tasks;
+	uint32_t					pending = 0;				// queued or running tasks
+};
+
+/**
+* Get a component of a float3 by axis index.
+*/
+inline float Axis(const XMFLOAT3 &v, int axis)
+{
+	return (&v.x)[axis];
+}
+
+/**
+* Get the position of a triangle's vertex.
+*/
+inline const XMFLOAT3& Get_Position(const Model &model, uint32_t triangleIndex, uint32_t vertex)
+{
+	return model.vertices[model.indices[triangleIndex * 3 + vertex]].position;
+}
+
+/**
+* Map a centroid to its bin along an axis.
+*/
+inline uint32_t Get_Bin(const XMFLOAT3 &centroid, int axis, float binMin, float binScale)
+{
+	int bin = static_cast<int>((Axis(centroid, axis) - binMin) * binScale);
+	if (bin < 0) return 0;
+	return (bin < static_cast<int>(BinCount)) ? static_cast<uint32_t>(bin) : (BinCount - 1);
+}
+
+/**
+* Bin the centroids of a range of triangles along all three axes.
+*/
+void Bin_Triangles(const PrimitiveReference* references, size_t count, const AABB &centroidBounds, Bin bins[3][BinCount])
+{
+	float binScale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = Axis(centroidBounds.max, axis) - Axis(centroidBounds.min, axis);
+		binScale[axis] = (extent > 0.f) ? (BinCount / extent) : 0.f;
+	}
+
+	// Compute the bin on all three axes at once
+	XMVECTOR binMin = XMLoadFloat3(&centroidBounds.min);
+	XMVECTOR binScales = XMVectorSet(binScale[0], binScale[1], binScale[2], 0.f);
+	XMVECTOR binLast = XMVectorReplicate(static_cast<float>(BinCount - 1));
+	for (size_t i = 0; i < count; i++)
+	{
+		const AABB &bounds = references[i].bounds;
+		XMVECTOR boundsMin = XMLoadFloat3(&bounds.min);
+		XMVECTOR boundsMax = XMLoadFloat3(&bounds.max);
+		XMVECTOR centroid = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+
+		XMFLOAT4A binIndex;
+		XMStoreFloat4A(&binIndex, XMVectorMin(XMVectorMax(XMVectorMultiply(XMVectorSubtract(centroid, binMin), binScales), XMVectorZero()), binLast));
+		for (int axis = 0; axis < 3; axis++)
+		{
+			Bin &bin = bins[axis][static_cast<uint32_t>((&binIndex.x)[axis])];
+			bin.boundsMin = XMVectorMin(bin.boundsMin, boundsMin);
+			bin.boundsMax = XMVectorMax(bin.boundsMax, boundsMax);
+			bin.centroidMin = XMVectorMin(bin.centroidMin, centroid);
+			bin.centroidMax = XMVectorMax(bin.centroidMax, centroid);
+			bin.count++;
+		}
+	}
+}
+
+/**
+* Split a node with the binned surface area heuristic. Returns false if the node should stay a leaf.
+*/
+bool Split_Node(BuildContext &ctx, uint32_t nodeIndex, const AABB &centroidBounds, BuildTask children[2])
+{
+	BVHTree &bvh = *ctx.bvh;
+	BVHNode &node = bvh.nodes[nodeIndex];
+	PrimitiveReference* references = ctx.references.data() + node.leftFirst;
+	if (node.count <= 1) return false;
+
+	// Bin the triangles, splitting large nodes across all threads
+	Bin bins[3][BinCount];
+	if (node.count >= ctx.horizontalThreshold && ctx.threadCount > 1)
+	{
+		vector<Bin> threadBins(static_cast<size_t>(ctx.threadCount) * 3 * BinCount);
+		size_t rangeSize = (node.count + ctx.threadCount - 1) / ctx.threadCount;
+		Utils::ParallelFor(ctx.threadCount, ctx.threadCount, [&](size_t firstRange, size_t lastRange)
+		{
+			for (size_t r = firstRange; r < lastRange; r++)
+			{
+				size_t begin = min(r * rangeSize, static_cast<size_t>(node.count));
+				size_t end = min(begin + rangeSize, static_cast<size_t>(node.count));
+				Bin (*local)[BinCount] = reinterpret_cast<Bin(*)[BinCount]>(&threadBins[r * 3 * BinCount]);
+				Bin_Triangles(references + begin, end - begin, centroidBounds, local);
+			}
+		});
+
+		for (unsigned t = 0; t < ctx.threadCount; t++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				for (uint32_t b = 0; b < BinCount; b++)
+				{
+					bins[axis][b].Grow(threadBins[(t * 3 + axis) * BinCount + b]);
+				}
+			}
+		}
+	}
+	else
+	{
+		Bin_Triangles(references, node.count, centroidBounds, bins);
+	}
+
+	// Evaluate the cost of splitting after each bin, sweeping from both sides
+	AABB nodeBounds;
+	nodeBounds.min = node.boundsMin;
+	nodeBounds.max = node.boundsMax;
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (Axis(centroidBounds.max, axis) <= Axis(centroidBounds.min, axis)) continue;
+
+		float rightArea[BinCount];
+		uint32_t rightCount[BinCount];
+		Bin right;
+		for (uint32_t b = BinCount - 1; b > 0; b--)
+		{
+			right.Grow(bins[axis][b]);
+			rightArea[b] = right.Bounds().Area();
+			rightCount[b] = right.count;
+		}
+
+		Bin left;
+		for (uint32_t b = 0; b < BinCount - 1; b++)
+		{
+			left.Grow(bins[axis][b]);
+			if (left.count == 0 || rightCount[b + 1] == 0) continue;
+
+			float cost = left.Bounds().Area() * left.count + rightArea[b + 1] * rightCount[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b + 1;
+			}
+		}
+	}
+
+	float area = nodeBounds.Area();
+	float leafCost = IntersectionCost * node.count;
+	float splitCost = TraversalCost + IntersectionCost * ((area > 0.f) ? (bestCost / area) : 0.f);
+	if (bestAxis < 0 && node.count <= MaxLeafSize) return false;
+	if (bestAxis >= 0 && splitCost >= leafCost && node.count <= MaxLeafSize) return false;
+
+	uint32_t leftCount;
+	AABB leftBounds, rightBounds, leftCentroids, rightCentroids;
+	if (bestAxis >= 0)
+	{
+		// Partition around the best split
+		float binMin = Axis(centroidBounds.min, bestAxis);
+		float binScale = BinCount / (Axis(centroidBounds.max, bestAxis) - binMin);
+		PrimitiveReference* middle = partition(references, references + node.count, [&](const PrimitiveReference &reference)
+		{
+			return Get_Bin(reference.bounds.Centroid(), bestAxis, binMin, binScale) < bestSplit;
+		});
+		leftCount = static_cast<uint32_t>(middle - references);
+
+		Bin leftBin, rightBin;
+		for (uint32_t b = 0; b < BinCount; b++)
+		{
+			((b < bestSplit) ? leftBin : rightBin).Grow(bins[bestAxis][b]);
+		}
+		leftBounds = leftBin.Bounds();
+		leftCentroids = leftBin.Centroid_Bounds();
+		rightBounds = rightBin.Bounds();
+		rightCentroids = rightBin.Centroid_Bounds();
+	}
+	else
+	{
+		// All centroids coincide, split the range in half to bound the leaf size
+		leftCount = node.count / 2;
+		for (uint32_t i = 0; i < node.count; i++)
+		{
+			(i < leftCount ? leftBounds : rightBounds).Grow(references[i].bounds);
+		}
+		leftCentroids = rightCentroids = centroidBounds;
+	}
+
+	uint32_t leftIndex = ctx.nodeCount.fetch_add(2);
+	BVHNode &left = bvh.nodes[leftIndex];
+	BVHNode &right = bvh.nodes[leftIndex + 1];
+	left.leftFirst = node.leftFirst;
+	left.count = leftCount;
+	left.boundsMin = leftBounds.min;
+	left.boundsMax = leftBounds.max;
+	right.leftFirst = node.leftFirst + leftCount;
+	right.count = node.count - leftCount;
+	right.boundsMin = rightBounds.min;
+	right.boundsMax = rightBounds.max;
+
+	node.leftFirst = leftIndex;
+	node.count = 0;
+
+	children[0] = { leftIndex, leftCentroids };
+	children[1] = { leftIndex + 1, rightCentroids };
+	return true;
+}
+
+/**
+* Queue a subtree to be built by any thread.
+*/
+void Push_Task(BuildContext &ctx, const BuildTask &task)
+{
+	lock_guard<mutex> guard(ctx.lock);
+	ctx.tasks.push_back(task);
+	ctx.pending++;
+	ctx.wake.notify_one();
+}
+
+/**
+* Build a subtree. Large child subtrees are queued for other threads, small ones are built here.
+*/
+void Build_Subtree(BuildContext &ctx, const BuildTask &task)
+{
+	vector<BuildTask> stack;
+	stack.push_back(task);
+	while (!stack.empty())
+	{
+		BuildTask current = stack.back();
+		stack.pop_back();
+
+		BuildTask children[2];
+		if (!Split_Node(ctx, current.nodeIndex, current.centroidBounds, children)) continue;
+
+		for (const BuildTask &child : children)
+		{
+			if (ctx.threadCount > 1 && ctx.bvh->nodes[child.nodeIndex].count >= TaskThreshold) Push_Task(ctx, child);
+			else stack.push_back(child);
+		}
+	}
+}
+
+/**
+* Run queued subtree tasks until the whole tree is built.
+*/
+void Build_Worker(BuildContext &ctx)
+{
+	while (true)
+	{
+		BuildTask task;
+		{
+			unique_lock<mutex> guard(ctx.lock);
+			ctx.wake.wait(guard, [&ctx] { return !ctx.tasks.empty() || ctx.pending == 0; });
+			if (ctx.tasks.empty()) return;
+
+			task = ctx.tasks.back();
+			ctx.tasks.pop_back();
+		}
+
+		Build_Subtree(ctx, task);
+
+		lock_guard<mutex> guard(ctx.lock);
+		if (--ctx.pending == 0) ctx.wake.notify_all();
+	}
+}
+
+/**
+* Build the tree over the primitive references of the context, given the bounds of the root and of its centroids.
+*/
+void Build_Tree(BuildContext &ctx, const AABB &rootBounds, const AABB &rootCentroids)
+{
+	BVHTree &bvh = *ctx.bvh;
+	uint32_t primitiveCount = static_cast<uint32_t>(ctx.references.size());
+	ctx.horizontalThreshold = max(HorizontalThreshold, primitiveCount / ctx.threadCount);
+	ctx.nodeCount = 1;
+
+	// A binary tree over N primitives has at most 2N - 1 nodes
+	bvh.nodes.resize(static_cast<size_t>(primitiveCount) * 2 - 1);
+	BVHNode &root = bvh.nodes[0];
+	root.leftFirst = 0;
+	root.count = primitiveCount;
+	root.boundsMin = rootBounds.min;
+	root.boundsMax = rootBounds.max;
+
+	// Workers pick up subtrees as they are queued, the calling thread starts with the root
+	Push_Task(ctx, { 0, rootCentroids });
+	vector<thread> workers;
+	for (unsigned i = 1; i < ctx.threadCount; i++) workers.emplace_back(Build_Worker, ref(ctx));
+	Build_Worker(ctx);
+	for (thread &worker : workers) worker.join();
+
+	bvh.nodes.resize(ctx.nodeCount);
+	bvh.nodes.shrink_to_fit();
+
+	bvh.triangles.resize(primitiveCount);
+	Utils::ParallelFor(primitiveCount, ctx.threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++) bvh.triangles[i] = ctx.references[i].primitive;
+	});
+}
+
+/**
+* Build a binary BVH over the model's triangles with the binned surface area heuristic.
+* Subtrees are built in parallel, and the large nodes near the root are binned by all threads.
+*/
+void Build(BVHTree &bvh, const Model &model, unsigned threadCount)
+{
+	uint32_t triangleCount = static_cast<uint32_t>(model.indices.size() / 3);
+	bvh.nodes.clear();
+	bvh.triangles.clear();
+	if (triangleCount == 0) return;
+
+	BuildContext ctx;
+	ctx.bvh = &bvh;
+	ctx.threadCount = Utils::GetThreadCount(threadCount);
+	ctx.references.resize(triangleCount);
+
+	// Compute the triangle bounds, and the bounds of the root and its centroids
+	mutex rootLock;
+	AABB rootBounds, rootCentroids;
+	Utils::ParallelFor(triangleCount, ctx.threadCount, [&](size_t begin, size_t end)
+	{
+		AABB bounds, centroids;
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t t = static_cast<uint32_t>(i);
+			PrimitiveReference &reference = ctx.references[i];
+			reference.primitive = t;
+			reference.bounds.Grow(Get_Position(model, t, 0));
+			reference.bounds.Grow(Get_Position(model, t, 1));
+			reference.bounds.Grow(Get_Position(model, t, 2));
+			bounds.Grow(reference.bounds);
+			centroids.Grow(reference.bounds.Centroid());
+		}
+
+		lock_guard<mutex> guard(rootLock);
+		rootBounds.Grow(bounds);
+		rootCentroids.Grow(centroids);
+	});
+
+	Build_Tree(ctx, rootBounds, rootCentroids);
+}
+
+/**
+* Build the BVH of a bottom-level structure with the builder its flags prefer, and collapse it into an 8-wide BVH when AVX2 is available.
+*/
+void Build(CPUBottomLevelAS &blas, const Model &model, unsigned threadCount)
+{
+	blas.model = &model;
+	if (blas.buildFlags & BVH_BUILD_FLAG_PREFER_FAST_BUILD) Build_Linear(blas.bvh, model, 0, threadCount);
+	else if (blas.buildFlags & BVH_BUILD_FLAG_ALLOW_SPATIAL_SPLITS) Build_Spatial(blas.bvh, model, SpatialOverlapBudget, SpatialDuplicateBudget, threadCount);
+	else Build(blas.bvh, model, threadCount);
+	blas.bvh8 = BVH8Tree();
+	if (Utils::HasAVX2()) Collapse(blas.bvh8, blas.bvh);
+}
+
+/**
+* Build the top-level BVH over the world space bounds of the instances, like Create_Top_Level_AS.
+* The bottom-level structures must be built first.
+*/
+void Build(CPUTopLevelAS &tlas, unsigned threadCount)
+{
+	uint32_t instanceCount = static_cast<uint32_t>(tlas.instances.size());
+	tlas.bvh.nodes.clear();
+	tlas.bvh.triangles.clear();
+	if (instanceCount == 0) return;
+
+	BuildContext ctx;
+	ctx.bvh = &tlas.bvh;
+	ctx.threadCount = Utils::GetThreadCount(threadCount);
+	ctx.references.resize(instanceCount);
+
+	mutex rootLock;
+	AABB rootBounds, rootCentroids;
+	Utils::ParallelFor(instanceCount, ctx.threadCount, [&](size_t begin, size_t end)
+	{
+		AABB bounds, centroids;
+		for (size_t i = begin; i < end; i++)
+		{
+			CPUInstance &instance = tlas.instances[i];
+			XMStoreFloat3x4(&instance.worldToObject, XMMatrixInverse(nullptr, XMLoadFloat3x4(&instance.transform)));
+
+			PrimitiveReference &reference = ctx.references[i];
+			reference.primitive = static_cast<uint32_t>(i);
+
+			// Transform the center and the half extent of the bottom-level bounds, which gives the tightest box around the transformed box
+			const BVHTree &bvh = tlas.bottomLevels[instance.bottomLevel].bvh;
+			if (bvh.nodes.empty())
+			{
+				reference.bounds.Grow(XMFLOAT3(instance.transform.m[0][3], instance.transform.m[1][3], instance.transform.m[2][3]));
+			}
+			else
+			{
+				const BVHNode &root = bvh.nodes[0];
+				XMFLOAT3 center((root.boundsMin.x + root.boundsMax.x) * 0.5f, (root.boundsMin.y + root.boundsMax.y) * 0.5f, (root.boundsMin.z + root.boundsMax.z) * 0.5f);
+				XMFLOAT3 extent(root.boundsMax.x - center.x, root.boundsMax.y - center.y, root.boundsMax.z - center.z);
+				float worldCenter[3], worldExtent[3];
+				for (int row = 0; row < 3; row++)
+				{
+					const float* m = instance.transform.m[row];
+					worldCenter[row] = m[0] * center.x + m[1] * center.y + m[2] * center.z + m[3];
+					worldExtent[row] = fabsf(m[0]) * extent.x + fabsf(m[1]) * extent.y + fabsf(m[2]) * extent.z;
+				}
+				reference.bounds.Grow(XMFLOAT3(worldCenter[0] - worldExtent[0], worldCenter[1] - worldExtent[1], worldCenter[2] - worldExtent[2]));
+				reference.bounds.Grow(XMFLOAT3(worldCenter[0] + worldExtent[0], worldCenter[1] + worldExtent[1], worldCenter[2] + worldExtent[2]));
+			}
+			bounds.Grow(reference.bounds);
+			centroids.Grow(reference.bounds.Centroid());
+		}
+
+		lock_guard<mutex> guard(rootLock);
+		rootBounds.Grow(bounds);
+		rootCentroids.Grow(centroids);
+	});
+
+	Build_Tree(ctx, rootBounds, rootCentroids);
+}
+
+/**
+* Refit the bounds of a tree to the model's current vertex positions, keeping its topology.
+* Leaves are refit in parallel, and the second of two siblings to finish goes on to refit their parent, so every node is refit once,
+* after both of its children. Leaves of a tree built with spatial splits grow back to the bounds of their whole triangles.
+*/
+void Refit(BVHTree &bvh, const Model &model, unsigned threadCount)
+{
+	uint32_t nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+	if (nodeCount == 0) return;
+
+	vector<uint32_t> parents(nodeCount);
+	unique_ptr<atomic<uint32_t>[]> arrivals(new atomic<uint32_t>[nodeCount]);
+	parents[0] = UINT32_MAX;
+	Utils::ParallelFor(nodeCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			arrivals[i] = 0;
+			const BVHNode &node = bvh.nodes[i];
+			if (node.count > 0) continue;
+			parents[node.leftFirst] = static_cast<uint32_t>(i);
+			parents[node.leftFirst + 1] = static_cast<uint32_t>(i);
+		}
+	});
+
+	Utils::ParallelFor(nodeCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			BVHNode &leaf = bvh.nodes[i];
+			if (leaf.count == 0) continue;
+
+			AABB bounds;
+			for (uint32_t t = 0; t < leaf.count; t++)
+			{
+				uint32_t triangle = bvh.triangles[leaf.leftFirst + t];
+				bounds.Grow(Get_Position(model, triangle, 0));
+				bounds.Grow(Get_Position(model, triangle, 1));
+				bounds.Grow(Get_Position(model, triangle, 2));
+			}
+			leaf.boundsMin = bounds.min;
+			leaf.boundsMax = bounds.max;
+
+			// The first sibling to arrive at a parent stops, the second refits it
+			uint32_t index = parents[i];
+			while (index != UINT32_MAX && arrivals[index].fetch_add(1) == 1)
+			{
+				BVHNode &node = bvh.nodes[index];
+				const BVHNode &left = bvh.nodes[node.leftFirst];
+				const BVHNode &right = bvh.nodes[node.leftFirst + 1];
+				node.boundsMin = XMFLOAT3(Min(left.boundsMin.x, right.boundsMin.x), Min(left.boundsMin.y, right.boundsMin.y), Min(left.boundsMin.z, right.boundsMin.z));
+				node.boundsMax = XMFLOAT3(Max(left.boundsMax.x, right.boundsMax.x), Max(left.boundsMax.y, right.boundsMax.y), Max(left.boundsMax.z, right.boundsMax.z));
+				index = parents[index];
+			}
+		}
+	});
+}
+
+/**
+* Update a tree after the model's vertices moved: refit it, and rebuild it from scratch if refitting has let its SAH cost
+* grow past the state's threshold since the last build. Returns true if the tree was rebuilt.
+*/
+bool Update(BVHTree &bvh, const Model &model, BVHUpdateState &state, unsigned threadCount)
+{
+	if (!bvh.nodes.empty() && state.builtCost > 0.f)
+	{
+		Refit(bvh, model, threadCount);
+		state.refits++;
+		state.cost = Get_SAH_Cost(bvh);
+		if (state.cost <= state.builtCost * state.rebuildRatio) return false;
+	}
+
+	if (state.buildFlags & BVH_BUILD_FLAG_PREFER_FAST_BUILD) Build_Linear(bvh, model, 0, threadCount);
+	else if (state.buildFlags & BVH_BUILD_FLAG_ALLOW_SPATIAL_SPLITS) Build_Spatial(bvh, model, SpatialOverlapBudget, SpatialDuplicateBudget, threadCount);
+	else Build(bvh, model, threadCount);
+	state.rebuilds++;
+	state.cost = Get_SAH_Cost(bvh);
+	state.builtCost = state.cost;
+	return true;
+}
+
+/**
+* Compute the SAH cost of a tree: the expected cost of tracing a random ray that hits the root.
+*/
+float Get_SAH_Cost(const BVHTree &bvh)
+{
+	if (bvh.nodes.empty()) return 0.f;
+
+	AABB root;
+	root.min = bvh.nodes[0].boundsMin;
+	root.max = bvh.nodes[0].boundsMax;
+	float rootArea = root.Area();
+	if (rootArea <= 0.f) return IntersectionCost * bvh.nodes[0].count;
+
+	double cost = 0.0;
+	for (const BVHNode &node : bvh.nodes)
+	{
+		AABB bounds;
+		bounds.min = node.boundsMin;
+		bounds.max = node.boundsMax;
+		float area = bounds.Area() / rootArea;
+		cost += (node.count > 0) ? (IntersectionCost * node.count * area) : (TraversalCost * area);
+	}
+	return static_cast<float>(cost);
+}
+
+/**
+* Intersect a ray with a box, returning the entry distance or FLT_MAX if the box is missed.
+*/
+inline float Intersect_Box(const BVHNode &node, const XMFLOAT3 &origin, const XMFLOAT3 &invDirection, float tMin, float tMax)
+{
+	float tx1 = (node.boundsMin.x - origin.x) * invDirection.x;
+	float tx2 = (node.boundsMax.x - origin.x) * invDirection.x;
+	float tNear = Min(tx1, tx2), tFar = Max(tx1, tx2);
+	float ty1 = (node.boundsMin.y - origin.y) * invDirection.y;
+	float ty2 = (node.boundsMax.y - origin.y) * invDirection.y;
+	tNear = Max(tNear, Min(ty1, ty2)); tFar = Min(tFar, Max(ty1, ty2));
+	float tz1 = (node.boundsMin.z - origin.z) * invDirection.z;
+	float tz2 = (node.boundsMax.z - origin.z) * invDirection.z;
+	tNear = Max(tNear, Min(tz1, tz2)); tFar = Min(tFar, Max(tz1, tz2));
+	tNear = Max(tNear, tMin);
+	tFar = Min(tFar, tMax);
+	return (tNear <= tFar) ? tNear : FLT_MAX;
+}
+
+/**
+* Continue a closest hit search in the subtree under a node, keeping only hits closer than hit.t.
+* The node's own bounds are not tested. Visits the nearer child first.
+*/
+void Intersect_Subtree(const BVHTree &bvh, const Model &model, const CPURay &ray, CPUHit &hit, uint32_t nodeIndex)
+{
+	XMFLOAT3 invDirection(1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z);
+	WatertightRay watertight = Get_Watertight_Ray(ray);
+
+	struct StackEntry
+	{
+		uint32_t nodeIndex;
+		float tNear;
+	};
+
+	CPUTraversalStack<StackEntry, MaxStackDepth> stack;
+	while (true)
+	{
+		const BVHNode &node = bvh.nodes[nodeIndex];
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; i++)
+			{
+				Intersect_Triangle(model, bvh.triangles[node.leftFirst + i], watertight, hit);
+			}
+		}
+		else
+		{
+			uint32_t nearIndex = node.leftFirst;
+			uint32_t farIndex = node.leftFirst + 1;
+			float tNear = Intersect_Box(bvh.nodes[nearIndex], ray.origin, invDirection, ray.tMin, hit.t);
+			float tFar = Intersect_Box(bvh.nodes[farIndex], ray.origin, invDirection, ray.tMin, hit.t);
+			if (tFar < tNear)
+			{
+				swap(nearIndex, farIndex);
+				swap(tNear, tFar);
+			}
+
+			if (tNear != FLT_MAX)
+			{
+				if (tFar != FLT_MAX) stack.Push({ farIndex, tFar });
+				nodeIndex = nearIndex;
+				continue;
+			}
+		}
+
+		// Skip nodes that are further away than a hit found since they were pushed
+		while (stack.size > 0 && stack.Top().tNear > hit.t) stack.Pop();
+		if (stack.size == 0) break;
+		nodeIndex = stack.Pop().nodeIndex;
+	}
+}
+
+/**
+* Find the closest intersection of a ray with the model.
+*/
+bool Intersect(const BVHTree &bvh, const Model &model, const CPURay &ray, CPUHit &hit)
+{
+	hit.t = ray.tMax;
+	hit.triangleIndex = UINT32_MAX;
+	if (bvh.nodes.empty()) return false;
+
+	XMFLOAT3 invDirection(1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z);
+	if (Intersect_Box(bvh.nodes[0], ray.origin, invDirection, ray.tMin, hit.t) == FLT_MAX) return false;
+
+	Intersect_Subtree(bvh, model, ray, hit, 0);
+	return (hit.triangleIndex != UINT32_MAX);
+}
+
+/**
+* Find whether a ray hits any triangle between its tMin and tMax, for shadow rays. Traversal stops at the first hit
+* found, so children are visited in order without finding the nearer one.
+*/
+bool Occluded(const BVHTree &bvh, const Model &model, const CPURay &ray)
+{
+	if (bvh.nodes.empty()) return false;
+
+	XMFLOAT3 invDirection(1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z);
+	if (Intersect_Box(bvh.nodes[0], ray.origin, invDirection, ray.tMin, ray.tMax) == FLT_MAX) return false;
+
+	WatertightRay watertight = Get_Watertight_Ray(ray);
+	CPUHit hit;
+	hit.t = ray.tMax;
+
+	CPUTraversalStack<uint32_t, MaxStackDepth> stack;
+	uint32_t nodeIndex = 0;
+	while (true)
+	{
+		const BVHNode &node = bvh.nodes[nodeIndex];
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; i++)
+			{
+				if (Intersect_Triangle(model, bvh.triangles[node.leftFirst + i], watertight, hit)) return true;
+			}
+		}
+		else
+		{
+			uint32_t leftIndex = node.leftFirst;
+			uint32_t rightIndex = node.leftFirst + 1;
+			bool left = (Intersect_Box(bvh.nodes[leftIndex], ray.origin, invDirection, ray.tMin, ray.tMax) != FLT_MAX);
+			bool right = (Intersect_Box(bvh.nodes[rightIndex], ray.origin, invDirection, ray.tMin, ray.tMax) != FLT_MAX);
+			if (left || right)
+			{
+				if (left && right) stack.Push(rightIndex);
+				nodeIndex = left ? leftIndex : rightIndex;
+				continue;
+			}
+		}
+
+		if (stack.size == 0) break;
+		nodeIndex = stack.Pop();
+	}
+	return false;
+}
+
+/**
+* Find the closest intersection of a ray with the model like Intersect, counting the nodes visited and the box and
+* triangle tests into the stats. Kept apart from Intersect_Subtree so the counters cost nothing when rendering.
+*/
+bool Intersect_Counted(const BVHTree &bvh, const Model &model, const CPURay &ray, CPUHit &hit, BVHTraversalStats &stats)
+{
+	hit.t = ray.tMax;
+	hit.triangleIndex = UINT32_MAX;
+	stats.rays++;
+	if (bvh.nodes.empty()) return false;
+
+	XMFLOAT3 invDirection(1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z);
+	WatertightRay watertight = Get_Watertight_Ray(ray);
+	stats.boxTests++;
+	if (Intersect_Box(bvh.nodes[0], ray.origin, invDirection, ray.tMin, hit.t) == FLT_MAX) return false;
+
+	struct StackEntry
+	{
+		uint32_t nodeIndex;
+		float tNear;
+	};
+
+	CPUTraversalStack<StackEntry, MaxStackDepth> stack;
+	uint32_t nodeIndex = 0;
+	while (true)
+	{
+		const BVHNode &node = bvh.nodes[nodeIndex];
+		stats.nodeVisits++;
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; i++)
+			{
+				Intersect_Triangle(model, bvh.triangles[node.leftFirst + i], watertight, hit);
+			}
+			stats.triangleTests += node.count;
+		}
+		else
+		{
+			uint32_t nearIndex = node.leftFirst;
+			uint32_t farIndex = node.leftFirst + 1;
+			float tNear = Intersect_Box(bvh.nodes[nearIndex], ray.origin, invDirection, ray.tMin, hit.t);
+			float tFar = Intersect_Box(bvh.nodes[farIndex], ray.origin, invDirection, ray.tMin, hit.t);
+			stats.boxTests += 2;
+			if (tFar < tNear)
+			{
+				swap(nearIndex, farIndex);
+				swap(tNear, tFar);
+			}
+
+			if (tNear != FLT_MAX)
+			{
+				if (tFar != FLT_MAX) stack.Push({ farIndex, tFar });
+				nodeIndex = nearIndex;
+				continue;
+			}
+		}
+
+		while (stack.size > 0 && stack.Top().tNear > hit.t) stack.Pop();
+		if (stack.size == 0) break;
+		nodeIndex = stack.Pop().nodeIndex;
+	}
+
+	if (hit.triangleIndex == UINT32_MAX) return false;
+	stats.hits++;
+	return true;
+}
+
+/**
+* Transform a point or a direction by a 3x4 matrix.
+*/
+inline XMFLOAT3 Transform(const XMFLOAT3X4 &m, const XMFLOAT3 &v, float w)
+{
+	return XMFLOAT3(
+		m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z + m.m[0][3] * w,
+		m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z + m.m[1][3] * w,
+		m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z + m.m[2][3] * w);
+}
+
+/**
+* Find the closest intersection of a ray with the instances of a two-level structure, skipping the instances
+* whose InstanceMask shares no bits with the ray's InstanceInclusionMask, like TraceRay.
+* The ray is transformed into each instance's object space without normalizing the direction, so t is the same
+* in world and object space and hits in different instances compare directly.
+*/
+bool Intersect(const CPUTopLevelAS &tlas, const CPURay &ray, uint32_t instanceInclusionMask, CPUHit &hit)
+{
+	hit.t = ray.tMax;
+	hit.triangleIndex = UINT32_MAX;
+	hit.instanceIndex = 0;
+	const BVHTree &bvh = tlas.bvh;
+	if (bvh.nodes.empty()) return false;
+
+	XMFLOAT3 invDirection(1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z);
+	if (Intersect_Box(bvh.nodes[0], ray.origin, invDirection, ray.tMin, hit.t) == FLT_MAX) return false;
+
+	struct StackEntry
+	{
+		uint32_t nodeIndex;
+		float tNear;
+	};
+
+	CPUTraversalStack<StackEntry, MaxStackDepth> stack;
+	uint32_t nodeIndex = 0;
+	while (true)
+	{
+		const BVHNode &node = bvh.nodes[nodeIndex];
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; i++)
+			{
+				uint32_t instanceIndex = bvh.triangles[node.leftFirst + i];
+				const CPUInstance &instance = tlas.instances[instanceIndex];
+				if ((instance.instanceMask & instanceInclusionMask & 0xFF) == 0) continue;
+
+				// Trace the bottom level in object space, only accepting hits closer than the closest so far
+				CPURay objectRay;
+				objectRay.origin = Transform(instance.worldToObject, ray.origin, 1.f);
+				objectRay.direction = Transform(instance.worldToObject, ray.direction, 0.f);
+				objectRay.tMin = ray.tMin;
+				objectRay.tMax = hit.t;
+
+				const CPUBottomLevelAS &blas = tlas.bottomLevels[instance.bottomLevel];
+				CPUHit objectHit;
+				bool found = blas.bvh8.nodes.empty() ? Intersect(blas.bvh, *blas.model, objectRay, objectHit) : Intersect(blas.bvh8, *blas.model, objectRay, objectHit);
+				if (found)
+				{
+					hit = objectHit;
+					hit.instanceIndex = instanceIndex;
+				}
+			}
+		}
+		else
+		{
+			uint32_t nearIndex = node.leftFirst;
+			uint32_t farIndex = node.leftFirst + 1;
+			float tNear = Intersect_Box(bvh.nodes[nearIndex], ray.origin, invDirection, ray.tMin, hit.t);
+			float tFar = Intersect_Box(bvh.nodes[farIndex], ray.origin, invDirection, ray.tMin, hit.t);
+			if (tFar < tNear)
+			{
+				swap(nearIndex, farIndex);
+				swap(tNear, tFar);
+			}
+
+			if (tNear != FLT_MAX)
+			{
+				if (tFar != FLT_MAX) stack.Push({ farIndex, tFar });
+				nodeIndex = nearIndex;
+				continue;
+			}
+		}
+
+		// Skip nodes that are further away than a hit found since they were pushed
+		while (stack.size > 0 && stack.Top().tNear > hit.t) stack.Pop();
+		if (stack.size == 0) break;
+		nodeIndex = stack.Pop().nodeIndex;
+	}
+
+	return (hit.triangleIndex != UINT32_MAX);
+}
+
+}
@@ -0,0 +1,420 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CPU.h"
+#include "Platform.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// 8-Wide Bounding Volume Hierarchy Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+static const uint32_t MaxWidth = 8;
+static const uint32_t MaxStackDepth8 = 512;				// traversal stack entries before spilling to the heap, up to 7 are pushed per level
+static const float MinDirection = 1e-20f;				// keeps the inverse direction finite, so no 0 * inf in the slab tests
+
+/**
+* Get a component of a float3 by axis index.
+*/
+inline float Axis(const XMFLOAT3 &v, int axis)
+{
+	return (&v.x)[axis];
+}
+
+/**
+* Get the surface area of a binary node's bounds.
+*/
+inline float Area(const BVHNode &node)
+{
+	float x = node.boundsMax.x - node.boundsMin.x;
+	float y = node.boundsMax.y - node.boundsMin.y;
+	float z = node.boundsMax.z - node.boundsMin.z;
+	return 2.f * (x * y + y * z + z * x);
+}
+
+/**
+* Get 2^exponent as a float.
+*/
+inline float Exp2(int exponent)
+{
+	uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+/**
+* Find the smallest power of two step that covers an extent with 255 steps.
+*/
+int Get_Exponent(float extent)
+{
+	if (extent <= 0.f) return -126;
+
+	int exponent;
+	frexpf(extent / 255.f, &exponent);
+	exponent = min(max(exponent, -126), 127);
+	while (exponent < 127 && Exp2(exponent) * 255.f < extent) exponent++;
+	return exponent;
+}
+
+/**
+* Quantize a child's bounds relative to the parent, rounding outward so the child is always contained.
+*/
+void Quantize_Child(BVH8Node &node, uint32_t slot, const BVHNode &child)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float origin = Axis(node.origin, axis);
+		float scale = Exp2(node.exponent[axis]);
+		float childMin = Axis(child.boundsMin, axis);
+		float childMax = Axis(child.boundsMax, axis);
+
+		int qMin = static_cast<int>(min(max(floorf((childMin - origin) / scale), 0.f), 255.f));
+		while (qMin > 0 && origin + qMin * scale > childMin) qMin--;
+
+		int qMax = static_cast<int>(min(max(ceilf((childMax - origin) / scale), 0.f), 255.f));
+		while (qMax < 255 && origin + qMax * scale < childMax) qMax++;
+
+		node.boundsMin[axis][slot] = static_cast<uint8_t>(qMin);
+		node.boundsMax[axis][slot] = static_cast<uint8_t>(qMax);
+	}
+}
+
+/**
+* Collapse the binary subtree under a node into one 8-wide node, then collapse its interior children.
+* The children are gathered by repeatedly opening the interior child with the largest surface area.
+*/
+void Collapse_Node(BVH8Tree &bvh8, const BVHTree &bvh, uint32_t binaryIndex, uint32_t nodeIndex)
+{
+	const BVHNode &binary = bvh.nodes[binaryIndex];
+
+	uint32_t children[MaxWidth];
+	uint32_t childCount = 0;
+	if (binary.count > 0)
+	{
+		// A single leaf root
+		children[childCount++] = binaryIndex;
+	}
+	else
+	{
+		children[childCount++] = binary.leftFirst;
+		children[childCount++] = binary.leftFirst + 1;
+	}
+
+	while (childCount < MaxWidth)
+	{
+		int largest = -1;
+		float largestArea = -1.f;
+		for (uint32_t i = 0; i < childCount; i++)
+		{
+			const BVHNode &child = bvh.nodes[children[i]];
+			if (child.count == 0 && Area(child) > largestArea)
+			{
+				largest = static_cast<int>(i);
+				largestArea = Area(child);
+			}
+		}
+		if (largest < 0) break;
+
+		uint32_t opened = children[largest];
+		children[largest] = bvh.nodes[opened].leftFirst;
+		children[childCount++] = bvh.nodes[opened].leftFirst + 1;
+	}
+
+	// Allocate the interior children before taking a reference, since the node array may grow
+	uint32_t childNodes[MaxWidth];
+	for (uint32_t i = 0; i < childCount; i++)
+	{
+		if (bvh.nodes[children[i]].count > 0) continue;
+		childNodes[i] = static_cast<uint32_t>(bvh8.nodes.size());
+		bvh8.nodes.emplace_back();
+	}
+
+	BVH8Node &node = bvh8.nodes[nodeIndex];
+	node = BVH8Node();
+	node.origin = binary.boundsMin;
+	node.childCount = static_cast<uint8_t>(childCount);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		node.exponent[axis] = static_cast<int8_t>(Get_Exponent(Axis(binary.boundsMax, axis) - Axis(binary.boundsMin, axis)));
+	}
+
+	for (uint32_t i = 0; i < MaxWidth; i++)
+	{
+		if (i >= childCount)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				node.boundsMin[axis][i] = 255;
+				node.boundsMax[axis][i] = 0;
+			}
+			node.children[i] = 0;
+			node.counts[i] = 0;
+			continue;
+		}
+
+		const BVHNode &child = bvh.nodes[children[i]];
+		Quantize_Child(node, i, child);
+		node.children[i] = (child.count > 0) ? child.leftFirst : childNodes[i];
+		node.counts[i] = static_cast<uint8_t>(child.count);
+	}
+
+	for (uint32_t i = 0; i < childCount; i++)
+	{
+		if (bvh.nodes[children[i]].count == 0) Collapse_Node(bvh8, bvh, children[i], childNodes[i]);
+	}
+}
+
+/**
+* Collapse a binary BVH into an 8-wide BVH with 8-bit child bounds quantized to the parent's bounds.
+* Leaves and the triangle order are shared with the binary BVH.
+*/
+void Collapse(BVH8Tree &bvh8, const BVHTree &bvh)
+{
+	bvh8.nodes.clear();
+	bvh8.triangles = bvh.triangles;
+	if (bvh.nodes.empty()) return;
+
+	bvh8.nodes.reserve(bvh.nodes.size() / 4 + 1);
+	bvh8.nodes.emplace_back();
+	Collapse_Node(bvh8, bvh, 0, 0);
+	bvh8.nodes.shrink_to_fit();
+}
+
+/**
+* Load eight quantized bounds as floats.
+*/
+PLATFORM_TARGET_AVX2 inline __m256 Load_Bounds(const uint8_t* bounds)
+{
+	return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bounds))));
+}
+
+/**
+* Find the closest intersection of a ray with the model, testing all eight child boxes of a node at once with AVX2.
+* Hit children are visited nearest first. Requires AVX2 and FMA (see Utils::HasAVX2).
+*/
+PLATFORM_TARGET_AVX2 bool Intersect(const BVH8Tree &bvh, const Model &model, const CPURay &ray, CPUHit &hit)
+{
+	hit.t = ray.tMax;
+	hit.triangleIndex = UINT32_MAX;
+	if (bvh.nodes.empty()) return false;
+
+	float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+	float invDirection[3];
+	bool negative[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float d = Axis(ray.direction, axis);
+		if (fabsf(d) < MinDirection) d = (d < 0.f) ? -MinDirection : MinDirection;
+		invDirection[axis] = 1.f / d;
+		negative[axis] = (d < 0.f);
+	}
+
+	struct StackEntry
+	{
+		uint32_t index;
+		uint32_t count;			// triangles in a leaf, 0 for nodes
+		float tNear;
+	};
+
+	WatertightRay watertight = Get_Watertight_Ray(ray);
+
+	CPUTraversalStack<StackEntry, MaxStackDepth8> stack;
+	StackEntry entry = { 0, 0, ray.tMin };
+	const __m256 tMin = _mm256_set1_ps(ray.tMin);
+
+	while (true)
+	{
+		if (entry.count > 0)
+		{
+			for (uint32_t i = 0; i < entry.count; i++)
+			{
+				Intersect_Triangle(model, bvh.triangles[entry.index + i], watertight, hit);
+			}
+		}
+		else
+		{
+			const BVH8Node &node = bvh.nodes[entry.index];
+			const float* nodeOrigin = &node.origin.x;
+
+			// Slab test of the eight children, choosing the near plane of each axis from the ray direction
+			__m256 tNear = tMin;
+			__m256 tFar = _mm256_set1_ps(hit.t);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				__m256 scale = _mm256_set1_ps(Exp2(node.exponent[axis]) * invDirection[axis]);
+				__m256 offset = _mm256_set1_ps((nodeOrigin[axis] - origin[axis]) * invDirection[axis]);
+				const uint8_t* nearBounds = negative[axis] ? node.boundsMax[axis] : node.boundsMin[axis];
+				const uint8_t* farBounds = negative[axis] ? node.boundsMin[axis] : node.boundsMax[axis];
+				tNear = _mm256_max_ps(tNear, _mm256_fmadd_ps(Load_Bounds(nearBounds), scale, offset));
+				tFar = _mm256_min_ps(tFar, _mm256_fmadd_ps(Load_Bounds(farBounds), scale, offset));
+			}
+
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+			mask &= (1u << node.childCount) - 1;
+
+			if (mask != 0)
+			{
+				float distances[MaxWidth];
+				_mm256_storeu_ps(distances, tNear);
+
+				// Sort the hit children by distance, nearest last
+				StackEntry hits[MaxWidth];
+				uint32_t hitCount = 0;
+				while (mask != 0)
+				{
+					uint32_t slot = 0;
+					while (!(mask & (1u << slot))) slot++;
+					mask &= mask - 1;
+
+					StackEntry child = { node.children[slot], node.counts[slot], distances[slot] };
+					uint32_t i = hitCount++;
+					while (i > 0 && hits[i - 1].tNear < child.tNear)
+					{
+						hits[i] = hits[i - 1];
+						i--;
+					}
+					hits[i] = child;
+				}
+
+				for (uint32_t i = 0; i + 1 < hitCount; i++) stack.Push(hits[i]);
+				entry = hits[hitCount - 1];
+				continue;
+			}
+		}
+
+		// Skip entries that are further away than a hit found since they were pushed
+		while (stack.size > 0 && stack.Top().tNear > hit.t) stack.Pop();
+		if (stack.size == 0) break;
+		entry = stack.Pop();
+	}
+
+	return (hit.triangleIndex != UINT32_MAX);
+}
+
+/**
+* Find whether a ray hits any triangle between its tMin and tMax, for shadow rays, testing all eight child boxes of a
+* node at once. Traversal stops at the first hit found, so hit children are not sorted. Requires AVX2 and FMA.
+*/
+PLATFORM_TARGET_AVX2 bool Occluded(const BVH8Tree &bvh, const Model &model, const CPURay &ray)
+{
+	if (bvh.nodes.empty()) return false;
+
+	float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+	float invDirection[3];
+	bool negative[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float d = Axis(ray.direction, axis);
+		if (fabsf(d) < MinDirection) d = (d < 0.f) ? -MinDirection : MinDirection;
+		invDirection[axis] = 1.f / d;
+		negative[axis] = (d < 0.f);
+	}
+
+	struct StackEntry
+	{
+		uint32_t index;
+		uint32_t count;			// triangles in a leaf, 0 for nodes
+	};
+
+	WatertightRay watertight = Get_Watertight_Ray(ray);
+	CPUHit hit;
+	hit.t = ray.tMax;
+
+	CPUTraversalStack<StackEntry, MaxStackDepth8> stack;
+	StackEntry entry = { 0, 0 };
+	const __m256 tMin = _mm256_set1_ps(ray.tMin);
+	const __m256 tMax = _mm256_set1_ps(ray.tMax);
+
+	while (true)
+	{
+		if (entry.count > 0)
+		{
+			for (uint32_t i = 0; i < entry.count; i++)
+			{
+				if (Intersect_Triangle(model, bvh.triangles[entry.index + i], watertight, hit)) return true;
+			}
+		}
+		else
+		{
+			const BVH8Node &node = bvh.nodes[entry.index];
+			const float* nodeOrigin = &node.origin.x;
+
+			__m256 tNear = tMin;
+			__m256 tFar = tMax;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				__m256 scale = _mm256_set1_ps(Exp2(node.exponent[axis]) * invDirection[axis]);
+				__m256 offset = _mm256_set1_ps((nodeOrigin[axis] - origin[axis]) * invDirection[axis]);
+				const uint8_t* nearBounds = negative[axis] ? node.boundsMax[axis] : node.boundsMin[axis];
+				const uint8_t* farBounds = negative[axis] ? node.boundsMin[axis] : node.boundsMax[axis];
+				tNear = _mm256_max_ps(tNear, _mm256_fmadd_ps(Load_Bounds(nearBounds), scale, offset));
+				tFar = _mm256_min_ps(tFar, _mm256_fmadd_ps(Load_Bounds(farBounds), scale, offset));
+			}
+
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+			mask &= (1u << node.childCount) - 1;
+
+			// Push all hit children but the last, and visit the last
+			if (mask != 0)
+			{
+				while (true)
+				{
+					uint32_t slot = 0;
+					while (!(mask & (1u << slot))) slot++;
+					mask &= mask - 1;
+
+					StackEntry child = { node.children[slot], node.counts[slot] };
+					if (mask == 0)
+					{
+						entry = child;
+						break;
+					}
+					stack.Push(child);
+				}
+				continue;
+			}
+		}
+
+		if (stack.size == 0) break;
+		entry = stack.Pop();
+	}
+	return false;
+}
+
+}
@@ -0,0 +1,297 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CPU.h"
+#include "Platform.h"
+#include "Utils.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// BVH Cache Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+static const char CacheMagic[8] = { 'D', 'X', 'R', 'B', 'V', 'H', 'C', '\0' };
+static const uint32_t CacheVersion = 1;					// bump when the file layout, BVHNode or BVH8Node change
+static const uint64_t CacheAlignment = 64;				// sections start on cache lines, so a mapped file can be read in place
+static const size_t HashChunkSize = 1 << 20;
+
+enum CacheSection
+{
+	SectionNodes,
+	SectionTriangles,
+	SectionNodes8,
+	SectionCount
+};
+
+// The file is the header followed by the sections. Sections are found by their offset from the start of the file,
+// so the file needs no pointer fixups wherever it is mapped.
+struct CacheHeader
+{
+	char		magic[8];
+	uint32_t	version = CacheVersion;
+	uint32_t	headerSize = sizeof(CacheHeader);
+	uint64_t	fileSize = 0;
+	uint64_t	contentHash = 0;						// of the model the BVH was built from
+	uint32_t	vertexCount = 0;
+	uint32_t	triangleCount = 0;
+	uint32_t	nodeSize = sizeof(BVHNode);
+	uint32_t	node8Size = sizeof(BVH8Node);
+	uint64_t	offsets[SectionCount];
+	uint64_t	counts[SectionCount];
+	uint64_t	headerHash = 0;							// of all the bytes above
+};
+
+/**
+* Mix a 64-bit word into a hash.
+*/
+inline uint64_t Mix(uint64_t hash, uint64_t word)
+{
+	word *= 0x87C37B91114253D5ull;
+	word = (word << 31) | (word >> 33);
+	hash ^= word * 0x4CF5AD432745937Full;
+	hash = (hash << 27) | (hash >> 37);
+	return hash * 5 + 0x52DCE729;
+}
+
+/**
+* Hash a block of memory.
+*/
+uint64_t Hash_Bytes(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t hash = seed ^ (size * 0x9E3779B97F4A7C15ull);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = Mix(hash, word);
+	}
+
+	uint64_t tail = 0;
+	if (i < size) memcpy(&tail, bytes + i, size - i);
+	return Mix(hash, tail);
+}
+
+/**
+* Hash a large block of memory in parallel. The result depends only on the data, not on the thread count.
+*/
+uint64_t Hash_Bytes_Parallel(const void* data, size_t size, uint64_t seed, unsigned threadCount)
+{
+	size_t chunkCount = (size + HashChunkSize - 1) / HashChunkSize;
+	vector<uint64_t> chunkHashes(chunkCount);
+	Utils::ParallelFor(chunkCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			size_t offset = i * HashChunkSize;
+			chunkHashes[i] = Hash_Bytes(static_cast<const uint8_t*>(data) + offset, min(HashChunkSize, size - offset), seed);
+		}
+	});
+	return Hash_Bytes(chunkHashes.data(), chunkHashes.size() * sizeof(uint64_t), seed);
+}
+
+/**
+* Hash the geometry of a model: its vertices and indices. A cached BVH is only used for a model with the same hash.
+*/
+uint64_t Get_Content_Hash(const Model &model, unsigned threadCount)
+{
+	uint64_t hash = Hash_Bytes_Parallel(model.vertices.data(), model.vertices.size() * sizeof(Vertex), 0, threadCount);
+	return Hash_Bytes_Parallel(model.indices.data(), model.indices.size() * sizeof(uint32_t), hash, threadCount);
+}
+
+/**
+* Round an offset up to the section alignment.
+*/
+inline uint64_t Align(uint64_t offset)
+{
+	return (offset + CacheAlignment - 1) & ~(CacheAlignment - 1);
+}
+
+/**
+* Write a BVH, and its 8-wide version if there is one, to a cache file for the model it was built from.
+*/
+bool Save_Cache(const string &path, const Model &model, const BVHTree &bvh, const BVH8Tree &bvh8, unsigned threadCount)
+{
+	CacheHeader header;
+	memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+	header.contentHash = Get_Content_Hash(model, threadCount);
+	header.vertexCount = static_cast<uint32_t>(model.vertices.size());
+	header.triangleCount = static_cast<uint32_t>(model.indices.size() / 3);
+
+	const void* data[SectionCount] = { bvh.nodes.data(), bvh.triangles.data(), bvh8.nodes.data() };
+	uint64_t sizes[SectionCount] = { sizeof(BVHNode), sizeof(uint32_t), sizeof(BVH8Node) };
+	header.counts[SectionNodes] = bvh.nodes.size();
+	header.counts[SectionTriangles] = bvh.triangles.size();
+	header.counts[SectionNodes8] = bvh8.nodes.size();
+
+	uint64_t offset = Align(sizeof(CacheHeader));
+	for (int section = 0; section < SectionCount; section++)
+	{
+		header.offsets[section] = offset;
+		offset = Align(offset + header.counts[section] * sizes[section]);
+	}
+	header.fileSize = offset;
+	header.headerHash = Hash_Bytes(&header, offsetof(CacheHeader, headerHash), 0);
+
+	ofstream file(path, ios::binary | ios::trunc);
+	if (!file.is_open()) return false;
+
+	const char padding[CacheAlignment] = {};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	uint64_t written = sizeof(header);
+	for (int section = 0; section < SectionCount; section++)
+	{
+		file.write(padding, header.offsets[section] - written);
+		file.write(static_cast<const char*>(data[section]), header.counts[section] * sizes[section]);
+		written = header.offsets[section] + header.counts[section] * sizes[section];
+	}
+	file.write(padding, header.fileSize - written);
+	return file.good();
+}
+
+/**
+* Check that the nodes of a cached BVH only reference nodes after themselves and triangles in range, so traversal
+* cannot loop or read out of bounds even if the file is corrupt.
+*/
+bool Validate_Cache(const CacheHeader &header, const BVHNode* nodes, const uint32_t* triangles, const BVH8Node* nodes8, unsigned threadCount)
+{
+	uint64_t nodeCount = header.counts[SectionNodes];
+	uint64_t triangleIndexCount = header.counts[SectionTriangles];
+	uint64_t node8Count = header.counts[SectionNodes8];
+	if (triangleIndexCount != header.triangleCount) return false;
+	if ((nodeCount == 0) != (header.triangleCount == 0)) return false;
+
+	atomic<bool> valid{ true };
+	Utils::ParallelFor(nodeCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end && valid; i++)
+		{
+			const BVHNode &node = nodes[i];
+			bool ok = (node.count > 0) ? (static_cast<uint64_t>(node.leftFirst) + node.count <= triangleIndexCount) : (node.leftFirst > i && static_cast<uint64_t>(node.leftFirst) + 1 < nodeCount);
+			if (!ok) valid = false;
+		}
+	});
+
+	Utils::ParallelFor(triangleIndexCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end && valid; i++)
+		{
+			if (triangles[i] >= header.triangleCount) valid = false;
+		}
+	});
+
+	Utils::ParallelFor(node8Count, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end && valid; i++)
+		{
+			const BVH8Node &node = nodes8[i];
+			bool ok = (node.childCount <= 8);
+			for (uint32_t c = 0; c < node.childCount && ok; c++)
+			{
+				ok = (node.counts[c] > 0) ? (static_cast<uint64_t>(node.children[c]) + node.counts[c] <= triangleIndexCount) : (node.children[c] > i && node.children[c] < node8Count);
+			}
+			if (!ok) valid = false;
+		}
+	});
+	return valid;
+}
+
+/**
+* Load a BVH from a cache file written by Save_Cache. The file is memory mapped, and the trees use its sections in place
+* and keep it mapped until they are destroyed or rebuilt, so the file must not be rewritten while they are in use.
+* Returns false, leaving the trees empty, if the file is missing, was written by another version, was built from different
+* geometry, or fails validation. The 8-wide BVH is empty if the file has none.
+*/
+bool Load_Cache(const string &path, const Model &model, BVHTree &bvh, BVH8Tree &bvh8, unsigned threadCount)
+{
+	bvh = BVHTree();
+	bvh8 = BVH8Tree();
+
+	MappedFile file;
+	if (!Platform::MapFile(path, file)) return false;
+
+	bool loaded = false;
+	uint8_t* view = file.data;
+	if (file.size >= sizeof(CacheHeader))
+	{
+		CacheHeader header;
+		memcpy(&header, view, sizeof(header));
+
+		uint64_t sizes[SectionCount] = { sizeof(BVHNode), sizeof(uint32_t), sizeof(BVH8Node) };
+		bool valid = (memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) == 0) && header.version == CacheVersion &&
+			header.headerSize == sizeof(CacheHeader) && header.nodeSize == sizeof(BVHNode) && header.node8Size == sizeof(BVH8Node) &&
+			header.fileSize == file.size && header.headerHash == Hash_Bytes(&header, offsetof(CacheHeader, headerHash), 0);
+		for (int section = 0; section < SectionCount && valid; section++)
+		{
+			valid = (header.offsets[section] % CacheAlignment == 0) && header.offsets[section] <= header.fileSize &&
+				header.counts[section] <= (header.fileSize - header.offsets[section]) / sizes[section];
+		}
+
+		// Hash the model last, it is the most expensive check
+		valid = valid && header.vertexCount == model.vertices.size() && header.triangleCount == model.indices.size() / 3;
+		valid = valid && header.contentHash == Get_Content_Hash(model, threadCount);
+
+		BVHNode* nodes = reinterpret_cast<BVHNode*>(view + header.offsets[SectionNodes]);
+		uint32_t* triangles = reinterpret_cast<uint32_t*>(view + header.offsets[SectionTriangles]);
+		BVH8Node* nodes8 = reinterpret_cast<BVH8Node*>(view + header.offsets[SectionNodes8]);
+		if (valid && Validate_Cache(header, nodes, triangles, nodes8, threadCount))
+		{
+			// The trees share the mapping, the last one to let go of it unmaps the file
+			shared_ptr<void> mapping(new MappedFile(file), [](MappedFile* mapped)
+			{
+				Platform::UnmapFile(*mapped);
+				delete mapped;
+			});
+			bvh.nodes.View(nodes, header.counts[SectionNodes], mapping);
+			bvh.triangles.View(triangles, header.counts[SectionTriangles], mapping);
+			if (header.counts[SectionNodes8] > 0)
+			{
+				bvh8.nodes.View(nodes8, header.counts[SectionNodes8], mapping);
+				bvh8.triangles.View(triangles, header.counts[SectionTriangles], mapping);
+			}
+			loaded = true;
+		}
+	}
+
+	if (!loaded) Platform::UnmapFile(file);
+	return loaded;
+}
+
+}
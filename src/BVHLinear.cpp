@@ -0,0 +1,405 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CPU.h"
+#include "Platform.h"
+#include "Utils.h"
+
+#include <atomic>
+#include <cfloat>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Linear Bounding Volume Hierarchy Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+static const uint32_t LinearLeafSize = 4;				// subtrees over this many triangles or fewer become leaves
+static const uint32_t WideCodeThreshold = 1 << 20;		// meshes with more triangles than this get 63-bit Morton codes
+static const uint32_t RadixBits = 8;
+static const uint32_t RadixSize = 1 << RadixBits;
+static const uint32_t SortBlockSize = 16384;			// keys per block of the parallel radix sort
+static const uint32_t LeafFlag = 0x80000000;			// marks a leaf (a sorted triangle) in a child reference
+
+inline float Min(float a, float b) { return (a < b) ? a : b; }
+inline float Max(float a, float b) { return (a > b) ? a : b; }
+
+/**
+* Get the position of a triangle's vertex.
+*/
+inline const XMFLOAT3& Get_Position(const Model &model, uint32_t triangleIndex, uint32_t vertex)
+{
+	return model.vertices[model.indices[triangleIndex * 3 + vertex]].position;
+}
+
+/**
+* Get the bounds of a triangle as a leaf node.
+*/
+inline BVHNode Get_Triangle_Bounds(const Model &model, uint32_t triangleIndex)
+{
+	const XMFLOAT3 &a = Get_Position(model, triangleIndex, 0);
+	const XMFLOAT3 &b = Get_Position(model, triangleIndex, 1);
+	const XMFLOAT3 &c = Get_Position(model, triangleIndex, 2);
+
+	BVHNode node;
+	node.boundsMin = XMFLOAT3(Min(Min(a.x, b.x), c.x), Min(Min(a.y, b.y), c.y), Min(Min(a.z, b.z), c.z));
+	node.boundsMax = XMFLOAT3(Max(Max(a.x, b.x), c.x), Max(Max(a.y, b.y), c.y), Max(Max(a.z, b.z), c.z));
+	return node;
+}
+
+/**
+* Grow the bounds of a node by the bounds of another.
+*/
+inline void Grow(BVHNode &node, const BVHNode &other)
+{
+	node.boundsMin = XMFLOAT3(Min(node.boundsMin.x, other.boundsMin.x), Min(node.boundsMin.y, other.boundsMin.y), Min(node.boundsMin.z, other.boundsMin.z));
+	node.boundsMax = XMFLOAT3(Max(node.boundsMax.x, other.boundsMax.x), Max(node.boundsMax.y, other.boundsMax.y), Max(node.boundsMax.z, other.boundsMax.z));
+}
+
+/**
+* Spread the low 10 bits of a value to every third bit, for 30-bit Morton codes.
+*/
+inline uint64_t Spread_Bits_10(uint64_t v)
+{
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+/**
+* Spread the low 21 bits of a value to every third bit, for 63-bit Morton codes.
+*/
+inline uint64_t Spread_Bits_21(uint64_t v)
+{
+	v &= 0x1FFFFF;
+	v = (v | (v << 32)) & 0x001F00000000FFFFull;
+	v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+	v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+	v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+	v = (v | (v << 2)) & 0x1249249249249249ull;
+	return v;
+}
+
+/**
+* Count the leading zero bits of a 64-bit value.
+*/
+inline int Leading_Zeros(uint64_t v)
+{
+	return Platform::LeadingZeros64(v);
+}
+
+/**
+* Sort key and value pairs by the low bits of the keys with a parallel least significant digit radix sort.
+* The keys are split into blocks, and each pass counts the digits of every block, then scatters each block to its place
+* in parallel. Passes where all keys share the same digit are skipped.
+*/
+void Radix_Sort(vector<uint64_t> &keys, vector<uint32_t> &values, uint32_t keyBits, unsigned threadCount)
+{
+	size_t count = keys.size();
+	size_t blockCount = (count + SortBlockSize - 1) / SortBlockSize;
+	vector<uint64_t> keysOut(count);
+	vector<uint32_t> valuesOut(count);
+	vector<uint32_t> histograms(blockCount * RadixSize);
+
+	for (uint32_t shift = 0; shift < keyBits; shift += RadixBits)
+	{
+		Utils::ParallelFor(blockCount, threadCount, [&](size_t begin, size_t end)
+		{
+			for (size_t block = begin; block < end; block++)
+			{
+				uint32_t* histogram = &histograms[block * RadixSize];
+				memset(histogram, 0, RadixSize * sizeof(uint32_t));
+				size_t last = min((block + 1) * SortBlockSize, count);
+				for (size_t i = block * SortBlockSize; i < last; i++) histogram[(keys[i] >> shift) & (RadixSize - 1)]++;
+			}
+		});
+
+		// Turn the counts into the first output position of each digit of each block: digits in order, blocks in order within a digit
+		uint32_t offset = 0;
+		bool single = false;
+		for (uint32_t digit = 0; digit < RadixSize; digit++)
+		{
+			uint32_t digitCount = 0;
+			for (size_t block = 0; block < blockCount; block++)
+			{
+				uint32_t blockDigits = histograms[block * RadixSize + digit];
+				histograms[block * RadixSize + digit] = offset + digitCount;
+				digitCount += blockDigits;
+			}
+			if (digitCount == count) single = true;
+			offset += digitCount;
+		}
+		if (single) continue;
+
+		Utils::ParallelFor(blockCount, threadCount, [&](size_t begin, size_t end)
+		{
+			for (size_t block = begin; block < end; block++)
+			{
+				uint32_t* positions = &histograms[block * RadixSize];
+				size_t last = min((block + 1) * SortBlockSize, count);
+				for (size_t i = block * SortBlockSize; i < last; i++)
+				{
+					uint32_t position = positions[(keys[i] >> shift) & (RadixSize - 1)]++;
+					keysOut[position] = keys[i];
+					valuesOut[position] = values[i];
+				}
+			}
+		});
+		keys.swap(keysOut);
+		values.swap(valuesOut);
+	}
+}
+
+/**
+* The length of the common prefix of the sorted keys at two positions, with the positions appended to the keys so every key is unique.
+* -1 if j is out of range.
+*/
+inline int Common_Prefix(const vector<uint64_t> &keys, int64_t i, int64_t j)
+{
+	if (j < 0 || j >= static_cast<int64_t>(keys.size())) return -1;
+	uint64_t a = keys[static_cast<size_t>(i)], b = keys[static_cast<size_t>(j)];
+	if (a == b) return 64 + Leading_Zeros(static_cast<uint64_t>(i ^ j));
+	return Leading_Zeros(a ^ b);
+}
+
+/**
+* Build a binary BVH with the linear BVH algorithm: sort the triangles along a Morton curve through their centroids,
+* then emit the hierarchy of the curve's binary radix tree (Karras 2012), where every internal node is found independently.
+* Much faster to build than the binned SAH builder, at some cost in trace speed. Small subtrees are collapsed into leaves.
+* The codes have 30 or 63 bits, or 0 picks 63 bits for meshes large enough that 30-bit codes would often collide.
+*/
+void Build_Linear(BVHTree &bvh, const Model &model, uint32_t mortonBits, unsigned threadCount)
+{
+	uint32_t triangleCount = static_cast<uint32_t>(model.indices.size() / 3);
+	bvh.nodes.clear();
+	bvh.triangles.clear();
+	if (triangleCount == 0) return;
+	if (mortonBits == 0) mortonBits = (triangleCount > WideCodeThreshold) ? 63 : 30;
+	threadCount = Utils::GetThreadCount(threadCount);
+
+	// Bounds of the triangles, and of their centroids
+	vector<BVHNode> triangleBounds(triangleCount);
+	XMFLOAT3 centroidMin(FLT_MAX, FLT_MAX, FLT_MAX), centroidMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	mutex boundsLock;
+	Utils::ParallelFor(triangleCount, threadCount, [&](size_t begin, size_t end)
+	{
+		XMFLOAT3 localMin(FLT_MAX, FLT_MAX, FLT_MAX), localMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (size_t i = begin; i < end; i++)
+		{
+			BVHNode &bounds = triangleBounds[i];
+			bounds = Get_Triangle_Bounds(model, static_cast<uint32_t>(i));
+			XMFLOAT3 c((bounds.boundsMin.x + bounds.boundsMax.x) * 0.5f, (bounds.boundsMin.y + bounds.boundsMax.y) * 0.5f, (bounds.boundsMin.z + bounds.boundsMax.z) * 0.5f);
+			localMin = XMFLOAT3(Min(localMin.x, c.x), Min(localMin.y, c.y), Min(localMin.z, c.z));
+			localMax = XMFLOAT3(Max(localMax.x, c.x), Max(localMax.y, c.y), Max(localMax.z, c.z));
+		}
+
+		lock_guard<mutex> guard(boundsLock);
+		centroidMin = XMFLOAT3(Min(centroidMin.x, localMin.x), Min(centroidMin.y, localMin.y), Min(centroidMin.z, localMin.z));
+		centroidMax = XMFLOAT3(Max(centroidMax.x, localMax.x), Max(centroidMax.y, localMax.y), Max(centroidMax.z, localMax.z));
+	});
+
+	// Morton codes of the centroids, quantized to the centroid bounds
+	bool wide = (mortonBits > 30);
+	float cells = wide ? 2097151.f : 1023.f;
+	XMFLOAT3 scale(
+		(centroidMax.x > centroidMin.x) ? cells / (centroidMax.x - centroidMin.x) : 0.f,
+		(centroidMax.y > centroidMin.y) ? cells / (centroidMax.y - centroidMin.y) : 0.f,
+		(centroidMax.z > centroidMin.z) ? cells / (centroidMax.z - centroidMin.z) : 0.f);
+
+	vector<uint64_t> keys(triangleCount);
+	vector<uint32_t> order(triangleCount);
+	Utils::ParallelFor(triangleCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const BVHNode &bounds = triangleBounds[i];
+			uint64_t x = static_cast<uint64_t>(((bounds.boundsMin.x + bounds.boundsMax.x) * 0.5f - centroidMin.x) * scale.x);
+			uint64_t y = static_cast<uint64_t>(((bounds.boundsMin.y + bounds.boundsMax.y) * 0.5f - centroidMin.y) * scale.y);
+			uint64_t z = static_cast<uint64_t>(((bounds.boundsMin.z + bounds.boundsMax.z) * 0.5f - centroidMin.z) * scale.z);
+			keys[i] = wide ? (Spread_Bits_21(x) << 2) | (Spread_Bits_21(y) << 1) | Spread_Bits_21(z) : (Spread_Bits_10(x) << 2) | (Spread_Bits_10(y) << 1) | Spread_Bits_10(z);
+			order[i] = static_cast<uint32_t>(i);
+		}
+	});
+
+	Radix_Sort(keys, order, wide ? 63 : 30, threadCount);
+
+	bvh.triangles = order;
+	if (triangleCount == 1)
+	{
+		bvh.nodes.push_back(triangleBounds[0]);
+		bvh.nodes[0].leftFirst = 0;
+		bvh.nodes[0].count = 1;
+		return;
+	}
+
+	// Find the range and split of every internal node of the radix tree. Internal node i covers sorted triangles [first, last],
+	// its children are internal nodes or leaves (sorted triangles, marked with LeafFlag).
+	uint32_t internalCount = triangleCount - 1;
+	vector<uint32_t> first(internalCount), last(internalCount), left(internalCount), right(internalCount);
+	vector<uint32_t> internalParents(internalCount), leafParents(triangleCount);
+	internalParents[0] = UINT32_MAX;
+	Utils::ParallelFor(internalCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t index = begin; index < end; index++)
+		{
+			int64_t i = static_cast<int64_t>(index);
+			int direction = (Common_Prefix(keys, i, i + 1) > Common_Prefix(keys, i, i - 1)) ? 1 : -1;
+
+			// Find the other end of the range: double the length while the prefix stays longer than with the neighbor outside the range,
+			// then binary search for it
+			int minPrefix = Common_Prefix(keys, i, i - direction);
+			int64_t maxLength = 2;
+			while (Common_Prefix(keys, i, i + maxLength * direction) > minPrefix) maxLength *= 2;
+			int64_t length = 0;
+			for (int64_t step = maxLength / 2; step >= 1; step /= 2)
+			{
+				if (Common_Prefix(keys, i, i + (length + step) * direction) > minPrefix) length += step;
+			}
+			int64_t j = i + length * direction;
+
+			// Find the split: the last position that still shares more than the node's common prefix with i
+			int nodePrefix = Common_Prefix(keys, i, j);
+			int64_t split = 0;
+			int64_t step = length;
+			do
+			{
+				step = (step + 1) / 2;
+				if (Common_Prefix(keys, i, i + (split + step) * direction) > nodePrefix) split += step;
+			} while (step > 1);
+			int64_t splitPosition = i + split * direction + min(direction, 0);
+
+			uint32_t rangeFirst = static_cast<uint32_t>(min(i, j));
+			uint32_t rangeLast = static_cast<uint32_t>(max(i, j));
+			uint32_t splitIndex = static_cast<uint32_t>(splitPosition);
+			first[index] = rangeFirst;
+			last[index] = rangeLast;
+			left[index] = (rangeFirst == splitIndex) ? (splitIndex | LeafFlag) : splitIndex;
+			right[index] = (rangeLast == splitIndex + 1) ? ((splitIndex + 1) | LeafFlag) : (splitIndex + 1);
+
+			if (left[index] & LeafFlag) leafParents[splitIndex] = static_cast<uint32_t>(index);
+			else internalParents[splitIndex] = static_cast<uint32_t>(index);
+			if (right[index] & LeafFlag) leafParents[splitIndex + 1] = static_cast<uint32_t>(index);
+			else internalParents[splitIndex + 1] = static_cast<uint32_t>(index);
+		}
+	});
+
+	// Compute the bounds of every node bottom up. The second child to finish computes its parent's bounds, and how many
+	// output nodes the parent's subtree will have once small subtrees are collapsed into leaves.
+	vector<BVHNode> internals(internalCount);
+	vector<uint32_t> outputCounts(internalCount);
+	unique_ptr<atomic<uint32_t>[]> arrivals(new atomic<uint32_t>[internalCount]);
+	Utils::ParallelFor(internalCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++) arrivals[i] = 0;
+	});
+
+	auto getNode = [&](uint32_t child) -> const BVHNode& { return (child & LeafFlag) ? triangleBounds[order[child & ~LeafFlag]] : internals[child]; };
+	auto getOutputCount = [&](uint32_t child) { return (child & LeafFlag) ? 1u : outputCounts[child]; };
+	Utils::ParallelFor(triangleCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; k++)
+		{
+			uint32_t index = leafParents[k];
+			while (index != UINT32_MAX && arrivals[index].fetch_add(1) == 1)
+			{
+				BVHNode &node = internals[index];
+				node = getNode(left[index]);
+				Grow(node, getNode(right[index]));
+				outputCounts[index] = (last[index] - first[index] + 1 <= LinearLeafSize) ? 1 : 1 + getOutputCount(left[index]) + getOutputCount(right[index]);
+				index = internalParents[index];
+			}
+		}
+	});
+
+	// Emit the nodes depth first, each pair of children followed by the left child's subtree, then the right child's.
+	// The top of the tree is cut into subtrees serially, then the subtrees are emitted in parallel.
+	struct EmitTask
+	{
+		uint32_t node;				// a radix tree node
+		uint32_t position;			// where it goes in the output
+		uint32_t firstChild;		// where its children go, if it has any
+	};
+
+	auto emit = [&](const EmitTask &task, vector<EmitTask> &children)
+	{
+		BVHNode &out = bvh.nodes[task.position];
+		out = getNode(task.node);
+		if (task.node & LeafFlag)
+		{
+			out.leftFirst = task.node & ~LeafFlag;
+			out.count = 1;
+		}
+		else if (outputCounts[task.node] == 1)
+		{
+			out.leftFirst = first[task.node];
+			out.count = last[task.node] - first[task.node] + 1;
+		}
+		else
+		{
+			out.leftFirst = task.firstChild;
+			out.count = 0;
+			uint32_t l = left[task.node], r = right[task.node];
+			children.push_back({ l, task.firstChild, task.firstChild + 2 });
+			children.push_back({ r, task.firstChild + 1, task.firstChild + 2 + getOutputCount(l) - 1 });
+		}
+	};
+
+	bvh.nodes.resize(outputCounts[0]);
+	uint32_t subtreeSize = max(outputCounts[0] / (threadCount * 16), 1024u);
+	vector<EmitTask> pending(1, EmitTask{ 0, 0, 1 }), subtrees;
+	while (!pending.empty())
+	{
+		EmitTask task = pending.back();
+		pending.pop_back();
+		if (getOutputCount(task.node) <= subtreeSize) subtrees.push_back(task);
+		else emit(task, pending);
+	}
+
+	Utils::ParallelForWorkStealing(subtrees.size(), threadCount, [&](size_t index)
+	{
+		vector<EmitTask> stack(1, subtrees[index]);
+		while (!stack.empty())
+		{
+			EmitTask task = stack.back();
+			stack.pop_back();
+			emit(task, stack);
+		}
+	});
+}
+
+}
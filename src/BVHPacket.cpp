@@ -0,0 +1,317 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CPU.h"
+
+#include <cfloat>
+#include <cmath>
+#include <xmmintrin.h>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Ray Packet Traversal Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+static const uint32_t MaxPacketStackDepth = 128;		// traversal stack entries before spilling to the heap
+
+/**
+* A packet of up to 16 rays in structure of arrays layout, as groups of four SSE lanes.
+*/
+template<int Groups>
+struct RayPacket
+{
+	__m128 origin[3][Groups];
+	__m128 invDirectionX[Groups], invDirectionY[Groups], invDirectionZ[Groups];
+	__m128 shearX[Groups], shearY[Groups], shearZ[Groups];
+	int kx, ky, kz;								// the watertight test's axes, shared by all rays of a packet
+	__m128 tMin[Groups];
+	alignas(16) float t[Groups * 4];			// closest hit so far, per ray
+};
+
+inline int Count_Bits(uint32_t mask)
+{
+	int count = 0;
+	for (; mask != 0; mask &= mask - 1) count++;
+	return count;
+}
+
+/**
+* Test the rays of a packet against a box. Returns the lanes that hit, out of the active lanes.
+* Uses the same operations as Intersect_Box, so packets and single rays make the same decisions.
+*/
+template<int Groups>
+uint32_t Intersect_Box(const BVHNode &node, const RayPacket<Groups> &packet, uint32_t active)
+{
+	__m128 minX = _mm_set1_ps(node.boundsMin.x), maxX = _mm_set1_ps(node.boundsMax.x);
+	__m128 minY = _mm_set1_ps(node.boundsMin.y), maxY = _mm_set1_ps(node.boundsMax.y);
+	__m128 minZ = _mm_set1_ps(node.boundsMin.z), maxZ = _mm_set1_ps(node.boundsMax.z);
+
+	uint32_t mask = 0;
+	for (int g = 0; g < Groups; g++)
+	{
+		if (((active >> (g * 4)) & 0xF) == 0) continue;
+
+		__m128 tx1 = _mm_mul_ps(_mm_sub_ps(minX, packet.origin[0][g]), packet.invDirectionX[g]);
+		__m128 tx2 = _mm_mul_ps(_mm_sub_ps(maxX, packet.origin[0][g]), packet.invDirectionX[g]);
+		__m128 tNear = _mm_min_ps(tx1, tx2), tFar = _mm_max_ps(tx1, tx2);
+		__m128 ty1 = _mm_mul_ps(_mm_sub_ps(minY, packet.origin[1][g]), packet.invDirectionY[g]);
+		__m128 ty2 = _mm_mul_ps(_mm_sub_ps(maxY, packet.origin[1][g]), packet.invDirectionY[g]);
+		tNear = _mm_max_ps(tNear, _mm_min_ps(ty1, ty2)); tFar = _mm_min_ps(tFar, _mm_max_ps(ty1, ty2));
+		__m128 tz1 = _mm_mul_ps(_mm_sub_ps(minZ, packet.origin[2][g]), packet.invDirectionZ[g]);
+		__m128 tz2 = _mm_mul_ps(_mm_sub_ps(maxZ, packet.origin[2][g]), packet.invDirectionZ[g]);
+		tNear = _mm_max_ps(tNear, _mm_min_ps(tz1, tz2)); tFar = _mm_min_ps(tFar, _mm_max_ps(tz1, tz2));
+		tNear = _mm_max_ps(tNear, packet.tMin[g]);
+		tFar = _mm_min_ps(tFar, _mm_load_ps(&packet.t[g * 4]));
+		mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) << (g * 4);
+	}
+	return mask & active;
+}
+
+/**
+* Test the rays of a packet against one triangle, updating the lanes that find a closer hit.
+* Uses the same operations as the watertight Intersect_Triangle, so packets and single rays find the same hits.
+*/
+template<int Groups>
+void Intersect_Triangle(const Model &model, uint32_t triangleIndex, RayPacket<Groups> &packet, CPUHit* hits, uint32_t active)
+{
+	const XMFLOAT3 &v0 = model.vertices[model.indices[triangleIndex * 3 + 0]].position;
+	const XMFLOAT3 &v1 = model.vertices[model.indices[triangleIndex * 3 + 1]].position;
+	const XMFLOAT3 &v2 = model.vertices[model.indices[triangleIndex * 3 + 2]].position;
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const int axes[3] = { packet.kx, packet.ky, packet.kz };
+
+	for (int g = 0; g < Groups; g++)
+	{
+		uint32_t groupActive = (active >> (g * 4)) & 0xF;
+		if (groupActive == 0) continue;
+
+		// Vertices relative to the ray origins, in the permuted axes, sheared so the rays run along the kz axis
+		__m128 a[3], b[3], c[3];
+		for (int k = 0; k < 3; k++)
+		{
+			a[k] = _mm_sub_ps(_mm_set1_ps((&v0.x)[axes[k]]), packet.origin[axes[k]][g]);
+			b[k] = _mm_sub_ps(_mm_set1_ps((&v1.x)[axes[k]]), packet.origin[axes[k]][g]);
+			c[k] = _mm_sub_ps(_mm_set1_ps((&v2.x)[axes[k]]), packet.origin[axes[k]][g]);
+		}
+		__m128 ax = _mm_sub_ps(a[0], _mm_mul_ps(packet.shearX[g], a[2])), ay = _mm_sub_ps(a[1], _mm_mul_ps(packet.shearY[g], a[2]));
+		__m128 bx = _mm_sub_ps(b[0], _mm_mul_ps(packet.shearX[g], b[2])), by = _mm_sub_ps(b[1], _mm_mul_ps(packet.shearY[g], b[2]));
+		__m128 cx = _mm_sub_ps(c[0], _mm_mul_ps(packet.shearX[g], c[2])), cy = _mm_sub_ps(c[1], _mm_mul_ps(packet.shearY[g], c[2]));
+
+		__m128 u = _mm_sub_ps(_mm_mul_ps(cx, by), _mm_mul_ps(cy, bx));
+		__m128 v = _mm_sub_ps(_mm_mul_ps(ax, cy), _mm_mul_ps(ay, cx));
+		__m128 w = _mm_sub_ps(_mm_mul_ps(bx, ay), _mm_mul_ps(by, ax));
+
+		uint32_t onEdge = static_cast<uint32_t>(_mm_movemask_ps(_mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(u, zero), _mm_cmpeq_ps(v, zero)), _mm_cmpeq_ps(w, zero)))) & groupActive;
+		if (onEdge != 0)
+		{
+			// Rare: redo the edge functions of these lanes in double precision
+			alignas(16) float lanes[9][4];
+			_mm_store_ps(lanes[0], ax); _mm_store_ps(lanes[1], ay); _mm_store_ps(lanes[2], bx); _mm_store_ps(lanes[3], by);
+			_mm_store_ps(lanes[4], cx); _mm_store_ps(lanes[5], cy); _mm_store_ps(lanes[6], u); _mm_store_ps(lanes[7], v); _mm_store_ps(lanes[8], w);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (!(onEdge & (1u << lane))) continue;
+				lanes[6][lane] = static_cast<float>(static_cast<double>(lanes[4][lane]) * lanes[3][lane] - static_cast<double>(lanes[5][lane]) * lanes[2][lane]);
+				lanes[7][lane] = static_cast<float>(static_cast<double>(lanes[0][lane]) * lanes[5][lane] - static_cast<double>(lanes[1][lane]) * lanes[4][lane]);
+				lanes[8][lane] = static_cast<float>(static_cast<double>(lanes[2][lane]) * lanes[1][lane] - static_cast<double>(lanes[3][lane]) * lanes[0][lane]);
+			}
+			u = _mm_load_ps(lanes[6]); v = _mm_load_ps(lanes[7]); w = _mm_load_ps(lanes[8]);
+		}
+
+		__m128 negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmplt_ps(v, zero)), _mm_cmplt_ps(w, zero));
+		__m128 positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(u, zero), _mm_cmpgt_ps(v, zero)), _mm_cmpgt_ps(w, zero));
+		__m128 det = _mm_add_ps(_mm_add_ps(u, v), w);
+		__m128 mask = _mm_andnot_ps(_mm_or_ps(_mm_and_ps(negative, positive), _mm_cmpeq_ps(det, zero)), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+		__m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(u, _mm_mul_ps(packet.shearZ[g], a[2])), _mm_mul_ps(v, _mm_mul_ps(packet.shearZ[g], b[2]))), _mm_mul_ps(w, _mm_mul_ps(packet.shearZ[g], c[2])));
+		__m128 invDet = _mm_div_ps(one, det);
+		t = _mm_mul_ps(t, invDet);
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t, packet.tMin[g]), _mm_cmplt_ps(t, _mm_load_ps(&packet.t[g * 4]))));
+
+		uint32_t laneMask = static_cast<uint32_t>(_mm_movemask_ps(mask)) & groupActive;
+		if (laneMask == 0) continue;
+
+		alignas(16) float tLanes[4], uLanes[4], vLanes[4];
+		_mm_store_ps(tLanes, t);
+		_mm_store_ps(uLanes, _mm_mul_ps(v, invDet));
+		_mm_store_ps(vLanes, _mm_mul_ps(w, invDet));
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if (!(laneMask & (1u << lane))) continue;
+			CPUHit &hit = hits[g * 4 + lane];
+			hit.t = packet.t[g * 4 + lane] = tLanes[lane];
+			hit.uv = XMFLOAT2(uLanes[lane], vLanes[lane]);
+			hit.triangleIndex = triangleIndex;
+		}
+	}
+}
+
+/**
+* Trace a packet of rays through the BVH, testing all rays of the packet against each visited node.
+* Nodes that only a few rays of the packet still reach are finished with single ray traversal.
+*/
+template<int Groups>
+void Intersect_Packet(const BVHTree &bvh, const Model &model, const CPURay* rays, CPUHit* hits, uint32_t rayCount)
+{
+	const int width = Groups * 4;
+	const int divergentCount = width / 4;		// at most this many active rays continue as single rays
+
+	RayPacket<Groups> packet;
+	WatertightRay watertight[width];
+	alignas(16) float lanes[10][width];
+	for (int i = 0; i < width; i++)
+	{
+		// Unused lanes repeat the first ray, and are never marked active
+		const CPURay &ray = rays[(static_cast<uint32_t>(i) < rayCount) ? i : 0];
+		watertight[i] = Get_Watertight_Ray(ray);
+		lanes[0][i] = ray.origin.x; lanes[1][i] = ray.origin.y; lanes[2][i] = ray.origin.z;
+		lanes[3][i] = watertight[i].shear.x; lanes[4][i] = watertight[i].shear.y; lanes[5][i] = watertight[i].shear.z;
+		lanes[6][i] = 1.f / ray.direction.x; lanes[7][i] = 1.f / ray.direction.y; lanes[8][i] = 1.f / ray.direction.z;
+		lanes[9][i] = ray.tMin;
+		packet.t[i] = ray.tMax;
+	}
+	packet.kx = watertight[0].kx;
+	packet.ky = watertight[0].ky;
+	packet.kz = watertight[0].kz;
+	for (int g = 0; g < Groups; g++)
+	{
+		packet.origin[0][g] = _mm_load_ps(&lanes[0][g * 4]);
+		packet.origin[1][g] = _mm_load_ps(&lanes[1][g * 4]);
+		packet.origin[2][g] = _mm_load_ps(&lanes[2][g * 4]);
+		packet.shearX[g] = _mm_load_ps(&lanes[3][g * 4]);
+		packet.shearY[g] = _mm_load_ps(&lanes[4][g * 4]);
+		packet.shearZ[g] = _mm_load_ps(&lanes[5][g * 4]);
+		packet.invDirectionX[g] = _mm_load_ps(&lanes[6][g * 4]);
+		packet.invDirectionY[g] = _mm_load_ps(&lanes[7][g * 4]);
+		packet.invDirectionZ[g] = _mm_load_ps(&lanes[8][g * 4]);
+		packet.tMin[g] = _mm_load_ps(&lanes[9][g * 4]);
+	}
+
+	for (uint32_t i = 0; i < rayCount; i++)
+	{
+		hits[i].t = rays[i].tMax;
+		hits[i].triangleIndex = UINT32_MAX;
+	}
+	if (bvh.nodes.empty()) return;
+
+	// Packets whose rays do not share direction signs and dominant axis are traced as single rays
+	uint32_t active = (rayCount >= 32) ? 0xFFFFFFFFu : ((1u << rayCount) - 1);
+	bool coherent = true;
+	for (uint32_t i = 1; i < rayCount; i++)
+	{
+		coherent &= ((rays[i].direction.x < 0.f) == (rays[0].direction.x < 0.f));
+		coherent &= ((rays[i].direction.y < 0.f) == (rays[0].direction.y < 0.f));
+		coherent &= ((rays[i].direction.z < 0.f) == (rays[0].direction.z < 0.f));
+		coherent &= (watertight[i].kx == packet.kx && watertight[i].ky == packet.ky && watertight[i].kz == packet.kz);
+	}
+	if (!coherent)
+	{
+		for (uint32_t i = 0; i < rayCount; i++) Intersect(bvh, model, rays[i], hits[i]);
+		return;
+	}
+
+	struct StackEntry
+	{
+		uint32_t nodeIndex;
+		uint32_t active;
+	};
+
+	CPUTraversalStack<StackEntry, MaxPacketStackDepth> stack;
+	StackEntry entry = { 0, active };
+	while (true)
+	{
+		const BVHNode &node = bvh.nodes[entry.nodeIndex];
+		uint32_t mask = Intersect_Box(node, packet, entry.active);
+		if (mask != 0)
+		{
+			if (node.count > 0)
+			{
+				for (uint32_t i = 0; i < node.count; i++)
+				{
+					Intersect_Triangle(model, bvh.triangles[node.leftFirst + i], packet, hits, mask);
+				}
+			}
+			else if (Count_Bits(mask) <= divergentCount)
+			{
+				for (uint32_t lanes = mask; lanes != 0; lanes &= lanes - 1)
+				{
+					uint32_t lane = 0;
+					while (!(lanes & (1u << lane))) lane++;
+					Intersect_Subtree(bvh, model, rays[lane], hits[lane], entry.nodeIndex);
+					packet.t[lane] = hits[lane].t;
+				}
+			}
+			else
+			{
+				// Visit first the child on the side the rays come from, along the axis that separates the children most
+				const BVHNode &left = bvh.nodes[node.leftFirst];
+				const BVHNode &right = bvh.nodes[node.leftFirst + 1];
+				float separation[3] =
+				{
+					(right.boundsMin.x + right.boundsMax.x) - (left.boundsMin.x + left.boundsMax.x),
+					(right.boundsMin.y + right.boundsMax.y) - (left.boundsMin.y + left.boundsMax.y),
+					(right.boundsMin.z + right.boundsMax.z) - (left.boundsMin.z + left.boundsMax.z)
+				};
+				int axis = (fabsf(separation[0]) > fabsf(separation[1])) ? 0 : 1;
+				if (fabsf(separation[2]) > fabsf(separation[axis])) axis = 2;
+				float direction = (&rays[0].direction.x)[axis];
+
+				uint32_t nearIndex = node.leftFirst;
+				uint32_t farIndex = node.leftFirst + 1;
+				if ((separation[axis] < 0.f) != (direction < 0.f)) swap(nearIndex, farIndex);
+
+				stack.Push({ farIndex, mask });
+				entry = { nearIndex, mask };
+				continue;
+			}
+		}
+
+		if (stack.size == 0) break;
+		entry = stack.Pop();
+	}
+}
+
+/**
+* Find the closest intersections of a packet of 4, 8 or 16 coherent rays, such as a tile of primary rays.
+* Fewer rays than the packet width may be passed to fill the edge tiles of an image.
+*/
+void Intersect_Packet(const BVHTree &bvh, const Model &model, const CPURay* rays, CPUHit* hits, uint32_t rayCount, uint32_t packetWidth)
+{
+	if (packetWidth <= 4) Intersect_Packet<1>(bvh, model, rays, hits, min(rayCount, 4u));
+	else if (packetWidth <= 8) Intersect_Packet<2>(bvh, model, rays, hits, min(rayCount, 8u));
+	else Intersect_Packet<4>(bvh, model, rays, hits, min(rayCount, 16u));
+}
+
+}
@@ -0,0 +1,632 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CPU.h"
+#include "Utils.h"
+
+#include <atomic>
+#include <cfloat>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Spatial Split Bounding Volume Hierarchy Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+static const uint32_t ObjectBinCount = 16;
+static const uint32_t SpatialBinCount = 32;
+static const uint32_t SpatialLeafSize = 8;				// larger nodes are always split
+static const uint32_t SpatialTaskThreshold = 1024;		// subtrees with at least this many references are handed to other threads
+
+static const float TraversalCost = 1.f;
+static const float IntersectionCost = 1.f;
+
+inline float Min(float a, float b) { return (a < b) ? a : b; }
+inline float Max(float a, float b) { return (a > b) ? a : b; }
+
+/**
+* Get a component of a float3 by axis index.
+*/
+inline float Axis(const XMFLOAT3 &v, int axis)
+{
+	return (&v.x)[axis];
+}
+
+struct SpatialBounds
+{
+	XMFLOAT3 min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	bool Valid() const
+	{
+		return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+	}
+
+	void Grow(const XMFLOAT3 &p)
+	{
+		min = XMFLOAT3(Min(min.x, p.x), Min(min.y, p.y), Min(min.z, p.z));
+		max = XMFLOAT3(Max(max.x, p.x), Max(max.y, p.y), Max(max.z, p.z));
+	}
+
+	void Grow(const SpatialBounds &b)
+	{
+		if (!b.Valid()) return;
+		min = XMFLOAT3(Min(min.x, b.min.x), Min(min.y, b.min.y), Min(min.z, b.min.z));
+		max = XMFLOAT3(Max(max.x, b.max.x), Max(max.y, b.max.y), Max(max.z, b.max.z));
+	}
+
+	void Clip(const SpatialBounds &b)
+	{
+		min = XMFLOAT3(Max(min.x, b.min.x), Max(min.y, b.min.y), Max(min.z, b.min.z));
+		max = XMFLOAT3(Min(max.x, b.max.x), Min(max.y, b.max.y), Min(max.z, b.max.z));
+	}
+
+	float Centroid(int axis) const
+	{
+		return (Axis(min, axis) + Axis(max, axis)) * 0.5f;
+	}
+
+	float Area() const
+	{
+		if (!Valid()) return 0.f;
+		float x = max.x - min.x, y = max.y - min.y, z = max.z - min.z;
+		return 2.f * (x * y + y * z + z * x);
+	}
+};
+
+struct SpatialReference
+{
+	SpatialBounds bounds;		// the part of the triangle this reference covers
+	uint32_t primitive;
+};
+
+struct SpatialBin
+{
+	SpatialBounds bounds;
+	uint32_t count = 0;			// centroids in the bin, for object splits
+	uint32_t entries = 0;		// references that start in the bin, for spatial splits
+	uint32_t exits = 0;			// references that end in the bin
+};
+
+struct SpatialTask
+{
+	uint32_t nodeIndex = 0;
+	vector<SpatialReference> references;
+};
+
+struct SpatialContext
+{
+	const Model*				model = nullptr;
+	BVHTree*					bvh = nullptr;
+	float						minOverlapArea = 0.f;		// spatial splits are only tried where object split children overlap by more than this
+	atomic<uint32_t>			duplicateBudget;			// references that spatial splits may still add
+	atomic<uint32_t>			nodeCount;
+	atomic<uint32_t>			referenceCount;				// references written to leaves
+	unsigned					threadCount = 1;
+
+	mutex						lock;
+	condition_variable			wake;
+	vector<SpatialTask>			tasks;
+	uint32_t					pending = 0;				// queued or running tasks
+};
+
+/**
+* Get the position of a triangle's vertex.
+*/
+inline const XMFLOAT3& Get_Position(const Model &model, uint32_t triangleIndex, uint32_t vertex)
+{
+	return model.vertices[model.indices[triangleIndex * 3 + vertex]].position;
+}
+
+/**
+* Map a coordinate to its bin along an axis.
+*/
+inline uint32_t Get_Bin(float value, float binMin, float binScale, uint32_t binCount)
+{
+	int bin = static_cast<int>((value - binMin) * binScale);
+	if (bin < 0) return 0;
+	return (bin < static_cast<int>(binCount)) ? static_cast<uint32_t>(bin) : (binCount - 1);
+}
+
+/**
+* Split the part of a triangle inside some bounds with an axis aligned plane, giving the bounds of the parts on each side.
+* A side the triangle does not reach gets invalid bounds.
+*/
+void Split_Reference(const Model &model, uint32_t triangleIndex, const SpatialBounds &bounds, int axis, float plane, SpatialBounds &left, SpatialBounds &right)
+{
+	left = SpatialBounds();
+	right = SpatialBounds();
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		const XMFLOAT3 &a = Get_Position(model, triangleIndex, i);
+		const XMFLOAT3 &b = Get_Position(model, triangleIndex, (i + 1) % 3);
+		float pa = Axis(a, axis), pb = Axis(b, axis);
+		if (pa <= plane) left.Grow(a);
+		if (pa >= plane) right.Grow(a);
+
+		// An edge that crosses the plane adds the crossing point to both sides
+		if ((pa < plane && pb > plane) || (pa > plane && pb < plane))
+		{
+			float t = (plane - pa) / (pb - pa);
+			XMFLOAT3 p(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t);
+			(&p.x)[axis] = plane;
+			left.Grow(p);
+			right.Grow(p);
+		}
+	}
+	left.Clip(bounds);
+	right.Clip(bounds);
+}
+
+/**
+* Take references from the duplicate budget. Fails, taking nothing, if the budget does not cover them.
+*/
+bool Reserve_Duplicates(SpatialContext &ctx, uint32_t count)
+{
+	uint32_t budget = ctx.duplicateBudget.load();
+	do
+	{
+		if (budget < count) return false;
+	} while (!ctx.duplicateBudget.compare_exchange_weak(budget, budget - count));
+	return true;
+}
+
+/**
+* Partition references around a spatial split plane. References that straddle the plane are split in two, unless keeping
+* them whole on one side is cheaper (reference unsplitting). Returns false, leaving the budget as it was, if the split would
+* not shrink both children or the duplicates it needs are over budget.
+*/
+bool Partition_Spatial(SpatialContext &ctx, const vector<SpatialReference> &references, const SpatialBounds &nodeBounds, int axis, uint32_t split,
+	vector<SpatialReference> &left, vector<SpatialReference> &right)
+{
+	float binMin = Axis(nodeBounds.min, axis);
+	float extent = Axis(nodeBounds.max, axis) - binMin;
+	float binScale = SpatialBinCount / extent;
+	float plane = binMin + split * (extent / SpatialBinCount);
+
+	// Sort the references that lie on one side, and split the rest to get the bounds of each child
+	SpatialBounds leftBounds, rightBounds;
+	vector<SpatialReference> straddling;
+	vector<SpatialBounds> pieces;
+	left.clear();
+	right.clear();
+	for (const SpatialReference &reference : references)
+	{
+		uint32_t first = Get_Bin(Axis(reference.bounds.min, axis), binMin, binScale, SpatialBinCount);
+		uint32_t last = Get_Bin(Axis(reference.bounds.max, axis), binMin, binScale, SpatialBinCount);
+		if (last < split)
+		{
+			left.push_back(reference);
+			leftBounds.Grow(reference.bounds);
+		}
+		else if (first >= split)
+		{
+			right.push_back(reference);
+			rightBounds.Grow(reference.bounds);
+		}
+		else
+		{
+			SpatialBounds leftPiece, rightPiece;
+			Split_Reference(*ctx.model, reference.primitive, reference.bounds, axis, plane, leftPiece, rightPiece);
+			leftBounds.Grow(leftPiece);
+			rightBounds.Grow(rightPiece);
+			straddling.push_back(reference);
+			pieces.push_back(leftPiece);
+			pieces.push_back(rightPiece);
+		}
+	}
+
+	uint32_t leftCount = static_cast<uint32_t>(left.size() + straddling.size());
+	uint32_t rightCount = static_cast<uint32_t>(right.size() + straddling.size());
+	uint32_t duplicates = 0;
+	for (size_t i = 0; i < straddling.size(); i++)
+	{
+		const SpatialReference &reference = straddling[i];
+		const SpatialBounds &leftPiece = pieces[i * 2];
+		const SpatialBounds &rightPiece = pieces[i * 2 + 1];
+		if (!leftPiece.Valid() || !rightPiece.Valid())
+		{
+			// Clipping left nothing on one side
+			SpatialReference piece = { leftPiece.Valid() ? leftPiece : rightPiece, reference.primitive };
+			if (!piece.bounds.Valid()) piece.bounds = reference.bounds;
+			(leftPiece.Valid() ? left : right).push_back(piece);
+			(leftPiece.Valid() ? rightCount : leftCount)--;
+			continue;
+		}
+
+		SpatialBounds leftWhole = leftBounds, rightWhole = rightBounds;
+		leftWhole.Grow(reference.bounds);
+		rightWhole.Grow(reference.bounds);
+		float splitCost = leftBounds.Area() * leftCount + rightBounds.Area() * rightCount;
+		float leftCost = leftWhole.Area() * leftCount + rightBounds.Area() * (rightCount - 1);
+		float rightCost = leftBounds.Area() * (leftCount - 1) + rightWhole.Area() * rightCount;
+		if (leftCost < splitCost && leftCost <= rightCost)
+		{
+			left.push_back(reference);
+			leftBounds = leftWhole;
+			rightCount--;
+		}
+		else if (rightCost < splitCost)
+		{
+			right.push_back(reference);
+			rightBounds = rightWhole;
+			leftCount--;
+		}
+		else
+		{
+			left.push_back({ leftPiece, reference.primitive });
+			right.push_back({ rightPiece, reference.primitive });
+			duplicates++;
+		}
+	}
+
+	if (left.empty() || right.empty() || left.size() >= references.size() || right.size() >= references.size()) return false;
+	return duplicates == 0 || Reserve_Duplicates(ctx, duplicates);
+}
+
+/**
+* Split a node with the better of the binned object split and the binned spatial split, by the surface area heuristic.
+* Returns false if the node should stay a leaf.
+*/
+bool Split_Spatial_Node(SpatialContext &ctx, SpatialTask &task, SpatialTask children[2])
+{
+	BVHTree &bvh = *ctx.bvh;
+	vector<SpatialReference> &references = task.references;
+	uint32_t count = static_cast<uint32_t>(references.size());
+	if (count <= 1) return false;
+
+	SpatialBounds nodeBounds, centroidBounds;
+	nodeBounds.min = bvh.nodes[task.nodeIndex].boundsMin;
+	nodeBounds.max = bvh.nodes[task.nodeIndex].boundsMax;
+	for (const SpatialReference &reference : references)
+	{
+		centroidBounds.Grow(XMFLOAT3(reference.bounds.Centroid(0), reference.bounds.Centroid(1), reference.bounds.Centroid(2)));
+	}
+
+	// Bin the centroids for an object split, sweeping from both sides
+	float objectCost = FLT_MAX;
+	int objectAxis = -1;
+	uint32_t objectSplit = 0;
+	SpatialBounds objectLeft, objectRight;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float binMin = Axis(centroidBounds.min, axis);
+		float extent = Axis(centroidBounds.max, axis) - binMin;
+		if (extent <= 0.f) continue;
+
+		float binScale = ObjectBinCount / extent;
+		SpatialBin bins[ObjectBinCount];
+		for (const SpatialReference &reference : references)
+		{
+			SpatialBin &bin = bins[Get_Bin(reference.bounds.Centroid(axis), binMin, binScale, ObjectBinCount)];
+			bin.bounds.Grow(reference.bounds);
+			bin.count++;
+		}
+
+		SpatialBounds rightBounds[ObjectBinCount];
+		uint32_t rightCount[ObjectBinCount];
+		SpatialBounds right;
+		uint32_t rightTotal = 0;
+		for (uint32_t b = ObjectBinCount - 1; b > 0; b--)
+		{
+			right.Grow(bins[b].bounds);
+			rightTotal += bins[b].count;
+			rightBounds[b] = right;
+			rightCount[b] = rightTotal;
+		}
+
+		SpatialBounds left;
+		uint32_t leftTotal = 0;
+		for (uint32_t b = 0; b < ObjectBinCount - 1; b++)
+		{
+			left.Grow(bins[b].bounds);
+			leftTotal += bins[b].count;
+			if (leftTotal == 0 || rightCount[b + 1] == 0) continue;
+
+			float cost = left.Area() * leftTotal + rightBounds[b + 1].Area() * rightCount[b + 1];
+			if (cost < objectCost)
+			{
+				objectCost = cost;
+				objectAxis = axis;
+				objectSplit = b + 1;
+				objectLeft = left;
+				objectRight = rightBounds[b + 1];
+			}
+		}
+	}
+
+	// Only look for a spatial split where the object split children overlap enough to be worth splitting triangles
+	float spatialCost = FLT_MAX;
+	int spatialAxis = -1;
+	uint32_t spatialSplit = 0;
+	SpatialBounds overlap = objectLeft;
+	overlap.Clip(objectRight);
+	if (objectAxis >= 0 && overlap.Area() > ctx.minOverlapArea && ctx.duplicateBudget.load() > 0)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float binMin = Axis(nodeBounds.min, axis);
+			float extent = Axis(nodeBounds.max, axis) - binMin;
+			if (extent <= 0.f) continue;
+
+			// Chop each reference into the bins it spans, and count where it enters and exits
+			float binScale = SpatialBinCount / extent;
+			float binWidth = extent / SpatialBinCount;
+			SpatialBin bins[SpatialBinCount];
+			for (const SpatialReference &reference : references)
+			{
+				uint32_t first = Get_Bin(Axis(reference.bounds.min, axis), binMin, binScale, SpatialBinCount);
+				uint32_t last = Get_Bin(Axis(reference.bounds.max, axis), binMin, binScale, SpatialBinCount);
+				SpatialBounds remaining = reference.bounds;
+				for (uint32_t b = first; b < last; b++)
+				{
+					SpatialBounds piece, rest;
+					Split_Reference(*ctx.model, reference.primitive, remaining, axis, binMin + (b + 1) * binWidth, piece, rest);
+					bins[b].bounds.Grow(piece);
+					remaining = rest;
+				}
+				bins[last].bounds.Grow(remaining);
+				bins[first].entries++;
+				bins[last].exits++;
+			}
+
+			SpatialBounds rightBounds[SpatialBinCount];
+			uint32_t rightCount[SpatialBinCount];
+			SpatialBounds right;
+			uint32_t exits = 0;
+			for (uint32_t b = SpatialBinCount - 1; b > 0; b--)
+			{
+				right.Grow(bins[b].bounds);
+				exits += bins[b].exits;
+				rightBounds[b] = right;
+				rightCount[b] = exits;
+			}
+
+			SpatialBounds left;
+			uint32_t entries = 0;
+			for (uint32_t b = 0; b < SpatialBinCount - 1; b++)
+			{
+				left.Grow(bins[b].bounds);
+				entries += bins[b].entries;
+				if (entries == 0 || rightCount[b + 1] == 0) continue;
+
+				float cost = left.Area() * entries + rightBounds[b + 1].Area() * rightCount[b + 1];
+				if (cost < spatialCost)
+				{
+					spatialCost = cost;
+					spatialAxis = axis;
+					spatialSplit = b + 1;
+				}
+			}
+		}
+	}
+
+	float area = nodeBounds.Area();
+	float bestCost = Min(objectCost, spatialCost);
+	float leafCost = IntersectionCost * count;
+	float splitCost = TraversalCost + IntersectionCost * ((area > 0.f) ? (bestCost / area) : 0.f);
+	if (objectAxis < 0 && count <= SpatialLeafSize) return false;
+	if (objectAxis >= 0 && splitCost >= leafCost && count <= SpatialLeafSize) return false;
+
+	vector<SpatialReference> &left = children[0].references;
+	vector<SpatialReference> &right = children[1].references;
+	bool split = spatialAxis >= 0 && spatialCost < objectCost && Partition_Spatial(ctx, references, nodeBounds, spatialAxis, spatialSplit, left, right);
+	if (!split && objectAxis >= 0)
+	{
+		// Partition around the object split
+		float binMin = Axis(centroidBounds.min, objectAxis);
+		float binScale = ObjectBinCount / (Axis(centroidBounds.max, objectAxis) - binMin);
+		left.clear();
+		right.clear();
+		for (const SpatialReference &reference : references)
+		{
+			bool isLeft = Get_Bin(reference.bounds.Centroid(objectAxis), binMin, binScale, ObjectBinCount) < objectSplit;
+			(isLeft ? left : right).push_back(reference);
+		}
+	}
+	else if (!split)
+	{
+		// All centroids coincide, split the references in half to bound the leaf size
+		left.assign(references.begin(), references.begin() + count / 2);
+		right.assign(references.begin() + count / 2, references.end());
+	}
+
+	uint32_t leftIndex = ctx.nodeCount.fetch_add(2);
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		SpatialBounds bounds;
+		for (const SpatialReference &reference : children[i].references) bounds.Grow(reference.bounds);
+
+		BVHNode &child = bvh.nodes[leftIndex + i];
+		child.boundsMin = bounds.min;
+		child.boundsMax = bounds.max;
+		child.leftFirst = 0;
+		child.count = 0;
+		children[i].nodeIndex = leftIndex + i;
+	}
+
+	BVHNode &node = bvh.nodes[task.nodeIndex];
+	node.leftFirst = leftIndex;
+	node.count = 0;
+	references.clear();
+	references.shrink_to_fit();
+	return true;
+}
+
+/**
+* Write the references of a leaf to the tree's triangle list.
+*/
+void Emit_Leaf(SpatialContext &ctx, const SpatialTask &task)
+{
+	uint32_t count = static_cast<uint32_t>(task.references.size());
+	uint32_t first = ctx.referenceCount.fetch_add(count);
+	for (uint32_t i = 0; i < count; i++) ctx.bvh->triangles[first + i] = task.references[i].primitive;
+
+	BVHNode &node = ctx.bvh->nodes[task.nodeIndex];
+	node.leftFirst = first;
+	node.count = count;
+}
+
+/**
+* Queue a subtree to be built by any thread.
+*/
+void Push_Task(SpatialContext &ctx, SpatialTask &task)
+{
+	lock_guard<mutex> guard(ctx.lock);
+	ctx.tasks.push_back(move(task));
+	ctx.pending++;
+	ctx.wake.notify_one();
+}
+
+/**
+* Build a subtree. Large child subtrees are queued for other threads, small ones are built here.
+*/
+void Build_Spatial_Subtree(SpatialContext &ctx, SpatialTask &task)
+{
+	vector<SpatialTask> stack;
+	stack.push_back(move(task));
+	while (!stack.empty())
+	{
+		SpatialTask current = move(stack.back());
+		stack.pop_back();
+
+		SpatialTask children[2];
+		if (!Split_Spatial_Node(ctx, current, children))
+		{
+			Emit_Leaf(ctx, current);
+			continue;
+		}
+
+		// Push the right child first, so the left subtree's leaves come first in the triangle list
+		for (int i = 1; i >= 0; i--)
+		{
+			if (ctx.threadCount > 1 && children[i].references.size() >= SpatialTaskThreshold) Push_Task(ctx, children[i]);
+			else stack.push_back(move(children[i]));
+		}
+	}
+}
+
+/**
+* Run queued subtree tasks until the whole tree is built.
+*/
+void Build_Spatial_Worker(SpatialContext &ctx)
+{
+	while (true)
+	{
+		SpatialTask task;
+		{
+			unique_lock<mutex> guard(ctx.lock);
+			ctx.wake.wait(guard, [&ctx] { return !ctx.tasks.empty() || ctx.pending == 0; });
+			if (ctx.tasks.empty()) return;
+
+			task = move(ctx.tasks.back());
+			ctx.tasks.pop_back();
+		}
+
+		Build_Spatial_Subtree(ctx, task);
+
+		lock_guard<mutex> guard(ctx.lock);
+		if (--ctx.pending == 0) ctx.wake.notify_all();
+	}
+}
+
+/**
+* Build a binary BVH over the model's triangles with spatial splits (SBVH), for meshes with large or long thin triangles
+* whose bounds overlap badly under object splits. Where the children of the best object split overlap by more than
+* overlapBudget times the root's surface area, the builder also tries splitting the triangles themselves at a plane,
+* so a triangle may be referenced by several leaves, each with the bounds of its own part. The duplicated references are
+* capped at duplicateBudget times the triangle count, which bounds the memory of the tree; once the budget is spent the
+* builder falls back to object splits.
+*/
+void Build_Spatial(BVHTree &bvh, const Model &model, float overlapBudget, float duplicateBudget, unsigned threadCount)
+{
+	uint32_t triangleCount = static_cast<uint32_t>(model.indices.size() / 3);
+	bvh.nodes.clear();
+	bvh.triangles.clear();
+	if (triangleCount == 0) return;
+
+	SpatialContext ctx;
+	ctx.model = &model;
+	ctx.bvh = &bvh;
+	ctx.threadCount = Utils::GetThreadCount(threadCount);
+	ctx.duplicateBudget = static_cast<uint32_t>(Min(Max(duplicateBudget, 0.f) * triangleCount, static_cast<float>(UINT32_MAX / 2 - triangleCount)));
+	ctx.nodeCount = 1;
+	ctx.referenceCount = 0;
+
+	// Compute the triangle bounds and the bounds of the root
+	SpatialTask root;
+	root.references.resize(triangleCount);
+	mutex rootLock;
+	SpatialBounds rootBounds;
+	Utils::ParallelFor(triangleCount, ctx.threadCount, [&](size_t begin, size_t end)
+	{
+		SpatialBounds bounds;
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t t = static_cast<uint32_t>(i);
+			SpatialReference &reference = root.references[i];
+			reference.primitive = t;
+			reference.bounds.Grow(Get_Position(model, t, 0));
+			reference.bounds.Grow(Get_Position(model, t, 1));
+			reference.bounds.Grow(Get_Position(model, t, 2));
+			bounds.Grow(reference.bounds);
+		}
+
+		lock_guard<mutex> guard(rootLock);
+		rootBounds.Grow(bounds);
+	});
+	ctx.minOverlapArea = Max(overlapBudget, 0.f) * rootBounds.Area();
+
+	// Every leaf holds at least one reference, so a binary tree over all the references the budget allows has at most 2N - 1 nodes
+	size_t maxReferences = static_cast<size_t>(triangleCount) + ctx.duplicateBudget;
+	bvh.nodes.resize(maxReferences * 2 - 1);
+	bvh.triangles.resize(maxReferences);
+	bvh.nodes[0].boundsMin = rootBounds.min;
+	bvh.nodes[0].boundsMax = rootBounds.max;
+
+	// Workers pick up subtrees as they are queued, the calling thread starts with the root
+	Push_Task(ctx, root);
+	vector<thread> workers;
+	for (unsigned i = 1; i < ctx.threadCount; i++) workers.emplace_back(Build_Spatial_Worker, ref(ctx));
+	Build_Spatial_Worker(ctx);
+	for (thread &worker : workers) worker.join();
+
+	bvh.nodes.resize(ctx.nodeCount);
+	bvh.nodes.shrink_to_fit();
+	bvh.triangles.resize(ctx.referenceCount);
+	bvh.triangles.shrink_to_fit();
+}
+
+}
@@ -0,0 +1,228 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CPU.h"
+#include "Utils.h"
+
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Bounding Volume Hierarchy Statistics Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+static const uint32_t MaxClippedVertices = 9;			// a triangle clipped by the six planes of a box
+static const uint32_t MaxStatsStackDepth = 128;			// traversal stack entries before spilling to the heap
+
+static const float TraversalCost = 1.f;
+static const float IntersectionCost = 1.f;
+
+/**
+* Get the position of a triangle's vertex.
+*/
+inline const XMFLOAT3& Get_Position(const Model &model, uint32_t triangleIndex, uint32_t vertex)
+{
+	return model.vertices[model.indices[triangleIndex * 3 + vertex]].position;
+}
+
+/**
+* Check whether the bounds of two nodes overlap, touching included.
+*/
+inline bool Overlaps(const BVHNode &a, const BVHNode &b)
+{
+	return a.boundsMin.x <= b.boundsMax.x && b.boundsMin.x <= a.boundsMax.x
+		&& a.boundsMin.y <= b.boundsMax.y && b.boundsMin.y <= a.boundsMax.y
+		&& a.boundsMin.z <= b.boundsMax.z && b.boundsMin.z <= a.boundsMax.z;
+}
+
+/**
+* Get the area of a triangle.
+*/
+inline float Triangle_Area(const XMFLOAT3 &a, const XMFLOAT3 &b, const XMFLOAT3 &c)
+{
+	XMVECTOR p0 = XMLoadFloat3(&a);
+	XMVECTOR edge1 = XMVectorSubtract(XMLoadFloat3(&b), p0);
+	XMVECTOR edge2 = XMVectorSubtract(XMLoadFloat3(&c), p0);
+	return 0.5f * XMVectorGetX(XMVector3Length(XMVector3Cross(edge1, edge2)));
+}
+
+/**
+* Get the area of the part of a triangle inside the bounds of a node, by clipping it against each face of the box.
+*/
+float Get_Clipped_Area(const Model &model, uint32_t triangleIndex, const BVHNode &node)
+{
+	XMFLOAT3 polygon[2][MaxClippedVertices];
+	uint32_t count = 3;
+	for (uint32_t i = 0; i < 3; i++) polygon[0][i] = Get_Position(model, triangleIndex, i);
+
+	uint32_t current = 0;
+	for (int plane = 0; plane < 6 && count > 0; plane++)
+	{
+		// Keep the side of each plane inside the box: min faces keep larger values, max faces smaller ones
+		int axis = plane % 3;
+		float sign = (plane < 3) ? 1.f : -1.f;
+		float offset = (plane < 3) ? (&node.boundsMin.x)[axis] : (&node.boundsMax.x)[axis];
+
+		const XMFLOAT3* in = polygon[current];
+		XMFLOAT3* out = polygon[current ^ 1];
+		uint32_t outCount = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const XMFLOAT3 &a = in[i];
+			const XMFLOAT3 &b = in[(i + 1) % count];
+			float da = sign * ((&a.x)[axis] - offset);
+			float db = sign * ((&b.x)[axis] - offset);
+			if (da >= 0.f) out[outCount++] = a;
+			if ((da >= 0.f) != (db >= 0.f))
+			{
+				float t = da / (da - db);
+				out[outCount++] = XMFLOAT3(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t);
+			}
+			if (outCount == MaxClippedVertices) break;
+		}
+		count = outCount;
+		current ^= 1;
+	}
+
+	float area = 0.f;
+	for (uint32_t i = 2; i < count; i++) area += Triangle_Area(polygon[current][0], polygon[current][i - 1], polygon[current][i]);
+	return area;
+}
+
+/**
+* Get the surface area of the triangles outside a node's subtree that lie inside its bounds, the overlap the node adds
+* to every ray that enters it. The subtree is skipped by never descending into the node itself.
+*/
+double Get_Node_Overlap(const BVHTree &bvh, const Model &model, uint32_t nodeIndex)
+{
+	const BVHNode &target = bvh.nodes[nodeIndex];
+	double area = 0.0;
+
+	CPUTraversalStack<uint32_t, MaxStatsStackDepth> stack;
+	stack.Push(0);
+	while (stack.size > 0)
+	{
+		uint32_t index = stack.Pop();
+		const BVHNode &node = bvh.nodes[index];
+		if (index == nodeIndex || !Overlaps(node, target)) continue;
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; i++) area += Get_Clipped_Area(model, bvh.triangles[node.leftFirst + i], target);
+		}
+		else
+		{
+			stack.Push(node.leftFirst);
+			stack.Push(node.leftFirst + 1);
+		}
+	}
+	return area;
+}
+
+/**
+* Measure the quality of a tree: node and leaf counts, SAH cost, end point overlap (EPO), memory, and histograms of
+* leaf sizes and leaf depths. EPO weighs each node by the area of the geometry from outside its subtree that a ray
+* entering the node may still have to test, relative to the area of all the geometry. With spatial splits, a triangle
+* split across several leaves counts once for each of them.
+*/
+void Get_Stats(const BVHTree &bvh, const Model &model, BVHStats &stats, unsigned threadCount)
+{
+	stats = BVHStats();
+	uint32_t nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+	if (nodeCount == 0) return;
+
+	stats.nodeCount = nodeCount;
+	stats.references = bvh.triangles.size();
+	stats.sahCost = Get_SAH_Cost(bvh);
+	stats.memoryBytes = bvh.nodes.size() * sizeof(BVHNode) + bvh.triangles.size() * sizeof(uint32_t);
+
+	// Walk the tree for the leaf histograms
+	vector<pair<uint32_t, uint32_t>> stack(1, { 0u, 0u });
+	while (!stack.empty())
+	{
+		uint32_t index = stack.back().first;
+		uint32_t depth = stack.back().second;
+		stack.pop_back();
+
+		const BVHNode &node = bvh.nodes[index];
+		if (node.count == 0)
+		{
+			stack.push_back({ node.leftFirst, depth + 1 });
+			stack.push_back({ node.leftFirst + 1, depth + 1 });
+			continue;
+		}
+
+		stats.leafCount++;
+		stats.maxDepth = max(stats.maxDepth, depth);
+		if (stats.leafSizes.size() <= node.count) stats.leafSizes.resize(node.count + 1);
+		if (stats.leafDepths.size() <= depth) stats.leafDepths.resize(depth + 1);
+		stats.leafSizes[node.count]++;
+		stats.leafDepths[depth]++;
+	}
+
+	// Sum the area of all the triangles, then the cost weighted overlap of every node
+	uint32_t triangleCount = static_cast<uint32_t>(model.indices.size() / 3);
+	mutex lock;
+	double totalArea = 0.0;
+	Utils::ParallelFor(triangleCount, threadCount, [&](size_t begin, size_t end)
+	{
+		double area = 0.0;
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t t = static_cast<uint32_t>(i);
+			area += Triangle_Area(Get_Position(model, t, 0), Get_Position(model, t, 1), Get_Position(model, t, 2));
+		}
+
+		lock_guard<mutex> guard(lock);
+		totalArea += area;
+	});
+	if (totalArea <= 0.0) return;
+
+	// Nodes deep in the tree query far fewer triangles than those near the root, so they are dealt out by work stealing
+	double overlap = 0.0;
+	Utils::ParallelForWorkStealing(nodeCount, threadCount, [&](size_t i)
+	{
+		const BVHNode &node = bvh.nodes[i];
+		double cost = (node.count > 0) ? (IntersectionCost * node.count) : TraversalCost;
+		double area = cost * Get_Node_Overlap(bvh, model, static_cast<uint32_t>(i));
+		if (area <= 0.0) return;
+
+		lock_guard<mutex> guard(lock);
+		overlap += area;
+	});
+	stats.epo = static_cast<float>(overlap / totalArea);
+}
+
+}
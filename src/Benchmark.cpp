@@ -0,0 +1,2129 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Benchmark.h"
+#include "CPU.h"
+#include "Platform.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Benchmark Functions
+//--------------------------------------------------------------------------------------
+
+namespace Benchmark
+{
+
+// Synthetic mesh sizes, from a small prop to a large production mesh
+static const uint32_t MeshSizes[] = { 10000, 100000, 1000000, 10000000, 50000000 };
+
+// Ray set size, as a square image of primary rays
+static const int RayImageSize = 1024;
+static const int TraceRuns = 3;
+
+// Crack test: shared edges and vertices sampled per mesh, and rays fired at each
+static const uint32_t CrackTargets = 100000;
+static const int CrackRaysPerTarget = 4;
+
+// Triangle kernel throughput: triangles per test, like a full BVH leaf
+static const uint32_t KernelBatchSize = 8;
+static const uint32_t KernelRayCount = 1 << 20;
+
+// Render scaling benchmark
+static const int ScalingResolutions[][2] = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+static const unsigned ScalingThreads[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+// Instancing benchmark
+static const uint32_t InstanceGridSize = 100;			// instances per side of the square grid
+static const uint32_t InstanceMeshTriangles = 500;
+
+// Refit benchmark
+static const int AnimationFrames = 60;
+static const int RebuildInterval = 10;					// frames between rebuilds for refit with periodic rebuilds
+static const int AnimationRayStride = 16;				// traces every 16th primary ray of each frame
+
+// BVH cache benchmark
+static const char* CacheBenchmarkPath = "benchmark.bvh";
+
+// Spatial split benchmark: architectural mesh sizes, and duplicate reference budgets as fractions of the triangle count
+static const uint32_t SpatialMeshSizes[] = { 10000, 100000, 1000000 };
+static const float SpatialOverlapBudget = 1e-5f;
+static const float SpatialDuplicateBudgets[] = { 0.1f, 0.3f, 1.f };
+
+// Texture sampler benchmark
+static const int SamplerTextureSizes[][2] = { { 256, 256 }, { 1024, 1024 }, { 4096, 4096 }, { 1000, 600 } };
+static const size_t SamplerSampleCount = 1 << 20;
+
+// Progressive accumulation benchmark
+static const int AccumulationResolution[] = { 320, 180 };
+static const uint32_t AccumulationReferenceSamples = 1024;	// per pixel, for the converged image errors are measured against
+static const uint32_t AccumulationMaxSamples = 256;			// per pixel, for adaptive and uniform sampling
+static const float AccumulationThresholds[] = { 0.02f, 0.01f, 0.005f };
+
+// Ray sorting benchmark
+static const int DiffuseBounces = 2;
+
+// Wavefront benchmark
+static const int WavefrontResolution[] = { 640, 360 };
+static const uint32_t WavefrontSamples = 4;				// per pixel
+static const uint32_t WavefrontBounces[] = { 0, 1, 2, 4, 8 };
+static const char* WavefrontStageNames[] = { "generate", "extend", "shade hit", "shade miss", "shadow", "compact" };
+
+// Path tracing benchmark
+static const int PathResolution[] = { 320, 180 };
+static const uint32_t PathReferenceSamples = 128;		// per pixel, for the converged image errors are measured against
+static const uint32_t PathSamples = 16;					// per pixel
+static const uint32_t PathBounces = 4;
+static const uint32_t PathArchitectureTriangles = 10000;
+static const float PathBudgets[] = { 0.5f, 0.25f, 0.125f, 0.0625f };	// of the camera rays, for the first to fourth bounce
+
+/**
+* Print a line to the console and the debugger output.
+*/
+void Log(const char* format, ...)
+{
+	char msg[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(msg, sizeof(msg), format, args);
+	va_end(args);
+
+	Platform::DebugOutput(msg);
+	printf("%s", msg);
+}
+
+/**
+* Get the milliseconds elapsed since a time point.
+*/
+double Elapsed_Ms(const chrono::high_resolution_clock::time_point &start)
+{
+	return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+/**
+* Create a displaced, tessellated grid with roughly the requested number of triangles.
+*/
+void Create_Grid_Mesh(Model &model, uint32_t triangleCount)
+{
+	uint32_t quads = max(triangleCount / 2, 1u);
+	uint32_t size = max(static_cast<uint32_t>(sqrtf(static_cast<float>(quads))), 1u);
+
+	model.vertices.resize(static_cast<size_t>(size + 1) * (size + 1));
+	model.indices.resize(static_cast<size_t>(size) * size * 6);
+
+	Utils::ParallelFor(size + 1, 0, [&](size_t begin, size_t end)
+	{
+		for (size_t y = begin; y < end; y++)
+		{
+			for (uint32_t x = 0; x <= size; x++)
+			{
+				float u = static_cast<float>(x) / size;
+				float v = static_cast<float>(y) / size;
+				float height = 0.5f * sinf(u * 12.f) * cosf(v * 9.f) + 0.1f * sinf(u * 57.f + v * 31.f);
+
+				Vertex &vertex = model.vertices[y * (size + 1) + x];
+				vertex.position = XMFLOAT3((u - 0.5f) * 10.f, height, (v - 0.5f) * 10.f);
+				vertex.uv = XMFLOAT2(u, v);
+			}
+		}
+	});
+
+	Utils::ParallelFor(size, 0, [&](size_t begin, size_t end)
+	{
+		for (size_t y = begin; y < end; y++)
+		{
+			for (uint32_t x = 0; x < size; x++)
+			{
+				uint32_t i0 = static_cast<uint32_t>(y * (size + 1) + x);
+				uint32_t i1 = i0 + 1;
+				uint32_t i2 = i0 + size + 1;
+				uint32_t i3 = i2 + 1;
+
+				uint32_t* index = &model.indices[(y * size + x) * 6];
+				index[0] = i0; index[1] = i2; index[2] = i1;
+				index[3] = i1; index[4] = i2; index[5] = i3;
+			}
+		}
+	});
+}
+
+/**
+* Get the meshes to benchmark: the model given on the command line, then the synthetic meshes.
+*/
+vector<pair<string, uint32_t>> Get_Meshes(const ConfigInfo &config)
+{
+	vector<pair<string, uint32_t>> meshes;
+	if (!config.model.empty()) meshes.push_back({ config.model, 0 });
+	for (uint32_t size : MeshSizes)
+	{
+		if (size <= config.benchmarkTriangles) meshes.push_back({ "grid", size });
+	}
+	return meshes;
+}
+
+/**
+* Load a benchmark mesh.
+*/
+void Load_Mesh(const pair<string, uint32_t> &mesh, Model &model)
+{
+	model = Model();
+	if (mesh.second == 0)
+	{
+		Material material;
+		Utils::LoadModel(mesh.first, model, material);
+	}
+	else
+	{
+		Create_Grid_Mesh(model, mesh.second);
+	}
+}
+
+/**
+* Measure binned SAH BVH build speed (millions of triangles per second) and tree quality (SAH cost).
+*/
+void Run_BVH_Build(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	Log("BVH build (binned SAH, %u threads)\n", threadCount);
+	Log("%-24s %12s %10s %10s %10s %10s\n", "mesh", "triangles", "nodes", "build ms", "Mtris/s", "SAH cost");
+
+	for (const pair<string, uint32_t> &mesh : Get_Meshes(config))
+	{
+		Model model;
+		Load_Mesh(mesh, model);
+		size_t triangleCount = model.indices.size() / 3;
+
+		// Repeat small builds so the timing is stable, and keep the fastest
+		BVHTree bvh;
+		int runs = static_cast<int>(min(max(1000000 / max(triangleCount, static_cast<size_t>(1)), static_cast<size_t>(1)), static_cast<size_t>(10)));
+		double bestMs = DBL_MAX;
+		for (int run = 0; run < runs; run++)
+		{
+			auto start = chrono::high_resolution_clock::now();
+			BVH::Build(bvh, model, threadCount);
+			bestMs = min(bestMs, Elapsed_Ms(start));
+		}
+
+		Log("%-24s %12zu %10zu %10.2f %10.2f %10.2f\n", mesh.first.c_str(), triangleCount, bvh.nodes.size(), bestMs, triangleCount / (bestMs * 1000.0), BVH::Get_SAH_Cost(bvh));
+	}
+}
+
+/**
+* Create the benchmark ray sets for a mesh: coherent primary rays from a pinhole camera looking at the mesh,
+* and incoherent rays with random origins inside the mesh bounds and random directions.
+*/
+void Create_Rays(const BVHNode &root, vector<CPURay> &coherent, vector<CPURay> &incoherent)
+{
+	XMVECTOR boundsMin = XMLoadFloat3(&root.boundsMin);
+	XMVECTOR boundsMax = XMLoadFloat3(&root.boundsMax);
+	XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+	float diagonal = max(XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin))), 1e-3f);
+
+	XMVECTOR eye = XMVectorAdd(center, XMVectorSet(0.f, 0.6f * diagonal, -0.8f * diagonal, 0.f));
+	XMVECTOR forward = XMVector3Normalize(XMVectorSubtract(center, eye));
+	XMVECTOR right = XMVector3Normalize(XMVector3Cross(XMVectorSet(0.f, 1.f, 0.f, 0.f), forward));
+	XMVECTOR up = XMVector3Cross(forward, right);
+	float tanHalfFov = tanf(XMConvertToRadians(45.f) * 0.5f);
+
+	coherent.resize(static_cast<size_t>(RayImageSize) * RayImageSize);
+	for (int y = 0; y < RayImageSize; y++)
+	{
+		for (int x = 0; x < RayImageSize; x++)
+		{
+			float dx = ((x + 0.5f) / RayImageSize * 2.f - 1.f) * tanHalfFov;
+			float dy = ((y + 0.5f) / RayImageSize * 2.f - 1.f) * tanHalfFov;
+			XMVECTOR direction = XMVectorAdd(XMVectorAdd(XMVectorScale(right, dx), XMVectorScale(up, -dy)), forward);
+
+			CPURay &ray = coherent[static_cast<size_t>(y) * RayImageSize + x];
+			XMStoreFloat3(&ray.origin, eye);
+			XMStoreFloat3(&ray.direction, XMVector3Normalize(direction));
+			ray.tMin = 0.f;
+			ray.tMax = FLT_MAX;
+		}
+	}
+
+	mt19937 rng(1);
+	uniform_real_distribution<float> unit(0.f, 1.f);
+	incoherent.resize(coherent.size());
+	for (CPURay &ray : incoherent)
+	{
+		XMVECTOR t = XMVectorSet(unit(rng), unit(rng), unit(rng), 0.f);
+		XMStoreFloat3(&ray.origin, XMVectorAdd(boundsMin, XMVectorMultiply(t, XMVectorSubtract(boundsMax, boundsMin))));
+
+		// Uniform direction on the sphere
+		float z = unit(rng) * 2.f - 1.f;
+		float phi = unit(rng) * XM_2PI;
+		float r = sqrtf(max(1.f - z * z, 0.f));
+		ray.direction = XMFLOAT3(r * cosf(phi), r * sinf(phi), z);
+		ray.tMin = 0.f;
+		ray.tMax = FLT_MAX;
+	}
+}
+
+/**
+* Trace a ray set with all threads and return the best rate, in millions of rays per second, over a few runs.
+*/
+double Trace_Rays(const vector<CPURay> &rays, unsigned threadCount, size_t &hitCount, const function<bool(const CPURay&, CPUHit&)> &intersect)
+{
+	double bestMs = DBL_MAX;
+	for (int run = 0; run < TraceRuns; run++)
+	{
+		atomic<size_t> hits{};
+		auto start = chrono::high_resolution_clock::now();
+		Utils::ParallelFor(rays.size(), threadCount, [&](size_t begin, size_t end)
+		{
+			size_t localHits = 0;
+			for (size_t i = begin; i < end; i++)
+			{
+				CPUHit hit;
+				if (intersect(rays[i], hit)) localHits++;
+			}
+			hits += localHits;
+		});
+		bestMs = min(bestMs, Elapsed_Ms(start));
+		hitCount = hits;
+	}
+	return rays.size() / (bestMs * 1000.0);
+}
+
+/**
+* Compare the binary BVH with the collapsed 8-wide BVH: rays per second on coherent and incoherent rays, and node memory.
+*/
+void Run_BVH8(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	if (!Utils::HasAVX2())
+	{
+		Log("BVH8 traversal requires AVX2 and FMA, which this processor does not support\n");
+		return;
+	}
+
+	Log("Binary BVH vs BVH8 (%u threads, %d rays per set)\n", threadCount, RayImageSize * RayImageSize);
+	Log("%-24s %12s %8s %10s %10s %14s %14s\n", "mesh", "triangles", "layout", "nodes", "node MB", "coherent Mr/s", "incoherent Mr/s");
+
+	for (const pair<string, uint32_t> &mesh : Get_Meshes(config))
+	{
+		Model model;
+		Load_Mesh(mesh, model);
+		size_t triangleCount = model.indices.size() / 3;
+
+		BVHTree bvh;
+		BVH8Tree bvh8;
+		BVH::Build(bvh, model, threadCount);
+		BVH::Collapse(bvh8, bvh);
+
+		vector<CPURay> coherent, incoherent;
+		Create_Rays(bvh.nodes[0], coherent, incoherent);
+
+		size_t hits2[2], hits8[2];
+		auto intersect2 = [&](const CPURay &ray, CPUHit &hit) { return BVH::Intersect(bvh, model, ray, hit); };
+		auto intersect8 = [&](const CPURay &ray, CPUHit &hit) { return BVH::Intersect(bvh8, model, ray, hit); };
+		double coherent2 = Trace_Rays(coherent, threadCount, hits2[0], intersect2);
+		double incoherent2 = Trace_Rays(incoherent, threadCount, hits2[1], intersect2);
+		double coherent8 = Trace_Rays(coherent, threadCount, hits8[0], intersect8);
+		double incoherent8 = Trace_Rays(incoherent, threadCount, hits8[1], intersect8);
+
+		double megabytes2 = bvh.nodes.size() * sizeof(BVHNode) / (1024.0 * 1024.0);
+		double megabytes8 = bvh8.nodes.size() * sizeof(BVH8Node) / (1024.0 * 1024.0);
+		Log("%-24s %12zu %8s %10zu %10.2f %14.2f %14.2f\n", mesh.first.c_str(), triangleCount, "binary", bvh.nodes.size(), megabytes2, coherent2, incoherent2);
+		Log("%-24s %12s %8s %10zu %10.2f %14.2f %14.2f\n", "", "", "bvh8", bvh8.nodes.size(), megabytes8, coherent8, incoherent8);
+		if (hits2[0] != hits8[0] || hits2[1] != hits8[1])
+		{
+			Log("  warning: hit counts differ (binary %zu/%zu, bvh8 %zu/%zu)\n", hits2[0], hits2[1], hits8[0], hits8[1]);
+		}
+	}
+}
+
+/**
+* Trace an image of primary rays as packets of square-ish tiles, and return the rate in millions of rays per second.
+*/
+double Trace_Packets(const BVHTree &bvh, const Model &model, const vector<CPURay> &rays, uint32_t packetWidth, unsigned threadCount, size_t &hitCount)
+{
+	const int tileWidth = (packetWidth >= 8) ? 4 : 2;
+	const int tileHeight = static_cast<int>(packetWidth) / tileWidth;
+	const int tilesX = (RayImageSize + tileWidth - 1) / tileWidth;
+	const int tilesY = (RayImageSize + tileHeight - 1) / tileHeight;
+
+	double bestMs = DBL_MAX;
+	for (int run = 0; run < TraceRuns; run++)
+	{
+		atomic<size_t> hits{};
+		auto start = chrono::high_resolution_clock::now();
+		Utils::ParallelFor(tilesY, threadCount, [&](size_t begin, size_t end)
+		{
+			size_t localHits = 0;
+			CPURay packet[16];
+			CPUHit packetHits[16];
+			for (int ty = static_cast<int>(begin); ty < static_cast<int>(end); ty++)
+			{
+				for (int tx = 0; tx < tilesX; tx++)
+				{
+					uint32_t count = 0;
+					for (int y = ty * tileHeight; y < min((ty + 1) * tileHeight, RayImageSize); y++)
+					{
+						for (int x = tx * tileWidth; x < min((tx + 1) * tileWidth, RayImageSize); x++)
+						{
+							packet[count++] = rays[static_cast<size_t>(y) * RayImageSize + x];
+						}
+					}
+
+					BVH::Intersect_Packet(bvh, model, packet, packetHits, count, packetWidth);
+					for (uint32_t i = 0; i < count; i++) localHits += (packetHits[i].triangleIndex != UINT32_MAX);
+				}
+			}
+			hits += localHits;
+		});
+		bestMs = min(bestMs, Elapsed_Ms(start));
+		hitCount = hits;
+	}
+	return rays.size() / (bestMs * 1000.0);
+}
+
+/**
+* Measure the speedup of 4, 8 and 16-wide ray packets over single ray traversal on camera rays.
+*/
+void Run_Packets(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	Log("Ray packets on primary rays (%u threads, %dx%d image)\n", threadCount, RayImageSize, RayImageSize);
+	Log("%-24s %12s %10s %10s %10s\n", "mesh", "triangles", "traversal", "Mrays/s", "speedup");
+
+	for (const pair<string, uint32_t> &mesh : Get_Meshes(config))
+	{
+		Model model;
+		Load_Mesh(mesh, model);
+		size_t triangleCount = model.indices.size() / 3;
+
+		BVHTree bvh;
+		BVH::Build(bvh, model, threadCount);
+
+		vector<CPURay> coherent, incoherent;
+		Create_Rays(bvh.nodes[0], coherent, incoherent);
+
+		size_t singleHits = 0;
+		double single = Trace_Rays(coherent, threadCount, singleHits, [&](const CPURay &ray, CPUHit &hit) { return BVH::Intersect(bvh, model, ray, hit); });
+		Log("%-24s %12zu %10s %10.2f %10.2f\n", mesh.first.c_str(), triangleCount, "single", single, 1.0);
+
+		for (uint32_t packetWidth : { 4u, 8u, 16u })
+		{
+			size_t packetHits = 0;
+			double rate = Trace_Packets(bvh, model, coherent, packetWidth, threadCount, packetHits);
+
+			char name[16];
+			snprintf(name, sizeof(name), "packet%u", packetWidth);
+			Log("%-24s %12s %10s %10.2f %10.2f\n", "", "", name, rate, rate / single);
+			if (packetHits != singleHits) Log("  warning: hit counts differ (single %zu, packets %zu)\n", singleHits, packetHits);
+		}
+	}
+}
+
+/**
+* Intersect a ray with a triangle using the Möller-Trumbore test the CPU ray tracer used before the watertight test.
+* It is not watertight, and is only kept to compare against.
+*/
+bool Intersect_Moller_Trumbore(const Model &model, uint32_t triangleIndex, const CPURay &ray, CPUHit &hit)
+{
+	const XMFLOAT3 &v0 = model.vertices[model.indices[triangleIndex * 3 + 0]].position;
+	const XMFLOAT3 &v1 = model.vertices[model.indices[triangleIndex * 3 + 1]].position;
+	const XMFLOAT3 &v2 = model.vertices[model.indices[triangleIndex * 3 + 2]].position;
+
+	XMFLOAT3 e1(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+	XMFLOAT3 e2(v2.x - v0.x, v2.y - v0.y, v2.z - v0.z);
+	const XMFLOAT3 &d = ray.direction;
+
+	XMFLOAT3 p(d.y * e2.z - d.z * e2.y, d.z * e2.x - d.x * e2.z, d.x * e2.y - d.y * e2.x);
+	float det = e1.x * p.x + e1.y * p.y + e1.z * p.z;
+	if (fabsf(det) < 1e-12f) return false;
+	float invDet = 1.f / det;
+
+	XMFLOAT3 s(ray.origin.x - v0.x, ray.origin.y - v0.y, ray.origin.z - v0.z);
+	float u = (s.x * p.x + s.y * p.y + s.z * p.z) * invDet;
+	if (u < 0.f || u > 1.f) return false;
+
+	XMFLOAT3 q(s.y * e1.z - s.z * e1.y, s.z * e1.x - s.x * e1.z, s.x * e1.y - s.y * e1.x);
+	float v = (d.x * q.x + d.y * q.y + d.z * q.z) * invDet;
+	if (v < 0.f || u + v > 1.f) return false;
+
+	float t = (e2.x * q.x + e2.y * q.y + e2.z * q.z) * invDet;
+	if (t < ray.tMin || t >= hit.t) return false;
+
+	hit.t = t;
+	hit.uv = XMFLOAT2(u, v);
+	hit.triangleIndex = triangleIndex;
+	return true;
+}
+
+/**
+* A shared edge or vertex of a mesh, and the triangles around it.
+*/
+struct CrackTarget
+{
+	XMFLOAT3 point;
+	XMFLOAT3 normal;					// average normal of the triangles around the target
+	float size;							// longest edge of the triangles around the target
+	vector<uint32_t> triangles;
+};
+
+/**
+* Find the edges shared by exactly two triangles, and the vertices whose triangle fan is closed.
+* Only the positions matter, so vertices that differ only in their uv are welded.
+*/
+void Find_Crack_Targets(const Model &model, vector<CrackTarget> &edges, vector<CrackTarget> &vertices)
+{
+	uint32_t triangleCount = static_cast<uint32_t>(model.indices.size() / 3);
+
+	// Weld the vertices by position
+	unordered_map<uint64_t, uint32_t> positions;
+	vector<uint32_t> welded(model.vertices.size());
+	for (size_t i = 0; i < model.vertices.size(); i++)
+	{
+		const XMFLOAT3 &p = model.vertices[i].position;
+		uint64_t key = Utils::Hash(&p, sizeof(p));
+		welded[i] = positions.insert({ key, static_cast<uint32_t>(i) }).first->second;
+	}
+
+	unordered_map<uint64_t, vector<uint32_t>> edgeTriangles;
+	vector<vector<uint32_t>> vertexTriangles(model.vertices.size());
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			uint32_t a = welded[model.indices[t * 3 + k]];
+			uint32_t b = welded[model.indices[t * 3 + (k + 1) % 3]];
+			uint64_t key = (static_cast<uint64_t>(min(a, b)) << 32) | max(a, b);
+			edgeTriangles[key].push_back(t);
+			vertexTriangles[a].push_back(t);
+		}
+	}
+
+	// A vertex on a boundary or non-manifold edge does not have a closed fan
+	vector<bool> closed(model.vertices.size(), true);
+	for (const auto &edge : edgeTriangles)
+	{
+		if (edge.second.size() == 2) continue;
+		closed[edge.first >> 32] = false;
+		closed[edge.first & 0xFFFFFFFF] = false;
+	}
+
+	auto finish = [&](CrackTarget &target)
+	{
+		XMVECTOR normal = XMVectorZero();
+		target.size = 0.f;
+		for (uint32_t t : target.triangles)
+		{
+			XMVECTOR v0 = XMLoadFloat3(&model.vertices[model.indices[t * 3 + 0]].position);
+			XMVECTOR v1 = XMLoadFloat3(&model.vertices[model.indices[t * 3 + 1]].position);
+			XMVECTOR v2 = XMLoadFloat3(&model.vertices[model.indices[t * 3 + 2]].position);
+			normal = XMVectorAdd(normal, XMVector3Cross(XMVectorSubtract(v1, v0), XMVectorSubtract(v2, v0)));
+			target.size = max(target.size, XMVectorGetX(XMVector3Length(XMVectorSubtract(v1, v0))));
+			target.size = max(target.size, XMVectorGetX(XMVector3Length(XMVectorSubtract(v2, v0))));
+		}
+		XMStoreFloat3(&target.normal, XMVector3Normalize(normal));
+	};
+
+	mt19937 rng(7);
+	uniform_real_distribution<float> unit(0.05f, 0.95f);
+	for (const auto &edge : edgeTriangles)
+	{
+		if (edge.second.size() != 2) continue;
+		const XMFLOAT3 &a = model.vertices[edge.first >> 32].position;
+		const XMFLOAT3 &b = model.vertices[edge.first & 0xFFFFFFFF].position;
+		float s = unit(rng);
+
+		CrackTarget target;
+		target.point = XMFLOAT3(a.x + s * (b.x - a.x), a.y + s * (b.y - a.y), a.z + s * (b.z - a.z));
+		target.triangles = edge.second;
+		finish(target);
+		edges.push_back(target);
+	}
+
+	for (size_t i = 0; i < model.vertices.size(); i++)
+	{
+		if (welded[i] != i || !closed[i] || vertexTriangles[i].size() < 3) continue;
+		CrackTarget target;
+		target.point = model.vertices[i].position;
+		target.triangles = vertexTriangles[i];
+		finish(target);
+		vertices.push_back(target);
+	}
+
+	// Keep a fixed size sample of large meshes
+	shuffle(edges.begin(), edges.end(), rng);
+	shuffle(vertices.begin(), vertices.end(), rng);
+	if (edges.size() > CrackTargets) edges.resize(CrackTargets);
+	if (vertices.size() > CrackTargets) vertices.resize(CrackTargets);
+}
+
+/**
+* Fire rays at shared edges and vertices, against only the triangles around each target, and count the rays that
+* pass through without hitting any of them. Also checks that the hit barycentrics follow the DXR Attributes.uv
+* convention, by rebuilding the hit point from the triangle's vertices. Returns false if a ray leaks through the
+* watertight tests or a hit point is wrong; the Möller-Trumbore leaks are only reported.
+*/
+bool Run_Crack_Test(const ConfigInfo &config)
+{
+	bool avx2 = Utils::HasAVX2();
+	bool passed = true;
+	Log("Watertight crack test (%d rays per shared edge or vertex)\n", CrackRaysPerTarget);
+	Log("%-24s %12s %8s %10s %12s %12s %12s %12s %10s %7s\n", "mesh", "triangles", "target", "rays", "M-T leaks", "scalar leaks", "sse4 leaks", "avx8 leaks", "uv errors", "result");
+
+	for (const pair<string, uint32_t> &mesh : Get_Meshes(config))
+	{
+		Model model;
+		Load_Mesh(mesh, model);
+		size_t triangleCount = model.indices.size() / 3;
+
+		vector<CrackTarget> edges, vertices;
+		Find_Crack_Targets(model, edges, vertices);
+
+		mt19937 rng(11);
+		uniform_real_distribution<float> jitter(-0.3f, 0.3f);
+		for (int set = 0; set < 2; set++)
+		{
+			const vector<CrackTarget> &targets = (set == 0) ? edges : vertices;
+			size_t rays = 0, leaks[4] = {}, uvErrors = 0;
+			for (const CrackTarget &target : targets)
+			{
+				uint32_t count = static_cast<uint32_t>(target.triangles.size());
+				for (int r = 0; r < CrackRaysPerTarget; r++)
+				{
+					// Aim at the target against the average normal, tilted a little
+					XMVECTOR direction = XMVectorNegate(XMVector3Normalize(XMVectorAdd(XMLoadFloat3(&target.normal), XMVectorSet(jitter(rng), jitter(rng), jitter(rng), 0.f))));
+					XMVECTOR origin = XMVectorSubtract(XMLoadFloat3(&target.point), XMVectorScale(direction, 4.f * target.size));
+
+					CPURay ray;
+					XMStoreFloat3(&ray.origin, origin);
+					XMStoreFloat3(&ray.direction, direction);
+					ray.tMin = 0.f;
+					ray.tMax = FLT_MAX;
+					WatertightRay watertight = BVH::Get_Watertight_Ray(ray);
+					rays++;
+
+					CPUHit hits[4];
+					bool found[4] = {};
+					for (CPUHit &hit : hits) hit.t = ray.tMax;
+					for (uint32_t t : target.triangles)
+					{
+						found[0] |= Intersect_Moller_Trumbore(model, t, ray, hits[0]);
+						found[1] |= BVH::Intersect_Triangle(model, t, watertight, hits[1]);
+					}
+					found[2] = BVH::Intersect_Triangles4(model, target.triangles.data(), count, watertight, hits[2]);
+					found[3] = avx2 && BVH::Intersect_Triangles8(model, target.triangles.data(), count, watertight, hits[3]);
+					for (int k = 0; k < (avx2 ? 4 : 3); k++) leaks[k] += !found[k];
+
+					if (found[1])
+					{
+						// The hit point, from Attributes.uv as the closest hit shader interpolates it
+						const CPUHit &hit = hits[1];
+						XMVECTOR v0 = XMLoadFloat3(&model.vertices[model.indices[hit.triangleIndex * 3 + 0]].position);
+						XMVECTOR v1 = XMLoadFloat3(&model.vertices[model.indices[hit.triangleIndex * 3 + 1]].position);
+						XMVECTOR v2 = XMLoadFloat3(&model.vertices[model.indices[hit.triangleIndex * 3 + 2]].position);
+						XMVECTOR p = XMVectorAdd(XMVectorAdd(XMVectorScale(v0, 1.f - hit.uv.x - hit.uv.y), XMVectorScale(v1, hit.uv.x)), XMVectorScale(v2, hit.uv.y));
+						XMVECTOR expected = XMVectorAdd(origin, XMVectorScale(direction, hit.t));
+						float error = XMVectorGetX(XMVector3Length(XMVectorSubtract(p, expected)));
+						uvErrors += (error > 1e-4f * target.size + 1e-6f);
+					}
+				}
+			}
+
+			char avx8[16];
+			if (avx2) snprintf(avx8, sizeof(avx8), "%zu", leaks[3]);
+			else snprintf(avx8, sizeof(avx8), "n/a");
+			bool leaked = (leaks[1] + leaks[2] + leaks[3] + uvErrors) > 0;
+			passed &= !leaked;
+			Log("%-24s %12s %8s %10zu %12zu %12zu %12zu %12s %10zu %7s\n", (set == 0) ? mesh.first.c_str() : "", (set == 0) ? to_string(triangleCount).c_str() : "",
+				(set == 0) ? "edges" : "vertices", rays, leaks[0], leaks[1], leaks[2], avx8, uvErrors, leaked ? "FAIL" : "pass");
+		}
+	}
+
+	Log("%s\n", passed ? "All watertight tests passed" : "Rays leaked through the watertight tests, or hit points are wrong");
+	return passed;
+}
+
+/**
+* Measure ray-triangle tests per second for the Möller-Trumbore test, the scalar watertight test,
+* and the 4 and 8-wide watertight tests, on batches of triangles the size of a full BVH leaf.
+*/
+void Run_Triangle_Kernels(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool avx2 = Utils::HasAVX2();
+
+	Model model;
+	Create_Grid_Mesh(model, 10000);
+	uint32_t triangleCount = static_cast<uint32_t>(model.indices.size() / 3);
+
+	// Rays aimed at a random point inside one triangle of a batch of neighboring triangles
+	mt19937 rng(5);
+	uniform_real_distribution<float> unit(0.f, 1.f);
+	uniform_int_distribution<uint32_t> batch(0, triangleCount - KernelBatchSize);
+	uniform_int_distribution<uint32_t> member(0, KernelBatchSize - 1);
+	vector<CPURay> rays(KernelRayCount);
+	vector<uint32_t> firstTriangles(KernelRayCount);
+	for (uint32_t i = 0; i < KernelRayCount; i++)
+	{
+		firstTriangles[i] = batch(rng);
+		uint32_t t = firstTriangles[i] + member(rng);
+		float b1 = unit(rng), b2 = unit(rng);
+		if (b1 + b2 > 1.f)
+		{
+			b1 = 1.f - b1;
+			b2 = 1.f - b2;
+		}
+
+		XMVECTOR v0 = XMLoadFloat3(&model.vertices[model.indices[t * 3 + 0]].position);
+		XMVECTOR v1 = XMLoadFloat3(&model.vertices[model.indices[t * 3 + 1]].position);
+		XMVECTOR v2 = XMLoadFloat3(&model.vertices[model.indices[t * 3 + 2]].position);
+		XMVECTOR target = XMVectorAdd(v0, XMVectorAdd(XMVectorScale(XMVectorSubtract(v1, v0), b1), XMVectorScale(XMVectorSubtract(v2, v0), b2)));
+		XMVECTOR origin = XMVectorAdd(target, XMVectorSet(unit(rng) * 0.2f - 0.1f, 1.f, unit(rng) * 0.2f - 0.1f, 0.f));
+
+		CPURay &ray = rays[i];
+		XMStoreFloat3(&ray.origin, origin);
+		XMStoreFloat3(&ray.direction, XMVector3Normalize(XMVectorSubtract(target, origin)));
+		ray.tMin = 0.f;
+		ray.tMax = FLT_MAX;
+	}
+
+	vector<uint32_t> triangles(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; i++) triangles[i] = i;
+
+	Log("Ray-triangle kernels (%u threads, %u triangles per test)\n", threadCount, KernelBatchSize);
+	Log("%-16s %14s %10s\n", "kernel", "Mtests/s", "hits");
+
+	const char* names[] = { "moller-trumbore", "watertight", "watertight sse4", "watertight avx8" };
+	for (int kernel = 0; kernel < 4; kernel++)
+	{
+		if (kernel == 3 && !avx2)
+		{
+			Log("%-16s %14s %10s\n", names[kernel], "n/a", "");
+			continue;
+		}
+
+		size_t hitCount = 0;
+		double rate = Trace_Rays(rays, threadCount, hitCount, [&](const CPURay &ray, CPUHit &hit)
+		{
+			size_t i = &ray - rays.data();
+			const uint32_t* batchTriangles = &triangles[firstTriangles[i]];
+			hit.t = ray.tMax;
+			hit.triangleIndex = UINT32_MAX;
+			if (kernel == 0)
+			{
+				bool found = false;
+				for (uint32_t k = 0; k < KernelBatchSize; k++) found |= Intersect_Moller_Trumbore(model, batchTriangles[k], ray, hit);
+				return found;
+			}
+
+			WatertightRay watertight = BVH::Get_Watertight_Ray(ray);
+			if (kernel == 1)
+			{
+				bool found = false;
+				for (uint32_t k = 0; k < KernelBatchSize; k++) found |= BVH::Intersect_Triangle(model, batchTriangles[k], watertight, hit);
+				return found;
+			}
+			if (kernel == 2) return BVH::Intersect_Triangles4(model, batchTriangles, KernelBatchSize, watertight, hit);
+			return BVH::Intersect_Triangles8(model, batchTriangles, KernelBatchSize, watertight, hit);
+		});
+
+		Log("%-16s %14.2f %10zu\n", names[kernel], rate * KernelBatchSize, hitCount);
+	}
+}
+
+/**
+* Set up a view constant buffer that looks from eye to focus, like Utils::UpdateView.
+*/
+ViewCB Create_View(XMVECTOR eye, XMVECTOR focus, int width, int height)
+{
+	float fov = 65.f * (XM_PI / 180.f);
+	XMMATRIX view = XMMatrixLookAtLH(eye, focus, XMVectorSet(0.f, 1.f, 0.f, 0.f));
+	XMMATRIX invView = XMMatrixInverse(NULL, view);
+
+	ViewCB viewCB;
+	viewCB.view = XMMatrixTranspose(invView);
+	viewCB.viewOriginAndTanHalfFovY = XMFLOAT4(XMVectorGetX(eye), XMVectorGetY(eye), XMVectorGetZ(eye), tanf(fov * 0.5f));
+	viewCB.resolution = XMFLOAT2(static_cast<float>(width), static_cast<float>(height));
+	return viewCB;
+}
+
+/**
+* Create an RGBA8 checkerboard texture for benchmark scenes.
+*/
+void Create_Checker_Texture(TextureInfo &texture, int size)
+{
+	texture.width = size;
+	texture.height = size;
+	texture.stride = 4;
+	texture.pixels.resize(static_cast<size_t>(size) * size * 4);
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			uint8_t value = (((x / 32) + (y / 32)) & 1) ? 200 : 60;
+			uint8_t* texel = &texture.pixels[(static_cast<size_t>(y) * size + x) * 4];
+			texel[0] = value;
+			texel[1] = value;
+			texel[2] = value;
+			texel[3] = 255;
+		}
+	}
+}
+
+/**
+* Measure how CPU rendering scales with the thread count, splitting the image into equal bands of rows per thread
+* or into work-stealing tiles. The camera looks down at the mesh so the top of the image is sky, which costs far
+* less per pixel than the mesh and unbalances the row bands.
+*/
+void Run_Render_Scaling(const ConfigInfo &config)
+{
+	Model model;
+	Load_Mesh(config.model.empty() ? make_pair(string("grid"), 100000u) : make_pair(config.model, 0u), model);
+
+	TextureInfo texture;
+	Create_Checker_Texture(texture, 512);
+
+	CPUScene scene;
+	CPU::Create_Scene(scene, model, texture, "", 0);
+	scene.packetWidth = config.packetWidth;
+
+	const BVHNode &root = scene.bvh.nodes[0];
+	XMVECTOR boundsMin = XMLoadFloat3(&root.boundsMin);
+	XMVECTOR boundsMax = XMLoadFloat3(&root.boundsMax);
+	XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+	float diagonal = max(XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin))), 1e-3f);
+	XMVECTOR eye = XMVectorAdd(center, XMVectorSet(0.f, 0.25f * diagonal, -0.7f * diagonal, 0.f));
+
+	Log("Render scaling (%zu triangles, packet width %u, %u hardware threads)\n", model.indices.size() / 3, scene.packetWidth, Utils::GetThreadCount(0));
+	Log("%-10s %-10s %8s %10s %10s %10s %11s\n", "image", "scheduler", "threads", "ms", "Mrays/s", "speedup", "efficiency");
+
+	CPUImage image;
+	for (const int* resolution : ScalingResolutions)
+	{
+		ViewCB view = Create_View(eye, center, resolution[0], resolution[1]);
+		double pixels = static_cast<double>(resolution[0]) * resolution[1];
+
+		char name[32];
+		snprintf(name, sizeof(name), "%dx%d", resolution[0], resolution[1]);
+		for (int mode = 0; mode < 2; mode++)
+		{
+			scene.workStealing = (mode == 1);
+			double singleMs = 0.0;
+			for (unsigned threads : ScalingThreads)
+			{
+				double bestMs = DBL_MAX;
+				for (int run = 0; run < TraceRuns; run++)
+				{
+					auto start = chrono::high_resolution_clock::now();
+					CPU::Render(scene, view, image, threads);
+					bestMs = min(bestMs, Elapsed_Ms(start));
+				}
+				if (threads == 1) singleMs = bestMs;
+
+				double speedup = singleMs / bestMs;
+				Log("%-10s %-10s %8u %10.2f %10.2f %10.2f %10.1f%%\n", name, scene.workStealing ? "stealing" : "rows", threads, bestMs, pixels / (bestMs * 1000.0), speedup, 100.0 * speedup / threads);
+			}
+		}
+	}
+}
+
+/**
+* Get the memory used by a bottom-level structure and its geometry, in bytes.
+*/
+size_t Get_Memory(const CPUBottomLevelAS &blas)
+{
+	size_t bytes = blas.model->vertices.size() * sizeof(Vertex) + blas.model->indices.size() * sizeof(uint32_t);
+	bytes += blas.bvh.nodes.size() * sizeof(BVHNode) + blas.bvh.triangles.size() * sizeof(uint32_t);
+	bytes += blas.bvh8.nodes.size() * sizeof(BVH8Node) + blas.bvh8.triangles.size() * sizeof(uint32_t);
+	return bytes;
+}
+
+/**
+* Bake the instances of a two-level structure into a single model in world space.
+*/
+void Flatten_Instances(const CPUTopLevelAS &tlas, Model &model)
+{
+	vector<size_t> firstVertex(tlas.instances.size() + 1, 0), firstIndex(tlas.instances.size() + 1, 0);
+	for (size_t i = 0; i < tlas.instances.size(); i++)
+	{
+		const Model &instanceModel = *tlas.bottomLevels[tlas.instances[i].bottomLevel].model;
+		firstVertex[i + 1] = firstVertex[i] + instanceModel.vertices.size();
+		firstIndex[i + 1] = firstIndex[i] + instanceModel.indices.size();
+	}
+
+	model = Model();
+	model.vertices.resize(firstVertex.back());
+	model.indices.resize(firstIndex.back());
+	Utils::ParallelFor(tlas.instances.size(), 0, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const CPUInstance &instance = tlas.instances[i];
+			const Model &instanceModel = *tlas.bottomLevels[instance.bottomLevel].model;
+			XMMATRIX transform = XMLoadFloat3x4(&instance.transform);
+			for (size_t v = 0; v < instanceModel.vertices.size(); v++)
+			{
+				Vertex &vertex = model.vertices[firstVertex[i] + v];
+				vertex = instanceModel.vertices[v];
+				XMStoreFloat3(&vertex.position, XMVector3TransformCoord(XMLoadFloat3(&vertex.position), transform));
+			}
+			for (size_t n = 0; n < instanceModel.indices.size(); n++)
+			{
+				model.indices[firstIndex[i] + n] = static_cast<uint32_t>(instanceModel.indices[n] + firstVertex[i]);
+			}
+		}
+	});
+}
+
+/**
+* Compare a two-level structure of many instances sharing one bottom-level BVH with the same scene flattened into a single BVH:
+* build time, memory and rays per second. The instances alternate between InstanceMask 0x1 and 0x2, and the two-level structure
+* is also traced with InstanceInclusionMask 0x1, which skips half of them.
+*/
+void Run_Instances(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+
+	Model mesh;
+	Load_Mesh(config.model.empty() ? make_pair(string("grid"), InstanceMeshTriangles) : make_pair(config.model, 0u), mesh);
+
+	CPUTopLevelAS tlas;
+	tlas.bottomLevels.resize(1);
+	auto start = chrono::high_resolution_clock::now();
+	BVH::Build(tlas.bottomLevels[0], mesh, threadCount);
+	double blasMs = Elapsed_Ms(start);
+	if (tlas.bottomLevels[0].bvh.nodes.empty())
+	{
+		Log("The instanced mesh has no triangles\n");
+		return;
+	}
+
+	// Lay the instances out on a grid, with random rotations, scales and heights
+	const BVHNode &meshRoot = tlas.bottomLevels[0].bvh.nodes[0];
+	float spacing = 1.2f * max(meshRoot.boundsMax.x - meshRoot.boundsMin.x, meshRoot.boundsMax.z - meshRoot.boundsMin.z);
+	mt19937 rng(7);
+	uniform_real_distribution<float> unit(0.f, 1.f);
+	tlas.instances.resize(static_cast<size_t>(InstanceGridSize) * InstanceGridSize);
+	for (uint32_t i = 0; i < tlas.instances.size(); i++)
+	{
+		float x = (static_cast<float>(i % InstanceGridSize) - InstanceGridSize * 0.5f) * spacing;
+		float z = (static_cast<float>(i / InstanceGridSize) - InstanceGridSize * 0.5f) * spacing;
+		float scale = 0.8f + 0.4f * unit(rng);
+		XMMATRIX transform = XMMatrixMultiply(XMMatrixMultiply(XMMatrixScaling(scale, scale, scale), XMMatrixRotationY(unit(rng) * XM_2PI)), XMMatrixTranslation(x, unit(rng) * spacing * 0.2f, z));
+
+		CPUInstance &instance = tlas.instances[i];
+		XMStoreFloat3x4(&instance.transform, transform);
+		instance.instanceID = i;
+		instance.instanceMask = (i & 1) ? 0x2 : 0x1;
+		instance.hitGroupIndex = 0;
+		instance.bottomLevel = 0;
+	}
+
+	start = chrono::high_resolution_clock::now();
+	BVH::Build(tlas, threadCount);
+	double tlasMs = blasMs + Elapsed_Ms(start);
+	size_t tlasBytes = Get_Memory(tlas.bottomLevels[0]) + tlas.instances.size() * sizeof(CPUInstance);
+	tlasBytes += tlas.bvh.nodes.size() * sizeof(BVHNode) + tlas.bvh.triangles.size() * sizeof(uint32_t);
+
+	vector<CPURay> coherent, incoherent;
+	Create_Rays(tlas.bvh.nodes[0], coherent, incoherent);
+
+	size_t meshTriangles = mesh.indices.size() / 3;
+	size_t sceneTriangles = meshTriangles * tlas.instances.size();
+	Log("Two-level vs flattened BVH (%u threads, %zu instances of %zu triangles, %d rays per set)\n", threadCount, tlas.instances.size(), meshTriangles, RayImageSize * RayImageSize);
+	Log("%-20s %12s %10s %10s %14s %14s %10s\n", "structure", "unique tris", "build ms", "MB", "coherent Mr/s", "incoherent Mr/s", "hits");
+
+	const uint32_t masks[] = { 0xFF, 0x1 };
+	for (uint32_t mask : masks)
+	{
+		size_t hits[2];
+		auto intersect = [&](const CPURay &ray, CPUHit &hit) { return BVH::Intersect(tlas, ray, mask, hit); };
+		double coherentRate = Trace_Rays(coherent, threadCount, hits[0], intersect);
+		double incoherentRate = Trace_Rays(incoherent, threadCount, hits[1], intersect);
+
+		char name[32];
+		snprintf(name, sizeof(name), "two-level mask 0x%X", mask);
+		Log("%-20s %12zu %10.2f %10.2f %14.2f %14.2f %10zu\n", name, meshTriangles, tlasMs, tlasBytes / (1024.0 * 1024.0), coherentRate, incoherentRate, hits[0]);
+	}
+
+	if (sceneTriangles > config.benchmarkTriangles)
+	{
+		Log("%-20s %12zu skipped, larger than -maxtriangles\n", "flattened", sceneTriangles);
+		return;
+	}
+
+	Model flattened;
+	Flatten_Instances(tlas, flattened);
+	CPUBottomLevelAS flat;
+	start = chrono::high_resolution_clock::now();
+	BVH::Build(flat, flattened, threadCount);
+	double flatMs = Elapsed_Ms(start);
+
+	size_t hits[2];
+	auto intersect = [&](const CPURay &ray, CPUHit &hit)
+	{
+		return flat.bvh8.nodes.empty() ? BVH::Intersect(flat.bvh, flattened, ray, hit) : BVH::Intersect(flat.bvh8, flattened, ray, hit);
+	};
+	double coherentRate = Trace_Rays(coherent, threadCount, hits[0], intersect);
+	double incoherentRate = Trace_Rays(incoherent, threadCount, hits[1], intersect);
+	Log("%-20s %12zu %10.2f %10.2f %14.2f %14.2f %10zu\n", "flattened", sceneTriangles, flatMs, Get_Memory(flat) / (1024.0 * 1024.0), coherentRate, incoherentRate, hits[0]);
+}
+
+/**
+* Deform a mesh with a vortex around its vertical axis, which twists the center more than the rim,
+* so triangles that started out side by side drift apart over time.
+*/
+void Animate_Mesh(const Model &rest, Model &model, float time)
+{
+	XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX), boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const Vertex &vertex : rest.vertices)
+	{
+		boundsMin = XMFLOAT3(min(boundsMin.x, vertex.position.x), min(boundsMin.y, vertex.position.y), min(boundsMin.z, vertex.position.z));
+		boundsMax = XMFLOAT3(max(boundsMax.x, vertex.position.x), max(boundsMax.y, vertex.position.y), max(boundsMax.z, vertex.position.z));
+	}
+	float centerX = (boundsMin.x + boundsMax.x) * 0.5f;
+	float centerZ = (boundsMin.z + boundsMax.z) * 0.5f;
+	float radius = max(max(boundsMax.x - boundsMin.x, boundsMax.z - boundsMin.z) * 0.5f, 1e-3f);
+
+	model.vertices = rest.vertices;
+	model.indices = rest.indices;
+	Utils::ParallelFor(model.vertices.size(), 0, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			XMFLOAT3 &position = model.vertices[i].position;
+			float x = position.x - centerX, z = position.z - centerZ;
+			float r = sqrtf(x * x + z * z) / radius;
+			float angle = time * XM_2PI * max(1.f - r, 0.f);
+			float c = cosf(angle), s = sinf(angle);
+			position.x = centerX + c * x - s * z;
+			position.z = centerZ + s * x + c * z;
+			position.y += 0.1f * radius * sinf(time * XM_2PI + r * 8.f);
+		}
+	});
+}
+
+/**
+* Compare ways of keeping the BVH of a deforming mesh up to date over an animation: a full rebuild every frame, refitting every frame,
+* refitting with a rebuild every few frames, and refitting with a rebuild when the SAH cost has degraded (BVH::Update).
+* Reports the update time per frame (including the BVH8 collapse when AVX2 is available), the SAH cost, and the trace speed of primary rays.
+*/
+void Run_Refit(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool avx2 = Utils::HasAVX2();
+
+	Model rest;
+	Load_Mesh(config.model.empty() ? make_pair(string("grid"), 100000u) : make_pair(config.model, 0u), rest);
+	if (rest.indices.empty()) return;
+
+	BVHTree bvh;
+	BVH8Tree bvh8;
+	BVH::Build(bvh, rest, threadCount);
+
+	vector<CPURay> coherent, incoherent, rays;
+	Create_Rays(bvh.nodes[0], coherent, incoherent);
+	for (size_t i = 0; i < coherent.size(); i += AnimationRayStride) rays.push_back(coherent[i]);
+
+	Log("BVH updates over %d animated frames (%u threads, %zu triangles, %zu rays per frame)\n", AnimationFrames, threadCount, rest.indices.size() / 3, rays.size());
+	Log("%-22s %10s %12s %10s %10s %10s %10s\n", "strategy", "rebuilds", "update ms", "mean SAH", "final SAH", "Mrays/s", "frame ms");
+
+	const char* names[] = { "rebuild", "refit", "refit + rebuild/10", "refit + SAH monitor" };
+	for (int strategy = 0; strategy < 4; strategy++)
+	{
+		// The first update builds the tree for the rest pose
+		Model model = rest;
+		BVHUpdateState state;
+		BVH::Update(bvh, model, state, threadCount);
+
+		double updateMs = 0.0, traceMs = 0.0, totalCost = 0.0;
+		uint32_t rebuilds = 0;
+		float cost = 0.f;
+		for (int frame = 1; frame <= AnimationFrames; frame++)
+		{
+			Animate_Mesh(rest, model, static_cast<float>(frame) / AnimationFrames);
+
+			auto start = chrono::high_resolution_clock::now();
+			if (strategy == 0 || (strategy == 2 && frame % RebuildInterval == 0))
+			{
+				BVH::Build(bvh, model, threadCount);
+				rebuilds++;
+			}
+			else if (strategy == 3)
+			{
+				if (BVH::Update(bvh, model, state, threadCount)) rebuilds++;
+			}
+			else
+			{
+				BVH::Refit(bvh, model, threadCount);
+			}
+			if (avx2) BVH::Collapse(bvh8, bvh);
+			updateMs += Elapsed_Ms(start);
+
+			cost = BVH::Get_SAH_Cost(bvh);
+			totalCost += cost;
+
+			size_t hitCount = 0;
+			double rate = Trace_Rays(rays, threadCount, hitCount, [&](const CPURay &ray, CPUHit &hit)
+			{
+				return avx2 ? BVH::Intersect(bvh8, model, ray, hit) : BVH::Intersect(bvh, model, ray, hit);
+			});
+			traceMs += rays.size() / (rate * 1000.0);
+		}
+
+		Log("%-22s %10u %12.2f %10.2f %10.2f %10.2f %10.2f\n", names[strategy], rebuilds, updateMs / AnimationFrames, totalCost / AnimationFrames, cost,
+			rays.size() * AnimationFrames / (traceMs * 1000.0), (updateMs + traceMs) / AnimationFrames);
+	}
+}
+
+/**
+* Compare starting up from a BVH cache file with building the BVH: build and collapse time, file size, and load time,
+* which includes mapping the file, hashing the model and validating the nodes. Also checks that the loaded trees match the
+* built ones and use the mapped file in place, and that the cache is rejected once the model changes.
+*/
+void Run_BVH_Cache(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool avx2 = Utils::HasAVX2();
+	Log("BVH cache (%u threads)\n", threadCount);
+	Log("%-24s %12s %10s %10s %10s %10s %10s %10s %10s\n", "mesh", "triangles", "build ms", "save ms", "file MB", "hash ms", "load ms", "speedup", "check");
+
+	for (const pair<string, uint32_t> &mesh : Get_Meshes(config))
+	{
+		Model model;
+		Load_Mesh(mesh, model);
+		size_t triangleCount = model.indices.size() / 3;
+
+		BVHTree bvh;
+		BVH8Tree bvh8;
+		auto start = chrono::high_resolution_clock::now();
+		BVH::Build(bvh, model, threadCount);
+		if (avx2) BVH::Collapse(bvh8, bvh);
+		double buildMs = Elapsed_Ms(start);
+
+		start = chrono::high_resolution_clock::now();
+		bool saved = BVH::Save_Cache(CacheBenchmarkPath, model, bvh, bvh8, threadCount);
+		double saveMs = Elapsed_Ms(start);
+		if (!saved)
+		{
+			Log("%-24s %12zu failed to write %s\n", mesh.first.c_str(), triangleCount, CacheBenchmarkPath);
+			continue;
+		}
+
+		start = chrono::high_resolution_clock::now();
+		BVH::Get_Content_Hash(model, threadCount);
+		double hashMs = Elapsed_Ms(start);
+
+		BVHTree loaded;
+		BVH8Tree loaded8;
+		start = chrono::high_resolution_clock::now();
+		bool hit = BVH::Load_Cache(CacheBenchmarkPath, model, loaded, loaded8, threadCount);
+		double loadMs = Elapsed_Ms(start);
+
+		bool same = hit && loaded.nodes.size() == bvh.nodes.size() && loaded.triangles == bvh.triangles && loaded8.nodes.size() == bvh8.nodes.size();
+		same = same && memcmp(loaded.nodes.data(), bvh.nodes.data(), bvh.nodes.size() * sizeof(BVHNode)) == 0;
+		same = same && memcmp(loaded8.nodes.data(), bvh8.nodes.data(), bvh8.nodes.size() * sizeof(BVH8Node)) == 0;
+		bool inPlace = hit && loaded.nodes.Is_View() && loaded.triangles.Is_View() && (bvh8.nodes.empty() || loaded8.nodes.Is_View());
+
+		// Nudge one vertex, the cache must no longer match
+		model.vertices[0].position.x += 1e-3f;
+		bool stale = BVH::Load_Cache(CacheBenchmarkPath, model, loaded, loaded8, threadCount);
+
+		ifstream file(CacheBenchmarkPath, ios::binary | ios::ate);
+		double fileMegabytes = static_cast<double>(file.tellg()) / (1024.0 * 1024.0);
+		file.close();
+		remove(CacheBenchmarkPath);
+
+		const char* check = !same ? "mismatch" : (!inPlace ? "copied" : (stale ? "stale hit" : "ok"));
+		Log("%-24s %12zu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %10s\n", mesh.first.c_str(), triangleCount, buildMs, saveMs, fileMegabytes, hashMs, loadMs, buildMs / loadMs, check);
+	}
+}
+
+/**
+* Compare the linear BVH builder, with 30 and 63-bit Morton codes, with the binned SAH builder: builds per second,
+* SAH cost, and rays per second, to choose between BVH_BUILD_FLAG_PREFER_FAST_BUILD and BVH_BUILD_FLAG_PREFER_FAST_TRACE per mesh.
+*/
+void Run_Linear_BVH(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool avx2 = Utils::HasAVX2();
+	Log("Linear vs binned SAH BVH builds (%u threads, %d rays per set)\n", threadCount, RayImageSize * RayImageSize);
+	Log("%-24s %12s %8s %10s %10s %10s %14s %14s %10s\n", "mesh", "triangles", "builder", "build ms", "builds/s", "SAH cost", "coherent Mr/s", "incoherent Mr/s", "penalty");
+
+	for (const pair<string, uint32_t> &mesh : Get_Meshes(config))
+	{
+		Model model;
+		Load_Mesh(mesh, model);
+		size_t triangleCount = model.indices.size() / 3;
+		vector<CPURay> coherent, incoherent;
+
+		const char* names[] = { "sah", "lbvh30", "lbvh63" };
+		double sahRate = 0.0;
+		size_t sahHits = 0;
+		for (int builder = 0; builder < 3; builder++)
+		{
+			// Repeat small builds so the timing is stable, and keep the fastest
+			BVHTree bvh;
+			int runs = static_cast<int>(min(max(1000000 / max(triangleCount, static_cast<size_t>(1)), static_cast<size_t>(1)), static_cast<size_t>(10)));
+			double bestMs = DBL_MAX;
+			for (int run = 0; run < runs; run++)
+			{
+				auto start = chrono::high_resolution_clock::now();
+				if (builder == 0) BVH::Build(bvh, model, threadCount);
+				else BVH::Build_Linear(bvh, model, (builder == 1) ? 30 : 63, threadCount);
+				bestMs = min(bestMs, Elapsed_Ms(start));
+			}
+			if (coherent.empty()) Create_Rays(bvh.nodes[0], coherent, incoherent);
+
+			BVH8Tree bvh8;
+			if (avx2) BVH::Collapse(bvh8, bvh);
+			auto intersect = [&](const CPURay &ray, CPUHit &hit) { return avx2 ? BVH::Intersect(bvh8, model, ray, hit) : BVH::Intersect(bvh, model, ray, hit); };
+			size_t hits[2];
+			double coherentRate = Trace_Rays(coherent, threadCount, hits[0], intersect);
+			double incoherentRate = Trace_Rays(incoherent, threadCount, hits[1], intersect);
+			double rate = coherentRate + incoherentRate;
+			if (builder == 0)
+			{
+				sahRate = rate;
+				sahHits = hits[0] + hits[1];
+			}
+
+			Log("%-24s %12zu %8s %10.2f %10.2f %10.2f %14.2f %14.2f %9.1f%%\n", mesh.first.c_str(), triangleCount, names[builder], bestMs, 1000.0 / bestMs,
+				BVH::Get_SAH_Cost(bvh), coherentRate, incoherentRate, 100.0 * (1.0 - rate / sahRate));
+			if (hits[0] + hits[1] != sahHits) Log("  warning: hit counts differ from the SAH BVH (%zu vs %zu)\n", hits[0] + hits[1], sahHits);
+		}
+	}
+}
+
+/**
+* Create an architectural interior with roughly the requested number of triangles: floors, walls and diagonal walls made of
+* a few huge triangles, long thin beams, and small boxes of clutter filling the rooms. The large and long triangles make the
+* bounds of object split nodes overlap, like the walls and floors of the cinema scene.
+*/
+void Create_Architecture_Mesh(Model &model, uint32_t triangleCount)
+{
+	const int floors = 4;
+	const float size = 100.f, height = 4.f;
+	mt19937 rng(7);
+	uniform_real_distribution<float> unit(0.f, 1.f);
+
+	model.vertices.clear();
+	model.indices.clear();
+	auto add_quad = [&](XMFLOAT3 a, XMFLOAT3 b, XMFLOAT3 c, XMFLOAT3 d)
+	{
+		uint32_t first = static_cast<uint32_t>(model.vertices.size());
+		for (const XMFLOAT3 &p : { a, b, c, d }) model.vertices.push_back({ p, XMFLOAT2(0.f, 0.f) });
+		for (uint32_t i : { 0u, 1u, 2u, 0u, 2u, 3u }) model.indices.push_back(first + i);
+	};
+
+	for (int level = 0; level < floors; level++)
+	{
+		float y0 = level * height, y1 = y0 + height;
+		add_quad(XMFLOAT3(0.f, y0, 0.f), XMFLOAT3(0.f, y0, size), XMFLOAT3(size, y0, size), XMFLOAT3(size, y0, 0.f));
+		for (int wall = 0; wall <= 10; wall++)
+		{
+			float w = wall * size / 10.f;
+			add_quad(XMFLOAT3(w, y0, 0.f), XMFLOAT3(w, y1, 0.f), XMFLOAT3(w, y1, size), XMFLOAT3(w, y0, size));
+			add_quad(XMFLOAT3(0.f, y0, w), XMFLOAT3(0.f, y1, w), XMFLOAT3(size, y1, w), XMFLOAT3(size, y0, w));
+		}
+		add_quad(XMFLOAT3(0.f, y0, 0.f), XMFLOAT3(0.f, y1, 0.f), XMFLOAT3(size, y1, size), XMFLOAT3(size, y0, size));
+		add_quad(XMFLOAT3(size, y0, 0.f), XMFLOAT3(size, y1, 0.f), XMFLOAT3(0.f, y1, size), XMFLOAT3(0.f, y0, size));
+	}
+	add_quad(XMFLOAT3(0.f, floors * height, 0.f), XMFLOAT3(0.f, floors * height, size), XMFLOAT3(size, floors * height, size), XMFLOAT3(size, floors * height, 0.f));
+
+	// Long thin beams across the building, one in 400 triangles
+	uint32_t beams = max(triangleCount / 800, 1u);
+	for (uint32_t i = 0; i < beams; i++)
+	{
+		XMFLOAT3 a(unit(rng) * size, unit(rng) * floors * height, unit(rng) * size);
+		XMFLOAT3 b(unit(rng) * size, unit(rng) * floors * height, unit(rng) * size);
+		add_quad(a, XMFLOAT3(a.x, a.y + 0.05f, a.z), XMFLOAT3(b.x, b.y + 0.05f, b.z), b);
+	}
+
+	// Small boxes fill the rest
+	while (model.indices.size() / 3 + 12 <= triangleCount)
+	{
+		float extent = 0.1f + unit(rng) * 0.4f;
+		float x = unit(rng) * size, z = unit(rng) * size;
+		float y = floorf(unit(rng) * floors) * height;
+		XMFLOAT3 lo(x - extent, y, z - extent), hi(x + extent, y + extent * 2.f, z + extent);
+		add_quad(XMFLOAT3(lo.x, lo.y, lo.z), XMFLOAT3(lo.x, hi.y, lo.z), XMFLOAT3(hi.x, hi.y, lo.z), XMFLOAT3(hi.x, lo.y, lo.z));
+		add_quad(XMFLOAT3(hi.x, lo.y, hi.z), XMFLOAT3(hi.x, hi.y, hi.z), XMFLOAT3(lo.x, hi.y, hi.z), XMFLOAT3(lo.x, lo.y, hi.z));
+		add_quad(XMFLOAT3(lo.x, lo.y, hi.z), XMFLOAT3(lo.x, hi.y, hi.z), XMFLOAT3(lo.x, hi.y, lo.z), XMFLOAT3(lo.x, lo.y, lo.z));
+		add_quad(XMFLOAT3(hi.x, lo.y, lo.z), XMFLOAT3(hi.x, hi.y, lo.z), XMFLOAT3(hi.x, hi.y, hi.z), XMFLOAT3(hi.x, lo.y, hi.z));
+		add_quad(XMFLOAT3(lo.x, hi.y, lo.z), XMFLOAT3(lo.x, hi.y, hi.z), XMFLOAT3(hi.x, hi.y, hi.z), XMFLOAT3(hi.x, hi.y, lo.z));
+		add_quad(XMFLOAT3(lo.x, lo.y, hi.z), XMFLOAT3(lo.x, lo.y, lo.z), XMFLOAT3(hi.x, lo.y, lo.z), XMFLOAT3(hi.x, lo.y, hi.z));
+	}
+}
+
+/**
+* Compare spatial split BVHs, over a few duplicate reference budgets, with the object split SAH BVH on meshes with large and
+* long thin triangles: build time, node count, triangle references, SAH cost and rays per second.
+*/
+void Run_Spatial_Splits(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool avx2 = Utils::HasAVX2();
+	Log("Spatial vs object split BVHs (%u threads, %d rays per set, overlap budget %g)\n", threadCount, RayImageSize * RayImageSize, SpatialOverlapBudget);
+	Log("%-24s %12s %10s %10s %10s %12s %10s %14s %14s %10s\n", "mesh", "triangles", "builder", "build ms", "nodes", "references", "SAH cost", "coherent Mr/s", "incoherent Mr/s", "speedup");
+
+	vector<pair<string, uint32_t>> meshes;
+	if (!config.model.empty()) meshes.push_back({ config.model, 0 });
+	for (uint32_t size : SpatialMeshSizes)
+	{
+		if (size <= config.benchmarkTriangles) meshes.push_back({ "architecture", size });
+	}
+
+	for (const pair<string, uint32_t> &mesh : meshes)
+	{
+		Model model;
+		if (mesh.second == 0) Load_Mesh(mesh, model);
+		else Create_Architecture_Mesh(model, mesh.second);
+		size_t triangleCount = model.indices.size() / 3;
+		vector<CPURay> coherent, incoherent;
+
+		double objectRate = 0.0;
+		size_t objectHits = 0;
+		for (int builder = -1; builder < static_cast<int>(size(SpatialDuplicateBudgets)); builder++)
+		{
+			BVHTree bvh;
+			auto start = chrono::high_resolution_clock::now();
+			if (builder < 0) BVH::Build(bvh, model, threadCount);
+			else BVH::Build_Spatial(bvh, model, SpatialOverlapBudget, SpatialDuplicateBudgets[builder], threadCount);
+			double buildMs = Elapsed_Ms(start);
+			if (coherent.empty()) Create_Rays(bvh.nodes[0], coherent, incoherent);
+
+			BVH8Tree bvh8;
+			if (avx2) BVH::Collapse(bvh8, bvh);
+			auto intersect = [&](const CPURay &ray, CPUHit &hit) { return avx2 ? BVH::Intersect(bvh8, model, ray, hit) : BVH::Intersect(bvh, model, ray, hit); };
+			size_t hits[2];
+			double coherentRate = Trace_Rays(coherent, threadCount, hits[0], intersect);
+			double incoherentRate = Trace_Rays(incoherent, threadCount, hits[1], intersect);
+			double rate = coherentRate + incoherentRate;
+			if (builder < 0)
+			{
+				objectRate = rate;
+				objectHits = hits[0] + hits[1];
+			}
+
+			char name[32];
+			if (builder < 0) snprintf(name, sizeof(name), "object");
+			else snprintf(name, sizeof(name), "sbvh %.0f%%", SpatialDuplicateBudgets[builder] * 100.f);
+			Log("%-24s %12zu %10s %10.2f %10zu %11.2fx %10.2f %14.2f %14.2f %9.2fx\n", mesh.first.c_str(), triangleCount, name, buildMs, bvh.nodes.size(),
+				static_cast<double>(bvh.triangles.size()) / triangleCount, BVH::Get_SAH_Cost(bvh), coherentRate, incoherentRate, rate / objectRate);
+			if (hits[0] + hits[1] != objectHits) Log("  warning: hit counts differ from the object split BVH (%zu vs %zu)\n", hits[0] + hits[1], objectHits);
+		}
+	}
+}
+
+/**
+* Write the counts of a histogram as a JSON array.
+*/
+void Write_JSON_Array(ofstream &file, const vector<uint32_t> &values)
+{
+	file << "[";
+	for (size_t i = 0; i < values.size(); i++) file << (i > 0 ? ", " : "") << values[i];
+	file << "]";
+}
+
+/**
+* Build the BVH of each mesh with the SAH, linear and spatial split builders, and write the quality of each tree and the
+* traversal work of a fixed ray workload to a JSON file. The workload is the coherent and incoherent ray sets of the
+* benchmarks, which depend only on the mesh bounds, so the counts are comparable between builds of the application.
+*/
+bool Write_BVH_Stats(const ConfigInfo &config)
+{
+	ofstream file(config.bvhStats);
+	if (!file.is_open())
+	{
+		Log("Error: failed to open %s\n", config.bvhStats.c_str());
+		return false;
+	}
+
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	const char* builders[] = { "sah", "lbvh", "sbvh" };
+	vector<pair<string, uint32_t>> meshes = Get_Meshes(config);
+	file << "{\n  \"meshes\": [";
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		Model model;
+		Load_Mesh(meshes[m], model);
+		file << (m > 0 ? "," : "") << "\n    {\n";
+		file << "      \"name\": \"" << meshes[m].first << "\",\n";
+		file << "      \"triangles\": " << model.indices.size() / 3 << ",\n";
+		file << "      \"builders\": [";
+
+		vector<CPURay> coherent, incoherent;
+		for (int b = 0; b < 3; b++)
+		{
+			BVHTree bvh;
+			auto start = chrono::high_resolution_clock::now();
+			if (b == 0) BVH::Build(bvh, model, threadCount);
+			else if (b == 1) BVH::Build_Linear(bvh, model, 0, threadCount);
+			else BVH::Build_Spatial(bvh, model, SpatialOverlapBudget, SpatialDuplicateBudgets[1], threadCount);
+			double buildMs = Elapsed_Ms(start);
+			if (bvh.nodes.empty()) continue;
+			if (coherent.empty()) Create_Rays(bvh.nodes[0], coherent, incoherent);
+
+			BVHStats stats;
+			BVH::Get_Stats(bvh, model, stats, threadCount);
+			Log("%-24s %6s: %zu nodes, SAH %.2f, EPO %.4f\n", meshes[m].first.c_str(), builders[b], stats.nodeCount, stats.sahCost, stats.epo);
+
+			file << (b > 0 ? "," : "") << "\n        {\n";
+			file << "          \"builder\": \"" << builders[b] << "\",\n";
+			file << "          \"buildMs\": " << buildMs << ",\n";
+			file << "          \"nodes\": " << stats.nodeCount << ",\n";
+			file << "          \"leaves\": " << stats.leafCount << ",\n";
+			file << "          \"references\": " << stats.references << ",\n";
+			file << "          \"maxDepth\": " << stats.maxDepth << ",\n";
+			file << "          \"sahCost\": " << stats.sahCost << ",\n";
+			file << "          \"epo\": " << stats.epo << ",\n";
+			file << "          \"memoryBytes\": " << stats.memoryBytes << ",\n";
+			file << "          \"leafSizes\": ";
+			Write_JSON_Array(file, stats.leafSizes);
+			file << ",\n          \"leafDepths\": ";
+			Write_JSON_Array(file, stats.leafDepths);
+			file << ",\n          \"rays\": [";
+
+			// Count the traversal work per thread, and add it up at the end
+			const char* setNames[] = { "coherent", "incoherent" };
+			const vector<CPURay>* sets[] = { &coherent, &incoherent };
+			for (int r = 0; r < 2; r++)
+			{
+				mutex lock;
+				BVHTraversalStats traversal;
+				Utils::ParallelFor(sets[r]->size(), threadCount, [&](size_t begin, size_t end)
+				{
+					BVHTraversalStats local;
+					for (size_t i = begin; i < end; i++)
+					{
+						CPUHit hit;
+						BVH::Intersect_Counted(bvh, model, (*sets[r])[i], hit, local);
+					}
+
+					lock_guard<mutex> guard(lock);
+					traversal.rays += local.rays;
+					traversal.hits += local.hits;
+					traversal.nodeVisits += local.nodeVisits;
+					traversal.boxTests += local.boxTests;
+					traversal.triangleTests += local.triangleTests;
+				});
+
+				double rays = static_cast<double>(max(traversal.rays, static_cast<uint64_t>(1)));
+				file << (r > 0 ? "," : "") << "\n            { ";
+				file << "\"set\": \"" << setNames[r] << "\", ";
+				file << "\"rays\": " << traversal.rays << ", ";
+				file << "\"hits\": " << traversal.hits << ", ";
+				file << "\"nodeVisitsPerRay\": " << traversal.nodeVisits / rays << ", ";
+				file << "\"boxTestsPerRay\": " << traversal.boxTests / rays << ", ";
+				file << "\"triangleTestsPerRay\": " << traversal.triangleTests / rays << " }";
+			}
+			file << "\n          ]\n        }";
+		}
+		file << "\n      ]\n    }";
+	}
+	file << "\n  ]\n}\n";
+
+	Log("Wrote BVH stats for %zu meshes to %s\n", meshes.size(), config.bvhStats.c_str());
+	return true;
+}
+
+/**
+* Create a texture of random texels, so filtering and mip levels see no constant regions.
+*/
+void Create_Noise_Texture(TextureInfo &texture, int width, int height)
+{
+	texture.width = width;
+	texture.height = height;
+	texture.stride = 4;
+	texture.pixels.resize(static_cast<size_t>(width) * height * 4);
+	mt19937 random(width * 31 + height);
+	uniform_int_distribution<int> channel(0, 255);
+	for (uint8_t &value : texture.pixels) value = static_cast<uint8_t>(channel(random));
+}
+
+/**
+* Measure texture sampling throughput of the scalar, 4-wide and 8-wide samplers with point, bilinear and trilinear
+* filtering, over coherent (scanline order, full resolution) and random (wrapping coordinates, random level of detail)
+* coordinates. Also checks that point sampling of the full resolution level matches the Load the shaders and CPU
+* renderer do, and that the SIMD samplers return the same bits as the scalar sampler for every filter and address mode.
+*/
+void Run_Texture_Sampling(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool avx2 = Utils::HasAVX2();
+	const char* filters[] = { "point", "bilinear", "trilinear" };
+	const char* widths[] = { "scalar", "4-wide", "8-wide" };
+	Log("Texture sampling (%u threads, %zu samples per set%s)\n", threadCount, SamplerSampleCount, avx2 ? "" : ", no AVX2: 8-wide skipped");
+	Log("%-12s %8s %10s %8s %16s %16s\n", "texture", "levels", "filter", "sampler", "coherent Ms/s", "random Ms/s");
+
+	for (const int* size : SamplerTextureSizes)
+	{
+		TextureInfo source;
+		Create_Noise_Texture(source, size[0], size[1]);
+		CPUTexture texture;
+		Texture::Create(texture, source, threadCount);
+		char name[32];
+		snprintf(name, sizeof(name), "%dx%d", size[0], size[1]);
+
+		// Coherent: rows of the full resolution level in order. Random: coordinates in [-1, 2) and any level of detail.
+		vector<float> u[2], v[2], lod[2];
+		mt19937 random(size[0]);
+		uniform_real_distribution<float> coordinate(-1.f, 2.f);
+		uniform_real_distribution<float> level(0.f, static_cast<float>(texture.levels.size() - 1));
+		for (int set = 0; set < 2; set++)
+		{
+			u[set].resize(SamplerSampleCount);
+			v[set].resize(SamplerSampleCount);
+			lod[set].resize(SamplerSampleCount);
+		}
+		for (size_t i = 0; i < SamplerSampleCount; i++)
+		{
+			u[0][i] = (static_cast<float>(i % size[0]) + 0.3f) / size[0];
+			v[0][i] = (static_cast<float>((i / size[0]) % size[1]) + 0.7f) / size[1];
+			lod[0][i] = 0.f;
+			u[1][i] = coordinate(random);
+			v[1][i] = coordinate(random);
+			lod[1][i] = level(random);
+		}
+
+		vector<XMFLOAT4> colors(SamplerSampleCount);
+		for (int filter = 0; filter < 3; filter++)
+		{
+			CPUSampler sampler;
+			sampler.filter = static_cast<CPUTextureFilter>(filter);
+			for (int width = 0; width < 3; width++)
+			{
+				if (width == 2 && !avx2) continue;
+				double rates[2];
+				for (int set = 0; set < 2; set++)
+				{
+					auto start = chrono::high_resolution_clock::now();
+					Utils::ParallelFor(SamplerSampleCount / 8, threadCount, [&](size_t begin, size_t end)
+					{
+						for (size_t i = begin * 8; i < end * 8; i += 8)
+						{
+							if (width == 2) Texture::Sample8(texture, sampler, &u[set][i], &v[set][i], &lod[set][i], &colors[i]);
+							else if (width == 1)
+							{
+								Texture::Sample4(texture, sampler, &u[set][i], &v[set][i], &lod[set][i], &colors[i]);
+								Texture::Sample4(texture, sampler, &u[set][i + 4], &v[set][i + 4], &lod[set][i + 4], &colors[i + 4]);
+							}
+							else
+							{
+								for (size_t j = i; j < i + 8; j++) colors[j] = Texture::Sample(texture, sampler, XMFLOAT2(u[set][j], v[set][j]), lod[set][j]);
+							}
+						}
+					});
+					rates[set] = SamplerSampleCount / (Elapsed_Ms(start) * 1000.0);
+				}
+				Log("%-12s %8zu %10s %8s %16.2f %16.2f\n", name, texture.levels.size(), filters[filter], widths[width], rates[0], rates[1]);
+			}
+		}
+	}
+}
+
+/**
+* Check that point sampling of the full resolution level matches the shader's texture Load, and that the SIMD samplers
+* return the same bits as the scalar sampler for every filter and address mode, on the benchmark's noise textures.
+* Returns false on any mismatch.
+*/
+bool Run_Sampler_Test(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool avx2 = Utils::HasAVX2();
+	bool passed = true;
+	Log("Texture sampler test (%zu samples per check%s)\n", SamplerSampleCount, avx2 ? "" : ", no AVX2: 8-wide skipped");
+	Log("%-12s %8s %18s %18s %7s\n", "texture", "levels", "point vs Load", "SIMD vs scalar", "result");
+
+	for (const int* size : SamplerTextureSizes)
+	{
+		TextureInfo source;
+		Create_Noise_Texture(source, size[0], size[1]);
+		CPUTexture texture;
+		Texture::Create(texture, source, threadCount);
+		char name[32];
+		snprintf(name, sizeof(name), "%dx%d", size[0], size[1]);
+
+		// Point sampling at level 0 must match the shader: albedo.Load(floor(uv * textureResolution.x)), on square textures
+		mt19937 random(size[0]);
+		char pointMismatches[16] = "n/a";
+		size_t mismatches = 0;
+		if (size[0] == size[1])
+		{
+			CPUSampler sampler;
+			sampler.filter = CPU_TEXTURE_FILTER_POINT;
+			uniform_real_distribution<float> unit(0.f, 1.f);
+			size_t loadMismatches = 0;
+			for (size_t i = 0; i < SamplerSampleCount; i++)
+			{
+				XMFLOAT2 uv(unit(random), unit(random));
+				XMFLOAT4 color = Texture::Sample(texture, sampler, uv, 0.f);
+				XMFLOAT4 load = CPU::Load_Texel(source, static_cast<int>(floorf(uv.x * size[0])), static_cast<int>(floorf(uv.y * size[0])));
+				if (memcmp(&color, &load, sizeof(XMFLOAT4)) != 0) loadMismatches++;
+			}
+			snprintf(pointMismatches, sizeof(pointMismatches), "%zu", loadMismatches);
+			mismatches += loadMismatches;
+		}
+
+		// The SIMD samplers must return the same bits as the scalar sampler, at coordinates in [-1, 2) and any level of detail
+		vector<float> u(SamplerSampleCount), v(SamplerSampleCount), lod(SamplerSampleCount);
+		uniform_real_distribution<float> coordinate(-1.f, 2.f);
+		uniform_real_distribution<float> level(0.f, static_cast<float>(texture.levels.size() - 1));
+		for (size_t i = 0; i < SamplerSampleCount; i++)
+		{
+			u[i] = coordinate(random);
+			v[i] = coordinate(random);
+			lod[i] = level(random);
+		}
+
+		size_t simdMismatches = 0;
+		for (int filter = 0; filter < 3; filter++)
+		{
+			for (int address = 0; address < 4; address++)
+			{
+				CPUSampler sampler;
+				sampler.filter = static_cast<CPUTextureFilter>(filter);
+				sampler.addressU = static_cast<CPUTextureAddressMode>(address & 1);
+				sampler.addressV = static_cast<CPUTextureAddressMode>(address >> 1);
+				for (size_t i = 0; i < SamplerSampleCount; i += 8)
+				{
+					XMFLOAT4 scalar[8], simd[8];
+					for (int j = 0; j < 8; j++) scalar[j] = Texture::Sample(texture, sampler, XMFLOAT2(u[i + j], v[i + j]), lod[i + j]);
+					Texture::Sample4(texture, sampler, &u[i], &v[i], &lod[i], &simd[0]);
+					Texture::Sample4(texture, sampler, &u[i + 4], &v[i + 4], &lod[i + 4], &simd[4]);
+					for (int j = 0; j < 8; j++) simdMismatches += (memcmp(&scalar[j], &simd[j], sizeof(XMFLOAT4)) != 0);
+					if (!avx2) continue;
+					Texture::Sample8(texture, sampler, &u[i], &v[i], &lod[i], simd);
+					for (int j = 0; j < 8; j++) simdMismatches += (memcmp(&scalar[j], &simd[j], sizeof(XMFLOAT4)) != 0);
+				}
+			}
+		}
+		mismatches += simdMismatches;
+
+		passed &= (mismatches == 0);
+		Log("%-12s %8zu %18s %18zu %7s\n", name, texture.levels.size(), pointMismatches, simdMismatches, (mismatches == 0) ? "pass" : "FAIL");
+	}
+
+	Log("%s\n", passed ? "All sampler tests passed" : "Samplers disagree with the texture Load or with each other");
+	return passed;
+}
+
+/**
+* Get the root mean square error of the accumulated colors of an image against a reference accumulation.
+*/
+double Get_RMSE(const CPUAccumulator &accumulator, const CPUAccumulator &reference)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < accumulator.pixels.size(); i++)
+	{
+		const XMFLOAT3 &a = accumulator.pixels[i].mean;
+		const XMFLOAT3 &b = reference.pixels[i].mean;
+		sum += (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z);
+	}
+	return sqrt(sum / (accumulator.pixels.size() * 3));
+}
+
+/**
+* Compare adaptive progressive accumulation, at a few error thresholds, with uniform sampling of every pixel. Both run
+* until they stop, and are measured against a reference of many more samples per pixel. For each threshold, the number
+* of uniform samples per pixel needed to reach the same error gives the samples adaptive sampling saved.
+*/
+void Run_Accumulation(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	Model model;
+	Load_Mesh(config.model.empty() ? make_pair(string("grid"), 100000u) : make_pair(config.model, 0u), model);
+
+	TextureInfo texture;
+	Create_Checker_Texture(texture, 512);
+
+	CPUScene scene;
+	CPU::Create_Scene(scene, model, texture, "", threadCount);
+
+	const BVHNode &root = scene.bvh.nodes[0];
+	XMVECTOR boundsMin = XMLoadFloat3(&root.boundsMin);
+	XMVECTOR boundsMax = XMLoadFloat3(&root.boundsMax);
+	XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+	float diagonal = max(XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin))), 1e-3f);
+	XMVECTOR eye = XMVectorAdd(center, XMVectorSet(0.f, 0.25f * diagonal, -0.7f * diagonal, 0.f));
+	ViewCB view = Create_View(eye, center, AccumulationResolution[0], AccumulationResolution[1]);
+	double pixels = static_cast<double>(AccumulationResolution[0]) * AccumulationResolution[1];
+
+	Log("Progressive accumulation (%dx%d, %zu triangles, %u threads, %u samples per pixel reference)\n", AccumulationResolution[0], AccumulationResolution[1],
+		model.indices.size() / 3, threadCount, AccumulationReferenceSamples);
+
+	CPUImage image;
+	CPUAccumulator reference;
+	reference.adaptive = false;
+	reference.maxSamples = AccumulationReferenceSamples;
+	auto start = chrono::high_resolution_clock::now();
+	while (!CPU::Accumulate(scene, view, reference, image, threadCount)) {}
+	Log("reference: %.2f ms, %.2f Msamples/s\n", Elapsed_Ms(start), reference.samples / (Elapsed_Ms(start) * 1000.0));
+
+	// The error of uniform sampling after each pass, one sample per pixel per pass
+	CPUAccumulator uniform;
+	uniform.adaptive = false;
+	uniform.maxSamples = AccumulationMaxSamples;
+	vector<double> uniformErrors;
+	while (!CPU::Accumulate(scene, view, uniform, image, threadCount)) uniformErrors.push_back(Get_RMSE(uniform, reference));
+
+	Log("%-10s %8s %10s %14s %10s %16s %14s\n", "threshold", "passes", "ms", "samples/pixel", "RMSE", "uniform at RMSE", "samples saved");
+	for (float threshold : AccumulationThresholds)
+	{
+		CPUAccumulator adaptive;
+		adaptive.maxSamples = AccumulationMaxSamples;
+		adaptive.errorThreshold = threshold;
+		start = chrono::high_resolution_clock::now();
+		while (!CPU::Accumulate(scene, view, adaptive, image, threadCount)) {}
+		double ms = Elapsed_Ms(start);
+		double error = Get_RMSE(adaptive, reference);
+		double samplesPerPixel = adaptive.samples / pixels;
+
+		// Uniform samples per pixel needed for the same error
+		size_t uniformSamples = 0;
+		while (uniformSamples < uniformErrors.size() && uniformErrors[uniformSamples] > error) uniformSamples++;
+		if (uniformSamples == uniformErrors.size())
+		{
+			Log("%-10g %8u %10.2f %14.2f %10.5f %16s %14s\n", threshold, adaptive.passes, ms, samplesPerPixel, error, "not reached", "-");
+			continue;
+		}
+		uniformSamples++;
+		Log("%-10g %8u %10.2f %14.2f %10.5f %16zu %13.1f%%\n", threshold, adaptive.passes, ms, samplesPerPixel, error, uniformSamples, 100.0 * (1.0 - samplesPerPixel / uniformSamples));
+	}
+}
+
+/**
+* Create camera rays from inside a room on the ground floor of an architecture mesh, looking along the floor.
+*/
+void Create_Interior_Rays(const BVHNode &root, vector<CPURay> &rays)
+{
+	XMVECTOR boundsMin = XMLoadFloat3(&root.boundsMin);
+	XMVECTOR extent = XMVectorSubtract(XMLoadFloat3(&root.boundsMax), boundsMin);
+	XMVECTOR eye = XMVectorAdd(boundsMin, XMVectorMultiply(extent, XMVectorSet(0.55f, 0.1f, 0.52f, 0.f)));
+	XMVECTOR forward = XMVector3Normalize(XMVectorSet(1.f, -0.1f, 0.6f, 0.f));
+	XMVECTOR right = XMVector3Normalize(XMVector3Cross(XMVectorSet(0.f, 1.f, 0.f, 0.f), forward));
+	XMVECTOR up = XMVector3Cross(forward, right);
+	float tanHalfFov = tanf(XMConvertToRadians(65.f) * 0.5f);
+
+	rays.resize(static_cast<size_t>(RayImageSize) * RayImageSize);
+	for (int y = 0; y < RayImageSize; y++)
+	{
+		for (int x = 0; x < RayImageSize; x++)
+		{
+			float dx = ((x + 0.5f) / RayImageSize * 2.f - 1.f) * tanHalfFov;
+			float dy = ((y + 0.5f) / RayImageSize * 2.f - 1.f) * tanHalfFov;
+			XMVECTOR direction = XMVectorAdd(XMVectorAdd(XMVectorScale(right, dx), XMVectorScale(up, -dy)), forward);
+
+			CPURay &ray = rays[static_cast<size_t>(y) * RayImageSize + x];
+			XMStoreFloat3(&ray.origin, eye);
+			XMStoreFloat3(&ray.direction, XMVector3Normalize(direction));
+			ray.tMin = 0.f;
+			ray.tMax = FLT_MAX;
+		}
+	}
+}
+
+/**
+* Get a diffuse bounce off a hit: a ray from the hit point in a cosine distributed direction about the geometric normal,
+* on the side the ray came from.
+*/
+CPURay Get_Diffuse_Bounce(const Model &model, const CPURay &ray, const CPUHit &hit, float offset, float u1, float u2)
+{
+	const XMFLOAT3 &p0 = model.vertices[model.indices[hit.triangleIndex * 3 + 0]].position;
+	const XMFLOAT3 &p1 = model.vertices[model.indices[hit.triangleIndex * 3 + 1]].position;
+	const XMFLOAT3 &p2 = model.vertices[model.indices[hit.triangleIndex * 3 + 2]].position;
+	XMVECTOR v0 = XMLoadFloat3(&p0);
+	XMVECTOR normal = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&p1), v0), XMVectorSubtract(XMLoadFloat3(&p2), v0)));
+	XMVECTOR direction = XMLoadFloat3(&ray.direction);
+	if (XMVectorGetX(XMVector3Dot(normal, direction)) > 0.f) normal = XMVectorNegate(normal);
+
+	// Orthonormal basis about the normal (Duff et al. 2017)
+	XMFLOAT3 n;
+	XMStoreFloat3(&n, normal);
+	float sign = copysignf(1.f, n.z);
+	float a = -1.f / (sign + n.z);
+	float b = n.x * n.y * a;
+	XMVECTOR tangent = XMVectorSet(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x, 0.f);
+	XMVECTOR bitangent = XMVectorSet(b, sign + n.y * n.y * a, -n.y, 0.f);
+
+	float radius = sqrtf(u1);
+	float phi = XM_2PI * u2;
+	XMVECTOR bounce = XMVectorAdd(XMVectorAdd(XMVectorScale(tangent, radius * cosf(phi)), XMVectorScale(bitangent, radius * sinf(phi))), XMVectorScale(normal, sqrtf(max(1.f - u1, 0.f))));
+
+	CPURay result;
+	XMVECTOR point = XMVectorAdd(XMLoadFloat3(&ray.origin), XMVectorScale(direction, hit.t));
+	XMStoreFloat3(&result.origin, XMVectorAdd(point, XMVectorScale(normal, offset)));
+	XMStoreFloat3(&result.direction, XMVector3Normalize(bounce));
+	result.tMin = 0.f;
+	result.tMax = FLT_MAX;
+	return result;
+}
+
+/**
+* Compare tracing incoherent diffuse bounce rays in the order they were generated with tracing them sorted by direction
+* octant and origin. Camera rays are traced from inside a room of the architecture meshes, and each hit bounces off in a
+* random cosine distributed direction, for two bounces. Sorted rates are given without and with the time of the sort.
+*/
+void Run_Ray_Sorting(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool avx2 = Utils::HasAVX2();
+	Log("Ray sorting (%u threads, %s BVH, %d camera rays)\n", threadCount, avx2 ? "8-wide" : "binary", RayImageSize * RayImageSize);
+	Log("%-24s %12s %8s %10s %14s %10s %14s %14s %10s\n", "mesh", "triangles", "bounce", "rays", "unsorted Mr/s", "sort ms", "sorted Mr/s", "with sort Mr/s", "speedup");
+
+	vector<pair<string, uint32_t>> meshes;
+	if (!config.model.empty()) meshes.push_back({ config.model, 0 });
+	for (uint32_t size : SpatialMeshSizes)
+	{
+		if (size <= config.benchmarkTriangles) meshes.push_back({ "architecture", size });
+	}
+
+	for (const pair<string, uint32_t> &mesh : meshes)
+	{
+		Model model;
+		if (mesh.second == 0) Load_Mesh(mesh, model);
+		else Create_Architecture_Mesh(model, mesh.second);
+		size_t triangleCount = model.indices.size() / 3;
+
+		BVHTree bvh;
+		BVH8Tree bvh8;
+		BVH::Build(bvh, model, threadCount);
+		if (avx2) BVH::Collapse(bvh8, bvh);
+		const BVHNode &root = bvh.nodes[0];
+		float diagonal = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&root.boundsMax), XMLoadFloat3(&root.boundsMin))));
+
+		vector<CPURay> rays, incoherent;
+		if (mesh.second == 0) Create_Rays(root, rays, incoherent);
+		else Create_Interior_Rays(root, rays);
+		vector<CPUHit> hits(rays.size());
+		BVH::Intersect_Rays(bvh, bvh8, model, rays.data(), hits.data(), static_cast<uint32_t>(rays.size()), false, threadCount);
+
+		mt19937 rng(7);
+		uniform_real_distribution<float> unit(0.f, 1.f);
+		for (int bounce = 1; bounce <= DiffuseBounces; bounce++)
+		{
+			vector<CPURay> bounces;
+			for (size_t i = 0; i < rays.size(); i++)
+			{
+				if (hits[i].triangleIndex == UINT32_MAX) continue;
+				float u1 = unit(rng);
+				float u2 = unit(rng);
+				bounces.push_back(Get_Diffuse_Bounce(model, rays[i], hits[i], 1e-5f * diagonal, u1, u2));
+			}
+			rays.swap(bounces);
+			if (rays.empty()) break;
+			uint32_t rayCount = static_cast<uint32_t>(rays.size());
+
+			vector<CPUHit> sortedHits(rayCount);
+			vector<uint32_t> order;
+			double unsortedMs = DBL_MAX, sortMs = DBL_MAX, sortedMs = DBL_MAX;
+			for (int run = 0; run < TraceRuns; run++)
+			{
+				auto start = chrono::high_resolution_clock::now();
+				BVH::Intersect_Rays(bvh, bvh8, model, rays.data(), hits.data(), rayCount, false, threadCount);
+				unsortedMs = min(unsortedMs, Elapsed_Ms(start));
+
+				start = chrono::high_resolution_clock::now();
+				BVH::Sort_Rays(rays.data(), rayCount, root, order, threadCount);
+				sortMs = min(sortMs, Elapsed_Ms(start));
+
+				start = chrono::high_resolution_clock::now();
+				BVH::Intersect_Rays(bvh, bvh8, model, rays.data(), sortedHits.data(), rayCount, true, threadCount);
+				sortedMs = min(sortedMs, Elapsed_Ms(start));
+			}
+
+			size_t mismatches = 0;
+			for (uint32_t i = 0; i < rayCount; i++)
+			{
+				if (hits[i].triangleIndex != sortedHits[i].triangleIndex || hits[i].t != sortedHits[i].t) mismatches++;
+			}
+
+			// Intersect_Rays sorts as part of the sorted trace, so its time includes the sort
+			double traceMs = max(sortedMs - sortMs, 1e-3);
+			Log("%-24s %12zu %8d %10u %14.2f %10.2f %14.2f %14.2f %9.2fx\n", mesh.first.c_str(), triangleCount, bounce, rayCount,
+				rayCount / (unsortedMs * 1000.0), sortMs, rayCount / (traceMs * 1000.0), rayCount / (sortedMs * 1000.0), unsortedMs / sortedMs);
+			if (mismatches > 0) Log("  warning: %zu sorted rays found different hits\n", mismatches);
+		}
+	}
+}
+
+/**
+* Render the model, or a 100K triangle grid, with the wavefront path tracer at several bounce counts, and print the rays
+* and samples per second with the time each stage took. Without bounces, the image is checked against CPU::Render.
+*/
+void Run_Wavefront(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	Model model;
+	Load_Mesh(config.model.empty() ? make_pair(string("grid"), 100000u) : make_pair(config.model, 0u), model);
+
+	TextureInfo texture;
+	Create_Checker_Texture(texture, 512);
+
+	CPUScene scene;
+	CPU::Create_Scene(scene, model, texture, "", threadCount);
+	scene.packetWidth = 1;
+
+	const BVHNode &root = scene.bvh.nodes[0];
+	XMVECTOR boundsMin = XMLoadFloat3(&root.boundsMin);
+	XMVECTOR boundsMax = XMLoadFloat3(&root.boundsMax);
+	XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+	float diagonal = max(XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin))), 1e-3f);
+	XMVECTOR eye = XMVectorAdd(center, XMVectorSet(0.f, 0.25f * diagonal, -0.7f * diagonal, 0.f));
+	ViewCB view = Create_View(eye, center, WavefrontResolution[0], WavefrontResolution[1]);
+	double pixels = static_cast<double>(WavefrontResolution[0]) * WavefrontResolution[1];
+
+	Log("Wavefront path tracing (%dx%d, %zu triangles, %u threads, %u samples per pixel)\n", WavefrontResolution[0], WavefrontResolution[1],
+		model.indices.size() / 3, threadCount, WavefrontSamples);
+
+	// Without bounces and with one sample per pixel, the wavefront renders exactly what CPU::Render does
+	CPUImage reference, image;
+	CPUWavefront wavefront;
+	wavefront.maxBounces = 0;
+	auto start = chrono::high_resolution_clock::now();
+	CPU::Render(scene, view, reference, threadCount);
+	double renderMs = Elapsed_Ms(start);
+	start = chrono::high_resolution_clock::now();
+	CPU::Render_Wavefront(scene, view, wavefront, image, threadCount);
+	double wavefrontMs = Elapsed_Ms(start);
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < reference.pixels.size(); i++) mismatches += (reference.pixels[i] != image.pixels[i]) ? 1 : 0;
+	Log("camera rays: CPU::Render %.2f Mr/s, wavefront %.2f Mr/s, %zu mismatched channels\n", pixels / (renderMs * 1000.0), pixels / (wavefrontMs * 1000.0), mismatches);
+
+	Log("%8s %10s %10s %12s %12s", "bounces", "ms", "Mrays", "Mrays/s", "Msamples/s");
+	for (const char* name : WavefrontStageNames) Log(" %12s", name);
+	Log("\n");
+
+	wavefront.samplesPerPixel = WavefrontSamples;
+	for (uint32_t bounces : WavefrontBounces)
+	{
+		wavefront.maxBounces = bounces;
+		start = chrono::high_resolution_clock::now();
+		CPU::Render_Wavefront(scene, view, wavefront, image, threadCount);
+		double ms = Elapsed_Ms(start);
+
+		Log("%8u %10.2f %10.2f %12.2f %12.2f", bounces, ms, wavefront.rays / 1e6, wavefront.rays / (ms * 1000.0), pixels * WavefrontSamples / (ms * 1000.0));
+		for (int stage = 0; stage < CPU_WAVEFRONT_STAGE_COUNT; stage++) Log(" %9.2f ms", wavefront.stageMs[stage]);
+		Log("\n");
+	}
+
+	// Rays left in the queue after each bounce of the last render
+	Log("rays per bounce:");
+	for (uint64_t rays : wavefront.bounceRays) Log(" %llu", static_cast<unsigned long long>(rays));
+	Log("\n");
+}
+
+/**
+* Get the root mean square error of the mean radiance of two path traced images, per channel.
+*/
+double Get_RMSE(const CPUWavefront &wavefront, const CPUWavefront &reference)
+{
+	double weight = 1.0 / max(wavefront.samplesPerPixel, 1u);
+	double referenceWeight = 1.0 / max(reference.samplesPerPixel, 1u);
+	double sum = 0.0;
+	for (size_t i = 0; i < wavefront.radiance.size(); i++)
+	{
+		const XMFLOAT3 &a = wavefront.radiance[i];
+		const XMFLOAT3 &b = reference.radiance[i];
+		double dx = a.x * weight - b.x * referenceWeight;
+		double dy = a.y * weight - b.y * referenceWeight;
+		double dz = a.z * weight - b.z * referenceWeight;
+		sum += dx * dx + dy * dy + dz * dz;
+	}
+	return sqrt(sum / (wavefront.radiance.size() * 3));
+}
+
+/**
+* Path trace a room of a 10K triangle architecture mesh, or the model, lit by a sun, a point light and a dim sky, with
+* next event estimation, and compare the cost and error of tracing every bounce, Russian roulette, per bounce ray
+* budgets and both, against a converged reference. Samples per second lead each row, followed by the rays per sample,
+* the error, and the efficiency (inverse of error squared times time) against tracing every bounce. The time and rays
+* of each bounce follow.
+*/
+void Run_Path_Tracing(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	bool interior = config.model.empty();
+	Model model;
+	TextureInfo texture;
+	if (interior)
+	{
+		// The architecture mesh has no texture coordinates, so give it a light gray texel
+		Create_Architecture_Mesh(model, PathArchitectureTriangles);
+		texture.width = 1;
+		texture.height = 1;
+		texture.stride = 4;
+		texture.pixels = { 180, 180, 180, 255 };
+	}
+	else
+	{
+		Load_Mesh(make_pair(config.model, 0u), model);
+		Create_Checker_Texture(texture, 512);
+	}
+
+	CPUScene scene;
+	CPU::Create_Scene(scene, model, texture, "", threadCount);
+
+	const BVHNode &root = scene.bvh.nodes[0];
+	XMVECTOR boundsMin = XMLoadFloat3(&root.boundsMin);
+	XMVECTOR boundsMax = XMLoadFloat3(&root.boundsMax);
+	XMVECTOR extent = XMVectorSubtract(boundsMax, boundsMin);
+	XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+	float diagonal = max(XMVectorGetX(XMVector3Length(extent)), 1e-3f);
+
+	// The sun only reaches the model, the room has no windows. Its shadow rays end at the first occluder.
+	CPULight sun;
+	sun.type = CPU_LIGHT_DIRECTIONAL;
+	XMStoreFloat3(&sun.direction, XMVector3Normalize(XMVectorSet(-0.4f, -1.f, 0.3f, 0.f)));
+	sun.color = XMFLOAT3(2.f, 1.9f, 1.7f);
+	sun.radius = 0.02f;
+
+	// A warm lamp under the ceiling of the room the camera is in, or above the model, as bright as the sun close by
+	CPULight lamp;
+	lamp.type = CPU_LIGHT_POINT;
+	ViewCB view;
+	float lampDistance;
+	if (interior)
+	{
+		XMVECTOR eye = XMVectorAdd(boundsMin, XMVectorMultiply(extent, XMVectorSet(0.55f, 0.1f, 0.52f, 0.f)));
+		view = Create_View(eye, XMVectorAdd(eye, XMVectorSet(1.f, -0.1f, 0.6f, 0.f)), PathResolution[0], PathResolution[1]);
+		XMStoreFloat3(&lamp.position, XMVectorAdd(boundsMin, XMVectorMultiply(extent, XMVectorSet(0.57f, 0.2f, 0.56f, 0.f))));
+		lampDistance = 0.02f * diagonal;
+	}
+	else
+	{
+		XMVECTOR eye = XMVectorAdd(center, XMVectorSet(0.f, 0.25f * diagonal, -0.7f * diagonal, 0.f));
+		view = Create_View(eye, center, PathResolution[0], PathResolution[1]);
+		XMStoreFloat3(&lamp.position, XMVectorAdd(center, XMVectorSet(0.1f * diagonal, 0.2f * diagonal, 0.f, 0.f)));
+		lampDistance = 0.2f * diagonal;
+	}
+	float intensity = 2.f * lampDistance * lampDistance;
+	lamp.color = XMFLOAT3(intensity, 0.8f * intensity, 0.5f * intensity);
+	lamp.radius = 0.1f * lampDistance;
+
+	CPUWavefront base;
+	base.maxBounces = PathBounces;
+	base.skyColor = XMFLOAT3(0.2f, 0.25f, 0.35f);
+	base.skyAtLastBounce = false;
+	base.lights = { sun, lamp };
+	base.rouletteDepth = UINT32_MAX;
+
+	Log("Path tracing %s (%dx%d, %zu triangles, %u threads, %u bounces, %u samples per pixel, %u samples per pixel reference)\n", interior ? "architecture" : config.model.c_str(), PathResolution[0], PathResolution[1],
+		model.indices.size() / 3, threadCount, PathBounces, PathSamples, PathReferenceSamples);
+
+	CPUImage image;
+	CPUWavefront reference = base;
+	reference.samplesPerPixel = PathReferenceSamples;
+	CPU::Render_Wavefront(scene, view, reference, image, threadCount);
+	Log("reference: %.2f ms, %.3f Msamples/s\n", reference.renderMs, reference.samplesPerSecond / 1e6);
+
+	struct PathConfig
+	{
+		const char* name;
+		uint32_t rouletteDepth;
+		bool budgets;
+	};
+	const PathConfig configs[] = { { "all bounces", UINT32_MAX, false }, { "roulette", 1, false }, { "budgets", UINT32_MAX, true }, { "roulette+budgets", 1, true } };
+
+	Log("%-18s %12s %10s %12s %10s %10s %10s  %s\n", "integrator", "Msamples/s", "ms", "rays/sample", "Mrays/s", "RMSE", "efficiency", "ms / rays / shadow rays per bounce");
+	double baseEfficiency = 0.0;
+	for (const PathConfig &pathConfig : configs)
+	{
+		CPUWavefront wavefront = base;
+		wavefront.samplesPerPixel = PathSamples;
+		wavefront.rouletteDepth = pathConfig.rouletteDepth;
+		if (pathConfig.budgets) wavefront.bounceBudgets.assign(begin(PathBudgets), end(PathBudgets));
+		CPU::Render_Wavefront(scene, view, wavefront, image, threadCount);
+
+		double error = Get_RMSE(wavefront, reference);
+		double efficiency = 1.0 / (error * error * wavefront.renderMs);
+		if (baseEfficiency == 0.0) baseEfficiency = efficiency;
+		Log("%-18s %12.3f %10.2f %12.2f %10.2f %10.5f %9.2fx ", pathConfig.name, wavefront.samplesPerSecond / 1e6, wavefront.renderMs,
+			static_cast<double>(wavefront.rays) / wavefront.samples, wavefront.rays / (wavefront.renderMs * 1000.0), error, efficiency / baseEfficiency);
+		for (size_t bounce = 0; bounce < wavefront.bounceMs.size(); bounce++)
+		{
+			Log(" %.1f/%llu/%llu", wavefront.bounceMs[bounce], static_cast<unsigned long long>(wavefront.bounceRays[bounce]), static_cast<unsigned long long>(wavefront.bounceShadowRays[bounce]));
+		}
+		Log("\n");
+	}
+}
+
+/**
+* Run the benchmark named on the command line. Returns false if there is no such benchmark.
+*/
+bool Run(const ConfigInfo &config)
+{
+	if (config.benchmark == "bvh") Run_BVH_Build(config);
+	else if (config.benchmark == "bvh8") Run_BVH8(config);
+	else if (config.benchmark == "packets") Run_Packets(config);
+	else if (config.benchmark == "triangles") Run_Triangle_Kernels(config);
+	else if (config.benchmark == "scaling") Run_Render_Scaling(config);
+	else if (config.benchmark == "instances") Run_Instances(config);
+	else if (config.benchmark == "refit") Run_Refit(config);
+	else if (config.benchmark == "cache") Run_BVH_Cache(config);
+	else if (config.benchmark == "lbvh") Run_Linear_BVH(config);
+	else if (config.benchmark == "sbvh") Run_Spatial_Splits(config);
+	else if (config.benchmark == "sampler") Run_Texture_Sampling(config);
+	else if (config.benchmark == "accumulate") Run_Accumulation(config);
+	else if (config.benchmark == "raysort") Run_Ray_Sorting(config);
+	else if (config.benchmark == "wavefront") Run_Wavefront(config);
+	else if (config.benchmark == "pathtrace") Run_Path_Tracing(config);
+	else
+	{
+		Log("Unknown benchmark: %s\n", config.benchmark.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+* Run the test named on the command line. Returns false if there is no such test, or if it failed.
+*/
+bool Run_Test(const ConfigInfo &config)
+{
+	if (config.test == "watertight") return Run_Crack_Test(config);
+	if (config.test == "sampler") return Run_Sampler_Test(config);
+	Log("Unknown test: %s\n", config.test.c_str());
+	return false;
+}
+
+}
@@ -0,0 +1,530 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CPU.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// CPU Ray Tracing Functions
+//--------------------------------------------------------------------------------------
+
+namespace CPU
+{
+
+static const uint32_t MaxPacketWidth = 16;
+static const int RenderTileSize = 16;			// a multiple of the packet tile sizes
+static const XMFLOAT3 LuminanceWeights = XMFLOAT3(0.2126f, 0.7152f, 0.0722f);	// Rec. 709
+
+// Mirrors the HLSL structures in Common.hlsl
+struct HitInfo
+{
+	XMFLOAT4 ShadedColorAndHitT;
+};
+
+struct VertexAttributes
+{
+	XMFLOAT3 position;
+	XMFLOAT2 uv;
+};
+
+/**
+* Interpolate a triangle's vertex attributes. Mirrors GetVertexAttributes() in Common.hlsl.
+*/
+VertexAttributes Get_Vertex_Attributes(const CPUScene &scene, uint32_t triangleIndex, const float barycentrics[3])
+{
+	const Model &model = *scene.model;
+	uint32_t baseIndex = (triangleIndex * 3);
+
+	VertexAttributes v;
+	v.position = XMFLOAT3(0.f, 0.f, 0.f);
+	v.uv = XMFLOAT2(0.f, 0.f);
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		const Vertex &vertex = model.vertices[model.indices[baseIndex + i]];
+		v.position.x += vertex.position.x * barycentrics[i];
+		v.position.y += vertex.position.y * barycentrics[i];
+		v.position.z += vertex.position.z * barycentrics[i];
+		v.uv.x += vertex.uv.x * barycentrics[i];
+		v.uv.y += vertex.uv.y * barycentrics[i];
+	}
+
+	return v;
+}
+
+/**
+* Read a texel of the R8G8B8A8_UNORM albedo texture. Like Texture2D.Load, out of bounds reads return zero.
+*/
+XMFLOAT4 Load_Texel(const TextureInfo &texture, int x, int y)
+{
+	if (x < 0 || y < 0 || x >= texture.width || y >= texture.height) return XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+
+	const uint8_t* texel = &texture.pixels[(static_cast<size_t>(y) * texture.width + x) * texture.stride];
+	return XMFLOAT4(texel[0] / 255.f, texel[1] / 255.f, texel[2] / 255.f, texel[3] / 255.f);
+}
+
+/**
+* Mirrors Miss() in Miss.hlsl.
+*/
+void Miss(HitInfo &payload)
+{
+	payload.ShadedColorAndHitT = XMFLOAT4(0.2f, 0.2f, 0.2f, -1.f);
+}
+
+/**
+* Mirrors ClosestHit() in ClosestHit.hlsl, without the permutation features.
+*/
+void Closest_Hit(const CPUScene &scene, const CPUHit &hit, HitInfo &payload)
+{
+	float barycentrics[3] = { (1.f - hit.uv.x - hit.uv.y), hit.uv.x, hit.uv.y };
+	VertexAttributes vertex = Get_Vertex_Attributes(scene, hit.triangleIndex, barycentrics);
+
+	int coordX = static_cast<int>(floorf(vertex.uv.x * scene.material.resolution.x));
+	int coordY = static_cast<int>(floorf(vertex.uv.y * scene.material.resolution.x));
+	XMFLOAT4 color = Load_Texel(*scene.texture, coordX, coordY);
+
+	payload.ShadedColorAndHitT = XMFLOAT4(color.x, color.y, color.z, hit.t);
+}
+
+/**
+* Trace a ray through the scene and invoke the closest hit or miss shader.
+*/
+void Trace_Ray(const CPUScene &scene, const CPURay &ray, HitInfo &payload)
+{
+	CPUHit hit;
+	bool hitFound = scene.bvh8.nodes.empty() ? BVH::Intersect(scene.bvh, *scene.model, ray, hit) : BVH::Intersect(scene.bvh8, *scene.model, ray, hit);
+	if (hitFound) Closest_Hit(scene, hit, payload);
+	else Miss(payload);
+}
+
+/**
+* Generate the primary ray of a pixel, through a point of the pixel given in [0, 1) from its top left corner.
+* Mirrors the ray setup in RayGen() in RayGen.hlsl, which shoots through the pixel center (0.5, 0.5).
+*/
+CPURay Get_Primary_Ray(const ViewCB &view, const XMMATRIX &invView, int x, int y, float subpixelX, float subpixelY)
+{
+	float dx = (((x + subpixelX) / view.resolution.x) * 2.f - 1.f);
+	float dy = (((y + subpixelY) / view.resolution.y) * 2.f - 1.f);
+	float aspectRatio = (view.resolution.x / view.resolution.y);
+	float tanHalfFovY = view.viewOriginAndTanHalfFovY.w;
+
+	// The view CB holds the transposed inverse view matrix, so view[0..2] in HLSL are the rows of invView
+	XMVECTOR direction = (dx * invView.r[0] * tanHalfFovY * aspectRatio) - (dy * invView.r[1] * tanHalfFovY) + invView.r[2];
+
+	// Setup the ray
+	CPURay ray;
+	ray.origin = XMFLOAT3(view.viewOriginAndTanHalfFovY.x, view.viewOriginAndTanHalfFovY.y, view.viewOriginAndTanHalfFovY.z);
+	XMStoreFloat3(&ray.direction, XMVector3Normalize(direction));
+	ray.tMin = 0.1f;
+	ray.tMax = 1000.f;
+	return ray;
+}
+
+/**
+* Generate and trace the primary ray of a pixel. Mirrors RayGen() in RayGen.hlsl.
+*/
+XMFLOAT4 Ray_Gen(const CPUScene &scene, const ViewCB &view, const XMMATRIX &invView, int x, int y, float subpixelX = 0.5f, float subpixelY = 0.5f)
+{
+	CPURay ray = Get_Primary_Ray(view, invView, x, y, subpixelX, subpixelY);
+
+	// Trace the ray
+	HitInfo payload;
+	payload.ShadedColorAndHitT = XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+	Trace_Ray(scene, ray, payload);
+
+	return XMFLOAT4(payload.ShadedColorAndHitT.x, payload.ShadedColorAndHitT.y, payload.ShadedColorAndHitT.z, 1.f);
+}
+
+/**
+* Generate and trace the primary rays of a tile of pixels as one packet, then invoke the closest hit or miss shader for each ray.
+* Returns the colors in row order. Edge tiles may be smaller than the packet.
+*/
+void Ray_Gen_Packet(const CPUScene &scene, const ViewCB &view, const XMMATRIX &invView, int x0, int y0, int tileWidth, int tileHeight, XMFLOAT4* colors)
+{
+	CPURay rays[MaxPacketWidth];
+	CPUHit hits[MaxPacketWidth];
+	uint32_t count = 0;
+	for (int y = y0; y < y0 + tileHeight; y++)
+	{
+		for (int x = x0; x < x0 + tileWidth; x++) rays[count++] = Get_Primary_Ray(view, invView, x, y, 0.5f, 0.5f);
+	}
+
+	BVH::Intersect_Packet(scene.bvh, *scene.model, rays, hits, count, scene.packetWidth);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		HitInfo payload;
+		payload.ShadedColorAndHitT = XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+		if (hits[i].triangleIndex != UINT32_MAX) Closest_Hit(scene, hits[i], payload);
+		else Miss(payload);
+		colors[i] = XMFLOAT4(payload.ShadedColorAndHitT.x, payload.ShadedColorAndHitT.y, payload.ShadedColorAndHitT.z, 1.f);
+	}
+}
+
+/**
+* Convert a float to UNORM8 with the D3D conversion rules (saturate, then round to nearest).
+*/
+uint8_t To_UNORM8(float value)
+{
+	if (!(value > 0.f)) return 0;					// also catches NaN
+	if (value >= 1.f) return 255;
+	return static_cast<uint8_t>(value * 255.f + 0.5f);
+}
+
+/**
+* Prepare a model and its texture for CPU ray tracing.
+* With a cache path, the BVH is loaded from the cache if it was built from the same geometry, otherwise it is built
+* and written to the cache. Returns true if the BVH came from the cache.
+*/
+bool Create_Scene(CPUScene &scene, const Model &model, const TextureInfo &texture, const string &cachePath, unsigned threadCount)
+{
+	scene.model = &model;
+	scene.texture = &texture;
+	scene.material.resolution = XMFLOAT4(static_cast<float>(texture.width), 0.f, 0.f, 0.f);
+
+	bool avx2 = Utils::HasAVX2();
+	if (!cachePath.empty() && BVH::Load_Cache(cachePath, model, scene.bvh, scene.bvh8, threadCount))
+	{
+		if (!avx2) scene.bvh8 = BVH8Tree();
+		else if (scene.bvh8.nodes.empty()) BVH::Collapse(scene.bvh8, scene.bvh);
+		return true;
+	}
+
+	BVH::Build(scene.bvh, model, threadCount);
+	if (avx2) BVH::Collapse(scene.bvh8, scene.bvh);
+	if (!cachePath.empty()) BVH::Save_Cache(cachePath, model, scene.bvh, scene.bvh8, threadCount);
+	return false;
+}
+
+/**
+* Spread the low 16 bits of a value to the even bits.
+*/
+inline uint32_t Spread_Bits(uint32_t v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+/**
+* Get the tiles of an image in Morton (Z) order, so consecutive tiles are close on screen.
+*/
+vector<uint32_t> Get_Tile_Order(int tilesX, int tilesY)
+{
+	vector<pair<uint32_t, uint32_t>> codes;
+	codes.reserve(static_cast<size_t>(tilesX) * tilesY);
+	for (int y = 0; y < tilesY; y++)
+	{
+		for (int x = 0; x < tilesX; x++)
+		{
+			uint32_t code = Spread_Bits(static_cast<uint32_t>(x)) | (Spread_Bits(static_cast<uint32_t>(y)) << 1);
+			codes.push_back({ code, static_cast<uint32_t>(y * tilesX + x) });
+		}
+	}
+	sort(codes.begin(), codes.end());
+
+	vector<uint32_t> order(codes.size());
+	for (size_t i = 0; i < codes.size(); i++) order[i] = codes[i].second;
+	return order;
+}
+
+/**
+* Render a rectangle of the image, as packet tiles or single rays.
+*/
+void Render_Rect(const CPUScene &scene, const ViewCB &view, const XMMATRIX &invView, int left, int top, int right, int bottom, CPUImage &image)
+{
+	// Packets cover square-ish tiles: 2x2, 4x2 or 4x4 pixels
+	bool packets = (scene.packetWidth > 1);
+	uint32_t packetWidth = min(scene.packetWidth, MaxPacketWidth);
+	int tileWidth = !packets ? 1 : ((packetWidth >= 8) ? 4 : 2);
+	int tileHeight = !packets ? 1 : max(static_cast<int>(packetWidth) / tileWidth, 1);
+
+	XMFLOAT4 colors[MaxPacketWidth];
+	for (int y0 = top; y0 < bottom; y0 += tileHeight)
+	{
+		for (int x0 = left; x0 < right; x0 += tileWidth)
+		{
+			int width = min(tileWidth, right - x0);
+			int height = min(tileHeight, bottom - y0);
+			if (packets) Ray_Gen_Packet(scene, view, invView, x0, y0, width, height, colors);
+			else colors[0] = Ray_Gen(scene, view, invView, x0, y0);
+
+			for (int i = 0; i < width * height; i++)
+			{
+				uint8_t* pixel = &image.pixels[(static_cast<size_t>(y0 + i / width) * image.width + x0 + i % width) * 4];
+				pixel[0] = To_UNORM8(colors[i].x);
+				pixel[1] = To_UNORM8(colors[i].y);
+				pixel[2] = To_UNORM8(colors[i].z);
+				pixel[3] = To_UNORM8(colors[i].w);
+			}
+		}
+	}
+}
+
+/**
+* Render the scene into an RGBA8 image.
+* The image is cut into tiles that threads take in Morton order, stealing tiles from each other when they run out,
+* since rays that hit the model cost much more than rays that miss.
+*/
+void Render(const CPUScene &scene, const ViewCB &view, CPUImage &image, unsigned threadCount)
+{
+	image.width = static_cast<int>(view.resolution.x);
+	image.height = static_cast<int>(view.resolution.y);
+	image.pixels.resize(static_cast<size_t>(image.width) * image.height * 4);
+
+	XMMATRIX invView = XMMatrixTranspose(view.view);
+
+	if (!scene.workStealing)
+	{
+		Utils::ParallelFor(image.height, threadCount, [&](size_t top, size_t bottom)
+		{
+			Render_Rect(scene, view, invView, 0, static_cast<int>(top), image.width, static_cast<int>(bottom), image);
+		});
+		return;
+	}
+
+	int tilesX = (image.width + RenderTileSize - 1) / RenderTileSize;
+	int tilesY = (image.height + RenderTileSize - 1) / RenderTileSize;
+	vector<uint32_t> tiles = Get_Tile_Order(tilesX, tilesY);
+
+	Utils::ParallelForWorkStealing(tiles.size(), threadCount, [&](size_t index)
+	{
+		int left = static_cast<int>(tiles[index] % tilesX) * RenderTileSize;
+		int top = static_cast<int>(tiles[index] / tilesX) * RenderTileSize;
+		Render_Rect(scene, view, invView, left, top, min(left + RenderTileSize, image.width), min(top + RenderTileSize, image.height), image);
+	});
+}
+
+/**
+* Hash the contents of a view constant buffer, to tell when the camera has changed.
+*/
+uint64_t Get_View_Hash(const ViewCB &view)
+{
+	// FNV-1a over the matrix, the origin and the resolution, without the padding at the end of the structure
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&view);
+	size_t size = offsetof(ViewCB, resolution) + sizeof(view.resolution);
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+	return hash;
+}
+
+/**
+* Get the radical inverse of an index in a base, the index-th point of the van der Corput sequence.
+*/
+inline float Radical_Inverse(uint32_t index, uint32_t base)
+{
+	float inverse = 1.f / base;
+	float scale = inverse;
+	float result = 0.f;
+	while (index > 0)
+	{
+		result += (index % base) * scale;
+		index /= base;
+		scale *= inverse;
+	}
+	return result;
+}
+
+/**
+* Hash an integer to 32 well mixed bits (Wang hash).
+*/
+inline uint32_t Hash_Integer(uint32_t v)
+{
+	v = (v ^ 61) ^ (v >> 16);
+	v *= 9;
+	v ^= v >> 4;
+	v *= 0x27D4EB2D;
+	v ^= v >> 15;
+	return v;
+}
+
+/**
+* Get the subpixel position of a pixel's sample: the 2D Halton sequence (bases 2 and 3), which covers the pixel evenly
+* after any number of samples, shifted by a random offset per pixel so neighboring pixels do not sample the same points.
+*/
+XMFLOAT2 Get_Subpixel(int x, int y, uint32_t sampleIndex)
+{
+	uint32_t seed = Hash_Integer(static_cast<uint32_t>(x) * 0x8DA6B343u ^ static_cast<uint32_t>(y) * 0xD8163841u);
+	float offsetX = (seed & 0xFFFF) / 65536.f;
+	float offsetY = (seed >> 16) / 65536.f;
+	float subpixelX = Radical_Inverse(sampleIndex, 2) + offsetX;
+	float subpixelY = Radical_Inverse(sampleIndex, 3) + offsetY;
+	return XMFLOAT2(subpixelX - floorf(subpixelX), subpixelY - floorf(subpixelY));
+}
+
+/**
+* Get the number of samples a pixel takes in the next accumulation pass. After the first samples, a pixel takes as many
+* as its variance says it still needs for the standard error of its mean to reach the threshold, and none once it has.
+* The variance is the largest of the pixel and its 8 neighbors: a few samples can all miss a small detail that the
+* pixel's neighbors have seen, which would make the pixel look converged.
+*/
+uint32_t Get_Pass_Samples(const CPUAccumulator &accumulator, int width, int height, int x, int y)
+{
+	const CPUAccumulatorPixel &pixel = accumulator.pixels[static_cast<size_t>(y) * width + x];
+	uint32_t minSamples = max(accumulator.minSamples, 2u);
+	if (pixel.count >= accumulator.maxSamples) return 0;
+	if (!accumulator.adaptive || pixel.count < minSamples) return 1;
+
+	float variance = 0.f;
+	for (int ny = max(y - 1, 0); ny <= min(y + 1, height - 1); ny++)
+	{
+		for (int nx = max(x - 1, 0); nx <= min(x + 1, width - 1); nx++)
+		{
+			const CPUAccumulatorPixel &neighbor = accumulator.pixels[static_cast<size_t>(ny) * width + nx];
+			if (neighbor.count >= minSamples) variance = max(variance, neighbor.m2 / (neighbor.count - 1));
+		}
+	}
+
+	// The standard error of the mean is sqrt(variance / n)
+	float needed = min(variance / (accumulator.errorThreshold * accumulator.errorThreshold), static_cast<float>(accumulator.maxSamples));
+	if (!(needed > pixel.count)) return 0;
+	uint32_t remaining = static_cast<uint32_t>(ceilf(needed)) - pixel.count;
+	return min(remaining, max(accumulator.maxPassSamples, 1u));
+}
+
+/**
+* Add a color sample to a pixel's running mean and luminance variance, with Welford's algorithm.
+*/
+void Add_Sample(CPUAccumulatorPixel &pixel, const XMFLOAT4 &color)
+{
+	float luminance = color.x * LuminanceWeights.x + color.y * LuminanceWeights.y + color.z * LuminanceWeights.z;
+	float meanLuminance = pixel.mean.x * LuminanceWeights.x + pixel.mean.y * LuminanceWeights.y + pixel.mean.z * LuminanceWeights.z;
+
+	pixel.count++;
+	float weight = 1.f / pixel.count;
+	pixel.mean.x += (color.x - pixel.mean.x) * weight;
+	pixel.mean.y += (color.y - pixel.mean.y) * weight;
+	pixel.mean.z += (color.z - pixel.mean.z) * weight;
+
+	float newMeanLuminance = pixel.mean.x * LuminanceWeights.x + pixel.mean.y * LuminanceWeights.y + pixel.mean.z * LuminanceWeights.z;
+	pixel.m2 += (luminance - meanLuminance) * (luminance - newMeanLuminance);
+}
+
+/**
+* Take the planned samples of an accumulation pass for a rectangle of the image, and write the mean of each pixel.
+* Returns the number of samples taken and the number of pixels that took them.
+*/
+void Accumulate_Rect(const CPUScene &scene, const ViewCB &view, const XMMATRIX &invView, CPUAccumulator &accumulator, const vector<uint8_t> &passSamples, int left, int top, int right, int bottom, CPUImage &image, uint64_t &samples, uint32_t &activePixels)
+{
+	samples = 0;
+	activePixels = 0;
+	for (int y = top; y < bottom; y++)
+	{
+		for (int x = left; x < right; x++)
+		{
+			size_t index = static_cast<size_t>(y) * image.width + x;
+			CPUAccumulatorPixel &pixel = accumulator.pixels[index];
+			uint32_t count = passSamples[index];
+			for (uint32_t i = 0; i < count; i++)
+			{
+				XMFLOAT2 subpixel = Get_Subpixel(x, y, pixel.count);
+				Add_Sample(pixel, Ray_Gen(scene, view, invView, x, y, subpixel.x, subpixel.y));
+			}
+			samples += count;
+			if (count > 0) activePixels++;
+
+			uint8_t* output = &image.pixels[index * 4];
+			output[0] = To_UNORM8(pixel.mean.x);
+			output[1] = To_UNORM8(pixel.mean.y);
+			output[2] = To_UNORM8(pixel.mean.z);
+			output[3] = 255;
+		}
+	}
+}
+
+/**
+* Render one progressive accumulation pass of the scene into an RGBA8 image, the mean of all the samples each pixel has
+* taken since the camera last changed. Samples are jittered across the pixel, and spent where the variance is high:
+* pixels stop taking samples once their error is below the accumulator's threshold. The accumulation starts over when
+* the hash of the view constant buffer changes. Returns true when no pixel took a sample, so the image has converged.
+*/
+bool Accumulate(const CPUScene &scene, const ViewCB &view, CPUAccumulator &accumulator, CPUImage &image, unsigned threadCount)
+{
+	image.width = static_cast<int>(view.resolution.x);
+	image.height = static_cast<int>(view.resolution.y);
+	image.pixels.resize(static_cast<size_t>(image.width) * image.height * 4);
+
+	uint64_t viewHash = Get_View_Hash(view);
+	size_t pixelCount = static_cast<size_t>(image.width) * image.height;
+	if (accumulator.passes == 0 || viewHash != accumulator.viewHash || accumulator.pixels.size() != pixelCount)
+	{
+		accumulator.viewHash = viewHash;
+		accumulator.passes = 0;
+		accumulator.samples = 0;
+		accumulator.pixels.assign(pixelCount, CPUAccumulatorPixel());
+	}
+
+	// Plan the pass before taking any samples, since pixels look at their neighbors' variance
+	vector<uint8_t> passSamples(pixelCount);
+	Utils::ParallelFor(image.height, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t y = begin; y < end; y++)
+		{
+			for (int x = 0; x < image.width; x++)
+			{
+				uint32_t count = Get_Pass_Samples(accumulator, image.width, image.height, x, static_cast<int>(y));
+				passSamples[y * image.width + x] = static_cast<uint8_t>(min(count, 255u));
+			}
+		}
+	});
+
+	XMMATRIX invView = XMMatrixTranspose(view.view);
+	int tilesX = (image.width + RenderTileSize - 1) / RenderTileSize;
+	int tilesY = (image.height + RenderTileSize - 1) / RenderTileSize;
+	vector<uint32_t> tiles = Get_Tile_Order(tilesX, tilesY);
+
+	atomic<uint64_t> samples(0);
+	atomic<uint32_t> activePixels(0);
+	Utils::ParallelForWorkStealing(tiles.size(), threadCount, [&](size_t index)
+	{
+		int left = static_cast<int>(tiles[index] % tilesX) * RenderTileSize;
+		int top = static_cast<int>(tiles[index] / tilesX) * RenderTileSize;
+		uint64_t tileSamples;
+		uint32_t tilePixels;
+		Accumulate_Rect(scene, view, invView, accumulator, passSamples, left, top, min(left + RenderTileSize, image.width), min(top + RenderTileSize, image.height), image, tileSamples, tilePixels);
+		samples += tileSamples;
+		activePixels += tilePixels;
+	});
+
+	accumulator.passes++;
+	accumulator.samples += samples;
+	accumulator.activePixels = activePixels;
+	return (activePixels == 0);
+}
+
+}
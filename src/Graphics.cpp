@@ -27,10 +27,28 @@
 
 #include <wrl.h>
 #include <atlcomcli.h>
+#include <d3d12shader.h>
 
 #include "Graphics.h"
+#include "ShaderDependencies.h"
+#include "ShaderIncludeHandler.h"
 #include "Utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#if PRECOMPILED_SHADERS
+// Generated by the PrecompileShaders build target
+#include "RayGen.dxil.h"
+#include "Miss.dxil.h"
+#include "ClosestHit.dxil.h"
+#include "RayTracing.dxil.h"
+#endif
+
 using namespace std;
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
@@ -316,40 +334,7 @@ void Create_Descriptor_Heaps(D3D12Global &d3d, D3D12Resources &resources)
 */
 void Update_View_CB(D3D12Global &d3d, D3D12Resources &resources) 
 {
-	const float rotationSpeed = 0.005f;
-	XMMATRIX view, invView;
-	XMFLOAT3 eye, focus, up;
-	float aspect, fov;
-
-	resources.eyeAngle.x += rotationSpeed;
-
-#if _DEBUG
-	float x = 2.f * cosf(resources.eyeAngle.x);
-	float y = 0.f;
-	float z = 2.25f + 2.f * sinf(resources.eyeAngle.x);
-
-	focus = XMFLOAT3(0.f, 0.f, 0.f);
-#else
-	float x = 8.f * cosf(resources.eyeAngle.x);
-	float y = 1.5f + 1.5f * cosf(resources.eyeAngle.x);
-	float z = 8.f + 2.25f * sinf(resources.eyeAngle.x);
-	focus = XMFLOAT3(0.f, 1.75f, 0.f);
-#endif
-
-	eye = XMFLOAT3(x, y, z);
-	up = XMFLOAT3(0.f, 1.f, 0.f);
-
-	aspect = (float)d3d.width / (float)d3d.height;
-	fov = 65.f * (XM_PI / 180.f);							// convert to radians
-
-	resources.rotationOffset += rotationSpeed;
-
-	view = XMMatrixLookAtLH(XMLoadFloat3(&eye), XMLoadFloat3(&focus), XMLoadFloat3(&up));
-	invView = XMMatrixInverse(NULL, view);
-
-	resources.viewCBData.view = XMMatrixTranspose(invView);
-	resources.viewCBData.viewOriginAndTanHalfFovY = XMFLOAT4(eye.x, eye.y, eye.z, tanf(fov * 0.5f));
-	resources.viewCBData.resolution = XMFLOAT2((float)d3d.width, (float)d3d.height);
+	Utils::UpdateView(resources.viewCBData, resources.eyeAngle, d3d.width, d3d.height);
 	memcpy(resources.viewCBStart, &resources.viewCBData, sizeof(resources.viewCBData));
 }
 
@@ -384,26 +369,198 @@ namespace D3DShaders
 {
 
 /**
-* Compile an HLSL shader using dxcompiler.
+* A DXIL library embedded in the executable at build time.
 */
-void Compile_Shader(D3D12ShaderCompilerInfo &compilerInfo, D3D12ShaderInfo &info, IDxcBlob** blob) 
+struct PrecompiledShader
+{
+	LPCWSTR					filename;
+	const unsigned char*	bytecode;
+	size_t					size;
+};
+
+#if PRECOMPILED_SHADERS
+static const PrecompiledShader PrecompiledShaders[] =
+{
+	{ L"shaders\\RayGen.hlsl", g_RayGen, sizeof(g_RayGen) },
+	{ L"shaders\\Miss.hlsl", g_Miss, sizeof(g_Miss) },
+	{ L"shaders\\ClosestHit.hlsl", g_ClosestHit, sizeof(g_ClosestHit) },
+	{ L"shaders\\RayTracing.hlsl", g_RayTracing, sizeof(g_RayTracing) },
+};
+#endif
+
+/**
+* Blob that references precompiled DXIL in static memory.
+*/
+class PrecompiledShaderBlob : public IDxcBlob
+{
+public:
+	PrecompiledShaderBlob(const PrecompiledShader &shader) : shader(shader) {}
+
+	LPVOID STDMETHODCALLTYPE GetBufferPointer() override { return (LPVOID)shader.bytecode; }
+	SIZE_T STDMETHODCALLTYPE GetBufferSize() override { return shader.size; }
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
+	{
+		if (riid == __uuidof(IDxcBlob) || riid == __uuidof(IUnknown))
+		{
+			*ppvObject = static_cast<IDxcBlob*>(this);
+			AddRef();
+			return S_OK;
+		}
+		*ppvObject = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef() override { return ++refCount; }
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		ULONG count = --refCount;
+		if (count == 0) delete this;
+		return count;
+	}
+
+private:
+	const PrecompiledShader&	shader;
+	atomic<ULONG>				refCount{ 1 };
+};
+
+/**
+* Get the precompiled DXIL for a shader, if it was embedded at build time.
+* Only shaders compiled without extra arguments or defines are precompiled.
+*/
+bool Load_Precompiled_Shader(const D3D12ShaderInfo &info, IDxcBlob** blob)
+{
+#if PRECOMPILED_SHADERS
+	if (info.argCount > 0 || info.defineCount > 0) return false;
+
+	for (const PrecompiledShader &shader : PrecompiledShaders)
+	{
+		if (_wcsicmp(shader.filename, info.filename) == 0)
+		{
+			*blob = new PrecompiledShaderBlob(shader);
+			return true;
+		}
+	}
+#endif
+	return false;
+}
+
+/**
+* Get the key of a shader in the dependency graph: its path, entry point and defines.
+*/
+wstring Get_Shader_Key(const D3D12ShaderInfo &info)
+{
+	vector<wstring> defines;
+	for (UINT32 i = 0; i < info.defineCount; i++)
+	{
+		wstring define = info.defines[i].Name;
+		if (info.defines[i].Value) define += wstring(L"=") + info.defines[i].Value;
+		defines.push_back(define);
+	}
+	return ShaderDependencies::Get_Key(ShaderDependencies::Get_Path(info.filename), info.entryPoint ? info.entryPoint : L"", defines);
+}
+
+/**
+* Read the instruction count and resource bindings of a compiled shader or library from its DXIL reflection.
+*/
+void Reflect_Shader(D3D12ShaderCompilerInfo &compilerInfo, IDxcBlob* blob, D3D12ShaderCompileStats &stats)
+{
+	CComPtr<IDxcContainerReflection> reflection;
+	if (FAILED(compilerInfo.DxcDllHelper.CreateInstance(CLSID_DxcContainerReflection, &reflection))) return;
+	if (FAILED(reflection->Load(blob))) return;
+
+	const UINT32 dxilPartKind = ('D' | ('X' << 8) | ('I' << 16) | ('L' << 24));
+	UINT32 partIndex;
+	if (FAILED(reflection->FindFirstPartKind(dxilPartKind, &partIndex))) return;
+
+	auto addBinding = [&stats](const D3D12_SHADER_INPUT_BIND_DESC &desc)
+	{
+		for (const D3D12ShaderBindingStats &binding : stats.bindings)
+		{
+			if (binding.name == desc.Name && binding.space == desc.Space && binding.bindPoint == desc.BindPoint) return;
+		}
+		stats.bindings.push_back({ desc.Name, static_cast<UINT>(desc.Type), desc.BindPoint, desc.BindCount, desc.Space });
+	};
+
+	// Libraries (ray tracing shaders) reflect per function, other shader stages reflect as a single shader
+	CComPtr<ID3D12LibraryReflection> libraryReflection;
+	CComPtr<ID3D12ShaderReflection> shaderReflection;
+	if (SUCCEEDED(reflection->GetPartReflection(partIndex, IID_PPV_ARGS(&libraryReflection))))
+	{
+		D3D12_LIBRARY_DESC libraryDesc;
+		if (FAILED(libraryReflection->GetDesc(&libraryDesc))) return;
+
+		for (UINT i = 0; i < libraryDesc.FunctionCount; i++)
+		{
+			ID3D12FunctionReflection* function = libraryReflection->GetFunctionByIndex(i);
+			D3D12_FUNCTION_DESC functionDesc;
+			if (FAILED(function->GetDesc(&functionDesc))) continue;
+
+			stats.instructionCount += functionDesc.InstructionCount;
+			for (UINT j = 0; j < functionDesc.BoundResources; j++)
+			{
+				D3D12_SHADER_INPUT_BIND_DESC bindDesc;
+				if (SUCCEEDED(function->GetResourceBindingDesc(j, &bindDesc))) addBinding(bindDesc);
+			}
+		}
+	}
+	else if (SUCCEEDED(reflection->GetPartReflection(partIndex, IID_PPV_ARGS(&shaderReflection))))
+	{
+		D3D12_SHADER_DESC shaderDesc;
+		if (FAILED(shaderReflection->GetDesc(&shaderDesc))) return;
+
+		stats.instructionCount = shaderDesc.InstructionCount;
+		for (UINT j = 0; j < shaderDesc.BoundResources; j++)
+		{
+			D3D12_SHADER_INPUT_BIND_DESC bindDesc;
+			if (SUCCEEDED(shaderReflection->GetResourceBindingDesc(j, &bindDesc))) addBinding(bindDesc);
+		}
+	}
+}
+
+/**
+* Compile an HLSL shader using the given dxcompiler and library instances.
+* Gets the files the shader was compiled from, even if the compile fails, but does not record them:
+* that is up to the caller once it installs the blob.
+* Does not report errors, so it is safe to call from worker threads.
+*/
+HRESULT Compile_Shader(D3D12ShaderCompilerInfo &compilerInfo, IDxcCompiler* compiler, IDxcLibrary* library, ShaderSourceCache &cache, D3D12ShaderInfo &info, IDxcBlob** blob, vector<ShaderDependency> &dependencies, string &errorMsg)
 {
 	HRESULT hr;
-	UINT32 code(0);
-	IDxcBlobEncoding* pShaderText(nullptr);
+	dependencies.clear();
+	ShaderIncludeHandler includeHandler(library, cache, dependencies);
+
+	D3D12ShaderCompileStats stats;
+	stats.filename = info.filename;
+	stats.entryPoint = info.entryPoint ? info.entryPoint : L"";
+	stats.targetProfile = info.targetProfile ? info.targetProfile : L"";
+	for (UINT32 i = 0; i < info.defineCount; i++)
+	{
+		stats.defines.push_back(info.defines[i].Name);
+	}
 
-	// Load and encode the shader file
-	hr = compilerInfo.library->CreateBlobFromFile(info.filename, &code, &pShaderText);
-	Utils::Validate(hr, L"Error: failed to create blob from shader file!");
+	// Load the shader file through the include handler, so it is cached and recorded as a dependency too
+	CComPtr<IDxcBlob> pShaderText;
+	hr = includeHandler.LoadSource(info.filename, &pShaderText);
+	if (FAILED(hr))
+	{
+		errorMsg = "Error: failed to create blob from shader file!";
+		return hr;
+	}
 
-	// Create the compiler include handler
-	CComPtr<IDxcIncludeHandler> dxcIncludeHandler;
-	hr = compilerInfo.library->CreateIncludeHandler(&dxcIncludeHandler);
-	Utils::Validate(hr, L"Error: failed to create include handler");
+	// Time preprocessing on its own. Compile() preprocesses again, so this is only done when collecting stats.
+	if (compilerInfo.collectStats)
+	{
+		auto start = chrono::high_resolution_clock::now();
+		CComPtr<IDxcOperationResult> preprocessResult;
+		compiler->Preprocess(pShaderText, info.filename, info.arguments, info.argCount, info.defines, info.defineCount, &includeHandler, &preprocessResult);
+		stats.preprocessMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
 
 	// Compile the shader
-	IDxcOperationResult* result;
-	hr = compilerInfo.compiler->Compile(
+	auto start = chrono::high_resolution_clock::now();
+	CComPtr<IDxcOperationResult> result;
+	hr = compiler->Compile(
 		pShaderText, 
 		info.filename, 
 		info.entryPoint, 
@@ -412,33 +569,207 @@ void Compile_Shader(D3D12ShaderCompilerInfo &compilerInfo, D3D12ShaderInfo &info
 		info.argCount, 
 		info.defines, 
 		info.defineCount, 
-		dxcIncludeHandler, 
+		&includeHandler, 
 		&result);
+	stats.compileMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
 
-	Utils::Validate(hr, L"Error: failed to compile shader!");
+	if (FAILED(hr))
+	{
+		errorMsg = "Error: failed to compile shader!";
+		return hr;
+	}
 
 	// Verify the result
 	result->GetStatus(&hr);
 	if (FAILED(hr)) 
 	{
-		IDxcBlobEncoding* error;
-		hr = result->GetErrorBuffer(&error);
-		Utils::Validate(hr, L"Error: failed to get shader compiler error buffer!");
+		CComPtr<IDxcBlobEncoding> error;
+		if (FAILED(result->GetErrorBuffer(&error)))
+		{
+			errorMsg = "Error: failed to get shader compiler error buffer!";
+			return hr;
+		}
 
 		// Convert error blob to a string
 		vector<char> infoLog(error->GetBufferSize() + 1);
 		memcpy(infoLog.data(), error->GetBufferPointer(), error->GetBufferSize());
 		infoLog[error->GetBufferSize()] = 0;
 
-		string errorMsg = "Shader Compiler Error:\n";
+		errorMsg = "Shader Compiler Error:\n";
 		errorMsg.append(infoLog.data());
+		return hr;
+	}
+
+	hr = result->GetResult(blob);
+	if (FAILED(hr))
+	{
+		errorMsg = "Error: failed to get shader blob result!";
+		return hr;
+	}
+
+	if (compilerInfo.collectStats)
+	{
+		stats.dxilSize = (*blob)->GetBufferSize();
+		Reflect_Shader(compilerInfo, *blob, stats);
 
+		lock_guard<mutex> guard(compilerInfo.statsLock);
+		compilerInfo.stats.push_back(move(stats));
+	}
+	return hr;
+}
+
+/**
+* Check if a shader, or any file it included, changed on disk since the blob installed for it was compiled.
+* Shaders with no installed blob, such as those that failed to compile or were precompiled, are stale.
+*/
+bool Is_Shader_Stale(D3D12ShaderCompilerInfo &compilerInfo, const D3D12ShaderInfo &info)
+{
+	return ShaderDependencies::Is_Stale(compilerInfo.dependencies, Get_Shader_Key(info));
+}
+
+/**
+* Start watching a shader directory (and its subdirectories) for file changes.
+*/
+void Watch_Shader_Directory(D3D12ShaderCompilerInfo &compilerInfo, LPCWSTR directory)
+{
+	ShaderDependencies::Watch_Directory(compilerInfo.watcher, directory);
+}
+
+/**
+* Check, without blocking, if any file in the watched shader directory changed since the last call.
+*/
+bool Shader_Files_Changed(D3D12ShaderCompilerInfo &compilerInfo)
+{
+	return ShaderDependencies::Files_Changed(compilerInfo.watcher);
+}
+
+/**
+* Compile an HLSL shader using dxcompiler, for a blob the caller installs right away.
+*/
+void Compile_Shader(D3D12ShaderCompilerInfo &compilerInfo, D3D12ShaderInfo &info, IDxcBlob** blob) 
+{
+	string errorMsg;
+	ShaderSourceCache cache;
+	vector<ShaderDependency> dependencies;
+	HRESULT hr = Compile_Shader(compilerInfo, compilerInfo.compiler, compilerInfo.library, cache, info, blob, dependencies, errorMsg);
+	if (FAILED(hr))
+	{
 		MessageBoxA(nullptr, errorMsg.c_str(), "Error!", MB_OK);
 		return;
 	}
+	ShaderDependencies::Record(compilerInfo.dependencies, Get_Shader_Key(info), dependencies);
+}
 
-	hr = result->GetResult(blob);
-	Utils::Validate(hr, L"Error: failed to get shader blob result!");
+/**
+* Compile a batch of HLSL shaders concurrently using dxcompiler.
+* Each worker thread creates its own compiler and library instances, since they are not thread safe.
+* Failed shaders have a null blob and a non-empty error message.
+* Callers record the dependencies of the blobs they install.
+*/
+void Compile_Shaders(D3D12ShaderCompilerInfo &compilerInfo, vector<D3D12ShaderInfo> &infos, vector<IDxcBlob*> &blobs, vector<vector<ShaderDependency>> &dependencies, vector<string> &errors)
+{
+	const size_t count = infos.size();
+	blobs.assign(count, nullptr);
+	dependencies.assign(count, vector<ShaderDependency>());
+	errors.assign(count, string());
+
+	vector<HRESULT> results(count, S_OK);
+
+	// Shared by all workers, so common includes are read from disk once per batch
+	ShaderSourceCache cache;
+
+	// Workers pull the next shader to compile until the batch is empty
+	atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		CComPtr<IDxcCompiler> compiler;
+		CComPtr<IDxcLibrary> library;
+		HRESULT hr = compilerInfo.DxcDllHelper.CreateInstance(CLSID_DxcCompiler, &compiler);
+		if (SUCCEEDED(hr)) hr = compilerInfo.DxcDllHelper.CreateInstance(CLSID_DxcLibrary, &library);
+
+		for (size_t i = next++; i < count; i = next++)
+		{
+			if (FAILED(hr))
+			{
+				results[i] = hr;
+				errors[i] = "Failed to create DxcCompiler!";
+				continue;
+			}
+			results[i] = Compile_Shader(compilerInfo, compiler, library, cache, infos[i], &blobs[i], dependencies[i], errors[i]);
+		}
+	};
+
+	size_t numThreads = max(thread::hardware_concurrency(), 1u);
+	if (numThreads > count) numThreads = count;
+	vector<thread> threads;
+	for (size_t i = 1; i < numThreads; i++)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+
+	for (thread &t : threads)
+	{
+		t.join();
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (FAILED(results[i])) SAFE_RELEASE(blobs[i]);
+	}
+}
+
+/**
+* Compile a batch of HLSL shaders concurrently using dxcompiler, reporting any errors.
+*/
+void Compile_Shaders(D3D12ShaderCompilerInfo &compilerInfo, vector<D3D12ShaderInfo> &infos, vector<IDxcBlob*> &blobs, vector<vector<ShaderDependency>> &dependencies)
+{
+	vector<string> errors;
+	Compile_Shaders(compilerInfo, infos, blobs, dependencies, errors);
+
+	// Report errors from the calling thread
+	for (const string &error : errors)
+	{
+		if (!error.empty())
+		{
+			MessageBoxA(nullptr, error.c_str(), "Error!", MB_OK);
+		}
+	}
+}
+
+/**
+* Compile a batch of HLSL ray tracing shaders concurrently using dxcompiler.
+*/
+void Compile_Shaders(D3D12ShaderCompilerInfo &compilerInfo, vector<RtProgram*> &programs)
+{
+	// Use precompiled DXIL where available, and only compile the rest
+	vector<RtProgram*> compilePrograms;
+	vector<D3D12ShaderInfo> infos;
+	vector<IDxcBlob*> blobs;
+	vector<vector<ShaderDependency>> dependencies;
+	for (RtProgram* program : programs)
+	{
+		if (Load_Precompiled_Shader(program->info, &program->blob))
+		{
+			program->SetBytecode();
+			continue;
+		}
+
+		compilePrograms.push_back(program);
+		infos.push_back(program->info);
+	}
+
+	if (infos.empty()) return;
+	Compile_Shaders(compilerInfo, infos, blobs, dependencies);
+
+	for (size_t i = 0; i < compilePrograms.size(); i++)
+	{
+		compilePrograms[i]->blob = blobs[i];
+		if (!compilePrograms[i]->blob) continue;
+
+		compilePrograms[i]->SetBytecode();
+		ShaderDependencies::Record(compilerInfo.dependencies, Get_Shader_Key(infos[i]), dependencies[i]);
+	}
 }
 
 /**
@@ -450,6 +781,258 @@ void Compile_Shader(D3D12ShaderCompilerInfo &compilerInfo, RtProgram &program)
 	program.SetBytecode();
 }
 
+/**
+* Compile the requested permutations of a shader on a background thread, with its own compiler instance.
+*/
+void Compile_Permutations(D3D12ShaderPermutations &permutations)
+{
+	D3D12ShaderCompilerInfo &compilerInfo = *permutations.compilerInfo;
+
+	CComPtr<IDxcCompiler> compiler;
+	CComPtr<IDxcLibrary> library;
+	HRESULT hr = compilerInfo.DxcDllHelper.CreateInstance(CLSID_DxcCompiler, &compiler);
+	if (SUCCEEDED(hr)) hr = compilerInfo.DxcDllHelper.CreateInstance(CLSID_DxcLibrary, &library);
+
+	unique_lock<mutex> lock(permutations.lock);
+	while (true)
+	{
+		permutations.wake.wait(lock, [&]() { return permutations.shutdown || !permutations.pending.empty(); });
+		if (permutations.shutdown) return;
+
+		vector<uint32_t> keys;
+		swap(keys, permutations.pending);
+		lock.unlock();
+
+		// Share sources between the permutations compiled in this batch
+		ShaderSourceCache cache;
+		for (uint32_t key : keys)
+		{
+			// Enable the define of each feature bit that is set
+			vector<DxcDefine> defines;
+			for (size_t feature = 0; feature < permutations.features.size(); feature++)
+			{
+				if (key & (1u << feature)) defines.push_back({ permutations.features[feature].c_str(), L"1" });
+			}
+
+			D3D12ShaderInfo info = permutations.info;
+			info.defines = defines.data();
+			info.defineCount = static_cast<UINT32>(defines.size());
+
+			IDxcBlob* blob = nullptr;
+			vector<ShaderDependency> dependencies;
+			string errorMsg = "Failed to create DxcCompiler!";
+			if (SUCCEEDED(hr) && FAILED(Compile_Shader(compilerInfo, compiler, library, cache, info, &blob, dependencies, errorMsg)))
+			{
+				SAFE_RELEASE(blob);
+			}
+
+			if (!blob)
+			{
+				OutputDebugStringA(errorMsg.c_str());
+				OutputDebugStringA("\n");
+			}
+
+			// Failed permutations keep their dependencies too, so fixing the shader evicts them and they are retried
+			lock_guard<mutex> guard(permutations.lock);
+			permutations.blobs[key] = blob;
+			permutations.defines[key] = move(defines);
+			permutations.dependencies[key] = move(dependencies);
+			permutations.compileCount++;
+		}
+
+		lock.lock();
+	}
+}
+
+/**
+* Initialize a shader's permutations, one per combination of feature bits.
+* Nothing is compiled until a permutation is requested.
+*/
+void Init_Permutations(D3D12ShaderCompilerInfo &compilerInfo, D3D12ShaderPermutations &permutations, const D3D12ShaderInfo &info, const vector<wstring> &features)
+{
+	permutations.compilerInfo = &compilerInfo;
+	permutations.info = info;
+	permutations.features = features;
+	permutations.worker = thread(Compile_Permutations, ref(permutations));
+}
+
+/**
+* Get a permutation of a shader, keyed by its feature bits, and assign it to a program.
+* The first request for a permutation queues it for compilation on the background thread, and returns false until it is ready.
+* Returns true when the program was updated, so the caller can rebuild its RTPSO.
+*/
+bool Get_Permutation(D3D12ShaderPermutations &permutations, uint32_t key, RtProgram &program)
+{
+	key &= (1u << permutations.features.size()) - 1;
+
+	lock_guard<mutex> guard(permutations.lock);
+	auto it = permutations.blobs.find(key);
+	if (it == permutations.blobs.end())
+	{
+		if (permutations.requested.insert(key).second)
+		{
+			permutations.pending.push_back(key);
+			permutations.wake.notify_one();
+		}
+		return false;
+	}
+
+	IDxcBlob* blob = it->second;
+	if (!blob || blob == program.blob) return false;
+
+	// The program holds its own reference, so the permutation can be evicted while in use
+	blob->AddRef();
+	SAFE_RELEASE(program.blob);
+	program.blob = blob;
+	program.SetBytecode();
+
+	// Copy the permutation's defines, so a hot reload recompiles the same permutation. The program keeps its own copy,
+	// since the compile thread replaces the permutation's defines when it compiles the permutation again.
+	program.SetDefines(permutations.defines[key]);
+	ShaderDependencies::Record(permutations.compilerInfo->dependencies, Get_Shader_Key(program.info), permutations.dependencies[key]);
+	return true;
+}
+
+/**
+* Drop the compiled permutations whose files changed on disk since they were compiled, so they are compiled again on their next request.
+*/
+void Evict_Stale_Permutations(D3D12ShaderPermutations &permutations)
+{
+	if (!permutations.compilerInfo) return;
+
+	lock_guard<mutex> guard(permutations.lock);
+	for (auto it = permutations.blobs.begin(); it != permutations.blobs.end();)
+	{
+		if (!ShaderDependencies::Is_Stale(permutations.dependencies[it->first]))
+		{
+			++it;
+			continue;
+		}
+
+		SAFE_RELEASE(it->second);
+		permutations.requested.erase(it->first);
+		permutations.dependencies.erase(it->first);
+		it = permutations.blobs.erase(it);
+	}
+}
+
+/**
+* Stop the permutation compile thread, report how many permutations were compiled, and release them.
+*/
+void Destroy(D3D12ShaderPermutations &permutations)
+{
+	if (!permutations.worker.joinable()) return;
+
+	{
+		lock_guard<mutex> guard(permutations.lock);
+		permutations.shutdown = true;
+	}
+	permutations.wake.notify_one();
+	permutations.worker.join();
+
+	char msg[256];
+	sprintf_s(msg, "Shader permutations: compiled %u of %u possible\n", permutations.compileCount, (1u << permutations.features.size()));
+	OutputDebugStringA(msg);
+
+	for (auto &it : permutations.blobs)
+	{
+		SAFE_RELEASE(it.second);
+	}
+	permutations.blobs.clear();
+}
+
+/**
+* Escape a UTF-8 string for a JSON string literal.
+*/
+string To_JSON_String(const string &utf8)
+{
+	string result = "\"";
+	for (char c : utf8)
+	{
+		if (c == '"' || c == '\\') result += '\\';
+		if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escaped[8];
+			sprintf_s(escaped, "\\u%04x", c);
+			result += escaped;
+			continue;
+		}
+		result += c;
+	}
+	return result + "\"";
+}
+
+/**
+* Convert a wide string to UTF-8 and escape it for a JSON string literal.
+*/
+string To_JSON_String(const wstring &value)
+{
+	string utf8;
+	int size = WideCharToMultiByte(CP_UTF8, 0, value.c_str(), static_cast<int>(value.size()), nullptr, 0, nullptr, nullptr);
+	utf8.resize(size);
+	if (size > 0) WideCharToMultiByte(CP_UTF8, 0, value.c_str(), static_cast<int>(value.size()), &utf8[0], size, nullptr, nullptr);
+	return To_JSON_String(utf8);
+}
+
+/**
+* Write the stats collected for every shader compiled so far to a JSON file.
+*/
+void Write_Compile_Stats(D3D12ShaderCompilerInfo &compilerInfo, const string &filename)
+{
+	ofstream file(filename);
+	if (!file.is_open())
+	{
+		Utils::Validate(E_FAIL, L"Error: failed to open shader stats file!");
+		return;
+	}
+
+	lock_guard<mutex> guard(compilerInfo.statsLock);
+
+	file << "{\n  \"shaders\": [";
+	for (size_t i = 0; i < compilerInfo.stats.size(); i++)
+	{
+		const D3D12ShaderCompileStats &stats = compilerInfo.stats[i];
+		file << (i > 0 ? "," : "") << "\n    {\n";
+		file << "      \"filename\": " << To_JSON_String(stats.filename) << ",\n";
+		file << "      \"entryPoint\": " << To_JSON_String(stats.entryPoint) << ",\n";
+		file << "      \"targetProfile\": " << To_JSON_String(stats.targetProfile) << ",\n";
+		file << "      \"defines\": [";
+		for (size_t j = 0; j < stats.defines.size(); j++)
+		{
+			file << (j > 0 ? ", " : "") << To_JSON_String(stats.defines[j]);
+		}
+		file << "],\n";
+		file << "      \"preprocessMs\": " << stats.preprocessMs << ",\n";
+		file << "      \"compileMs\": " << stats.compileMs << ",\n";
+		file << "      \"dxilSize\": " << stats.dxilSize << ",\n";
+		file << "      \"instructionCount\": " << stats.instructionCount << ",\n";
+		file << "      \"bindings\": [";
+		for (size_t j = 0; j < stats.bindings.size(); j++)
+		{
+			const D3D12ShaderBindingStats &binding = stats.bindings[j];
+			file << (j > 0 ? "," : "") << "\n        { ";
+			file << "\"name\": " << To_JSON_String(binding.name) << ", ";
+			file << "\"type\": " << binding.type << ", ";
+			file << "\"bindPoint\": " << binding.bindPoint << ", ";
+			file << "\"bindCount\": " << binding.bindCount << ", ";
+			file << "\"space\": " << binding.space << " }";
+		}
+		file << (stats.bindings.empty() ? "]\n" : "\n      ]\n");
+		file << "    }";
+	}
+	file << "\n  ],\n  \"libraryLayouts\": [";
+	for (size_t i = 0; i < compilerInfo.libraryLayouts.size(); i++)
+	{
+		const D3D12LibraryLayoutStats &layout = compilerInfo.libraryLayouts[i];
+		file << (i > 0 ? "," : "") << "\n    { ";
+		file << "\"layout\": " << To_JSON_String(layout.layout) << ", ";
+		file << "\"libraryCount\": " << layout.libraryCount << ", ";
+		file << "\"dxilSize\": " << layout.dxilSize << ", ";
+		file << "\"compileMs\": " << layout.compileMs << " }";
+	}
+	file << (compilerInfo.libraryLayouts.empty() ? "]\n}\n" : "\n  ]\n}\n");
+}
+
 /**
 * Initialize the shader compiler.
 */
@@ -924,11 +1507,10 @@ void Create_Top_Level_AS(D3D12Global &d3d, DXRGlobal &dxr, D3D12Resources &resou
 /**
 * Load and create the DXR Ray Generation program and root signature.
 */
-void Create_RayGen_Program(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler)
+void Create_RayGen_Program(D3D12Global &d3d, DXRGlobal &dxr)
 {
-	// Load and compile the ray generation shader
+	// Describe the ray generation shader, it is compiled with the other programs in Compile_Programs()
 	dxr.rgs = RtProgram(D3D12ShaderInfo(L"shaders\\RayGen.hlsl", L"", L"lib_6_3"));
-	D3DShaders::Compile_Shader(shaderCompiler, dxr.rgs);
 
 	// Describe the ray generation root signature
 	D3D12_DESCRIPTOR_RANGE ranges[3];
@@ -974,22 +1556,200 @@ void Create_RayGen_Program(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompiler
 /**
 * Load and create the DXR Miss program and root signature.
 */
-void Create_Miss_Program(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler)
+void Create_Miss_Program(D3D12Global &d3d, DXRGlobal &dxr)
 {
-	// Load and compile the miss shader
+	// Describe the miss shader
 	dxr.miss = RtProgram(D3D12ShaderInfo(L"shaders\\Miss.hlsl", L"", L"lib_6_3"));
-	D3DShaders::Compile_Shader(shaderCompiler, dxr.miss);
 }
 
 /**
 * Load and create the DXR Closest Hit program and root signature.
 */
-void Create_Closest_Hit_Program(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler)
+void Create_Closest_Hit_Program(D3D12Global &d3d, DXRGlobal &dxr)
 {
-	// Load and compile the Closest Hit shader
+	// Describe the Closest Hit shader
 	dxr.hit = HitProgram(L"Hit");
 	dxr.hit.chs = RtProgram(D3D12ShaderInfo(L"shaders\\ClosestHit.hlsl", L"", L"lib_6_3"));
-	D3DShaders::Compile_Shader(shaderCompiler, dxr.hit.chs);
+}
+
+/**
+* Load and create a single DXR library program that contains the RayGen, Miss, and Closest Hit entry points.
+* When created, it replaces the separate libraries in the RTPSO.
+*/
+void Create_Library_Program(D3D12Global &d3d, DXRGlobal &dxr)
+{
+	dxr.lib = RtProgram(D3D12ShaderInfo(L"shaders\\RayTracing.hlsl", L"", L"lib_6_3"));
+	dxr.combinedLibrary = true;
+}
+
+/**
+* Get the programs whose shaders make up the RTPSO's DXIL libraries.
+*/
+vector<RtProgram*> Get_Library_Programs(DXRGlobal &dxr)
+{
+	if (dxr.combinedLibrary) return { &dxr.lib };
+	return { &dxr.rgs, &dxr.miss, &dxr.hit.chs };
+}
+
+/**
+* Compile the shaders of a DXIL library layout without installing them, and measure its compile time and total DXIL size.
+* The fastest of a few compiles is kept, so DXC's first use warming up does not count against either layout.
+* Returns false if any of the libraries fails to compile.
+*/
+bool Measure_Library_Layout(D3D12ShaderCompilerInfo &shaderCompiler, const char* layout, vector<D3D12ShaderInfo> &infos, D3D12LibraryLayoutStats &stats)
+{
+	const int runs = 3;
+
+	bool compiled = true;
+	stats.layout = layout;
+	stats.libraryCount = infos.size();
+	for (int run = 0; run < runs; run++)
+	{
+		vector<IDxcBlob*> blobs;
+		vector<vector<ShaderDependency>> dependencies;
+		vector<string> errors;
+
+		auto start = chrono::high_resolution_clock::now();
+		D3DShaders::Compile_Shaders(shaderCompiler, infos, blobs, dependencies, errors);
+		double elapsed = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		if (run == 0 || elapsed < stats.compileMs) stats.compileMs = elapsed;
+
+		stats.dxilSize = 0;
+		for (IDxcBlob* &blob : blobs)
+		{
+			if (blob) stats.dxilSize += blob->GetBufferSize();
+			else compiled = false;
+			SAFE_RELEASE(blob);
+		}
+	}
+	return compiled;
+}
+
+/**
+* Compile the DXR programs' shaders in parallel.
+* Logs the compile time and total DXIL size. When collecting shader stats, both the separate and combined
+* library layouts are also measured, whichever is in use, and added to the stats so they can be compared.
+*/
+void Compile_Programs(DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler)
+{
+	vector<RtProgram*> programs = Get_Library_Programs(dxr);
+
+	auto start = chrono::high_resolution_clock::now();
+	D3DShaders::Compile_Shaders(shaderCompiler, programs);
+	chrono::duration<double, milli> elapsed = chrono::high_resolution_clock::now() - start;
+
+	size_t dxilSize = 0;
+	for (RtProgram* program : programs)
+	{
+		if (program->blob) dxilSize += program->blob->GetBufferSize();
+	}
+
+	char msg[256];
+	sprintf_s(msg, "DXR libraries (%s): %zu libraries, %zu bytes of DXIL, compiled in %.2f ms\n", 
+		dxr.combinedLibrary ? "combined" : "separate", programs.size(), dxilSize, elapsed.count());
+	OutputDebugStringA(msg);
+
+	if (!shaderCompiler.collectStats) return;
+
+	// The measurement compiles are not installed, so keep them out of the per shader stats
+	const char* names[] = { "separate", "combined" };
+	vector<D3D12ShaderInfo> layouts[] = {
+		{ dxr.rgs.info, dxr.miss.info, dxr.hit.chs.info },
+		{ dxr.combinedLibrary ? dxr.lib.info : D3D12ShaderInfo(L"shaders\\RayTracing.hlsl", L"", L"lib_6_3") } };
+
+	shaderCompiler.collectStats = false;
+	for (int i = 0; i < 2; i++)
+	{
+		D3D12LibraryLayoutStats layout;
+		if (!Measure_Library_Layout(shaderCompiler, names[i], layouts[i], layout))
+		{
+			sprintf_s(msg, "DXR library layout (%s): failed to compile, not measured\n", names[i]);
+			OutputDebugStringA(msg);
+			continue;
+		}
+
+		sprintf_s(msg, "DXR library layout (%s): %zu libraries, %zu bytes of DXIL, fastest compile %.2f ms\n",
+			names[i], layout.libraryCount, layout.dxilSize, layout.compileMs);
+		OutputDebugStringA(msg);
+
+		lock_guard<mutex> guard(shaderCompiler.statsLock);
+		shaderCompiler.libraryLayouts.push_back(layout);
+	}
+	shaderCompiler.collectStats = true;
+}
+
+/**
+* Recompile the programs whose shaders changed on disk, then rebuild the RTPSO and patch the shader table.
+* Geometry, acceleration structures, and descriptors are left untouched.
+* If a shader fails to compile, the error is logged and the current pipeline is kept.
+*/
+void Reload_Programs(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCompilerInfo &shaderCompiler)
+{
+	// Find the stale programs
+	vector<RtProgram*> programs = Get_Library_Programs(dxr);
+	vector<RtProgram*> stalePrograms;
+	vector<D3D12ShaderInfo> infos;
+	for (RtProgram* program : programs)
+	{
+		if (D3DShaders::Is_Shader_Stale(shaderCompiler, program->info))
+		{
+			stalePrograms.push_back(program);
+			infos.push_back(program->info);
+		}
+	}
+
+	if (stalePrograms.empty()) return;
+
+	// Compile into new blobs, so the running pipeline survives compile errors.
+	// Nothing is recorded for discarded blobs, so the programs stay stale until they all compile.
+	vector<IDxcBlob*> blobs;
+	vector<vector<ShaderDependency>> dependencies;
+	vector<string> errors;
+	D3DShaders::Compile_Shaders(shaderCompiler, infos, blobs, dependencies, errors);
+
+	bool failed = false;
+	for (const string &error : errors)
+	{
+		if (error.empty()) continue;
+		OutputDebugStringA(error.c_str());
+		OutputDebugStringA("\n");
+		failed = true;
+	}
+
+	if (failed)
+	{
+		for (IDxcBlob* blob : blobs) SAFE_RELEASE(blob);
+		return;
+	}
+
+	for (size_t i = 0; i < stalePrograms.size(); i++)
+	{
+		SAFE_RELEASE(stalePrograms[i]->blob);
+		stalePrograms[i]->blob = blobs[i];
+		stalePrograms[i]->SetBytecode();
+		ShaderDependencies::Record(shaderCompiler.dependencies, D3DShaders::Get_Shader_Key(infos[i]), dependencies[i]);
+	}
+
+	Rebuild_Pipeline_State_Object(d3d, dxr);
+}
+
+/**
+* Rebuild the RTPSO from the programs' current blobs, and patch the shader table to match.
+*/
+void Rebuild_Pipeline_State_Object(D3D12Global &d3d, DXRGlobal &dxr)
+{
+	// The GPU may still reference the current RTPSO and shader table
+	D3D12::WaitForGPU(d3d);
+
+	// Keep the old RTPSO alive until the shader table is patched
+	ID3D12StateObject* oldRtpso = dxr.rtpso;
+	ID3D12StateObjectProperties* oldRtpsoInfo = dxr.rtpsoInfo;
+
+	Create_Pipeline_State_Object(d3d, dxr);
+	Update_Shader_Table(dxr);
+
+	SAFE_RELEASE(oldRtpsoInfo);
+	SAFE_RELEASE(oldRtpso);
 }
 
 /**
@@ -997,7 +1757,7 @@ void Create_Closest_Hit_Program(D3D12Global &d3d, DXRGlobal &dxr, D3D12ShaderCom
 */
 void Create_Pipeline_State_Object(D3D12Global &d3d, DXRGlobal &dxr)
 {
-	// Need 10 subobjects:
+	// Need 10 subobjects (8 with a combined library):
 	// 1 for RGS program
 	// 1 for Miss program
 	// 1 for CHS program
@@ -1008,61 +1768,85 @@ void Create_Pipeline_State_Object(D3D12Global &d3d, DXRGlobal &dxr)
 	// 1 for Pipeline Config	
 	UINT index = 0;
 	vector<D3D12_STATE_SUBOBJECT> subobjects;
-	subobjects.resize(10);
+	subobjects.resize(dxr.combinedLibrary ? 8 : 10);
 	
-	// Add state subobject for the RGS
+	// Describe the RGS export
 	D3D12_EXPORT_DESC rgsExportDesc = {};
 	rgsExportDesc.Name = L"RayGen_12";
 	rgsExportDesc.ExportToRename = L"RayGen";
 	rgsExportDesc.Flags = D3D12_EXPORT_FLAG_NONE;
 
-	D3D12_DXIL_LIBRARY_DESC	rgsLibDesc = {};
-	rgsLibDesc.DXILLibrary.BytecodeLength = dxr.rgs.blob->GetBufferSize();
-	rgsLibDesc.DXILLibrary.pShaderBytecode = dxr.rgs.blob->GetBufferPointer();
-	rgsLibDesc.NumExports = 1;
-	rgsLibDesc.pExports = &rgsExportDesc;
-
-	D3D12_STATE_SUBOBJECT rgs = {};
-	rgs.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
-	rgs.pDesc = &rgsLibDesc;
-
-	subobjects[index++] = rgs;
-
-	// Add state subobject for the Miss shader
+	// Describe the Miss shader export
 	D3D12_EXPORT_DESC msExportDesc = {};
 	msExportDesc.Name = L"Miss_5";
 	msExportDesc.ExportToRename = L"Miss";
 	msExportDesc.Flags = D3D12_EXPORT_FLAG_NONE;
 
-	D3D12_DXIL_LIBRARY_DESC	msLibDesc = {};
-	msLibDesc.DXILLibrary.BytecodeLength = dxr.miss.blob->GetBufferSize();
-	msLibDesc.DXILLibrary.pShaderBytecode = dxr.miss.blob->GetBufferPointer();
-	msLibDesc.NumExports = 1;
-	msLibDesc.pExports = &msExportDesc;
-
-	D3D12_STATE_SUBOBJECT ms = {};
-	ms.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
-	ms.pDesc = &msLibDesc;
-
-	subobjects[index++] = ms;
-
-	// Add state subobject for the Closest Hit shader
+	// Describe the Closest Hit shader export
 	D3D12_EXPORT_DESC chsExportDesc = {};
 	chsExportDesc.Name = L"ClosestHit_76";
 	chsExportDesc.ExportToRename = L"ClosestHit";
 	chsExportDesc.Flags = D3D12_EXPORT_FLAG_NONE;
 
+	D3D12_EXPORT_DESC libExportDescs[] = { rgsExportDesc, msExportDesc, chsExportDesc };
+
+	D3D12_DXIL_LIBRARY_DESC	libDesc = {};
+	D3D12_DXIL_LIBRARY_DESC	rgsLibDesc = {};
+	D3D12_DXIL_LIBRARY_DESC	msLibDesc = {};
 	D3D12_DXIL_LIBRARY_DESC	chsLibDesc = {};
-	chsLibDesc.DXILLibrary.BytecodeLength = dxr.hit.chs.blob->GetBufferSize();
-	chsLibDesc.DXILLibrary.pShaderBytecode = dxr.hit.chs.blob->GetBufferPointer();
-	chsLibDesc.NumExports = 1;
-	chsLibDesc.pExports = &chsExportDesc;
 
-	D3D12_STATE_SUBOBJECT chs = {};
-	chs.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
-	chs.pDesc = &chsLibDesc;
+	if (dxr.combinedLibrary)
+	{
+		// Add a single state subobject for the library that exports all three shaders
+		libDesc.DXILLibrary.BytecodeLength = dxr.lib.blob->GetBufferSize();
+		libDesc.DXILLibrary.pShaderBytecode = dxr.lib.blob->GetBufferPointer();
+		libDesc.NumExports = _countof(libExportDescs);
+		libDesc.pExports = libExportDescs;
+
+		D3D12_STATE_SUBOBJECT lib = {};
+		lib.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
+		lib.pDesc = &libDesc;
+
+		subobjects[index++] = lib;
+	}
+	else
+	{
+		// Add state subobject for the RGS
+		rgsLibDesc.DXILLibrary.BytecodeLength = dxr.rgs.blob->GetBufferSize();
+		rgsLibDesc.DXILLibrary.pShaderBytecode = dxr.rgs.blob->GetBufferPointer();
+		rgsLibDesc.NumExports = 1;
+		rgsLibDesc.pExports = &rgsExportDesc;
+
+		D3D12_STATE_SUBOBJECT rgs = {};
+		rgs.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
+		rgs.pDesc = &rgsLibDesc;
+
+		subobjects[index++] = rgs;
 
-	subobjects[index++] = chs;
+		// Add state subobject for the Miss shader
+		msLibDesc.DXILLibrary.BytecodeLength = dxr.miss.blob->GetBufferSize();
+		msLibDesc.DXILLibrary.pShaderBytecode = dxr.miss.blob->GetBufferPointer();
+		msLibDesc.NumExports = 1;
+		msLibDesc.pExports = &msExportDesc;
+
+		D3D12_STATE_SUBOBJECT ms = {};
+		ms.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
+		ms.pDesc = &msLibDesc;
+
+		subobjects[index++] = ms;
+
+		// Add state subobject for the Closest Hit shader
+		chsLibDesc.DXILLibrary.BytecodeLength = dxr.hit.chs.blob->GetBufferSize();
+		chsLibDesc.DXILLibrary.pShaderBytecode = dxr.hit.chs.blob->GetBufferPointer();
+		chsLibDesc.NumExports = 1;
+		chsLibDesc.pExports = &chsExportDesc;
+
+		D3D12_STATE_SUBOBJECT chs = {};
+		chs.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
+		chs.pDesc = &chsLibDesc;
+
+		subobjects[index++] = chs;
+	}
 
 	// Add a state subobject for the hit group
 	D3D12_HIT_GROUP_DESC hitGroupDesc = {};
@@ -1218,6 +2002,33 @@ void Create_Shader_Table(D3D12Global &d3d, DXRGlobal &dxr, D3D12Resources &resou
 	dxr.shaderTable->Unmap(0, nullptr);
 }
 
+/**
+* Rewrite the shader identifiers in the shader table that differ from the current RTPSO's.
+* Local root arguments are left as they are.
+*/
+void Update_Shader_Table(DXRGlobal &dxr)
+{
+	// Shader table records, in order (see Create_Shader_Table)
+	const WCHAR* recordExports[] = { L"RayGen_12", L"Miss_5", L"HitGroup" };
+	uint32_t shaderIdSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
+
+	uint8_t* pData;
+	HRESULT hr = dxr.shaderTable->Map(0, nullptr, (void**)&pData);
+	Utils::Validate(hr, L"Error: failed to map shader table!");
+
+	for (UINT i = 0; i < _countof(recordExports); i++)
+	{
+		uint8_t* pRecord = pData + (i * dxr.shaderTableRecordSize);
+		const void* pShaderId = dxr.rtpsoInfo->GetShaderIdentifier(recordExports[i]);
+		if (memcmp(pRecord, pShaderId, shaderIdSize) != 0)
+		{
+			memcpy(pRecord, pShaderId, shaderIdSize);
+		}
+	}
+
+	dxr.shaderTable->Unmap(0, nullptr);
+}
+
 /**
 * Create the DXR descriptor heap for CBVs, SRVs, and the output UAV.
 */
@@ -1431,6 +2242,7 @@ void Destroy(DXRGlobal &dxr)
 	SAFE_RELEASE(dxr.rgs.pRootSignature);
 	SAFE_RELEASE(dxr.miss.blob);
 	SAFE_RELEASE(dxr.hit.chs.blob);
+	SAFE_RELEASE(dxr.lib.blob);
 	SAFE_RELEASE(dxr.rtpso);
 	SAFE_RELEASE(dxr.rtpsoInfo);
 }
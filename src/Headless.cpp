@@ -0,0 +1,157 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Headless.h"
+#include "Benchmark.h"
+#include "CPU.h"
+#include "Regression.h"
+#include "Utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+using namespace std;
+using namespace DirectX;
+
+namespace Headless
+{
+
+/**
+* Check if the command line asks for CPU rendering, a benchmark or a test, which need no window or GPU.
+*/
+bool Is_Requested(const ConfigInfo &config)
+{
+	return !config.cpuOutput.empty() || !config.benchmark.empty() || !config.bvhStats.empty() || !config.regression.empty() || !config.test.empty();
+}
+
+/**
+* Render one frame with the CPU ray tracer and write it to an image, without creating a window or a D3D12 device.
+*/
+bool Render(const ConfigInfo &config)
+{
+	Model model;
+	Material material;
+	Utils::LoadModel(config.model, model, material);
+	TextureInfo texture = Utils::LoadTexture(material.texturePath);
+
+	// Use the camera of the first frame the GPU renders
+	ViewCB view;
+	XMFLOAT3 eyeAngle = XMFLOAT3(0.f, 0.f, 0.f);
+	Utils::UpdateView(view, eyeAngle, config.width, config.height);
+
+	// The BVH cache lives next to the model
+	auto start = chrono::high_resolution_clock::now();
+	CPUScene scene;
+	bool cached = CPU::Create_Scene(scene, model, texture, config.bvhCache ? config.model + ".bvh" : "", config.threads);
+	scene.packetWidth = config.packetWidth;
+	auto built = chrono::high_resolution_clock::now();
+
+	// With bounces, path trace in waves with a fixed number of samples per pixel.
+	// Otherwise, with more than one sample per pixel, accumulate adaptively until the image converges.
+	CPUImage image;
+	CPUWavefront wavefront;
+	wavefront.samplesPerPixel = config.cpuSamples;
+	wavefront.maxBounces = config.cpuBounces;
+
+	// Light the path traced preview with a sun from above and behind the camera, and a dim blue sky
+	CPULight sun;
+	XMStoreFloat3(&sun.direction, XMVector3Normalize(XMVectorSet(-0.5f, -1.f, -0.6f, 0.f)));
+	sun.color = XMFLOAT3(2.5f, 2.4f, 2.2f);
+	sun.radius = 0.01f;
+	wavefront.lights.push_back(sun);
+	wavefront.skyColor = XMFLOAT3(0.3f, 0.35f, 0.45f);
+	CPUAccumulator accumulator;
+	accumulator.maxSamples = config.cpuSamples;
+	if (config.cpuBounces > 0) CPU::Render_Wavefront(scene, view, wavefront, image, config.threads);
+	else if (config.cpuSamples > 1)
+	{
+		while (!CPU::Accumulate(scene, view, accumulator, image, config.threads)) {}
+	}
+	else CPU::Render(scene, view, image, config.threads);
+	auto rendered = chrono::high_resolution_clock::now();
+
+	double buildMs = chrono::duration<double, std::milli>(built - start).count();
+	double renderMs = chrono::duration<double, std::milli>(rendered - built).count();
+	double rays = static_cast<double>(image.width) * image.height;
+	if (config.cpuBounces > 0) rays = static_cast<double>(wavefront.rays);
+	else if (config.cpuSamples > 1) rays = static_cast<double>(accumulator.samples);
+	printf("CPU render: %dx%d, %zu triangles, BVH %s in %.2f ms, rendered in %.2f ms (%.2f Mrays/s)\n",
+		image.width, image.height, model.indices.size() / 3, cached ? "loaded" : "built", buildMs, renderMs, rays / (renderMs * 1000.0));
+	if (config.cpuBounces > 0)
+	{
+		const char* stageNames[] = { "generate", "extend", "shade hit", "shade miss", "shadow", "compact" };
+		printf("Path traced %u samples per pixel with up to %u bounces in %u waves, %.3f Msamples/s\n", config.cpuSamples, config.cpuBounces, wavefront.waves, wavefront.samplesPerSecond / 1e6);
+		for (int stage = 0; stage < CPU_WAVEFRONT_STAGE_COUNT; stage++)
+		{
+			printf("  %-10s %10.2f ms %12llu entries\n", stageNames[stage], wavefront.stageMs[stage], static_cast<unsigned long long>(wavefront.stageItems[stage]));
+		}
+		for (size_t bounce = 0; bounce < wavefront.bounceMs.size(); bounce++)
+		{
+			printf("  bounce %zu: %10.2f ms %12llu rays %12llu shadow rays\n", bounce, wavefront.bounceMs[bounce],
+				static_cast<unsigned long long>(wavefront.bounceRays[bounce]), static_cast<unsigned long long>(wavefront.bounceShadowRays[bounce]));
+		}
+	}
+	else if (config.cpuSamples > 1)
+	{
+		double uniformSamples = static_cast<double>(image.width) * image.height * config.cpuSamples;
+		printf("Accumulated %u passes, %.2f samples per pixel, %.1f%% fewer than %u uniform samples per pixel\n",
+			accumulator.passes, rays / (image.width * image.height), 100.0 * (1.0 - rays / uniformSamples), config.cpuSamples);
+	}
+
+	if (!Utils::WriteImage(config.cpuOutput, image.width, image.height, image.pixels.data()))
+	{
+		printf("Error: failed to write %s\n", config.cpuOutput.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+* Run the CPU rendering, benchmark or test the command line asks for, and get the exit code of the process.
+*/
+int Run(const ConfigInfo &config)
+{
+	bool succeeded = false;
+	try
+	{
+		if (!config.benchmark.empty()) succeeded = Benchmark::Run(config);
+		else if (!config.bvhStats.empty()) succeeded = Benchmark::Write_BVH_Stats(config);
+		else if (!config.regression.empty()) succeeded = Regression::Run(config);
+		else if (!config.test.empty()) succeeded = Benchmark::Run_Test(config);
+		else if (!config.cpuOutput.empty()) succeeded = Render(config);
+	}
+	catch (const exception &e)
+	{
+		printf("Error: %s\n", e.what());
+		succeeded = false;
+	}
+	return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}
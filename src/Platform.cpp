@@ -0,0 +1,209 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Platform.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace Platform
+{
+
+//--------------------------------------------------------------------------------------
+// Processor Features
+//--------------------------------------------------------------------------------------
+
+/**
+* Query the processor with the CPUID instruction, for a leaf and subleaf, into EAX, EBX, ECX and EDX.
+*/
+void CPUID(int info[4], int leaf, int subleaf)
+{
+#ifdef _WIN32
+	__cpuidex(info, leaf, subleaf);
+#else
+	unsigned int regs[4] = {};
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+	for (int i = 0; i < 4; i++) info[i] = static_cast<int>(regs[i]);
+#endif
+}
+
+/**
+* Read an extended control register, which tells which register state the OS saves. Only valid when CPUID reports OSXSAVE.
+*/
+uint64_t XGETBV(uint32_t index)
+{
+#ifdef _WIN32
+	return _xgetbv(index);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+	return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+/**
+* Count the leading zero bits of a 64-bit value, 64 for zero.
+*/
+int LeadingZeros64(uint64_t value)
+{
+#ifdef _WIN32
+	unsigned long index;
+	return _BitScanReverse64(&index, value) ? 63 - static_cast<int>(index) : 64;
+#else
+	return (value != 0) ? __builtin_clzll(value) : 64;
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// Memory Mapped Files
+//--------------------------------------------------------------------------------------
+
+/**
+* Map a whole file copy on write: the view can be written, but the writes stay private to the process and never reach
+* the file. Returns false, leaving the file empty, if it is missing or empty.
+*/
+bool MapFile(const std::string &path, MappedFile &file)
+{
+	file = MappedFile();
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = NULL;
+	void* view = nullptr;
+	if (GetFileSizeEx(handle, &fileSize) && fileSize.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mapping) view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	}
+	if (!view)
+	{
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file.data = static_cast<uint8_t*>(view);
+	file.size = static_cast<size_t>(fileSize.QuadPart);
+	file.file = handle;
+	file.mapping = mapping;
+#else
+	int descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) return false;
+
+	struct stat status;
+	void* view = MAP_FAILED;
+	if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+	{
+		view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+	}
+
+	// The mapping keeps the file alive
+	close(descriptor);
+	if (view == MAP_FAILED) return false;
+
+	file.data = static_cast<uint8_t*>(view);
+	file.size = static_cast<size_t>(status.st_size);
+#endif
+	return true;
+}
+
+/**
+* Unmap a file mapped by MapFile, leaving it empty.
+*/
+void UnmapFile(MappedFile &file)
+{
+	if (!file.data) return;
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mapping);
+	CloseHandle(file.file);
+#else
+	munmap(file.data, file.size);
+#endif
+	file = MappedFile();
+}
+
+//--------------------------------------------------------------------------------------
+// Messages
+//--------------------------------------------------------------------------------------
+
+/**
+* Write a message to the debugger output, where there is one.
+*/
+void DebugOutput(const char* message)
+{
+#ifdef _WIN32
+	OutputDebugStringA(message);
+#else
+	(void)message;
+#endif
+}
+
+/**
+* Tell the user about an error: in a message box on Windows, on the standard error stream elsewhere.
+*/
+void ShowError(const wchar_t* message)
+{
+#ifdef _WIN32
+	MessageBoxW(NULL, message, L"Error", MB_OK);
+#else
+	fprintf(stderr, "%ls\n", message);
+#endif
+}
+
+/**
+* Leave the application with an exit code: after the message loop drains on Windows, at once elsewhere.
+*/
+void Quit(int exitCode)
+{
+#ifdef _WIN32
+	PostQuitMessage(exitCode);
+#else
+	exit(exitCode);
+#endif
+}
+
+}
@@ -0,0 +1,125 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CPU.h"
+#include "Utils.h"
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Ray Sorting Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+static const uint32_t RayOriginBits = 10;				// per axis of the quantized ray origin
+static const uint32_t RayKeyBits = 3 + 3 * RayOriginBits;	// the direction octant, then the Morton code of the origin
+
+/**
+* Spread the low 10 bits of a value to every third bit.
+*/
+inline uint32_t Spread_Bits_3(uint32_t v)
+{
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+/**
+* Quantize a coordinate to a cell of the grid over the bounds.
+*/
+inline uint32_t Quantize(float value, float boundsMin, float scale)
+{
+	float cell = (value - boundsMin) * scale;
+	if (!(cell > 0.f)) return 0;						// also catches NaN
+	return min(static_cast<uint32_t>(cell), (1u << RayOriginBits) - 1);
+}
+
+/**
+* Get the order to trace rays in so that rays likely to visit the same BVH nodes are traced one after another.
+* Rays are bucketed by the octant of their direction, which decides the order traversal visits children in, then sorted
+* along a Morton curve through their origins, quantized to a 1024^3 grid over the bounds. Origins outside the bounds are
+* clamped to the grid. The sort is the parallel radix sort of the linear BVH builder.
+*/
+void Sort_Rays(const CPURay* rays, uint32_t rayCount, const BVHNode &bounds, vector<uint32_t> &order, unsigned threadCount)
+{
+	float cells = static_cast<float>(1u << RayOriginBits);
+	XMFLOAT3 scale(
+		cells / max(bounds.boundsMax.x - bounds.boundsMin.x, 1e-20f),
+		cells / max(bounds.boundsMax.y - bounds.boundsMin.y, 1e-20f),
+		cells / max(bounds.boundsMax.z - bounds.boundsMin.z, 1e-20f));
+
+	vector<uint64_t> keys(rayCount);
+	order.resize(rayCount);
+	Utils::ParallelFor(rayCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const CPURay &ray = rays[i];
+			uint32_t octant = (ray.direction.x < 0.f ? 1 : 0) | (ray.direction.y < 0.f ? 2 : 0) | (ray.direction.z < 0.f ? 4 : 0);
+			uint32_t x = Quantize(ray.origin.x, bounds.boundsMin.x, scale.x);
+			uint32_t y = Quantize(ray.origin.y, bounds.boundsMin.y, scale.y);
+			uint32_t z = Quantize(ray.origin.z, bounds.boundsMin.z, scale.z);
+			keys[i] = (static_cast<uint64_t>(octant) << (3 * RayOriginBits)) | (Spread_Bits_3(x) << 2) | (Spread_Bits_3(y) << 1) | Spread_Bits_3(z);
+			order[i] = static_cast<uint32_t>(i);
+		}
+	});
+
+	Radix_Sort(keys, order, RayKeyBits, threadCount);
+}
+
+/**
+* Trace a batch of rays against a BVH, using the 8-wide BVH when it has been built, and write the closest hit of each
+* ray. With sorting, the rays are traced in the order of Sort_Rays, which pays off for incoherent rays, like secondary
+* rays, on large scenes. The hits are in the order of the rays either way.
+*/
+void Intersect_Rays(const BVHTree &bvh, const BVH8Tree &bvh8, const Model &model, const CPURay* rays, CPUHit* hits, uint32_t rayCount, bool sort, unsigned threadCount)
+{
+	if (rayCount == 0) return;
+
+	vector<uint32_t> order;
+	sort = sort && !bvh.nodes.empty();
+	if (sort) Sort_Rays(rays, rayCount, bvh.nodes[0], order, threadCount);
+
+	bool wide = !bvh8.nodes.empty();
+	Utils::ParallelFor(rayCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t index = sort ? order[i] : static_cast<uint32_t>(i);
+			if (wide) Intersect(bvh8, model, rays[index], hits[index]);
+			else Intersect(bvh, model, rays[index], hits[index]);
+		}
+	});
+}
+
+}
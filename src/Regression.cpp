@@ -0,0 +1,511 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Regression.h"
+#include "Benchmark.h"
+#include "CPU.h"
+#include "Platform.h"
+#include "Utils.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Regression Functions
+//--------------------------------------------------------------------------------------
+
+namespace Regression
+{
+
+// Small renders, so the whole suite runs in seconds
+static const int ImageWidth = 320;
+static const int ImageHeight = 180;
+
+// Camera poses, as the eye angle passed to Utils::UpdateView: a quarter turn apart
+static const float PoseAngles[] = { 0.f, 0.5f * XM_PI, XM_PI, 1.5f * XM_PI };
+
+// Pass thresholds. Goldens rendered by another compiler or processor may differ in a few pixels along triangle edges.
+static const double MinPSNR = 40.0;				// dB
+static const float MaxFLIP = 0.02f;				// mean error
+
+#if _DEBUG
+static const char* GoldenSuffix = "_debug";		// UpdateView places the camera differently in debug builds
+#else
+static const char* GoldenSuffix = "";
+#endif
+
+// LDR-FLIP (Andersson et al. 2020), for a 0.7 m wide 3840 pixel display seen from 0.7 m
+static const float PixelsPerDegree = 67.0206f;
+static const float ColorExponent = 0.7f;		// qc
+static const float FeatureExponent = 0.5f;		// qf
+static const float ColorCutoff = 0.4f;			// pc
+static const float ColorCutoffError = 0.95f;	// pt
+static const float FeatureWidth = 0.082f;		// w, in degrees
+
+// Contrast sensitivity of each opponent channel (Y, Cx, Cz), as the weight and scale of two Gaussians
+struct CSFGaussian
+{
+	float a;
+	float b;
+};
+
+static const CSFGaussian ContrastSensitivity[3][2] =
+{
+	{ { 1.f, 0.0047f }, { 0.f, 1e-5f } },
+	{ { 1.f, 0.0053f }, { 0.f, 1e-5f } },
+	{ { 34.1f, 0.04f }, { 13.5f, 0.025f } },
+};
+
+struct Fixture
+{
+	string					name;
+	Model					model;
+	TextureInfo				texture;
+};
+
+void Log(const char* format, ...)
+{
+	char msg[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(msg, sizeof(msg), format, args);
+	va_end(args);
+
+	Platform::DebugOutput(msg);
+	printf("%s", msg);
+}
+
+inline float SRGB_To_Linear(float c)
+{
+	return (c <= 0.04045f) ? (c / 12.92f) : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline XMFLOAT3 Linear_RGB_To_XYZ(const XMFLOAT3 &c)
+{
+	return XMFLOAT3(
+		(10135552.f * c.x + 8788810.f * c.y + 4435075.f * c.z) / 24577794.f,
+		(2613072.f * c.x + 8788810.f * c.y + 887015.f * c.z) / 12288897.f,
+		(1425312.f * c.x + 8788810.f * c.y + 70074185.f * c.z) / 73733382.f);
+}
+
+inline XMFLOAT3 XYZ_To_Linear_RGB(const XMFLOAT3 &c)
+{
+	return XMFLOAT3(
+		3.241003232976359f * c.x - 1.537398969488786f * c.y - 0.498615881996363f * c.z,
+		-0.969224252202516f * c.x + 1.875929983695176f * c.y + 0.041554226340085f * c.z,
+		0.055639419851975f * c.x - 0.204011206123910f * c.y + 1.057148977187533f * c.z);
+}
+
+/**
+* Convert XYZ to the YCxCz opponent space, which is linear in XYZ so it can be filtered.
+*/
+inline XMFLOAT3 XYZ_To_YCxCz(const XMFLOAT3 &c, const XMFLOAT3 &white)
+{
+	float y = c.y / white.y;
+	return XMFLOAT3(116.f * y - 16.f, 500.f * (c.x / white.x - y), 200.f * (y - c.z / white.z));
+}
+
+inline XMFLOAT3 YCxCz_To_XYZ(const XMFLOAT3 &c, const XMFLOAT3 &white)
+{
+	float y = (c.x + 16.f) / 116.f;
+	return XMFLOAT3((c.y / 500.f + y) * white.x, y * white.y, (y - c.z / 200.f) * white.z);
+}
+
+inline float Lab_F(float t)
+{
+	const float delta = 6.f / 29.f;
+	return (t > delta * delta * delta) ? cbrtf(t) : (t / (3.f * delta * delta) + 4.f / 29.f);
+}
+
+/**
+* Convert XYZ to CIELAB, then scale the chroma with lightness (the Hunt effect).
+*/
+inline XMFLOAT3 XYZ_To_Hunt_Lab(const XMFLOAT3 &c, const XMFLOAT3 &white)
+{
+	float fx = Lab_F(c.x / white.x), fy = Lab_F(c.y / white.y), fz = Lab_F(c.z / white.z);
+	float l = 116.f * fy - 16.f;
+	return XMFLOAT3(l, 0.01f * l * 500.f * (fx - fy), 0.01f * l * 200.f * (fy - fz));
+}
+
+/**
+* The HyAB color distance: city block distance in lightness, Euclidean in chroma.
+*/
+inline float HyAB(const XMFLOAT3 &a, const XMFLOAT3 &b)
+{
+	return fabsf(a.x - b.x) + sqrtf((a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z));
+}
+
+/**
+* Convolve a single channel image with a separable kernel, repeating the edge pixels.
+*/
+void Convolve(const vector<float> &input, vector<float> &output, int width, int height, const vector<float> &kernelX, const vector<float> &kernelY)
+{
+	int radiusX = static_cast<int>(kernelX.size() / 2);
+	int radiusY = static_cast<int>(kernelY.size() / 2);
+	vector<float> rows(input.size());
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float sum = 0.f;
+			for (int i = -radiusX; i <= radiusX; i++) sum += kernelX[i + radiusX] * input[static_cast<size_t>(y) * width + min(max(x + i, 0), width - 1)];
+			rows[static_cast<size_t>(y) * width + x] = sum;
+		}
+	}
+
+	output.resize(input.size());
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float sum = 0.f;
+			for (int i = -radiusY; i <= radiusY; i++) sum += kernelY[i + radiusY] * rows[static_cast<size_t>(min(max(y + i, 0), height - 1)) * width + x];
+			output[static_cast<size_t>(y) * width + x] = sum;
+		}
+	}
+}
+
+/**
+* Scale the positive and the negative weights of a feature detection kernel to sum to 1 and -1.
+*/
+void Normalize_Feature_Kernel(vector<float> &kernel)
+{
+	float positive = 0.f, negative = 0.f;
+	for (float w : kernel)
+	{
+		if (w > 0.f) positive += w;
+		else negative -= w;
+	}
+	for (float &w : kernel) w /= (w > 0.f) ? positive : negative;
+}
+
+/**
+* Get the peak signal to noise ratio of a test image against a reference, over the RGB channels, in dB.
+* Identical images have an infinite PSNR.
+*/
+double Get_PSNR(const CPUImage &reference, const CPUImage &test)
+{
+	if (reference.width != test.width || reference.height != test.height) return 0.0;
+
+	double sum = 0.0;
+	size_t count = static_cast<size_t>(reference.width) * reference.height;
+	for (size_t i = 0; i < count; i++)
+	{
+		for (size_t c = 0; c < 3; c++)
+		{
+			double difference = static_cast<double>(reference.pixels[i * 4 + c]) - test.pixels[i * 4 + c];
+			sum += difference * difference;
+		}
+	}
+	if (sum == 0.0) return HUGE_VAL;
+	return 10.0 * log10(255.0 * 255.0 / (sum / (count * 3)));
+}
+
+/**
+* Get the LDR-FLIP error (Andersson et al. 2020) of a test image against a reference: the mean of a per-pixel error in
+* [0, 1] that models how visible the differences are when flipping between the images. Colors are compared after
+* filtering both images with the contrast sensitivity of the eye, and the difference in edges and points is added.
+* Writes the per-pixel errors.
+*/
+float Get_FLIP(const CPUImage &reference, const CPUImage &test, vector<float> &errors)
+{
+	int width = reference.width, height = reference.height;
+	size_t count = static_cast<size_t>(width) * height;
+	if (test.width != width || test.height != height)
+	{
+		errors.assign(count, 1.f);
+		return 1.f;
+	}
+
+	// Both images in the YCxCz opponent space, one plane per channel
+	const CPUImage* images[2] = { &reference, &test };
+	XMFLOAT3 white = Linear_RGB_To_XYZ(XMFLOAT3(1.f, 1.f, 1.f));
+	vector<float> opponent[2][3];
+	for (int image = 0; image < 2; image++)
+	{
+		for (int c = 0; c < 3; c++) opponent[image][c].resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			const uint8_t* pixel = &images[image]->pixels[i * 4];
+			XMFLOAT3 rgb(SRGB_To_Linear(pixel[0] / 255.f), SRGB_To_Linear(pixel[1] / 255.f), SRGB_To_Linear(pixel[2] / 255.f));
+			XMFLOAT3 ycxcz = XYZ_To_YCxCz(Linear_RGB_To_XYZ(rgb), white);
+			opponent[image][0][i] = ycxcz.x;
+			opponent[image][1][i] = ycxcz.y;
+			opponent[image][2][i] = ycxcz.z;
+		}
+	}
+
+	// Filter each channel with its contrast sensitivity function, a sum of Gaussians over the visual angle
+	float maxScale = 0.04f;
+	int radius = static_cast<int>(ceilf(3.f * sqrtf(maxScale / (2.f * XM_PI * XM_PI)) * PixelsPerDegree));
+	vector<float> filtered[2][3];
+	vector<float> kernel(radius * 2 + 1), convolved;
+	for (int c = 0; c < 3; c++)
+	{
+		for (int image = 0; image < 2; image++) filtered[image][c].assign(count, 0.f);
+
+		float total = 0.f;
+		for (const CSFGaussian &gaussian : ContrastSensitivity[c])
+		{
+			if (gaussian.a == 0.f) continue;
+
+			float sum = 0.f;
+			for (int i = -radius; i <= radius; i++)
+			{
+				float x = i / PixelsPerDegree;
+				kernel[i + radius] = expf(-XM_PI * XM_PI * x * x / gaussian.b);
+				sum += kernel[i + radius];
+			}
+			float weight = gaussian.a * sqrtf(XM_PI / gaussian.b);
+			total += weight * sum * sum;
+
+			for (int image = 0; image < 2; image++)
+			{
+				Convolve(opponent[image][c], convolved, width, height, kernel, kernel);
+				for (size_t i = 0; i < count; i++) filtered[image][c][i] += weight * convolved[i];
+			}
+		}
+		for (int image = 0; image < 2; image++)
+		{
+			for (float &value : filtered[image][c]) value /= total;
+		}
+	}
+
+	// Edge and point detectors, the first and second derivatives of a Gaussian
+	float deviation = 0.5f * FeatureWidth * PixelsPerDegree;
+	int featureRadius = static_cast<int>(ceilf(3.f * deviation));
+	vector<float> gaussian(featureRadius * 2 + 1), edge(featureRadius * 2 + 1), point(featureRadius * 2 + 1);
+	float gaussianSum = 0.f;
+	for (int i = -featureRadius; i <= featureRadius; i++)
+	{
+		float g = expf(-static_cast<float>(i * i) / (2.f * deviation * deviation));
+		gaussian[i + featureRadius] = g;
+		edge[i + featureRadius] = -i * g;
+		point[i + featureRadius] = (i * i / (deviation * deviation) - 1.f) * g;
+		gaussianSum += g;
+	}
+	for (float &g : gaussian) g /= gaussianSum;
+	Normalize_Feature_Kernel(edge);
+	Normalize_Feature_Kernel(point);
+
+	// Feature magnitudes of the achromatic channel, normalized to [0, 1]
+	vector<float> edges[2], points[2], normalized(count), x, y;
+	for (int image = 0; image < 2; image++)
+	{
+		for (size_t i = 0; i < count; i++) normalized[i] = (opponent[image][0][i] + 16.f) / 116.f;
+		edges[image].resize(count);
+		points[image].resize(count);
+
+		Convolve(normalized, x, width, height, edge, gaussian);
+		Convolve(normalized, y, width, height, gaussian, edge);
+		for (size_t i = 0; i < count; i++) edges[image][i] = sqrtf(x[i] * x[i] + y[i] * y[i]);
+
+		Convolve(normalized, x, width, height, point, gaussian);
+		Convolve(normalized, y, width, height, gaussian, point);
+		for (size_t i = 0; i < count; i++) points[image][i] = sqrtf(x[i] * x[i] + y[i] * y[i]);
+	}
+
+	// The largest color difference, between green and blue, maps to 1
+	XMFLOAT3 green = XYZ_To_Hunt_Lab(Linear_RGB_To_XYZ(XMFLOAT3(0.f, 1.f, 0.f)), white);
+	XMFLOAT3 blue = XYZ_To_Hunt_Lab(Linear_RGB_To_XYZ(XMFLOAT3(0.f, 0.f, 1.f)), white);
+	float maxColorError = powf(HyAB(green, blue), ColorExponent);
+	float cutoff = ColorCutoff * maxColorError;
+
+	errors.resize(count);
+	double sum = 0.0;
+	for (size_t i = 0; i < count; i++)
+	{
+		XMFLOAT3 lab[2];
+		for (int image = 0; image < 2; image++)
+		{
+			XMFLOAT3 rgb = XYZ_To_Linear_RGB(YCxCz_To_XYZ(XMFLOAT3(filtered[image][0][i], filtered[image][1][i], filtered[image][2][i]), white));
+			rgb = XMFLOAT3(min(max(rgb.x, 0.f), 1.f), min(max(rgb.y, 0.f), 1.f), min(max(rgb.z, 0.f), 1.f));
+			lab[image] = XYZ_To_Hunt_Lab(Linear_RGB_To_XYZ(rgb), white);
+		}
+
+		// Compress large color differences into the top of the range
+		float colorError = powf(HyAB(lab[0], lab[1]), ColorExponent);
+		if (colorError < cutoff) colorError *= ColorCutoffError / cutoff;
+		else colorError = ColorCutoffError + (colorError - cutoff) / (maxColorError - cutoff) * (1.f - ColorCutoffError);
+
+		float featureError = max(fabsf(edges[0][i] - edges[1][i]), fabsf(points[0][i] - points[1][i]));
+		featureError = powf(featureError / sqrtf(2.f), FeatureExponent);
+
+		errors[i] = powf(colorError, 1.f - featureError);
+		sum += errors[i];
+	}
+	return static_cast<float>(sum / count);
+}
+
+/**
+* Write per-pixel errors as a heat map, from black through red and yellow to white.
+*/
+bool Write_Error_Image(const string &path, int width, int height, const vector<float> &errors)
+{
+	vector<uint8_t> pixels(errors.size() * 4);
+	for (size_t i = 0; i < errors.size(); i++)
+	{
+		float e = 3.f * errors[i];
+		pixels[i * 4 + 0] = static_cast<uint8_t>(min(max(e, 0.f), 1.f) * 255.f + 0.5f);
+		pixels[i * 4 + 1] = static_cast<uint8_t>(min(max(e - 1.f, 0.f), 1.f) * 255.f + 0.5f);
+		pixels[i * 4 + 2] = static_cast<uint8_t>(min(max(e - 2.f, 0.f), 1.f) * 255.f + 0.5f);
+		pixels[i * 4 + 3] = 255;
+	}
+	return Utils::WriteImage(path, width, height, pixels.data());
+}
+
+/**
+* Load the scenes to render: the quad model and its texture, and a displaced grid with a checkerboard texture, which has
+* many small triangles and texture edges.
+*/
+bool Load_Fixtures(vector<Fixture> &fixtures)
+{
+	fixtures.resize(2);
+	fixtures[0].name = "quad";
+	try
+	{
+		Material material;
+		Utils::LoadModel("models/quad.obj", fixtures[0].model, material);
+		fixtures[0].texture = Utils::LoadTexture(material.texturePath);
+	}
+	catch (const exception &e)
+	{
+		Log("Error: failed to load models/quad.obj: %s\n", e.what());
+		return false;
+	}
+
+	fixtures[1].name = "grid";
+	Benchmark::Create_Grid_Mesh(fixtures[1].model, 20000);
+	Benchmark::Create_Checker_Texture(fixtures[1].texture, 512);
+	return true;
+}
+
+/**
+* Render fixed camera poses of the test scenes with the CPU ray tracer, with packets and with single rays, and compare
+* each image to its golden image. A render passes when its PSNR and mean FLIP error are within the thresholds. Failed
+* renders are written next to the golden, with a heat map of the FLIP error. A missing golden fails its renders, unless
+* updateGolden is set, which writes every golden from the packet render. Every render is timed.
+* Returns false if any render failed.
+*/
+bool Run(const ConfigInfo &config)
+{
+	unsigned threadCount = Utils::GetThreadCount(config.threads);
+	vector<Fixture> fixtures;
+	if (!Load_Fixtures(fixtures)) return false;
+
+	Log("Regression (%dx%d, %u threads, PSNR >= %.0f dB, mean FLIP <= %g, goldens in %s)\n", ImageWidth, ImageHeight, threadCount, MinPSNR, MaxFLIP, config.regression.c_str());
+	Log("%-16s %8s %10s %10s %10s %10s %8s\n", "image", "renderer", "ms", "Mrays/s", "PSNR", "FLIP", "result");
+
+	uint32_t renders = 0, failures = 0, written = 0, missing = 0;
+	for (const Fixture &fixture : fixtures)
+	{
+		CPUScene scene;
+		CPU::Create_Scene(scene, fixture.model, fixture.texture, "", threadCount);
+
+		for (int pose = 0; pose < static_cast<int>(size(PoseAngles)); pose++)
+		{
+			ViewCB view;
+			XMFLOAT3 eyeAngle = XMFLOAT3(PoseAngles[pose], 0.f, 0.f);
+			Utils::UpdateView(view, eyeAngle, ImageWidth, ImageHeight);
+
+			char name[64];
+			snprintf(name, sizeof(name), "%s_%d%s", fixture.name.c_str(), pose, GoldenSuffix);
+			string path = config.regression + "/" + name;
+
+			CPUImage golden;
+			bool hasGolden = !config.updateGolden && ifstream(path + ".bmp").good();
+			if (!hasGolden && !config.updateGolden) missing++;
+			if (hasGolden)
+			{
+				TextureInfo image = Utils::LoadTexture(path + ".bmp");
+				golden.width = image.width;
+				golden.height = image.height;
+				golden.pixels = image.pixels;
+			}
+
+			const char* renderers[] = { "packets", "single" };
+			for (int renderer = 0; renderer < 2; renderer++)
+			{
+				CPUImage image;
+				scene.packetWidth = (renderer == 0) ? 8 : 1;
+				auto start = chrono::high_resolution_clock::now();
+				CPU::Render(scene, view, image, threadCount);
+				double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+				double rate = static_cast<double>(image.width) * image.height / (ms * 1000.0);
+				renders++;
+
+				// When updating, the packet render becomes the golden, and the single ray render is checked against it
+				string output = path + "_" + renderers[renderer];
+				if (!hasGolden && !config.updateGolden)
+				{
+					Log("%-16s %8s %10.2f %10.2f %10s %10s %8s\n", name, renderers[renderer], ms, rate, "-", "-", "MISSING");
+					failures++;
+					Utils::WriteImage(output + ".bmp", image.width, image.height, image.pixels.data());
+					continue;
+				}
+				if (!hasGolden)
+				{
+					if (!Utils::WriteImage(path + ".bmp", image.width, image.height, image.pixels.data()))
+					{
+						Log("Error: failed to write %s.bmp\n", path.c_str());
+						return false;
+					}
+					Log("%-16s %8s %10.2f %10.2f %10s %10s %8s\n", name, renderers[renderer], ms, rate, "-", "-", "written");
+					golden = image;
+					hasGolden = true;
+					written++;
+					continue;
+				}
+
+				vector<float> errors;
+				double psnr = Get_PSNR(golden, image);
+				float flip = Get_FLIP(golden, image, errors);
+				bool passed = (psnr >= MinPSNR && flip <= MaxFLIP);
+				Log("%-16s %8s %10.2f %10.2f %10.2f %10.5f %8s\n", name, renderers[renderer], ms, rate, psnr, flip, passed ? "pass" : "FAIL");
+				if (passed) continue;
+
+				failures++;
+				Utils::WriteImage(output + ".bmp", image.width, image.height, image.pixels.data());
+				Write_Error_Image(output + "_flip.bmp", golden.width, golden.height, errors);
+			}
+		}
+	}
+
+	Log("%u renders, %u failed, %u goldens written\n", renders, failures, written);
+	if (missing > 0) Log("%u goldens missing from %s, run with -updategolden 1 to write them\n", missing, config.regression.c_str());
+	return failures == 0;
+}
+
+}
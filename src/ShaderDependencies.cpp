@@ -0,0 +1,194 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ShaderDependencies.h"
+#include "Utils.h"
+
+#include <cwctype>
+
+using namespace std;
+
+namespace ShaderDependencies
+{
+
+/**
+* Get the normalized full path of a shader source file, used to key the source cache and dependency graph.
+* Windows paths are case insensitive, so they are lowercased there.
+*/
+wstring Get_Path(const wstring &filename)
+{
+	error_code error;
+	filesystem::path fullPath = filesystem::absolute(filesystem::path(filename), error);
+	wstring path = error ? filename : fullPath.lexically_normal().wstring();
+#ifdef _WIN32
+	for (wchar_t &c : path)
+	{
+		c = (c == L'/') ? L'\\' : towlower(c);
+	}
+#endif
+	return path;
+}
+
+/**
+* Get a shader source file from the cache, loading and hashing it from disk on first use.
+*/
+const ShaderSourceFile* Load_Source(ShaderSourceCache &cache, const wstring &path)
+{
+	{
+		lock_guard<mutex> guard(cache.lock);
+		auto it = cache.files.find(path);
+		if (it != cache.files.end()) return &it->second;
+	}
+
+	// Read outside the lock, so workers loading different files don't serialize
+	ShaderSourceFile file;
+	if (!Utils::ReadFile(path, file.contents)) return nullptr;
+	file.hash = Utils::Hash(file.contents.data(), file.contents.size());
+
+	// Element references are stable, so the pointer stays valid for the cache's lifetime.
+	// If another worker loaded the file first, its copy is kept.
+	lock_guard<mutex> guard(cache.lock);
+	return &cache.files.emplace(path, move(file)).first->second;
+}
+
+/**
+* Add a file read by a compile to the shader's dependencies, with the hash of the contents the compiler was given.
+*/
+void Add(vector<ShaderDependency> &dependencies, const wstring &path, uint64_t hash)
+{
+	for (const ShaderDependency &dependency : dependencies)
+	{
+		if (dependency.path == path) return;
+	}
+	dependencies.push_back({ path, hash });
+}
+
+/**
+* Get the key of a shader in the dependency graph. Permutations of a shader compile to different blobs,
+* so the entry point and defines are part of the key along with the path.
+*/
+wstring Get_Key(const wstring &path, const wstring &entryPoint, const vector<wstring> &defines)
+{
+	wstring key = path + L"|" + entryPoint;
+	for (const wstring &define : defines)
+	{
+		key += L"|" + define;
+	}
+	return key;
+}
+
+/**
+* Record the files a shader's blob was compiled from. Call once the blob is installed, so the graph always
+* describes the blob in use: a compile whose blob is discarded must not make the shader look up to date.
+*/
+void Record(ShaderDependencyGraph &graph, const wstring &shader, const vector<ShaderDependency> &dependencies)
+{
+	lock_guard<mutex> guard(graph.lock);
+	graph.includes[shader] = dependencies;
+}
+
+/**
+* Check if any file a blob was compiled from changed or disappeared since. A blob with no dependencies
+* was never compiled from source, so it is stale.
+*/
+bool Is_Stale(const vector<ShaderDependency> &dependencies)
+{
+	if (dependencies.empty()) return true;
+
+	string contents;
+	for (const ShaderDependency &dependency : dependencies)
+	{
+		if (!Utils::ReadFile(dependency.path, contents)) return true;
+		if (Utils::Hash(contents.data(), contents.size()) != dependency.hash) return true;
+	}
+	return false;
+}
+
+/**
+* Check if a shader, or any file it included, changed on disk since its installed blob was compiled.
+* Shaders with no installed blob are stale.
+*/
+bool Is_Stale(ShaderDependencyGraph &graph, const wstring &shader)
+{
+	vector<ShaderDependency> dependencies;
+	{
+		lock_guard<mutex> guard(graph.lock);
+		auto it = graph.includes.find(shader);
+		if (it == graph.includes.end()) return true;
+		dependencies = it->second;
+	}
+	return Is_Stale(dependencies);
+}
+
+/**
+* Get the last write time of every file in a directory and its subdirectories.
+*/
+static void Scan_Directory(const wstring &directory, unordered_map<wstring, filesystem::file_time_type> &files)
+{
+	files.clear();
+
+	error_code error;
+	for (filesystem::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+	{
+		if (!it->is_regular_file(error)) continue;
+
+		filesystem::file_time_type time = it->last_write_time(error);
+		if (!error) files[Get_Path(it->path().wstring())] = time;
+	}
+}
+
+/**
+* Start watching a shader directory (and its subdirectories) for file changes, by polling the files' last write times.
+*/
+void Watch_Directory(ShaderDirectoryWatcher &watcher, const wstring &directory)
+{
+	watcher.directory = directory;
+	watcher.lastPoll = chrono::steady_clock::now();
+	Scan_Directory(directory, watcher.files);
+}
+
+/**
+* Check if any file in the watched directory was written, added or removed since the last check.
+* Polls at most once per poll interval, so it is cheap enough to call every frame.
+*/
+bool Files_Changed(ShaderDirectoryWatcher &watcher)
+{
+	if (watcher.directory.empty()) return false;
+
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	if (chrono::duration<double, milli>(now - watcher.lastPoll).count() < watcher.pollIntervalMs) return false;
+	watcher.lastPoll = now;
+
+	unordered_map<wstring, filesystem::file_time_type> files;
+	Scan_Directory(watcher.directory, files);
+	if (files == watcher.files) return false;
+
+	watcher.files = move(files);
+	return true;
+}
+
+}
@@ -0,0 +1,529 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CPU.h"
+#include "Platform.h"
+#include "Utils.h"
+
+#include <cstring>
+#include <immintrin.h>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Texture Sampling Functions
+//--------------------------------------------------------------------------------------
+
+namespace Texture
+{
+
+inline float Min(float a, float b) { return (a < b) ? a : b; }		// same operand order as _mm_min_ps
+inline float Max(float a, float b) { return (a > b) ? a : b; }		// same operand order as _mm_max_ps
+
+struct Texels4
+{
+	__m128 r, g, b, a;
+};
+
+struct Texels8
+{
+	__m256 r, g, b, a;
+};
+
+/**
+* Round down like the SIMD paths do: truncate, then step down if that rounded a negative value up.
+* The scalar and SIMD paths use the same operations in the same order, so they return the same bits.
+*/
+inline float Floor(float x)
+{
+	float t = static_cast<float>(static_cast<int>(x));
+	return (t > x) ? (t - 1.f) : t;
+}
+
+/**
+* Map a texture coordinate into [0, 1] with the address mode.
+*/
+inline float Address(float u, CPUTextureAddressMode mode)
+{
+	return (mode == CPU_TEXTURE_ADDRESS_WRAP) ? (u - Floor(u)) : Min(Max(u, 0.f), 1.f);
+}
+
+/**
+* Bring a texel index that may be one past either edge back into the level with the address mode.
+*/
+inline int Address_Index(int x, int size, CPUTextureAddressMode mode)
+{
+	if (mode == CPU_TEXTURE_ADDRESS_WRAP)
+	{
+		if (x < 0) return x + size;
+		return (x >= size) ? (x - size) : x;
+	}
+	if (x < 0) return 0;
+	return (x >= size) ? (size - 1) : x;
+}
+
+/**
+* Convert an R8G8B8A8_UNORM texel to float like Texture2D.Load (and Load_Texel).
+*/
+inline XMFLOAT4 To_Float(uint32_t texel)
+{
+	return XMFLOAT4(
+		static_cast<float>(texel & 0xFF) / 255.f,
+		static_cast<float>((texel >> 8) & 0xFF) / 255.f,
+		static_cast<float>((texel >> 16) & 0xFF) / 255.f,
+		static_cast<float>(texel >> 24) / 255.f);
+}
+
+inline float Lerp(float a, float b, float t)
+{
+	return a + (b - a) * t;
+}
+
+inline XMFLOAT4 Lerp(const XMFLOAT4 &a, const XMFLOAT4 &b, float t)
+{
+	return XMFLOAT4(Lerp(a.x, b.x, t), Lerp(a.y, b.y, t), Lerp(a.z, b.z, t), Lerp(a.w, b.w, t));
+}
+
+/**
+* Sample one mip level with point or bilinear filtering.
+*/
+XMFLOAT4 Sample_Level(const CPUTexture &texture, const CPUSampler &sampler, int levelIndex, float u, float v, bool bilinear)
+{
+	const CPUTextureLevel &level = texture.levels[levelIndex];
+	const uint32_t* texels = &texture.texels[level.offset];
+	float s = Address(u, sampler.addressU) * static_cast<float>(level.width);
+	float t = Address(v, sampler.addressV) * static_cast<float>(level.height);
+	if (!bilinear)
+	{
+		int x = Address_Index(static_cast<int>(s), level.width, sampler.addressU);
+		int y = Address_Index(static_cast<int>(t), level.height, sampler.addressV);
+		return To_Float(texels[y * level.width + x]);
+	}
+
+	// Texel centers are at half coordinates
+	s -= 0.5f;
+	t -= 0.5f;
+	float s0 = Floor(s), t0 = Floor(t);
+	float fx = s - s0, fy = t - t0;
+	int x0 = Address_Index(static_cast<int>(s0), level.width, sampler.addressU);
+	int y0 = Address_Index(static_cast<int>(t0), level.height, sampler.addressV);
+	int x1 = Address_Index(static_cast<int>(s0) + 1, level.width, sampler.addressU);
+	int y1 = Address_Index(static_cast<int>(t0) + 1, level.height, sampler.addressV);
+
+	XMFLOAT4 c00 = To_Float(texels[y0 * level.width + x0]);
+	XMFLOAT4 c10 = To_Float(texels[y0 * level.width + x1]);
+	XMFLOAT4 c01 = To_Float(texels[y1 * level.width + x0]);
+	XMFLOAT4 c11 = To_Float(texels[y1 * level.width + x1]);
+	return Lerp(Lerp(c00, c10, fx), Lerp(c01, c11, fx), fy);
+}
+
+/**
+* Build a texture and its mip chain from R8G8B8A8 texture data, like TextureInfo from Utils::LoadTexture.
+* Each level averages 2x2 texels of the level above it, rounding to nearest; odd edges repeat their last texel.
+*/
+void Create(CPUTexture &texture, const TextureInfo &source, unsigned threadCount)
+{
+	texture = CPUTexture();
+	if (source.width <= 0 || source.height <= 0) return;
+
+	// Lay the levels out one after another
+	int width = source.width, height = source.height;
+	uint32_t offset = 0;
+	while (true)
+	{
+		CPUTextureLevel level;
+		level.width = width;
+		level.height = height;
+		level.offset = offset;
+		texture.levels.push_back(level);
+		offset += static_cast<uint32_t>(width * height);
+		if (width == 1 && height == 1) break;
+		width = max(width / 2, 1);
+		height = max(height / 2, 1);
+	}
+	texture.texels.resize(offset);
+
+	Utils::ParallelFor(source.height, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t y = begin; y < end; y++)
+		{
+			for (int x = 0; x < source.width; x++)
+			{
+				memcpy(&texture.texels[y * source.width + x], &source.pixels[(y * source.width + x) * source.stride + source.offset], sizeof(uint32_t));
+			}
+		}
+	});
+
+	for (size_t l = 1; l < texture.levels.size(); l++)
+	{
+		const CPUTextureLevel &parent = texture.levels[l - 1];
+		const CPUTextureLevel &level = texture.levels[l];
+		const uint32_t* in = &texture.texels[parent.offset];
+		uint32_t* out = &texture.texels[level.offset];
+		Utils::ParallelFor(level.height, threadCount, [&](size_t begin, size_t end)
+		{
+			for (size_t y = begin; y < end; y++)
+			{
+				int y0 = min(static_cast<int>(y) * 2, parent.height - 1);
+				int y1 = min(static_cast<int>(y) * 2 + 1, parent.height - 1);
+				for (int x = 0; x < level.width; x++)
+				{
+					int x0 = min(x * 2, parent.width - 1);
+					int x1 = min(x * 2 + 1, parent.width - 1);
+					uint32_t a = in[y0 * parent.width + x0], b = in[y0 * parent.width + x1];
+					uint32_t c = in[y1 * parent.width + x0], d = in[y1 * parent.width + x1];
+
+					uint32_t texel = 0;
+					for (uint32_t shift = 0; shift < 32; shift += 8)
+					{
+						uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+						texel |= ((sum + 2) / 4) << shift;
+					}
+					out[y * level.width + x] = texel;
+				}
+			}
+		});
+	}
+}
+
+/**
+* Sample a texture at a mip level of detail (0 is the full resolution level). Point and bilinear filtering use the
+* nearest level, trilinear filtering blends the two nearest.
+*/
+XMFLOAT4 Sample(const CPUTexture &texture, const CPUSampler &sampler, const XMFLOAT2 &uv, float lod)
+{
+	if (texture.levels.empty()) return XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+
+	int lastLevel = static_cast<int>(texture.levels.size()) - 1;
+	lod = Min(Max(lod, 0.f), static_cast<float>(lastLevel));
+	if (sampler.filter == CPU_TEXTURE_FILTER_TRILINEAR)
+	{
+		float base = Floor(lod);
+		int level0 = static_cast<int>(base);
+		int level1 = min(level0 + 1, lastLevel);
+		XMFLOAT4 c0 = Sample_Level(texture, sampler, level0, uv.x, uv.y, true);
+		XMFLOAT4 c1 = Sample_Level(texture, sampler, level1, uv.x, uv.y, true);
+		return Lerp(c0, c1, lod - base);
+	}
+
+	int level = static_cast<int>(Floor(lod + 0.5f));
+	return Sample_Level(texture, sampler, level, uv.x, uv.y, sampler.filter == CPU_TEXTURE_FILTER_BILINEAR);
+}
+
+//--------------------------------------------------------------------------------------
+// 4-wide (SSE2)
+//--------------------------------------------------------------------------------------
+
+inline __m128 Floor4(__m128 x)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+}
+
+inline __m128 Address4(__m128 u, CPUTextureAddressMode mode)
+{
+	if (mode == CPU_TEXTURE_ADDRESS_WRAP) return _mm_sub_ps(u, Floor4(u));
+	return _mm_min_ps(_mm_max_ps(u, _mm_setzero_ps()), _mm_set1_ps(1.f));
+}
+
+inline __m128i Address_Index4(__m128i x, __m128i size, CPUTextureAddressMode mode)
+{
+	__m128i below = _mm_cmplt_epi32(x, _mm_setzero_si128());
+	__m128i inside = _mm_cmplt_epi32(x, size);
+	if (mode == CPU_TEXTURE_ADDRESS_WRAP)
+	{
+		x = _mm_add_epi32(x, _mm_and_si128(below, size));
+		return _mm_sub_epi32(x, _mm_andnot_si128(inside, size));
+	}
+	x = _mm_andnot_si128(below, x);
+	__m128i last = _mm_sub_epi32(size, _mm_set1_epi32(1));
+	return _mm_or_si128(_mm_and_si128(inside, x), _mm_andnot_si128(inside, last));
+}
+
+inline Texels4 To_Float4(__m128i texels)
+{
+	__m128i mask = _mm_set1_epi32(0xFF);
+	__m128 scale = _mm_set1_ps(255.f);
+	Texels4 result;
+	result.r = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(texels, mask)), scale);
+	result.g = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels, 8), mask)), scale);
+	result.b = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels, 16), mask)), scale);
+	result.a = _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(texels, 24)), scale);
+	return result;
+}
+
+inline Texels4 Lerp4(const Texels4 &a, const Texels4 &b, __m128 t)
+{
+	Texels4 result;
+	result.r = _mm_add_ps(a.r, _mm_mul_ps(_mm_sub_ps(b.r, a.r), t));
+	result.g = _mm_add_ps(a.g, _mm_mul_ps(_mm_sub_ps(b.g, a.g), t));
+	result.b = _mm_add_ps(a.b, _mm_mul_ps(_mm_sub_ps(b.b, a.b), t));
+	result.a = _mm_add_ps(a.a, _mm_mul_ps(_mm_sub_ps(b.a, a.a), t));
+	return result;
+}
+
+/**
+* Gather four texels. SSE2 has no gather instruction, so the lanes are loaded one by one.
+*/
+inline __m128i Gather4(const CPUTexture &texture, const int offset[4], const int width[4], __m128i x, __m128i y)
+{
+	alignas(16) int xs[4], ys[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(xs), x);
+	_mm_store_si128(reinterpret_cast<__m128i*>(ys), y);
+	const int* texels = reinterpret_cast<const int*>(texture.texels.data());
+	return _mm_set_epi32(
+		texels[offset[3] + ys[3] * width[3] + xs[3]],
+		texels[offset[2] + ys[2] * width[2] + xs[2]],
+		texels[offset[1] + ys[1] * width[1] + xs[1]],
+		texels[offset[0] + ys[0] * width[0] + xs[0]]);
+}
+
+/**
+* Sample a mip level per lane with point or bilinear filtering. Mirrors Sample_Level.
+*/
+Texels4 Sample_Level4(const CPUTexture &texture, const CPUSampler &sampler, const int levels[4], __m128 u, __m128 v, bool bilinear)
+{
+	alignas(16) int width[4], height[4], offset[4];
+	for (int i = 0; i < 4; i++)
+	{
+		const CPUTextureLevel &level = texture.levels[levels[i]];
+		width[i] = level.width;
+		height[i] = level.height;
+		offset[i] = static_cast<int>(level.offset);
+	}
+	__m128i widthI = _mm_load_si128(reinterpret_cast<const __m128i*>(width));
+	__m128i heightI = _mm_load_si128(reinterpret_cast<const __m128i*>(height));
+	__m128 s = _mm_mul_ps(Address4(u, sampler.addressU), _mm_cvtepi32_ps(widthI));
+	__m128 t = _mm_mul_ps(Address4(v, sampler.addressV), _mm_cvtepi32_ps(heightI));
+	if (!bilinear)
+	{
+		__m128i x = Address_Index4(_mm_cvttps_epi32(s), widthI, sampler.addressU);
+		__m128i y = Address_Index4(_mm_cvttps_epi32(t), heightI, sampler.addressV);
+		return To_Float4(Gather4(texture, offset, width, x, y));
+	}
+
+	__m128 half = _mm_set1_ps(0.5f);
+	s = _mm_sub_ps(s, half);
+	t = _mm_sub_ps(t, half);
+	__m128 s0 = Floor4(s), t0 = Floor4(t);
+	__m128 fx = _mm_sub_ps(s, s0), fy = _mm_sub_ps(t, t0);
+	__m128i one = _mm_set1_epi32(1);
+	__m128i xi = _mm_cvttps_epi32(s0), yi = _mm_cvttps_epi32(t0);
+	__m128i x0 = Address_Index4(xi, widthI, sampler.addressU);
+	__m128i y0 = Address_Index4(yi, heightI, sampler.addressV);
+	__m128i x1 = Address_Index4(_mm_add_epi32(xi, one), widthI, sampler.addressU);
+	__m128i y1 = Address_Index4(_mm_add_epi32(yi, one), heightI, sampler.addressV);
+
+	Texels4 c00 = To_Float4(Gather4(texture, offset, width, x0, y0));
+	Texels4 c10 = To_Float4(Gather4(texture, offset, width, x1, y0));
+	Texels4 c01 = To_Float4(Gather4(texture, offset, width, x0, y1));
+	Texels4 c11 = To_Float4(Gather4(texture, offset, width, x1, y1));
+	return Lerp4(Lerp4(c00, c10, fx), Lerp4(c01, c11, fx), fy);
+}
+
+/**
+* Sample a texture at four coordinates and levels of detail at once with SSE2. Returns the same bits as Sample.
+*/
+void Sample4(const CPUTexture &texture, const CPUSampler &sampler, const float* u, const float* v, const float* lod, XMFLOAT4* colors)
+{
+	if (texture.levels.empty())
+	{
+		for (int i = 0; i < 4; i++) colors[i] = XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+		return;
+	}
+
+	int lastLevel = static_cast<int>(texture.levels.size()) - 1;
+	__m128 uv[2] = { _mm_loadu_ps(u), _mm_loadu_ps(v) };
+	__m128 level = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(lod), _mm_setzero_ps()), _mm_set1_ps(static_cast<float>(lastLevel)));
+	alignas(16) int level0[4], level1[4];
+	Texels4 result;
+	if (sampler.filter == CPU_TEXTURE_FILTER_TRILINEAR)
+	{
+		__m128 base = Floor4(level);
+		_mm_store_si128(reinterpret_cast<__m128i*>(level0), _mm_cvttps_epi32(base));
+		for (int i = 0; i < 4; i++) level1[i] = min(level0[i] + 1, lastLevel);
+		Texels4 c0 = Sample_Level4(texture, sampler, level0, uv[0], uv[1], true);
+		Texels4 c1 = Sample_Level4(texture, sampler, level1, uv[0], uv[1], true);
+		result = Lerp4(c0, c1, _mm_sub_ps(level, base));
+	}
+	else
+	{
+		_mm_store_si128(reinterpret_cast<__m128i*>(level0), _mm_cvttps_epi32(Floor4(_mm_add_ps(level, _mm_set1_ps(0.5f)))));
+		result = Sample_Level4(texture, sampler, level0, uv[0], uv[1], sampler.filter == CPU_TEXTURE_FILTER_BILINEAR);
+	}
+
+	_MM_TRANSPOSE4_PS(result.r, result.g, result.b, result.a);
+	_mm_storeu_ps(&colors[0].x, result.r);
+	_mm_storeu_ps(&colors[1].x, result.g);
+	_mm_storeu_ps(&colors[2].x, result.b);
+	_mm_storeu_ps(&colors[3].x, result.a);
+}
+
+//--------------------------------------------------------------------------------------
+// 8-wide (AVX2)
+//--------------------------------------------------------------------------------------
+
+PLATFORM_TARGET_AVX2 inline __m256 Floor8(__m256 x)
+{
+	__m256 t = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(x));
+	return _mm256_sub_ps(t, _mm256_and_ps(_mm256_cmp_ps(t, x, _CMP_GT_OQ), _mm256_set1_ps(1.f)));
+}
+
+PLATFORM_TARGET_AVX2 inline __m256 Address8(__m256 u, CPUTextureAddressMode mode)
+{
+	if (mode == CPU_TEXTURE_ADDRESS_WRAP) return _mm256_sub_ps(u, Floor8(u));
+	return _mm256_min_ps(_mm256_max_ps(u, _mm256_setzero_ps()), _mm256_set1_ps(1.f));
+}
+
+PLATFORM_TARGET_AVX2 inline __m256i Address_Index8(__m256i x, __m256i size, CPUTextureAddressMode mode)
+{
+	if (mode == CPU_TEXTURE_ADDRESS_WRAP)
+	{
+		x = _mm256_add_epi32(x, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), x), size));
+		return _mm256_sub_epi32(x, _mm256_andnot_si256(_mm256_cmpgt_epi32(size, x), size));
+	}
+	return _mm256_min_epi32(_mm256_max_epi32(x, _mm256_setzero_si256()), _mm256_sub_epi32(size, _mm256_set1_epi32(1)));
+}
+
+PLATFORM_TARGET_AVX2 inline Texels8 To_Float8(__m256i texels)
+{
+	__m256i mask = _mm256_set1_epi32(0xFF);
+	__m256 scale = _mm256_set1_ps(255.f);
+	Texels8 result;
+	result.r = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(texels, mask)), scale);
+	result.g = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texels, 8), mask)), scale);
+	result.b = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texels, 16), mask)), scale);
+	result.a = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(texels, 24)), scale);
+	return result;
+}
+
+PLATFORM_TARGET_AVX2 inline Texels8 Lerp8(const Texels8 &a, const Texels8 &b, __m256 t)
+{
+	Texels8 result;
+	result.r = _mm256_add_ps(a.r, _mm256_mul_ps(_mm256_sub_ps(b.r, a.r), t));
+	result.g = _mm256_add_ps(a.g, _mm256_mul_ps(_mm256_sub_ps(b.g, a.g), t));
+	result.b = _mm256_add_ps(a.b, _mm256_mul_ps(_mm256_sub_ps(b.b, a.b), t));
+	result.a = _mm256_add_ps(a.a, _mm256_mul_ps(_mm256_sub_ps(b.a, a.a), t));
+	return result;
+}
+
+/**
+* Gather eight texels with one AVX2 gather.
+*/
+PLATFORM_TARGET_AVX2 inline __m256i Gather8(const CPUTexture &texture, __m256i offset, __m256i width, __m256i x, __m256i y)
+{
+	__m256i index = _mm256_add_epi32(offset, _mm256_add_epi32(_mm256_mullo_epi32(y, width), x));
+	return _mm256_i32gather_epi32(reinterpret_cast<const int*>(texture.texels.data()), index, 4);
+}
+
+/**
+* Sample a mip level per lane with point or bilinear filtering. Mirrors Sample_Level.
+*/
+PLATFORM_TARGET_AVX2 Texels8 Sample_Level8(const CPUTexture &texture, const CPUSampler &sampler, const int levels[8], __m256 u, __m256 v, bool bilinear)
+{
+	alignas(32) int width[8], height[8], offset[8];
+	for (int i = 0; i < 8; i++)
+	{
+		const CPUTextureLevel &level = texture.levels[levels[i]];
+		width[i] = level.width;
+		height[i] = level.height;
+		offset[i] = static_cast<int>(level.offset);
+	}
+	__m256i widthI = _mm256_load_si256(reinterpret_cast<const __m256i*>(width));
+	__m256i heightI = _mm256_load_si256(reinterpret_cast<const __m256i*>(height));
+	__m256i offsetI = _mm256_load_si256(reinterpret_cast<const __m256i*>(offset));
+	__m256 s = _mm256_mul_ps(Address8(u, sampler.addressU), _mm256_cvtepi32_ps(widthI));
+	__m256 t = _mm256_mul_ps(Address8(v, sampler.addressV), _mm256_cvtepi32_ps(heightI));
+	if (!bilinear)
+	{
+		__m256i x = Address_Index8(_mm256_cvttps_epi32(s), widthI, sampler.addressU);
+		__m256i y = Address_Index8(_mm256_cvttps_epi32(t), heightI, sampler.addressV);
+		return To_Float8(Gather8(texture, offsetI, widthI, x, y));
+	}
+
+	__m256 half = _mm256_set1_ps(0.5f);
+	s = _mm256_sub_ps(s, half);
+	t = _mm256_sub_ps(t, half);
+	__m256 s0 = Floor8(s), t0 = Floor8(t);
+	__m256 fx = _mm256_sub_ps(s, s0), fy = _mm256_sub_ps(t, t0);
+	__m256i one = _mm256_set1_epi32(1);
+	__m256i xi = _mm256_cvttps_epi32(s0), yi = _mm256_cvttps_epi32(t0);
+	__m256i x0 = Address_Index8(xi, widthI, sampler.addressU);
+	__m256i y0 = Address_Index8(yi, heightI, sampler.addressV);
+	__m256i x1 = Address_Index8(_mm256_add_epi32(xi, one), widthI, sampler.addressU);
+	__m256i y1 = Address_Index8(_mm256_add_epi32(yi, one), heightI, sampler.addressV);
+
+	Texels8 c00 = To_Float8(Gather8(texture, offsetI, widthI, x0, y0));
+	Texels8 c10 = To_Float8(Gather8(texture, offsetI, widthI, x1, y0));
+	Texels8 c01 = To_Float8(Gather8(texture, offsetI, widthI, x0, y1));
+	Texels8 c11 = To_Float8(Gather8(texture, offsetI, widthI, x1, y1));
+	return Lerp8(Lerp8(c00, c10, fx), Lerp8(c01, c11, fx), fy);
+}
+
+/**
+* Sample a texture at eight coordinates and levels of detail at once with AVX2 gathers. Returns the same bits as Sample.
+* Requires AVX2 (see Utils::HasAVX2).
+*/
+PLATFORM_TARGET_AVX2 void Sample8(const CPUTexture &texture, const CPUSampler &sampler, const float* u, const float* v, const float* lod, XMFLOAT4* colors)
+{
+	if (texture.levels.empty())
+	{
+		for (int i = 0; i < 8; i++) colors[i] = XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+		return;
+	}
+
+	int lastLevel = static_cast<int>(texture.levels.size()) - 1;
+	__m256 uv[2] = { _mm256_loadu_ps(u), _mm256_loadu_ps(v) };
+	__m256 level = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(lod), _mm256_setzero_ps()), _mm256_set1_ps(static_cast<float>(lastLevel)));
+	alignas(32) int level0[8], level1[8];
+	Texels8 result;
+	if (sampler.filter == CPU_TEXTURE_FILTER_TRILINEAR)
+	{
+		__m256 base = Floor8(level);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(level0), _mm256_cvttps_epi32(base));
+		for (int i = 0; i < 8; i++) level1[i] = min(level0[i] + 1, lastLevel);
+		Texels8 c0 = Sample_Level8(texture, sampler, level0, uv[0], uv[1], true);
+		Texels8 c1 = Sample_Level8(texture, sampler, level1, uv[0], uv[1], true);
+		result = Lerp8(c0, c1, _mm256_sub_ps(level, base));
+	}
+	else
+	{
+		_mm256_store_si256(reinterpret_cast<__m256i*>(level0), _mm256_cvttps_epi32(Floor8(_mm256_add_ps(level, _mm256_set1_ps(0.5f)))));
+		result = Sample_Level8(texture, sampler, level0, uv[0], uv[1], sampler.filter == CPU_TEXTURE_FILTER_BILINEAR);
+	}
+
+	alignas(32) float channels[4][8];
+	_mm256_store_ps(channels[0], result.r);
+	_mm256_store_ps(channels[1], result.g);
+	_mm256_store_ps(channels[2], result.b);
+	_mm256_store_ps(channels[3], result.a);
+	for (int i = 0; i < 8; i++) colors[i] = XMFLOAT4(channels[0][i], channels[1][i], channels[2][i], channels[3][i]);
+}
+
+}
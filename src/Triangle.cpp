@@ -0,0 +1,276 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CPU.h"
+#include "Platform.h"
+
+#include <cmath>
+#include <immintrin.h>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Watertight Ray-Triangle Intersection Functions
+//--------------------------------------------------------------------------------------
+
+namespace BVH
+{
+
+/**
+* Get a component of a float3 by axis index.
+*/
+inline float Axis(const XMFLOAT3 &v, int axis)
+{
+	return (&v.x)[axis];
+}
+
+/**
+* Prepare a ray for watertight triangle tests: permute the axes so the largest direction component is along kz,
+* and find the shear that maps the direction onto that axis (Woop, Benthin and Wald, 2013).
+*/
+WatertightRay Get_Watertight_Ray(const CPURay &ray)
+{
+	float x = fabsf(ray.direction.x), y = fabsf(ray.direction.y), z = fabsf(ray.direction.z);
+
+	WatertightRay result;
+	result.origin = ray.origin;
+	result.tMin = ray.tMin;
+	result.kz = (x > y) ? ((x > z) ? 0 : 2) : ((y > z) ? 1 : 2);
+	result.kx = (result.kz + 1) % 3;
+	result.ky = (result.kx + 1) % 3;
+
+	// Keep the winding of the projected triangle when the direction points down the kz axis
+	float dz = Axis(ray.direction, result.kz);
+	if (dz < 0.f) swap(result.kx, result.ky);
+
+	result.shear = XMFLOAT3(Axis(ray.direction, result.kx) / dz, Axis(ray.direction, result.ky) / dz, 1.f / dz);
+	return result;
+}
+
+/**
+* Recompute a 2D edge function in double precision, for points exactly on an edge in single precision.
+*/
+inline float Edge_Function_Double(float ax, float ay, float bx, float by)
+{
+	return static_cast<float>(static_cast<double>(ax) * static_cast<double>(by) - static_cast<double>(ay) * static_cast<double>(bx));
+}
+
+/**
+* Intersect a ray with a triangle without gaps between triangles that share an edge or a vertex.
+* Double sided, like the TRIANGLE_FRONT_COUNTERCLOCKWISE instance with no cull flags.
+* The barycentrics follow the DXR convention: uv are the weights of the second and third vertex.
+*/
+bool Intersect_Triangle(const Model &model, uint32_t triangleIndex, const WatertightRay &ray, CPUHit &hit)
+{
+	const XMFLOAT3 &v0 = model.vertices[model.indices[triangleIndex * 3 + 0]].position;
+	const XMFLOAT3 &v1 = model.vertices[model.indices[triangleIndex * 3 + 1]].position;
+	const XMFLOAT3 &v2 = model.vertices[model.indices[triangleIndex * 3 + 2]].position;
+
+	// Vertices relative to the ray origin, in the permuted axes
+	float ax = Axis(v0, ray.kx) - Axis(ray.origin, ray.kx), ay = Axis(v0, ray.ky) - Axis(ray.origin, ray.ky), az = Axis(v0, ray.kz) - Axis(ray.origin, ray.kz);
+	float bx = Axis(v1, ray.kx) - Axis(ray.origin, ray.kx), by = Axis(v1, ray.ky) - Axis(ray.origin, ray.ky), bz = Axis(v1, ray.kz) - Axis(ray.origin, ray.kz);
+	float cx = Axis(v2, ray.kx) - Axis(ray.origin, ray.kx), cy = Axis(v2, ray.ky) - Axis(ray.origin, ray.ky), cz = Axis(v2, ray.kz) - Axis(ray.origin, ray.kz);
+
+	// Shear the vertices so the ray runs along the kz axis
+	ax = ax - ray.shear.x * az; ay = ay - ray.shear.y * az;
+	bx = bx - ray.shear.x * bz; by = by - ray.shear.y * bz;
+	cx = cx - ray.shear.x * cz; cy = cy - ray.shear.y * cz;
+
+	// Scaled barycentrics from the 2D edge functions
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+	if (u == 0.f || v == 0.f || w == 0.f)
+	{
+		u = Edge_Function_Double(cx, cy, bx, by);
+		v = Edge_Function_Double(ax, ay, cx, cy);
+		w = Edge_Function_Double(bx, by, ax, ay);
+	}
+
+	if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f)) return false;
+	float det = u + v + w;
+	if (det == 0.f) return false;
+
+	float t = (u * (ray.shear.z * az) + v * (ray.shear.z * bz) + w * (ray.shear.z * cz));
+	float invDet = 1.f / det;
+	t = t * invDet;
+	if (!(t >= ray.tMin && t < hit.t)) return false;
+
+	hit.t = t;
+	hit.uv = XMFLOAT2(v * invDet, w * invDet);
+	hit.triangleIndex = triangleIndex;
+	return true;
+}
+
+/**
+* SSE and AVX vector operations, so the wide triangle tests share one implementation.
+*/
+struct SSE
+{
+	typedef __m128 Float;
+	static const int Width = 4;
+	static Float Load(const float* p) { return _mm_load_ps(p); }
+	static void Store(float* p, Float a) { _mm_store_ps(p, a); }
+	static Float Set(float a) { return _mm_set1_ps(a); }
+	static Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+	static Float Sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+	static Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+	static Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+	static uint32_t Less(Float a, Float b) { return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(a, b))); }
+	static uint32_t Equal(Float a, Float b) { return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpeq_ps(a, b))); }
+	static uint32_t GreaterEqual(Float a, Float b) { return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(a, b))); }
+};
+
+struct AVX
+{
+	typedef __m256 Float;
+	static const int Width = 8;
+	PLATFORM_TARGET_AVX2 static Float Load(const float* p) { return _mm256_load_ps(p); }
+	PLATFORM_TARGET_AVX2 static void Store(float* p, Float a) { _mm256_store_ps(p, a); }
+	PLATFORM_TARGET_AVX2 static Float Set(float a) { return _mm256_set1_ps(a); }
+	PLATFORM_TARGET_AVX2 static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+	PLATFORM_TARGET_AVX2 static Float Sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+	PLATFORM_TARGET_AVX2 static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+	PLATFORM_TARGET_AVX2 static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+	PLATFORM_TARGET_AVX2 static uint32_t Less(Float a, Float b) { return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ))); }
+	PLATFORM_TARGET_AVX2 static uint32_t Equal(Float a, Float b) { return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ))); }
+	PLATFORM_TARGET_AVX2 static uint32_t GreaterEqual(Float a, Float b) { return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ))); }
+};
+
+/**
+* Intersect a ray with up to Width triangles at once, with the same operations as Intersect_Triangle,
+* so the wide and scalar tests return the same hits. On ties, the earlier triangle wins, as in a scalar loop.
+*/
+template<typename V>
+PLATFORM_INLINE_INTO_CALLER bool Intersect_Triangles(const Model &model, const uint32_t* triangleIndices, uint32_t count, const WatertightRay &ray, CPUHit &hit)
+{
+	const int W = V::Width;
+	alignas(32) float p0[3][W], p1[3][W], p2[3][W];
+
+	// Gather the vertices, one lane per triangle
+	for (int i = 0; i < W; i++)
+	{
+		uint32_t triangleIndex = triangleIndices[(static_cast<uint32_t>(i) < count) ? i : 0];
+		const XMFLOAT3 &v0 = model.vertices[model.indices[triangleIndex * 3 + 0]].position;
+		const XMFLOAT3 &v1 = model.vertices[model.indices[triangleIndex * 3 + 1]].position;
+		const XMFLOAT3 &v2 = model.vertices[model.indices[triangleIndex * 3 + 2]].position;
+		p0[0][i] = v0.x; p0[1][i] = v0.y; p0[2][i] = v0.z;
+		p1[0][i] = v1.x; p1[1][i] = v1.y; p1[2][i] = v1.z;
+		p2[0][i] = v2.x; p2[1][i] = v2.y; p2[2][i] = v2.z;
+	}
+
+	// Vertices relative to the ray origin, in the permuted axes, sheared so the ray runs along the kz axis
+	typename V::Float originX = V::Set(Axis(ray.origin, ray.kx)), originY = V::Set(Axis(ray.origin, ray.ky)), originZ = V::Set(Axis(ray.origin, ray.kz));
+	typename V::Float shearX = V::Set(ray.shear.x), shearY = V::Set(ray.shear.y), shearZ = V::Set(ray.shear.z);
+	typename V::Float az = V::Sub(V::Load(p0[ray.kz]), originZ), bz = V::Sub(V::Load(p1[ray.kz]), originZ), cz = V::Sub(V::Load(p2[ray.kz]), originZ);
+	typename V::Float ax = V::Sub(V::Sub(V::Load(p0[ray.kx]), originX), V::Mul(shearX, az)), ay = V::Sub(V::Sub(V::Load(p0[ray.ky]), originY), V::Mul(shearY, az));
+	typename V::Float bx = V::Sub(V::Sub(V::Load(p1[ray.kx]), originX), V::Mul(shearX, bz)), by = V::Sub(V::Sub(V::Load(p1[ray.ky]), originY), V::Mul(shearY, bz));
+	typename V::Float cx = V::Sub(V::Sub(V::Load(p2[ray.kx]), originX), V::Mul(shearX, cz)), cy = V::Sub(V::Sub(V::Load(p2[ray.ky]), originY), V::Mul(shearY, cz));
+
+	typename V::Float u = V::Sub(V::Mul(cx, by), V::Mul(cy, bx));
+	typename V::Float v = V::Sub(V::Mul(ax, cy), V::Mul(ay, cx));
+	typename V::Float w = V::Sub(V::Mul(bx, ay), V::Mul(by, ax));
+
+	const uint32_t active = (1u << min(count, static_cast<uint32_t>(W))) - 1;
+	const typename V::Float zero = V::Set(0.f);
+	uint32_t onEdge = (V::Equal(u, zero) | V::Equal(v, zero) | V::Equal(w, zero)) & active;
+	if (onEdge != 0)
+	{
+		// Rare: redo the edge functions of these lanes in double precision
+		alignas(32) float lanes[9][W];
+		V::Store(lanes[0], ax); V::Store(lanes[1], ay); V::Store(lanes[2], bx); V::Store(lanes[3], by);
+		V::Store(lanes[4], cx); V::Store(lanes[5], cy); V::Store(lanes[6], u); V::Store(lanes[7], v); V::Store(lanes[8], w);
+		for (int i = 0; i < W; i++)
+		{
+			if (!(onEdge & (1u << i))) continue;
+			lanes[6][i] = Edge_Function_Double(lanes[4][i], lanes[5][i], lanes[2][i], lanes[3][i]);
+			lanes[7][i] = Edge_Function_Double(lanes[0][i], lanes[1][i], lanes[4][i], lanes[5][i]);
+			lanes[8][i] = Edge_Function_Double(lanes[2][i], lanes[3][i], lanes[0][i], lanes[1][i]);
+		}
+		u = V::Load(lanes[6]); v = V::Load(lanes[7]); w = V::Load(lanes[8]);
+	}
+
+	uint32_t negative = V::Less(u, zero) | V::Less(v, zero) | V::Less(w, zero);
+	uint32_t positive = V::Less(zero, u) | V::Less(zero, v) | V::Less(zero, w);
+	typename V::Float det = V::Add(V::Add(u, v), w);
+	uint32_t mask = active & ~(negative & positive) & ~V::Equal(det, zero);
+	if (mask == 0) return false;
+
+	typename V::Float t = V::Add(V::Add(V::Mul(u, V::Mul(shearZ, az)), V::Mul(v, V::Mul(shearZ, bz))), V::Mul(w, V::Mul(shearZ, cz)));
+	typename V::Float invDet = V::Div(V::Set(1.f), det);
+	t = V::Mul(t, invDet);
+	mask &= V::GreaterEqual(t, V::Set(ray.tMin)) & V::Less(t, V::Set(hit.t));
+	if (mask == 0) return false;
+
+	// Closest lane, the first one on ties
+	alignas(32) float tLanes[W];
+	V::Store(tLanes, t);
+	int closest = -1;
+	for (int i = 0; i < W; i++)
+	{
+		if ((mask & (1u << i)) && (closest < 0 || tLanes[i] < tLanes[closest])) closest = i;
+	}
+
+	alignas(32) float uLanes[W], vLanes[W], invDetLanes[W];
+	V::Store(uLanes, v);
+	V::Store(vLanes, w);
+	V::Store(invDetLanes, invDet);
+	hit.t = tLanes[closest];
+	hit.uv = XMFLOAT2(uLanes[closest] * invDetLanes[closest], vLanes[closest] * invDetLanes[closest]);
+	hit.triangleIndex = triangleIndices[closest];
+	return true;
+}
+
+/**
+* Intersect a ray with a list of triangles, four at a time with SSE.
+*/
+bool Intersect_Triangles4(const Model &model, const uint32_t* triangleIndices, uint32_t count, const WatertightRay &ray, CPUHit &hit)
+{
+	bool found = false;
+	for (uint32_t i = 0; i < count; i += 4)
+	{
+		found |= Intersect_Triangles<SSE>(model, triangleIndices + i, count - i, ray, hit);
+	}
+	return found;
+}
+
+/**
+* Intersect a ray with a list of triangles, eight at a time with AVX. Requires AVX (see Utils::HasAVX2).
+*/
+PLATFORM_TARGET_AVX2 bool Intersect_Triangles8(const Model &model, const uint32_t* triangleIndices, uint32_t count, const WatertightRay &ray, CPUHit &hit)
+{
+	bool found = false;
+	for (uint32_t i = 0; i < count; i += 8)
+	{
+		found |= Intersect_Triangles<AVX>(model, triangleIndices + i, count - i, ray, hit);
+	}
+	return found;
+}
+
+}
@@ -25,10 +25,8 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#pragma once
-
-
 #include "Utils.h"
+#include "Platform.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -36,8 +34,18 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
-#include <shellapi.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 #include <unordered_map>
 
 namespace std
@@ -67,6 +75,7 @@ namespace std
 }
 
 using namespace std;
+using namespace DirectX;
 
 namespace Utils
 {
@@ -75,30 +84,23 @@ namespace Utils
 // Command Line Parser
 //--------------------------------------------------------------------------------------
 
-HRESULT ParseCommandLine(LPWSTR lpCmdLine, ConfigInfo &config)
+/**
+* Parse the arguments of the program, UTF-8 encoded, where argv[0] is the program itself.
+*/
+bool ParseCommandLine(int argc, char** argv, ConfigInfo &config)
 {
-	LPWSTR* argv = NULL;
-	int argc = 0;
-
-	argv = CommandLineToArgvW(GetCommandLine(), &argc);
-	if (argv == NULL)
-	{
-		MessageBox(NULL, L"Unable to parse command line!", L"Error", MB_OK);
-		return E_FAIL;
-	}
-
 	if (argc > 1)
 	{
-		char str[256];
+		const char* str;
 		int i = 1;
 		while (i < argc)
 		{
-			wcstombs(str, argv[i], 256);
+			str = argv[i];
 
 			if (strcmp(str, "-width") == 0)
 			{
 				i++;
-				wcstombs(str, argv[i], 256);
+				str = (i < argc) ? argv[i] : "";
 				config.width = atoi(str);
 				i++;
 				continue;
@@ -107,7 +109,7 @@ HRESULT ParseCommandLine(LPWSTR lpCmdLine, ConfigInfo &config)
 			if (strcmp(str, "-height") == 0)
 			{
 				i++;
-				wcstombs(str, argv[i], 256);
+				str = (i < argc) ? argv[i] : "";
 				config.height = atoi(str);
 				i++;
 				continue;
@@ -116,16 +118,151 @@ HRESULT ParseCommandLine(LPWSTR lpCmdLine, ConfigInfo &config)
 			if (strcmp(str, "-vsync") == 0)
 			{
 				i++;
-				wcstombs(str, argv[i], 256);
+				str = (i < argc) ? argv[i] : "";
 				config.vsync = (atoi(str) > 0);
 				i++;
 				continue;
 			}
 
+			if (strcmp(str, "-combinedlib") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.combinedLibrary = (atoi(str) > 0);
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-hitfeatures") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.hitFeatures = static_cast<uint32_t>(atoi(str));
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-shaderstats") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.shaderStats = str;
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-cpu") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.cpuOutput = str;
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-samples") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.cpuSamples = static_cast<uint32_t>(atoi(str));
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-bounces") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.cpuBounces = static_cast<uint32_t>(atoi(str));
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-threads") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.threads = static_cast<unsigned>(atoi(str));
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-packet") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.packetWidth = static_cast<uint32_t>(atoi(str));
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-bvhcache") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.bvhCache = (atoi(str) > 0);
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-benchmark") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.benchmark = str;
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-bvhstats") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.bvhStats = str;
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-regression") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.regression = str;
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-updategolden") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.updateGolden = (atoi(str) > 0);
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-test") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.test = str;
+				i++;
+				continue;
+			}
+
+			if (strcmp(str, "-maxtriangles") == 0)
+			{
+				i++;
+				str = (i < argc) ? argv[i] : "";
+				config.benchmarkTriangles = static_cast<uint32_t>(atoi(str));
+				i++;
+				continue;
+			}
+
 			if (strcmp(str, "-model") == 0)
 			{
 				i++;
-				wcstombs(str, argv[i], 256);
+				str = (i < argc) ? argv[i] : "";
 				config.model = str;
 				i++;
 				continue;
@@ -136,24 +273,23 @@ HRESULT ParseCommandLine(LPWSTR lpCmdLine, ConfigInfo &config)
 	}
 	else 
 	{
-		MessageBox(NULL, L"Incorrect command line usage!", L"Error", MB_OK);
-		return E_FAIL;
+		Platform::ShowError(L"Incorrect command line usage!");
+		return false;
 	}
 
-	LocalFree(argv);
-	return S_OK;
+	return true;
 }
 
 //--------------------------------------------------------------------------------------
 // Error Messaging
 //--------------------------------------------------------------------------------------
 
-void Validate(HRESULT hr, LPWSTR msg)
+void Validate(long hr, const wchar_t* msg)
 {
-	if (FAILED(hr))
+	if (hr < 0)
 	{
-		MessageBox(NULL, msg, L"Error", MB_OK);
-		PostQuitMessage(EXIT_FAILURE);
+		Platform::ShowError(msg);
+		Platform::Quit(EXIT_FAILURE);
 	}
 }
 
@@ -180,6 +316,275 @@ vector<char> ReadFile(const string &filename)
 	return buffer;
 }
 
+/**
+* Read a file into a string, without throwing if it does not exist.
+*/
+bool ReadFile(const wstring &filename, string &contents)
+{
+	ifstream file(filesystem::path(filename), ios::ate | ios::binary);
+	if (!file.is_open()) return false;
+
+	size_t fileSize = (size_t)file.tellg();
+	contents.resize(fileSize);
+
+	file.seekg(0);
+	file.read(&contents[0], fileSize);
+	file.close();
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Hashing
+//--------------------------------------------------------------------------------------
+
+/**
+* 64-bit FNV-1a hash of a block of memory.
+*/
+uint64_t Hash(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//--------------------------------------------------------------------------------------
+// Threading
+//--------------------------------------------------------------------------------------
+
+/**
+* Resolve a requested thread count, where 0 means one thread per hardware thread.
+*/
+unsigned GetThreadCount(unsigned requested)
+{
+	if (requested > 0) return requested;
+	return max(thread::hardware_concurrency(), 1u);
+}
+
+/**
+* Check that the processor and the OS support AVX2 and FMA, used by the wide BVH traversal.
+*/
+bool HasAVX2()
+{
+	int info[4];
+	Platform::CPUID(info, 0, 0);
+	if (info[0] < 7) return false;
+
+	// OSXSAVE, AVX and FMA, then check that the OS saves the YMM registers
+	Platform::CPUID(info, 1, 0);
+	const int features = (1 << 27) | (1 << 28) | (1 << 12);
+	if ((info[2] & features) != features) return false;
+	if ((Platform::XGETBV(0) & 0x6) != 0x6) return false;
+
+	Platform::CPUID(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+
+// Worker threads that sleep between parallel loops, so a loop wakes them instead of creating and joining threads
+struct WorkerPool
+{
+	atomic<bool>						busy{ false };			// a loop is running on the pool
+	mutex								lock;
+	condition_variable					wake;
+	condition_variable					finished;
+	vector<thread>						workers;
+	const function<void(size_t)>*		task = nullptr;			// the body of the current loop, run with the worker index + 1
+	size_t								active = 0;				// workers taking part in the current loop
+	size_t								running = 0;			// of those, the ones still running it
+	uint64_t							loop = 0;				// counts the loops, so a worker runs each one once
+	bool								quit = false;
+
+	~WorkerPool()
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			quit = true;
+		}
+		wake.notify_all();
+		for (thread &worker : workers) worker.join();
+	}
+};
+
+/**
+* Get the worker pool, created on first use.
+*/
+static WorkerPool& GetWorkerPool()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+/**
+* Run the loops of the worker pool that include this worker until the pool shuts down.
+*/
+static void RunWorker(size_t index)
+{
+	WorkerPool &workerPool = GetWorkerPool();
+	uint64_t done = 0;
+	while (true)
+	{
+		{
+			unique_lock<mutex> guard(workerPool.lock);
+			workerPool.wake.wait(guard, [&] { return workerPool.quit || (workerPool.loop != done && index < workerPool.active); });
+			if (workerPool.quit) return;
+			done = workerPool.loop;
+		}
+
+		(*workerPool.task)(index + 1);
+
+		lock_guard<mutex> guard(workerPool.lock);
+		if (--workerPool.running == 0) workerPool.finished.notify_one();
+	}
+}
+
+/**
+* Run a task on threadCount threads, with the thread index, on the calling thread and the worker pool. A loop nested in
+* a task, or started from another thread while the pool is busy, runs on threads of its own instead.
+*/
+static void RunOnThreads(size_t threadCount, const function<void(size_t)> &task)
+{
+	if (threadCount <= 1)
+	{
+		task(0);
+		return;
+	}
+
+	WorkerPool &workerPool = GetWorkerPool();
+	if (workerPool.busy.exchange(true))
+	{
+		vector<thread> workers;
+		for (size_t i = 1; i < threadCount; i++) workers.emplace_back(task, i);
+		task(0);
+		for (thread &worker : workers) worker.join();
+		return;
+	}
+
+	{
+		lock_guard<mutex> guard(workerPool.lock);
+		while (workerPool.workers.size() < threadCount - 1) workerPool.workers.emplace_back(RunWorker, workerPool.workers.size());
+		workerPool.task = &task;
+		workerPool.active = threadCount - 1;
+		workerPool.running = threadCount - 1;
+		workerPool.loop++;
+	}
+	workerPool.wake.notify_all();
+
+	// The workers still use the task if the calling thread's share throws, so wait for them either way
+	auto wait = [&]()
+	{
+		unique_lock<mutex> guard(workerPool.lock);
+		workerPool.finished.wait(guard, [&] { return workerPool.running == 0; });
+		workerPool.busy = false;
+	};
+	try
+	{
+		task(0);
+	}
+	catch (...)
+	{
+		wait();
+		throw;
+	}
+	wait();
+}
+
+/**
+* Split [0, count) into one contiguous range per thread and run the body on each range.
+* The calling thread runs the first range, and the worker pool the others.
+*/
+void ParallelFor(size_t count, unsigned threadCount, const function<void(size_t begin, size_t end)> &body)
+{
+	if (count == 0) return;
+
+	size_t numThreads = GetThreadCount(threadCount);
+	if (numThreads > count) numThreads = count;
+
+	size_t rangeSize = (count + numThreads - 1) / numThreads;
+	RunOnThreads(numThreads, [&](size_t i)
+	{
+		size_t begin = i * rangeSize;
+		size_t end = min(begin + rangeSize, count);
+		if (begin < end) body(begin, end);
+	});
+}
+
+/**
+* Run the body on each index in [0, count), for items of uneven cost.
+* Each thread owns a deque of indices, initially a contiguous share in order, and works through it from the front.
+* A thread that runs out steals single indices from the back of the deque with the most work left.
+* The indices of a deque stay contiguous, so each deque is a [begin, end) range packed in one atomic.
+*/
+void ParallelForWorkStealing(size_t count, unsigned threadCount, const function<void(size_t index)> &body)
+{
+	if (count == 0) return;
+	if (count > UINT32_MAX)
+	{
+		ParallelFor(count, threadCount, [&](size_t begin, size_t end) { for (size_t i = begin; i < end; i++) body(i); });
+		return;
+	}
+
+	size_t numThreads = GetThreadCount(threadCount);
+	if (numThreads > count) numThreads = count;
+
+	// One deque per thread, padded to a cache line
+	struct WorkDeque
+	{
+		atomic<uint64_t> range;				// begin in the low 32 bits, end in the high 32 bits
+		char padding[64 - sizeof(atomic<uint64_t>)];
+	};
+
+	unique_ptr<WorkDeque[]> deques(new WorkDeque[numThreads]);
+	size_t shareSize = (count + numThreads - 1) / numThreads;
+	for (size_t i = 0; i < numThreads; i++)
+	{
+		uint64_t begin = min(i * shareSize, count);
+		uint64_t end = min(begin + shareSize, count);
+		deques[i].range = begin | (end << 32);
+	}
+
+	auto run = [&](size_t self)
+	{
+		while (true)
+		{
+			// Take from the front of the own deque
+			uint64_t range = deques[self].range.load();
+			uint32_t begin = static_cast<uint32_t>(range), end = static_cast<uint32_t>(range >> 32);
+			if (begin < end)
+			{
+				if (deques[self].range.compare_exchange_weak(range, (begin + 1) | (static_cast<uint64_t>(end) << 32))) body(begin);
+				continue;
+			}
+
+			// Steal from the back of the fullest deque
+			size_t victim = numThreads;
+			uint32_t mostWork = 0;
+			for (size_t i = 0; i < numThreads; i++)
+			{
+				uint64_t other = deques[i].range.load();
+				uint32_t work = static_cast<uint32_t>(other >> 32) - static_cast<uint32_t>(other);
+				if (static_cast<uint32_t>(other) < static_cast<uint32_t>(other >> 32) && work > mostWork)
+				{
+					victim = i;
+					mostWork = work;
+				}
+			}
+			if (victim == numThreads) break;
+
+			range = deques[victim].range.load();
+			begin = static_cast<uint32_t>(range);
+			end = static_cast<uint32_t>(range >> 32);
+			if (begin < end && deques[victim].range.compare_exchange_weak(range, begin | (static_cast<uint64_t>(end - 1) << 32))) body(end - 1);
+		}
+	};
+
+	RunOnThreads(numThreads, run);
+}
+
 //--------------------------------------------------------------------------------------
 // Model Loading
 //--------------------------------------------------------------------------------------
@@ -192,15 +597,16 @@ void LoadModel(string filepath, Model &model, Material &material)
 	std::string err;
 
 	// Load the OBJ and MTL files
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filepath.c_str(), "materials\\")) 
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filepath.c_str(), "materials/")) 
 	{
 		throw std::runtime_error(err);
 	}
 
 	// Get the first material
-	// Only support a single material right now
+	// Only support a single material right now, whose texture path may use either separator
 	material.name = materials[0].name;
 	material.texturePath = materials[0].diffuse_texname;
+	replace(material.texturePath.begin(), material.texturePath.end(), '\\', '/');
 
 	// Parse the model and store the unique vertices
 	unordered_map<Vertex, uint32_t> uniqueVertices = {};
@@ -241,17 +647,16 @@ void LoadModel(string filepath, Model &model, Material &material)
 /**
 * Format the loaded texture into the layout we use with D3D12.
 */
-void FormatTexture(TextureInfo &info, UINT8* pixels)
+void FormatTexture(TextureInfo &info, uint8_t* pixels)
 {
-	const UINT numPixels = (info.width * info.height);
-	const UINT oldStride = info.stride;
-	const UINT oldSize = (numPixels * info.stride);
+	const uint32_t numPixels = (info.width * info.height);
+	const uint32_t oldStride = info.stride;
 
-	const UINT newStride = 4;				// uploading textures to GPU as DXGI_FORMAT_R8G8B8A8_UNORM
-	const UINT newSize = (numPixels * newStride);
+	const uint32_t newStride = 4;				// uploading textures to GPU as DXGI_FORMAT_R8G8B8A8_UNORM
+	const uint32_t newSize = (numPixels * newStride);
 	info.pixels.resize(newSize);
 
-	for (UINT i = 0; i < numPixels; i++)
+	for (uint32_t i = 0; i < numPixels; i++)
 	{
 		info.pixels[i * newStride]		= pixels[i * oldStride];		// R
 		info.pixels[i * newStride + 1]	= pixels[i * oldStride + 1];	// G
@@ -270,7 +675,7 @@ TextureInfo LoadTexture(string filepath)
 	TextureInfo result = {};
 
 	// Load image pixels with stb_image
-	UINT8* pixels = stbi_load(filepath.c_str(), &result.width, &result.height, &result.stride, STBI_default);
+	uint8_t* pixels = stbi_load(filepath.c_str(), &result.width, &result.height, &result.stride, STBI_default);
 	if (!pixels)
 	{
 		throw runtime_error("Error: failed to load image!");
@@ -281,4 +686,91 @@ TextureInfo LoadTexture(string filepath)
 	return result;
 }
 
+/**
+* Write RGBA8 pixels to an uncompressed 24-bit BMP file.
+*/
+bool WriteImage(string filepath, int width, int height, const uint8_t* pixels)
+{
+	ofstream file(filepath, ios::binary);
+	if (!file.is_open()) return false;
+
+	const uint32_t rowSize = (width * 3 + 3) / 4 * 4;
+	const uint32_t headerSize = 54;
+	const uint32_t imageSize = rowSize * height;
+
+	uint8_t header[headerSize] = {};
+	auto write16 = [&header](uint32_t offset, uint32_t value) { header[offset] = value & 0xFF; header[offset + 1] = (value >> 8) & 0xFF; };
+	auto write32 = [&write16](uint32_t offset, uint32_t value) { write16(offset, value & 0xFFFF); write16(offset + 2, value >> 16); };
+
+	header[0] = 'B';
+	header[1] = 'M';
+	write32(2, headerSize + imageSize);			// file size
+	write32(10, headerSize);					// pixel data offset
+	write32(14, 40);							// BITMAPINFOHEADER size
+	write32(18, width);
+	write32(22, height);						// positive height, rows are stored bottom up
+	write16(26, 1);								// planes
+	write16(28, 24);							// bits per pixel
+	write32(34, imageSize);
+	file.write(reinterpret_cast<const char*>(header), headerSize);
+
+	vector<uint8_t> row(rowSize, 0);
+	for (int y = height - 1; y >= 0; y--)
+	{
+		const uint8_t* src = pixels + (static_cast<size_t>(y) * width * 4);
+		for (int x = 0; x < width; x++)
+		{
+			row[x * 3 + 0] = src[x * 4 + 2];		// B
+			row[x * 3 + 1] = src[x * 4 + 1];		// G
+			row[x * 3 + 2] = src[x * 4 + 0];		// R
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), rowSize);
+	}
+
+	return file.good();
 }
+
+//--------------------------------------------------------------------------------------
+// Camera
+//--------------------------------------------------------------------------------------
+
+/**
+* Advance the camera orbit and compute the view constants for it.
+* Shared by the D3D12 renderer and the CPU ray tracer, so both see the model from the same poses.
+*/
+void UpdateView(ViewCB &viewCBData, XMFLOAT3 &eyeAngle, int width, int height)
+{
+	const float rotationSpeed = 0.005f;
+	XMMATRIX view, invView;
+	XMFLOAT3 eye, focus, up;
+	float fov;
+
+	eyeAngle.x += rotationSpeed;
+
+#if _DEBUG
+	float x = 2.f * cosf(eyeAngle.x);
+	float y = 0.f;
+	float z = 2.25f + 2.f * sinf(eyeAngle.x);
+
+	focus = XMFLOAT3(0.f, 0.f, 0.f);
+#else
+	float x = 8.f * cosf(eyeAngle.x);
+	float y = 1.5f + 1.5f * cosf(eyeAngle.x);
+	float z = 8.f + 2.25f * sinf(eyeAngle.x);
+	focus = XMFLOAT3(0.f, 1.75f, 0.f);
+#endif
+
+	eye = XMFLOAT3(x, y, z);
+	up = XMFLOAT3(0.f, 1.f, 0.f);
+
+	fov = 65.f * (XM_PI / 180.f);							// convert to radians
+
+	view = XMMatrixLookAtLH(XMLoadFloat3(&eye), XMLoadFloat3(&focus), XMLoadFloat3(&up));
+	invView = XMMatrixInverse(NULL, view);
+
+	viewCBData.view = XMMatrixTranspose(invView);
+	viewCBData.viewOriginAndTanHalfFovY = XMFLOAT4(eye.x, eye.y, eye.z, tanf(fov * 0.5f));
+	viewCBData.resolution = XMFLOAT2((float)width, (float)height);
+}
+
+}
\ No newline at end of file
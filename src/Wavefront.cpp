@@ -0,0 +1,666 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CPU.h"
+#include "Utils.h"
+
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+using namespace std;
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// Wavefront Path Tracing Functions
+//--------------------------------------------------------------------------------------
+
+namespace CPU
+{
+
+static const XMFLOAT3 BackgroundColor = XMFLOAT3(0.2f, 0.2f, 0.2f);	// Miss() in Miss.hlsl
+static const uint32_t ExtendBlockSize = 256;	// rays a thread takes at once when tracing
+static const uint32_t CompactBlockSize = 4096;	// queue entries counted together when compacting
+static const float BounceOffset = 1e-5f;		// of the scene's diagonal, off the surface along the normal
+static const float MaxSurvival = 0.95f;			// chance of a path surviving Russian roulette, however bright
+
+/**
+* Resize the arrays of a queue to hold a number of paths.
+*/
+void Resize_Queue(CPUWavefrontQueue &queue, uint32_t capacity)
+{
+	if (queue.pixel.size() == capacity) return;
+	for (vector<float>* values : { &queue.originX, &queue.originY, &queue.originZ, &queue.directionX, &queue.directionY, &queue.directionZ,
+		&queue.throughputR, &queue.throughputG, &queue.throughputB, &queue.hitT, &queue.hitU, &queue.hitV })
+	{
+		values->resize(capacity);
+	}
+	queue.pixel.resize(capacity);
+	queue.hitTriangle.resize(capacity);
+	queue.flags.resize(capacity);
+}
+
+/**
+* Resize the arrays of a shadow queue to hold a number of rays.
+*/
+void Resize_Queue(CPUShadowQueue &queue, uint32_t capacity)
+{
+	if (queue.pixel.size() == capacity) return;
+	for (vector<float>* values : { &queue.originX, &queue.originY, &queue.originZ, &queue.directionX, &queue.directionY, &queue.directionZ,
+		&queue.tMax, &queue.radianceR, &queue.radianceG, &queue.radianceB })
+	{
+		values->resize(capacity);
+	}
+	queue.pixel.resize(capacity);
+}
+
+/**
+* Hash a path's pixel, sample and bounce to the seed of the bounce's random numbers (PCG hash, Jarzynski and Olano 2020).
+*/
+inline uint32_t Hash_Path(uint32_t pixel, uint32_t sampleIndex, uint32_t depth)
+{
+	uint32_t state = (pixel * 0x9E3779B9u) ^ (sampleIndex * 0x85EBCA6Bu) ^ (depth * 0xC2B2AE35u);
+	state = state * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+	return (word >> 22) ^ word;
+}
+
+/**
+* Get a random number in [0, 1) from the top 24 bits of a hash, and advance the hash.
+*/
+inline float Next_Random(uint32_t &hash)
+{
+	float value = (hash >> 8) * (1.f / 16777216.f);
+	hash = hash * 747796405u + 2891336453u;
+	hash = ((hash >> ((hash >> 28) + 4)) ^ hash) * 277803737u;
+	hash = (hash >> 22) ^ hash;
+	return value;
+}
+
+/**
+* Write the indices of the queue entries whose flag has a value, in order. The entries are counted in blocks in
+* parallel, a prefix sum over the block counts gives each block its first output, and the blocks write in parallel.
+* Returns the number of indices.
+*/
+uint32_t Compact_Indices(const vector<uint8_t> &flags, uint32_t count, uint8_t value, vector<uint32_t> &indices, unsigned threadCount)
+{
+	uint32_t blockCount = (count + CompactBlockSize - 1) / CompactBlockSize;
+	vector<uint32_t> offsets(blockCount);
+	Utils::ParallelFor(blockCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t block = begin; block < end; block++)
+		{
+			uint32_t first = static_cast<uint32_t>(block) * CompactBlockSize;
+			uint32_t last = min(first + CompactBlockSize, count);
+			uint32_t matches = 0;
+			for (uint32_t i = first; i < last; i++) matches += (flags[i] == value) ? 1 : 0;
+			offsets[block] = matches;
+		}
+	});
+
+	uint32_t total = 0;
+	for (uint32_t &offset : offsets)
+	{
+		uint32_t matches = offset;
+		offset = total;
+		total += matches;
+	}
+
+	Utils::ParallelFor(blockCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t block = begin; block < end; block++)
+		{
+			uint32_t first = static_cast<uint32_t>(block) * CompactBlockSize;
+			uint32_t last = min(first + CompactBlockSize, count);
+			uint32_t output = offsets[block];
+			for (uint32_t i = first; i < last; i++)
+			{
+				if (flags[i] == value) indices[output++] = i;
+			}
+		}
+	});
+	return total;
+}
+
+/**
+* Generate stage: the camera rays of one sample of a range of pixels, with a throughput of one.
+* tMin and tMax get the interval of the camera rays, which is the same for all of them.
+*/
+void Generate(const ViewCB &view, const XMMATRIX &invView, uint32_t samplesPerPixel, uint32_t sampleIndex, uint32_t firstPixel, uint32_t pixelCount, CPUWavefrontQueue &queue, float &tMin, float &tMax, unsigned threadCount)
+{
+	int width = static_cast<int>(view.resolution.x);
+	Utils::ParallelFor(pixelCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t pixel = firstPixel + static_cast<uint32_t>(i);
+			int x = static_cast<int>(pixel % width);
+			int y = static_cast<int>(pixel / width);
+
+			// A single sample goes through the pixel center, like CPU::Render
+			XMFLOAT2 subpixel = (samplesPerPixel > 1) ? Get_Subpixel(x, y, sampleIndex) : XMFLOAT2(0.5f, 0.5f);
+			CPURay ray = Get_Primary_Ray(view, invView, x, y, subpixel.x, subpixel.y);
+
+			queue.originX[i] = ray.origin.x;
+			queue.originY[i] = ray.origin.y;
+			queue.originZ[i] = ray.origin.z;
+			queue.directionX[i] = ray.direction.x;
+			queue.directionY[i] = ray.direction.y;
+			queue.directionZ[i] = ray.direction.z;
+			queue.throughputR[i] = 1.f;
+			queue.throughputG[i] = 1.f;
+			queue.throughputB[i] = 1.f;
+			queue.pixel[i] = pixel;
+		}
+	});
+	queue.count = pixelCount;
+
+	CPURay ray = Get_Primary_Ray(view, invView, 0, 0, 0.5f, 0.5f);
+	tMin = ray.tMin;
+	tMax = ray.tMax;
+}
+
+/**
+* Extend stage: trace every ray of the queue to its closest hit. Threads take blocks of rays, since rays that hit the
+* model cost much more than rays that miss. Sets an entry's flag if its ray hit.
+*/
+void Extend(const CPUScene &scene, CPUWavefrontQueue &queue, float tMin, float tMax, unsigned threadCount)
+{
+	uint32_t blockCount = (queue.count + ExtendBlockSize - 1) / ExtendBlockSize;
+	Utils::ParallelForWorkStealing(blockCount, threadCount, [&](size_t block)
+	{
+		uint32_t first = static_cast<uint32_t>(block) * ExtendBlockSize;
+		uint32_t last = min(first + ExtendBlockSize, queue.count);
+		for (uint32_t i = first; i < last; i++)
+		{
+			CPURay ray;
+			ray.origin = XMFLOAT3(queue.originX[i], queue.originY[i], queue.originZ[i]);
+			ray.direction = XMFLOAT3(queue.directionX[i], queue.directionY[i], queue.directionZ[i]);
+			ray.tMin = tMin;
+			ray.tMax = tMax;
+
+			CPUHit hit;
+			bool hitFound = scene.bvh8.nodes.empty() ? BVH::Intersect(scene.bvh, *scene.model, ray, hit) : BVH::Intersect(scene.bvh8, *scene.model, ray, hit);
+			queue.hitT[i] = hit.t;
+			queue.hitU[i] = hit.uv.x;
+			queue.hitV[i] = hit.uv.y;
+			queue.hitTriangle[i] = hit.triangleIndex;
+			queue.flags[i] = hitFound ? 1 : 0;
+		}
+	});
+}
+
+/**
+* Shade miss stage: paths that missed add their throughput times the background for camera rays, which mirrors
+* Miss(), or times the sky for bounces. The paths end.
+*/
+void Shade_Miss(const CPUWavefront &wavefront, CPUWavefrontQueue &queue, const vector<uint32_t> &indices, uint32_t count, uint32_t depth, vector<XMFLOAT3> &radiance, unsigned threadCount)
+{
+	XMFLOAT3 light = (depth == 0) ? BackgroundColor : wavefront.skyColor;
+	Utils::ParallelFor(count, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t j = begin; j < end; j++)
+		{
+			uint32_t i = indices[j];
+			XMFLOAT3 &pixel = radiance[queue.pixel[i]];
+			pixel.x += queue.throughputR[i] * light.x;
+			pixel.y += queue.throughputG[i] * light.y;
+			pixel.z += queue.throughputB[i] * light.z;
+			queue.flags[i] = 0;
+		}
+	});
+}
+
+/**
+* Get an orthonormal basis about a unit vector (Duff et al. 2017).
+*/
+inline void Get_Basis(const XMFLOAT3 &n, XMFLOAT3 &tangent, XMFLOAT3 &bitangent)
+{
+	float sign = copysignf(1.f, n.z);
+	float a = -1.f / (sign + n.z);
+	float b = n.x * n.y * a;
+	tangent = XMFLOAT3(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	bitangent = XMFLOAT3(b, sign + n.y * n.y * a, -n.y);
+}
+
+/**
+* Sample the light arriving at a point from one light. Directional lights are sampled uniformly over the cone of
+* directions they cover, and point lights over a disk of their radius facing the point. Gives the unit direction and
+* distance to the light, and the irradiance it gives a surface facing it.
+*/
+void Sample_Light(const CPULight &light, const XMFLOAT3 &point, float u1, float u2, XMFLOAT3 &direction, float &distance, XMFLOAT3 &irradiance)
+{
+	if (light.type == CPU_LIGHT_DIRECTIONAL)
+	{
+		XMFLOAT3 axis;
+		XMStoreFloat3(&axis, XMVector3Normalize(XMVectorNegate(XMLoadFloat3(&light.direction))));
+		float cosMax = cosf(light.radius);
+		float cosTheta = 1.f - u1 * (1.f - cosMax);
+		float sinTheta = sqrtf(max(1.f - cosTheta * cosTheta, 0.f));
+		float x = sinTheta * cosf(XM_2PI * u2);
+		float y = sinTheta * sinf(XM_2PI * u2);
+
+		XMFLOAT3 tangent, bitangent;
+		Get_Basis(axis, tangent, bitangent);
+		direction = XMFLOAT3(tangent.x * x + bitangent.x * y + axis.x * cosTheta, tangent.y * x + bitangent.y * y + axis.y * cosTheta, tangent.z * x + bitangent.z * y + axis.z * cosTheta);
+		distance = FLT_MAX;
+		irradiance = light.color;
+		return;
+	}
+
+	XMVECTOR toCenter = XMVectorSubtract(XMLoadFloat3(&light.position), XMLoadFloat3(&point));
+	XMVECTOR target = XMLoadFloat3(&light.position);
+	if (light.radius > 0.f)
+	{
+		XMFLOAT3 axis, tangent, bitangent;
+		XMStoreFloat3(&axis, XMVector3Normalize(toCenter));
+		Get_Basis(axis, tangent, bitangent);
+		float r = light.radius * sqrtf(u1);
+		float x = r * cosf(XM_2PI * u2);
+		float y = r * sinf(XM_2PI * u2);
+		target = XMVectorAdd(target, XMVectorAdd(XMVectorScale(XMLoadFloat3(&tangent), x), XMVectorScale(XMLoadFloat3(&bitangent), y)));
+	}
+
+	XMVECTOR toLight = XMVectorSubtract(target, XMLoadFloat3(&point));
+	distance = max(XMVectorGetX(XMVector3Length(toLight)), 1e-6f);
+	XMStoreFloat3(&direction, XMVectorScale(toLight, 1.f / distance));
+	float falloff = 1.f / (distance * distance);
+	irradiance = XMFLOAT3(light.color.x * falloff, light.color.y * falloff, light.color.z * falloff);
+}
+
+/**
+* Shade hit stage: paths that hit multiply their throughput by the albedo, read like ClosestHit() does.
+* With lights, one light picked at random is sampled for the direct lighting of the Lambertian surface, and its shadow
+* ray is written to the shadow queue at the same position as the hit in the hit queue.
+* Before the last bounce the path continues in a cosine distributed direction about the geometric normal, on the side
+* the ray came from, written over the entry's ray. After rouletteDepth bounces, Russian roulette ends dim paths, and
+* brightens the survivors by the inverse of their chance to survive. At the last bounce the path ends, lit by the sky if
+* skyAtLastBounce is set, so without bounces or lights the image is the albedo, like CPU::Render.
+*/
+void Shade_Hit(const CPUScene &scene, const CPUWavefront &wavefront, CPUWavefrontQueue &queue, const vector<uint32_t> &indices, uint32_t count, uint32_t sampleIndex, uint32_t depth, float offset, CPUShadowQueue &shadows, vector<XMFLOAT3> &radiance, unsigned threadCount)
+{
+	const Model &model = *scene.model;
+	bool last = (depth >= wavefront.maxBounces);
+	uint32_t lightCount = static_cast<uint32_t>(wavefront.lights.size());
+	Utils::ParallelFor(count, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t j = begin; j < end; j++)
+		{
+			uint32_t i = indices[j];
+			uint32_t baseIndex = queue.hitTriangle[i] * 3;
+			const Vertex &v0 = model.vertices[model.indices[baseIndex + 0]];
+			const Vertex &v1 = model.vertices[model.indices[baseIndex + 1]];
+			const Vertex &v2 = model.vertices[model.indices[baseIndex + 2]];
+
+			// Interpolated in the same order as Get_Vertex_Attributes, for the same texel
+			float barycentrics[3] = { (1.f - queue.hitU[i] - queue.hitV[i]), queue.hitU[i], queue.hitV[i] };
+			float u = 0.f, v = 0.f;
+			u += v0.uv.x * barycentrics[0];
+			v += v0.uv.y * barycentrics[0];
+			u += v1.uv.x * barycentrics[1];
+			v += v1.uv.y * barycentrics[1];
+			u += v2.uv.x * barycentrics[2];
+			v += v2.uv.y * barycentrics[2];
+			int coordX = static_cast<int>(floorf(u * scene.material.resolution.x));
+			int coordY = static_cast<int>(floorf(v * scene.material.resolution.x));
+			XMFLOAT4 albedo = Load_Texel(*scene.texture, coordX, coordY);
+
+			queue.throughputR[i] *= albedo.x;
+			queue.throughputG[i] *= albedo.y;
+			queue.throughputB[i] *= albedo.z;
+			shadows.tMax[j] = 0.f;
+			if (last && wavefront.skyAtLastBounce)
+			{
+				XMFLOAT3 &pixel = radiance[queue.pixel[i]];
+				pixel.x += queue.throughputR[i] * wavefront.skyColor.x;
+				pixel.y += queue.throughputG[i] * wavefront.skyColor.y;
+				pixel.z += queue.throughputB[i] * wavefront.skyColor.z;
+			}
+			if (last && lightCount == 0)
+			{
+				queue.flags[i] = 0;
+				continue;
+			}
+
+			// Geometric normal, facing the ray
+			XMVECTOR p0 = XMLoadFloat3(&v0.position);
+			XMVECTOR normal = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&v1.position), p0), XMVectorSubtract(XMLoadFloat3(&v2.position), p0)));
+			XMVECTOR direction = XMVectorSet(queue.directionX[i], queue.directionY[i], queue.directionZ[i], 0.f);
+			if (XMVectorGetX(XMVector3Dot(normal, direction)) > 0.f) normal = XMVectorNegate(normal);
+
+			XMFLOAT3 n;
+			XMStoreFloat3(&n, normal);
+			float t = queue.hitT[i];
+			XMFLOAT3 point(
+				queue.originX[i] + queue.directionX[i] * t + n.x * offset,
+				queue.originY[i] + queue.directionY[i] * t + n.y * offset,
+				queue.originZ[i] + queue.directionZ[i] * t + n.z * offset);
+			uint32_t hash = Hash_Path(queue.pixel[i], sampleIndex, depth);
+
+			// Direct light from one light, weighted by the number of lights: throughput * albedo / pi * E * cos
+			if (lightCount > 0)
+			{
+				uint32_t lightIndex = min(static_cast<uint32_t>(Next_Random(hash) * lightCount), lightCount - 1);
+				float u1 = Next_Random(hash);
+				float u2 = Next_Random(hash);
+				XMFLOAT3 toLight, irradiance;
+				float distance;
+				Sample_Light(wavefront.lights[lightIndex], point, u1, u2, toLight, distance, irradiance);
+
+				float cosine = n.x * toLight.x + n.y * toLight.y + n.z * toLight.z;
+				if (cosine > 0.f)
+				{
+					float weight = cosine * lightCount * XM_1DIVPI;
+					shadows.originX[j] = point.x;
+					shadows.originY[j] = point.y;
+					shadows.originZ[j] = point.z;
+					shadows.directionX[j] = toLight.x;
+					shadows.directionY[j] = toLight.y;
+					shadows.directionZ[j] = toLight.z;
+					shadows.tMax[j] = distance;
+					shadows.radianceR[j] = queue.throughputR[i] * irradiance.x * weight;
+					shadows.radianceG[j] = queue.throughputG[i] * irradiance.y * weight;
+					shadows.radianceB[j] = queue.throughputB[i] * irradiance.z * weight;
+					shadows.pixel[j] = queue.pixel[i];
+				}
+			}
+
+			if (last)
+			{
+				queue.flags[i] = 0;
+				continue;
+			}
+
+			// Russian roulette, by the brightest channel of the throughput
+			if (depth >= wavefront.rouletteDepth)
+			{
+				float survival = min(max(queue.throughputR[i], max(queue.throughputG[i], queue.throughputB[i])), MaxSurvival);
+				if (!(Next_Random(hash) < survival))
+				{
+					queue.flags[i] = 0;
+					continue;
+				}
+				queue.throughputR[i] /= survival;
+				queue.throughputG[i] /= survival;
+				queue.throughputB[i] /= survival;
+			}
+
+			// Cosine distributed direction (Malley's method)
+			XMFLOAT3 tangent, bitangent;
+			Get_Basis(n, tangent, bitangent);
+			float u1 = Next_Random(hash);
+			float u2 = Next_Random(hash);
+			float radius = sqrtf(u1);
+			float x = radius * cosf(XM_2PI * u2);
+			float y = radius * sinf(XM_2PI * u2);
+			float z = sqrtf(max(1.f - u1, 0.f));
+
+			queue.originX[i] = point.x;
+			queue.originY[i] = point.y;
+			queue.originZ[i] = point.z;
+			queue.directionX[i] = tangent.x * x + bitangent.x * y + n.x * z;
+			queue.directionY[i] = tangent.y * x + bitangent.y * y + n.y * z;
+			queue.directionZ[i] = tangent.z * x + bitangent.z * y + n.z * z;
+			queue.flags[i] = 1;
+		}
+	});
+	shadows.count = count;
+}
+
+/**
+* Shadow stage: trace the shadow rays of the hits with any hit traversal, which stops at the first occluder, and add
+* the light of those that reach their light. Returns the number of rays traced.
+*/
+uint64_t Trace_Shadows(const CPUScene &scene, const CPUShadowQueue &shadows, vector<XMFLOAT3> &radiance, unsigned threadCount)
+{
+	atomic<uint64_t> traced(0);
+	uint32_t blockCount = (shadows.count + ExtendBlockSize - 1) / ExtendBlockSize;
+	Utils::ParallelForWorkStealing(blockCount, threadCount, [&](size_t block)
+	{
+		uint32_t first = static_cast<uint32_t>(block) * ExtendBlockSize;
+		uint32_t last = min(first + ExtendBlockSize, shadows.count);
+		uint64_t rays = 0;
+		for (uint32_t j = first; j < last; j++)
+		{
+			if (!(shadows.tMax[j] > 0.f)) continue;
+
+			CPURay ray;
+			ray.origin = XMFLOAT3(shadows.originX[j], shadows.originY[j], shadows.originZ[j]);
+			ray.direction = XMFLOAT3(shadows.directionX[j], shadows.directionY[j], shadows.directionZ[j]);
+			ray.tMin = 0.f;
+			ray.tMax = shadows.tMax[j];
+			rays++;
+
+			bool occluded = scene.bvh8.nodes.empty() ? BVH::Occluded(scene.bvh, *scene.model, ray) : BVH::Occluded(scene.bvh8, *scene.model, ray);
+			if (occluded) continue;
+
+			// Hits of one wave belong to different pixels
+			XMFLOAT3 &pixel = radiance[shadows.pixel[j]];
+			pixel.x += shadows.radianceR[j];
+			pixel.y += shadows.radianceG[j];
+			pixel.z += shadows.radianceB[j];
+		}
+		traced += rays;
+	});
+	return traced;
+}
+
+/**
+* Keep the paths that continue within a bounce's ray budget: when more paths continue than the budget allows, each is
+* kept with the chance budget / paths, and brightened by its inverse, so the image stays unbiased.
+*/
+void Apply_Budget(CPUWavefrontQueue &queue, const vector<uint32_t> &indices, uint32_t count, float budget, uint32_t sampleIndex, uint32_t depth, unsigned threadCount)
+{
+	float keep = budget / count;
+	Utils::ParallelFor(count, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t j = begin; j < end; j++)
+		{
+			uint32_t i = indices[j];
+
+			// Random numbers apart from those of the bounce
+			uint32_t hash = Hash_Path(queue.pixel[i], sampleIndex, ~depth);
+			if (Next_Random(hash) < keep)
+			{
+				queue.throughputR[i] /= keep;
+				queue.throughputG[i] /= keep;
+				queue.throughputB[i] /= keep;
+			}
+			else queue.flags[i] = 0;
+		}
+	});
+}
+
+/**
+* Compact stage: copy the paths that continue, in order, into the next queue.
+*/
+void Compact(const CPUWavefrontQueue &queue, const vector<uint32_t> &indices, uint32_t count, CPUWavefrontQueue &next, unsigned threadCount)
+{
+	Utils::ParallelFor(count, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t j = begin; j < end; j++)
+		{
+			uint32_t i = indices[j];
+			next.originX[j] = queue.originX[i];
+			next.originY[j] = queue.originY[i];
+			next.originZ[j] = queue.originZ[i];
+			next.directionX[j] = queue.directionX[i];
+			next.directionY[j] = queue.directionY[i];
+			next.directionZ[j] = queue.directionZ[i];
+			next.throughputR[j] = queue.throughputR[i];
+			next.throughputG[j] = queue.throughputG[i];
+			next.throughputB[j] = queue.throughputB[i];
+			next.pixel[j] = queue.pixel[i];
+		}
+	});
+	next.count = count;
+}
+
+/**
+* Render the scene into an RGBA8 image with diffuse path tracing, in waves of paths kept in structure of arrays queues.
+* Instead of one thread following a path through all its bounces, each stage runs over the whole queue before the next:
+* generate camera rays, extend them to their closest hits, shade the misses, shade the hits, trace their shadow rays,
+* and compact the paths that bounce into the next queue, until no path is left. A wave holds one sample of up to
+* maxPaths pixels, so no two paths in flight add to the same pixel. The time and queue entries of each stage, the rays
+* and time of each bounce, and the samples per second are kept in the wavefront.
+*/
+void Render_Wavefront(const CPUScene &scene, const ViewCB &view, CPUWavefront &wavefront, CPUImage &image, unsigned threadCount)
+{
+	image.width = static_cast<int>(view.resolution.x);
+	image.height = static_cast<int>(view.resolution.y);
+	image.pixels.resize(static_cast<size_t>(image.width) * image.height * 4);
+
+	uint32_t pixelCount = static_cast<uint32_t>(image.width) * image.height;
+	uint32_t capacity = max(min(wavefront.maxPaths, pixelCount), 1u);
+	Resize_Queue(wavefront.queues[0], capacity);
+	Resize_Queue(wavefront.queues[1], capacity);
+	Resize_Queue(wavefront.shadows, capacity);
+	wavefront.hitIndices.resize(capacity);
+	wavefront.missIndices.resize(capacity);
+	wavefront.radiance.assign(pixelCount, XMFLOAT3(0.f, 0.f, 0.f));
+
+	for (int stage = 0; stage < CPU_WAVEFRONT_STAGE_COUNT; stage++)
+	{
+		wavefront.stageMs[stage] = 0.0;
+		wavefront.stageItems[stage] = 0;
+	}
+	wavefront.bounceRays.assign(wavefront.maxBounces + 1, 0);
+	wavefront.bounceShadowRays.assign(wavefront.maxBounces + 1, 0);
+	wavefront.bounceMs.assign(wavefront.maxBounces + 1, 0.0);
+	wavefront.rays = 0;
+	wavefront.waves = 0;
+	auto renderStart = chrono::high_resolution_clock::now();
+
+	float offset = 0.f;
+	if (!scene.bvh.nodes.empty())
+	{
+		const BVHNode &root = scene.bvh.nodes[0];
+		offset = BounceOffset * XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&root.boundsMax), XMLoadFloat3(&root.boundsMin))));
+	}
+
+	uint32_t depth = 0;
+	auto time_stage = [&](CPUWavefrontStage stage, uint32_t items, const function<void()> &body)
+	{
+		auto start = chrono::high_resolution_clock::now();
+		body();
+		double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		wavefront.stageMs[stage] += ms;
+		wavefront.stageItems[stage] += items;
+		wavefront.bounceMs[depth] += ms;
+	};
+
+	XMMATRIX invView = XMMatrixTranspose(view.view);
+	uint32_t samplesPerPixel = max(wavefront.samplesPerPixel, 1u);
+	for (uint32_t sampleIndex = 0; sampleIndex < samplesPerPixel; sampleIndex++)
+	{
+		for (uint32_t firstPixel = 0; firstPixel < pixelCount; firstPixel += capacity)
+		{
+			uint32_t current = 0;
+			uint32_t pixels = min(capacity, pixelCount - firstPixel);
+			float tMin = 0.f, tMax = 0.f;
+			depth = 0;
+			time_stage(CPU_WAVEFRONT_STAGE_GENERATE, pixels, [&]()
+			{
+				Generate(view, invView, samplesPerPixel, sampleIndex, firstPixel, pixels, wavefront.queues[current], tMin, tMax, threadCount);
+			});
+
+			for (; wavefront.queues[current].count > 0; depth++)
+			{
+				CPUWavefrontQueue &queue = wavefront.queues[current];
+				CPUWavefrontQueue &next = wavefront.queues[current ^ 1];
+				uint32_t count = queue.count;
+				time_stage(CPU_WAVEFRONT_STAGE_EXTEND, count, [&]() { Extend(scene, queue, tMin, tMax, threadCount); });
+				wavefront.bounceRays[depth] += count;
+				wavefront.rays += count;
+
+				uint32_t hits = 0, misses = 0;
+				time_stage(CPU_WAVEFRONT_STAGE_COMPACT, count, [&]()
+				{
+					hits = Compact_Indices(queue.flags, count, 1, wavefront.hitIndices, threadCount);
+					misses = Compact_Indices(queue.flags, count, 0, wavefront.missIndices, threadCount);
+				});
+				time_stage(CPU_WAVEFRONT_STAGE_SHADE_MISS, misses, [&]()
+				{
+					Shade_Miss(wavefront, queue, wavefront.missIndices, misses, depth, wavefront.radiance, threadCount);
+				});
+				time_stage(CPU_WAVEFRONT_STAGE_SHADE_HIT, hits, [&]()
+				{
+					Shade_Hit(scene, wavefront, queue, wavefront.hitIndices, hits, sampleIndex, depth, offset, wavefront.shadows, wavefront.radiance, threadCount);
+				});
+				if (!wavefront.lights.empty())
+				{
+					uint64_t shadowRays = 0;
+					time_stage(CPU_WAVEFRONT_STAGE_SHADOW, hits, [&]() { shadowRays = Trace_Shadows(scene, wavefront.shadows, wavefront.radiance, threadCount); });
+					wavefront.bounceShadowRays[depth] += shadowRays;
+					wavefront.rays += shadowRays;
+				}
+
+				// The hit indices are done with, and hold the paths that continue
+				time_stage(CPU_WAVEFRONT_STAGE_COMPACT, hits, [&]()
+				{
+					uint32_t survivors = Compact_Indices(queue.flags, count, 1, wavefront.hitIndices, threadCount);
+					float budget = (depth < wavefront.bounceBudgets.size()) ? wavefront.bounceBudgets[depth] * pixels : FLT_MAX;
+					if (survivors > budget)
+					{
+						Apply_Budget(queue, wavefront.hitIndices, survivors, budget, sampleIndex, depth, threadCount);
+						survivors = Compact_Indices(queue.flags, count, 1, wavefront.hitIndices, threadCount);
+					}
+					Compact(queue, wavefront.hitIndices, survivors, next, threadCount);
+				});
+				queue.count = 0;
+				current ^= 1;
+
+				// Bounce rays start on the surface
+				tMin = 0.f;
+				tMax = FLT_MAX;
+			}
+			wavefront.waves++;
+		}
+	}
+
+	float weight = 1.f / samplesPerPixel;
+	Utils::ParallelFor(pixelCount, threadCount, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const XMFLOAT3 &sum = wavefront.radiance[i];
+			uint8_t* pixel = &image.pixels[i * 4];
+			pixel[0] = To_UNORM8(sum.x * weight);
+			pixel[1] = To_UNORM8(sum.y * weight);
+			pixel[2] = To_UNORM8(sum.z * weight);
+			pixel[3] = 255;
+		}
+	});
+
+	wavefront.samples = static_cast<uint64_t>(pixelCount) * samplesPerPixel;
+	wavefront.renderMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - renderStart).count();
+	wavefront.samplesPerSecond = wavefront.samples / (max(wavefront.renderMs, 1e-6) * 1e-3);
+}
+
+}
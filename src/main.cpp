@@ -27,8 +27,14 @@
 
 #include "Window.h"
 #include "Graphics.h"
+#include "Headless.h"
 #include "Utils.h"
 
+#include <shellapi.h>
+
+#include <string>
+#include <vector>
+
 #ifdef _DEBUG
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
@@ -45,7 +51,7 @@ public:
 	void Init(ConfigInfo &config) 
 	{		
 		// Create a new window
-		HRESULT hr = Window::Create(config.width, config.height, config.instance, window, L"Introduction to DirectX Raytracing (DXR)");
+		HRESULT hr = Window::Create(config.width, config.height, instance, window, L"Introduction to DirectX Raytracing (DXR)");
 		Utils::Validate(hr, L"Error: failed to create window!");
 
 		d3d.width = config.width;
@@ -55,8 +61,13 @@ public:
 		// Load a model
 		Utils::LoadModel(config.model, model, material);
 
-		// Initialize the shader compiler
+#if !PRECOMPILED_SHADERS
+		// Initialize the shader compiler, and watch the shaders for hot reloading
 		D3DShaders::Init_Shader_Compiler(shaderCompiler);
+		shaderCompiler.collectStats = !config.shaderStats.empty();
+		shaderStats = config.shaderStats;
+		D3DShaders::Watch_Shader_Directory(shaderCompiler, L"shaders");
+#endif
 
 		// Initialize D3D12
 		D3D12::Create_Device(d3d);
@@ -81,9 +92,11 @@ public:
 		DXR::Create_Top_Level_AS(d3d, dxr, resources);
 		DXR::Create_DXR_Output(d3d, resources);
 		DXR::Create_Descriptor_Heaps(d3d, dxr, resources, model);	
-		DXR::Create_RayGen_Program(d3d, dxr, shaderCompiler);
-		DXR::Create_Miss_Program(d3d, dxr, shaderCompiler);
-		DXR::Create_Closest_Hit_Program(d3d, dxr, shaderCompiler);
+		DXR::Create_RayGen_Program(d3d, dxr);
+		DXR::Create_Miss_Program(d3d, dxr);
+		DXR::Create_Closest_Hit_Program(d3d, dxr);
+		if (config.combinedLibrary) DXR::Create_Library_Program(d3d, dxr);
+		DXR::Compile_Programs(dxr, shaderCompiler);
 		DXR::Create_Pipeline_State_Object(d3d, dxr);
 		DXR::Create_Shader_Table(d3d, dxr, resources);
 
@@ -93,10 +106,34 @@ public:
 
 		D3D12::WaitForGPU(d3d);
 		D3D12::Reset_CommandList(d3d);
+
+#if !PRECOMPILED_SHADERS
+		// Closest hit shader features are compiled on demand
+		hitFeatures = config.hitFeatures;
+		D3DShaders::Init_Permutations(shaderCompiler, hitPermutations, Get_Hit_Program().info, { L"TEXTURE_BILINEAR", L"DEBUG_BARYCENTRICS", L"DEBUG_UV" });
+#else
+		// Permutations are compiled with DXC, which precompiled builds don't load
+		if (config.hitFeatures != 0)
+		{
+			const char* msg = "Warning: -hitfeatures is ignored, the shaders were precompiled without closest hit features\n";
+			OutputDebugStringA(msg);
+		}
+#endif
 	}
 	
 	void Update() 
 	{
+		if (D3DShaders::Shader_Files_Changed(shaderCompiler))
+		{
+			D3DShaders::Evict_Stale_Permutations(hitPermutations);
+			DXR::Reload_Programs(d3d, dxr, shaderCompiler);
+		}
+
+		if (hitFeatures != 0 && D3DShaders::Get_Permutation(hitPermutations, hitFeatures, Get_Hit_Program()))
+		{
+			DXR::Rebuild_Pipeline_State_Object(d3d, dxr);
+		}
+
 		D3DResources::Update_View_CB(d3d, resources);
 	}
 
@@ -113,6 +150,9 @@ public:
 		D3D12::WaitForGPU(d3d);
 		CloseHandle(d3d.fenceEvent);
 
+		D3DShaders::Destroy(hitPermutations);
+		if (shaderCompiler.collectStats) D3DShaders::Write_Compile_Stats(shaderCompiler, shaderStats);
+
 		DXR::Destroy(dxr);
 		D3DResources::Destroy(resources);		
 		D3DShaders::Destroy(shaderCompiler);
@@ -122,6 +162,15 @@ public:
 	}
 	
 private:
+	/**
+	 * Get the program that contains the closest hit shader.
+	 */
+	RtProgram& Get_Hit_Program()
+	{
+		return dxr.combinedLibrary ? dxr.lib : dxr.hit.chs;
+	}
+
+	HINSTANCE instance = NULL;
 	HWND window;
 	Model model;
 	Material material;
@@ -130,8 +179,50 @@ private:
 	D3D12Global d3d = {};
 	D3D12Resources resources = {};
 	D3D12ShaderCompilerInfo shaderCompiler;
+	D3D12ShaderPermutations hitPermutations;
+	uint32_t hitFeatures = 0;
+	std::string shaderStats;
 };
 
+/**
+ * Print to the console that launched the application, when running without a window.
+ */
+void Attach_Console()
+{
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		FILE* console = nullptr;
+		freopen_s(&console, "CONOUT$", "w", stdout);
+	}
+}
+
+/**
+ * Parse the command line, converted to UTF-8 like the arguments of a console program.
+ */
+bool Parse_Command_Line(ConfigInfo &config)
+{
+	int argc = 0;
+	LPWSTR* wideArgs = CommandLineToArgvW(GetCommandLine(), &argc);
+	if (wideArgs == NULL)
+	{
+		MessageBox(NULL, L"Unable to parse command line!", L"Error", MB_OK);
+		return false;
+	}
+
+	std::vector<std::string> args(argc);
+	std::vector<char*> argv(argc);
+	for (int i = 0; i < argc; i++)
+	{
+		int size = WideCharToMultiByte(CP_UTF8, 0, wideArgs[i], -1, NULL, 0, NULL, NULL);		// with the terminator
+		args[i].resize(size > 0 ? size : 1, '\0');
+		WideCharToMultiByte(CP_UTF8, 0, wideArgs[i], -1, &args[i][0], size, NULL, NULL);
+		argv[i] = &args[i][0];
+	}
+	LocalFree(wideArgs);
+
+	return Utils::ParseCommandLine(argc, argv.data(), config);
+}
+
 /**
  * Program entry point.
  */
@@ -146,8 +237,14 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
 
 		// Get the application configuration
 		ConfigInfo config;
-		hr = Utils::ParseCommandLine(lpCmdLine, config);
-		if (hr != EXIT_SUCCESS) return hr;
+		if (!Parse_Command_Line(config)) return E_FAIL;
+
+		// Headless CPU rendering, benchmarks and regression tests
+		if (Headless::Is_Requested(config))
+		{
+			Attach_Console();
+			return Headless::Run(config);
+		}
 
 		// Initialize
 		DXRApplication app;
@@ -0,0 +1,167 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ShaderDependencies.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+using namespace std;
+
+static int failures = 0;
+
+/**
+* Report a failed check, and keep going so one run lists every failure.
+*/
+static void Check(bool condition, const char* message)
+{
+	if (condition) return;
+	printf("FAILED: %s\n", message);
+	failures++;
+}
+
+/**
+* Write a test shader file, replacing its contents.
+*/
+static void Write_File(const filesystem::path &path, const string &contents)
+{
+	ofstream file(path, ios::binary | ios::trunc);
+	file << contents;
+}
+
+int main()
+{
+	filesystem::path directory = filesystem::temp_directory_path() / "ShaderDependenciesTest";
+	filesystem::remove_all(directory);
+	filesystem::create_directories(directory);
+
+	const filesystem::path shaderPath = directory / "Shader.hlsl";
+	const filesystem::path commonPath = directory / "Common.hlsl";
+	const filesystem::path otherPath = directory / "Other.hlsl";
+	const wstring shader = shaderPath.wstring();
+	const wstring common = commonPath.wstring();
+	const wstring other = otherPath.wstring();
+	Write_File(shaderPath, "#include \"Common.hlsl\"\n");
+	Write_File(commonPath, "float4 Color() { return 1; }\n");
+	Write_File(otherPath, "#include \"Common.hlsl\"\n");
+
+	// The source cache loads a file once, and compiles in a batch share it
+	ShaderSourceCache cache;
+	const ShaderSourceFile* file = ShaderDependencies::Load_Source(cache, common);
+	Check(file != nullptr, "Load_Source reads an existing file");
+	Check(file && file->contents == "float4 Color() { return 1; }\n", "Load_Source returns the file contents");
+	Check(ShaderDependencies::Load_Source(cache, common) == file, "Load_Source returns the cached file");
+	Check(ShaderDependencies::Load_Source(cache, (directory / "Missing.hlsl").wstring()) == nullptr, "Load_Source fails on a missing file");
+
+	// A compile lists each file once, with the hash it was compiled with
+	vector<ShaderDependency> dependencies;
+	ShaderDependencies::Add(dependencies, shader, ShaderDependencies::Load_Source(cache, shader)->hash);
+	ShaderDependencies::Add(dependencies, common, file->hash);
+	ShaderDependencies::Add(dependencies, common, file->hash);
+	Check(dependencies.size() == 2, "Add lists each file once");
+	Check(!ShaderDependencies::Is_Stale(dependencies), "unchanged files are not stale");
+	Check(ShaderDependencies::Is_Stale(vector<ShaderDependency>()), "a blob with no dependencies is stale");
+
+	// Keys tell permutations apart
+	Check(ShaderDependencies::Get_Key(shader, L"Main", {}) != ShaderDependencies::Get_Key(shader, L"Main", { L"FEATURE=1" }), "defines are part of the key");
+	Check(ShaderDependencies::Get_Key(shader, L"Main", {}) != ShaderDependencies::Get_Key(shader, L"Other", {}), "entry points are part of the key");
+	Check(ShaderDependencies::Get_Key(shader, L"Main", { L"A=1" }) == ShaderDependencies::Get_Key(shader, L"Main", { L"A=1" }), "keys are stable");
+
+	// Shaders are stale until a blob is installed and recorded
+	ShaderDependencyGraph graph;
+	const wstring shaderKey = ShaderDependencies::Get_Key(shader, L"Main", {});
+	const wstring otherKey = ShaderDependencies::Get_Key(other, L"Main", {});
+	Check(ShaderDependencies::Is_Stale(graph, shaderKey), "a shader with no installed blob is stale");
+	ShaderDependencies::Record(graph, shaderKey, dependencies);
+	Check(!ShaderDependencies::Is_Stale(graph, shaderKey), "a recorded shader is up to date");
+
+	vector<ShaderDependency> otherDependencies;
+	ShaderDependencies::Add(otherDependencies, other, ShaderDependencies::Load_Source(cache, other)->hash);
+	ShaderDependencies::Add(otherDependencies, common, file->hash);
+	ShaderDependencies::Record(graph, otherKey, otherDependencies);
+
+	// Changing an include makes every shader that includes it stale, and changing it back makes them current again
+	Write_File(commonPath, "float4 Color() { return 0.5; }\n");
+	Check(ShaderDependencies::Is_Stale(graph, shaderKey), "a changed include makes the shader stale");
+	Check(ShaderDependencies::Is_Stale(graph, otherKey), "a changed include makes every shader that includes it stale");
+
+	// Recompiling one shader against the new include must not make the other look current: hashes are per shader
+	ShaderSourceCache reloadCache;
+	vector<ShaderDependency> reloaded;
+	ShaderDependencies::Add(reloaded, shader, ShaderDependencies::Load_Source(reloadCache, shader)->hash);
+	ShaderDependencies::Add(reloaded, common, ShaderDependencies::Load_Source(reloadCache, common)->hash);
+	ShaderDependencies::Record(graph, shaderKey, reloaded);
+	Check(!ShaderDependencies::Is_Stale(graph, shaderKey), "the recompiled shader is up to date");
+	Check(ShaderDependencies::Is_Stale(graph, otherKey), "a shader that was not recompiled stays stale");
+
+	// A compile whose blob is discarded is not recorded, so the shader stays stale
+	Write_File(commonPath, "float4 Color() { return 0.25; }\n");
+	ShaderSourceCache discardedCache;
+	vector<ShaderDependency> discarded;
+	ShaderDependencies::Add(discarded, common, ShaderDependencies::Load_Source(discardedCache, common)->hash);
+	Check(!ShaderDependencies::Is_Stale(discarded), "the discarded compile matches the files on disk");
+	Check(ShaderDependencies::Is_Stale(graph, shaderKey), "a shader whose new blob was discarded stays stale");
+
+	Write_File(commonPath, "float4 Color() { return 0.5; }\n");
+	Check(!ShaderDependencies::Is_Stale(graph, shaderKey), "restoring the installed contents makes the shader current");
+
+	// A deleted file makes its shaders stale
+	filesystem::remove(commonPath);
+	Check(ShaderDependencies::Is_Stale(graph, shaderKey), "a deleted include makes the shader stale");
+
+	// Paths are normalized, so the same file is one entry in the cache and graph however a shader names it
+	Check(ShaderDependencies::Get_Path((directory / "sub" / ".." / "Shader.hlsl").wstring()) == ShaderDependencies::Get_Path(shader), "Get_Path normalizes the path");
+
+	// The watcher reports written, added and removed files once each. Last write times are set explicitly,
+	// since some file systems store them too coarsely to tell two writes in a row apart.
+	ShaderDirectoryWatcher watcher;
+	watcher.pollIntervalMs = 0;
+	ShaderDependencies::Watch_Directory(watcher, directory.wstring());
+	Check(!ShaderDependencies::Files_Changed(watcher), "an unchanged directory is not reported");
+
+	Write_File(shaderPath, "#include \"Common.hlsl\"\n// edited\n");
+	filesystem::last_write_time(shaderPath, filesystem::last_write_time(shaderPath) + chrono::seconds(2));
+	Check(ShaderDependencies::Files_Changed(watcher), "a written file is reported");
+	Check(!ShaderDependencies::Files_Changed(watcher), "a change is reported once");
+
+	filesystem::create_directories(directory / "sub");
+	Write_File(directory / "sub" / "New.hlsl", "");
+	Check(ShaderDependencies::Files_Changed(watcher), "a file added to a subdirectory is reported");
+	filesystem::remove(otherPath);
+	Check(ShaderDependencies::Files_Changed(watcher), "a removed file is reported");
+
+	watcher.pollIntervalMs = 60000;
+	Write_File(commonPath, "");
+	Check(!ShaderDependencies::Files_Changed(watcher), "the directory is polled at most once per interval");
+
+	filesystem::remove_all(directory);
+	printf("ShaderDependencies: %d failed\n", failures);
+	return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,140 @@
+/* Copyright (c) 2018-2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ShaderIncludeHandler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+using namespace std;
+
+static int failures = 0;
+
+/**
+* Report a failed check, and keep going so one run lists every failure.
+*/
+static void Check(bool condition, const char* message)
+{
+	if (condition) return;
+	printf("FAILED: %s\n", message);
+	failures++;
+}
+
+/**
+* Write a test shader file, replacing its contents.
+*/
+static void Write_File(const filesystem::path &path, const string &contents)
+{
+	ofstream file(path, ios::binary | ios::trunc);
+	file << contents;
+}
+
+/**
+* Compile a shader through the include handler the application uses, collecting the files it read.
+*/
+static HRESULT Compile(IDxcCompiler* compiler, IDxcLibrary* library, const wstring &path, vector<ShaderDependency> &dependencies)
+{
+	ShaderSourceCache cache;
+	dependencies.clear();
+	ShaderIncludeHandler includeHandler(library, cache, dependencies);
+
+	IDxcBlob* source = nullptr;
+	HRESULT hr = includeHandler.LoadSource(path.c_str(), &source);
+	if (FAILED(hr)) return hr;
+
+	IDxcOperationResult* result = nullptr;
+	hr = compiler->Compile(source, path.c_str(), L"main", L"ps_6_0", nullptr, 0, nullptr, 0, &includeHandler, &result);
+	if (SUCCEEDED(hr)) result->GetStatus(&hr);
+
+	if (result) result->Release();
+	source->Release();
+	return hr;
+}
+
+int main()
+{
+	IDxcCompiler* compiler = nullptr;
+	IDxcLibrary* library = nullptr;
+	if (FAILED(DxcCreateInstance(CLSID_DxcCompiler, __uuidof(IDxcCompiler), (void**)&compiler)) ||
+		FAILED(DxcCreateInstance(CLSID_DxcLibrary, __uuidof(IDxcLibrary), (void**)&library)))
+	{
+		printf("FAILED: could not create the DXC compiler\n");
+		return EXIT_FAILURE;
+	}
+
+	filesystem::path directory = filesystem::temp_directory_path() / "ShaderIncludeTest";
+	filesystem::remove_all(directory);
+	filesystem::create_directories(directory);
+
+	const filesystem::path shaderPath = directory / "Shader.hlsl";
+	const filesystem::path commonPath = directory / "Common.hlsl";
+	Write_File(shaderPath, "#include \"Common.hlsl\"\nfloat4 main() : SV_Target { return Color(); }\n");
+	Write_File(commonPath, "float4 Color() { return 1; }\n");
+
+	ShaderDirectoryWatcher watcher;
+	watcher.pollIntervalMs = 0;
+	ShaderDependencies::Watch_Directory(watcher, directory.wstring());
+
+	// DXC asks for the include by its own spelling of the path, which must map to the same dependency as the file on disk
+	vector<ShaderDependency> dependencies;
+	const wstring shader = ShaderDependencies::Get_Path(shaderPath.wstring());
+	const wstring common = ShaderDependencies::Get_Path(commonPath.wstring());
+	Check(SUCCEEDED(Compile(compiler, library, shader, dependencies)), "the shader compiles");
+	Check(dependencies.size() == 2, "the shader and its include are dependencies");
+	Check(dependencies.size() == 2 && dependencies[1].path == common, "the include is recorded by its full path");
+
+	ShaderDependencyGraph graph;
+	const wstring key = ShaderDependencies::Get_Key(shader, L"main", {});
+	ShaderDependencies::Record(graph, key, dependencies);
+	Check(!ShaderDependencies::Is_Stale(graph, key), "the compiled shader is up to date");
+	Check(!ShaderDependencies::Files_Changed(watcher), "compiling does not change the watched files");
+
+	// Touching the include is seen by the watcher, and makes the shader that includes it stale
+	Write_File(commonPath, "float4 Color() { return 0.5; }\n");
+	filesystem::last_write_time(commonPath, filesystem::last_write_time(commonPath) + chrono::seconds(2));
+	Check(ShaderDependencies::Files_Changed(watcher), "the watcher reports the changed include");
+	Check(ShaderDependencies::Is_Stale(graph, key), "a changed include makes the shader stale");
+
+	// A failed compile still lists what it read, so fixing the include is seen too
+	Write_File(commonPath, "float4 Color() { return }\n");
+	Check(FAILED(Compile(compiler, library, shader, dependencies)), "a broken include fails to compile");
+	Check(dependencies.size() == 2, "a failed compile lists its dependencies");
+
+	Write_File(commonPath, "float4 Color() { return 0.5; }\n");
+	Check(SUCCEEDED(Compile(compiler, library, shader, dependencies)), "the fixed shader compiles");
+	ShaderDependencies::Record(graph, key, dependencies);
+	Check(!ShaderDependencies::Is_Stale(graph, key), "the recompiled shader is up to date");
+
+	library->Release();
+	compiler->Release();
+	filesystem::remove_all(directory);
+	printf("ShaderInclude: %d failed\n", failures);
+	return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}